@@ -188,9 +188,11 @@ void init(Option& option, int argc, char* argv[])
     }
 }
 
-int32_t init_keys(const std::string& config_filepath, seal::SecretKey& seckey,
-                  seal::PublicKey& pubkey, seal::RelinKeys& relinkey,
-                  seal::EncryptionParameters& params)
+int32_t init_keys(const std::string& config_filepath,
+                  const ppcnn_client::Client& client,
+                  const ppcnn_share::ComputationParams& comp_params,
+                  seal::SecretKey& seckey, seal::PublicKey& pubkey,
+                  seal::RelinKeys& relinkey, seal::EncryptionParameters& params)
 {
     size_t power = 0, level = 0;
 
@@ -213,6 +215,19 @@ int32_t init_keys(const std::string& config_filepath, seal::SecretKey& seckey,
 #undef READ
     }
 
+    // levels consumed by the model are planned by server unless specified,
+    // and power is selected from level unless specified
+    if (level == 0)
+    {
+        bool status;
+        client.query_levels(comp_params, status, level);
+        if (!status)
+        {
+            STDSC_THROW_FAILURE("Failed to plan levels of model.");
+        }
+        STDSC_LOG_INFO("queried fhe parameter. (level: %lu)", level);
+    }
+
     ppcnn_client::KeyContainer keycont;
     auto key_id = keycont.new_keys(power, level);
 
@@ -234,8 +249,8 @@ int32_t init_keys(const std::string& config_filepath, seal::SecretKey& seckey,
 void compute(const int32_t key_id,
              const std::vector<std::vector<float>> test_imgs,
              const ppcnn_share::ComputationParams& comp_params,
-             const std::string& host, const std::string& port,
-             const size_t test_img_limit, const size_t number_prediction_trials,
+             ppcnn_client::Client& client, const size_t test_img_limit,
+             const size_t number_prediction_trials,
              const seal::PublicKey& pubkey, const seal::RelinKeys& relinkey,
              const seal::EncryptionParameters& enc_params,
              CallbackParam& callback_param)
@@ -260,8 +275,6 @@ void compute(const int32_t key_id,
     std::shared_ptr<seal::Encryptor> encryptor(
       new seal::Encryptor(context, pubkey));
 
-    ppcnn_client::Client client(host.c_str(), port.c_str(), enc_params);
-    client.connect();
     client.register_enckeys(key_id, pubkey, relinkey);
 
     for (size_t step = 0, img_count_in_step; step < step_count; ++step)
@@ -325,14 +338,6 @@ void exec(Option& option)
 
     STDSC_LOG_INFO("server: %s:%s", host, PORT_SRV);
 
-    seal::SecretKey seckey;
-    seal::PublicKey pubkey;
-    seal::RelinKeys relinkey;
-    seal::EncryptionParameters enc_params(seal::scheme_type::CKKS);
-    auto key_id =
-      init_keys(option.config_filepath, seckey, pubkey, relinkey, enc_params);
-    STDSC_LOG_INFO("Generated encryption keys. (key_id:%d)", key_id);
-
     size_t test_img_limit = 0, number_prediction_trials = 1;
 
     std::cout << "Loading test imgs & labels..." << std::endl;
@@ -356,6 +361,18 @@ void exec(Option& option)
     comp_params.opt_level = option.opt_level;
     comp_params.activation = option.activation;
 
+    // encryption parameters are set when keys are generated
+    seal::SecretKey seckey;
+    seal::PublicKey pubkey;
+    seal::RelinKeys relinkey;
+    seal::EncryptionParameters enc_params(seal::scheme_type::CKKS);
+    ppcnn_client::Client client(host, PORT_SRV, enc_params);
+    client.connect();
+
+    auto key_id = init_keys(option.config_filepath, client, comp_params,
+                            seckey, pubkey, relinkey, enc_params);
+    STDSC_LOG_INFO("Generated encryption keys. (key_id:%d)", key_id);
+
     auto context = seal::SEALContext::Create(enc_params);
     std::shared_ptr<seal::Decryptor> decryptor(
       new seal::Decryptor(context, seckey));
@@ -368,7 +385,7 @@ void exec(Option& option)
     callback_param.encoder = encoder.get();
     callback_param.test_lbls = &test_lbls;
 
-    compute(key_id, test_imgs, comp_params, host, PORT_SRV, test_img_limit,
+    compute(key_id, test_imgs, comp_params, client, test_img_limit,
             number_prediction_trials, pubkey, relinkey, enc_params,
             callback_param);
 }
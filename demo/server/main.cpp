@@ -41,13 +41,20 @@ struct Option
     uint32_t max_queries = PPCNN_DEFAULT_MAX_CONCURRENT_QUERIES;
     uint32_t max_results = PPCNN_DEFAULT_MAX_RESULTS;
     uint32_t max_result_lifetime_sec = PPCNN_DEFAULT_MAX_RESULT_LIFETIME_SEC;
+    uint32_t max_network_cache_mb = PPCNN_DEFAULT_MAX_NETWORK_CACHE_MB;
+    std::string snapshot_dir = PPCNN_DEFAULT_SNAPSHOT_DIR;
+    float sparsity_threshold = PPCNN_DEFAULT_SPARSITY_THRESHOLD;
+    uint32_t tile_size = PPCNN_DEFAULT_TILE_SIZE;
+    bool use_thread_local_pool = PPCNN_DEFAULT_USE_THREAD_LOCAL_POOL;
+    uint32_t memory_budget_mb = PPCNN_DEFAULT_MEMORY_BUDGET_MB;
+    std::string spill_dir = PPCNN_DEFAULT_SPILL_DIR;
 };
 
 void init(Option& option, int argc, char* argv[])
 {
     int opt;
     opterr = 0;
-    while ((opt = getopt(argc, argv, "p:q:r:l:h")) != -1)
+    while ((opt = getopt(argc, argv, "p:q:r:l:m:s:t:w:gb:d:h")) != -1)
     {
         switch (opt)
         {
@@ -63,11 +70,34 @@ void init(Option& option, int argc, char* argv[])
             case 'l':
                 option.max_result_lifetime_sec = std::stol(optarg);
                 break;
+            case 'm':
+                option.max_network_cache_mb = std::stol(optarg);
+                break;
+            case 's':
+                option.snapshot_dir = optarg;
+                break;
+            case 't':
+                option.sparsity_threshold = std::stof(optarg);
+                break;
+            case 'w':
+                option.tile_size = std::stol(optarg);
+                break;
+            case 'g':
+                option.use_thread_local_pool = false;
+                break;
+            case 'b':
+                option.memory_budget_mb = std::stol(optarg);
+                break;
+            case 'd':
+                option.spill_dir = optarg;
+                break;
             case 'h':
             default:
                 printf(
                   "Usage: %s [-p port] [-q max_queries] [-r max_results] [-l "
-                  "max_lifetime_sec]\n",
+                  "max_lifetime_sec] [-m max_network_cache_mb] [-s "
+                  "snapshot_dir] [-t sparsity_threshold] [-w tile_size] [-g] "
+                  "[-b memory_budget_mb] [-d spill_dir]\n",
                   argv[0]);
                 exit(1);
         }
@@ -91,13 +121,21 @@ void exec(Option& option)
         std::shared_ptr<stdsc::CallbackFunction> cb_result(
           new ppcnn_server::CallbackFunctionResultRequest());
         callback.set(ppcnn_share::kControlCodeUpDownloadResult, cb_result);
+
+        std::shared_ptr<stdsc::CallbackFunction> cb_levels(
+          new ppcnn_server::CallbackFunctionLevelsRequest());
+        callback.set(ppcnn_share::kControlCodeUpDownloadLevels, cb_levels);
     }
 
     const char* host = "localhost";
 
     std::shared_ptr<ppcnn_server::Server> server(new ppcnn_server::Server(
       option.port.c_str(), callback, state, option.max_queries,
-      option.max_results, option.max_result_lifetime_sec));
+      option.max_results, option.max_result_lifetime_sec,
+      option.max_network_cache_mb, option.snapshot_dir,
+      option.sparsity_threshold, option.tile_size,
+      option.use_thread_local_pool, option.memory_budget_mb,
+      option.spill_dir));
 
     server->start();
     server->wait();
@@ -68,6 +68,33 @@ struct Client::Impl
         client_.close();
     }
 
+    void query_levels(const ppcnn_share::ComputationParams& comp_params,
+                      bool& status, size_t& levels)
+    {
+        ppcnn_share::PlainData<ppcnn_share::ComputationParams> splaindata;
+        splaindata.push(comp_params);
+
+        auto sz = splaindata.stream_size();
+        stdsc::BufferStream sbuffstream(sz);
+        std::iostream stream(&sbuffstream);
+
+        splaindata.save(stream);
+
+        stdsc::Buffer* sbuffer = &sbuffstream;
+        stdsc::Buffer rbuffer;
+        client_.send_recv_data_blocking(
+          ppcnn_share::kControlCodeUpDownloadLevels, *sbuffer, rbuffer);
+
+        stdsc::BufferStream rbuffstream(rbuffer);
+        std::iostream rstream(&rbuffstream);
+
+        ppcnn_share::PlainData<ppcnn_share::Srv2CliLevelsParam> rplaindata;
+        rplaindata.load(rstream);
+        auto& s2c_param = rplaindata.data();
+        status = s2c_param.result == ppcnn_share::kServerCalcResultSuccess;
+        levels = s2c_param.levels;
+    }
+
     void register_enckeys(const int32_t key_id, const seal::PublicKey& pubkey,
                           const seal::RelinKeys& relinkey)
     {
@@ -207,6 +234,13 @@ void Client::disconnect(void)
     pimpl_->disconnect();
 }
 
+void Client::query_levels(const ppcnn_share::ComputationParams& comp_params,
+                          bool& status, size_t& levels) const
+{
+    STDSC_LOG_INFO("Query levels of model.");
+    pimpl_->query_levels(comp_params, status, levels);
+}
+
 void Client::register_enckeys(const int32_t key_id,
                               const seal::PublicKey& pubkey,
                               const seal::RelinKeys& relinkey) const
@@ -59,6 +59,17 @@ public:
      */
     void disconnect();
 
+    /**
+     * Query levels consumed by model
+     * (encryption parameters are not used, so that this can be called before
+     * keys are generated)
+     * @param[in] comp_params computation parameters
+     * @param[out] status     planning status
+     * @param[out] levels     minimal level of encryption parameters
+     */
+    void query_levels(const ppcnn_share::ComputationParams& comp_params,
+                      bool& status, size_t& levels) const;
+
     /**
      * Register encryption keys
      * @param[in] key_id key ID
@@ -129,10 +129,32 @@ struct KeyContainer::Impl
     {
         int32_t key_id = ppcnn_share::utility::gen_uuid();
         map_.emplace(key_id, KeyFilenames(key_id));
-        generate_keyfiles(power, level, map_.at(key_id));
+        generate_keyfiles(power > 0 ? power : secure_power(level), level,
+                          map_.at(key_id));
         return key_id;
     }
 
+    static size_t secure_power(const size_t level)
+    {
+        const size_t bit_count = 2 * PRE_SUF_PRIME_BIT_SIZE +
+                                 level * INTERMEDIATE_PRIMES_BIT_SIZE;
+        for (size_t power = MinPower; power <= MaxPower; ++power)
+        {
+            const size_t poly_mod_degree = static_cast<size_t>(1) << power;
+            const int max_bit_count =
+              seal::CoeffModulus::MaxBitCount(poly_mod_degree);
+            if (static_cast<int>(bit_count) <= max_bit_count)
+            {
+                STDSC_LOG_INFO("Selected power %lu for level %lu. (%lu bits)",
+                               power, level, bit_count);
+                return power;
+            }
+        }
+        std::ostringstream oss;
+        oss << "Err: No secure power for level. (level: " << level << ")";
+        STDSC_THROW_INVPARAM(oss.str().c_str());
+    }
+
     void delete_keys(const int32_t key_id)
     {
         remove_keyfiles(map_.at(key_id));
@@ -188,6 +210,10 @@ struct KeyContainer::Impl
     }
 
 private:
+    // range of polynomial modulus degree supported by SEAL
+    static constexpr size_t MinPower = 10;
+    static constexpr size_t MaxPower = 15;
+
     void generate_keyfiles(const std::size_t power, const std::size_t level,
                            const KeyFilenames& filenames)
     {
@@ -273,6 +299,11 @@ int32_t KeyContainer::new_keys(const size_t power, const size_t level)
     return key_id;
 }
 
+size_t KeyContainer::secure_power(const size_t level)
+{
+    return Impl::secure_power(level);
+}
+
 void KeyContainer::delete_keys(const int32_t key_id)
 {
     pimpl_->delete_keys(key_id);
@@ -50,12 +50,21 @@ struct KeyContainer
 
     /**
      * Generate new keys.
-     * @param[in] power power
-     * @param[in] level level
+     * @param[in] power power of polynomial modulus degree
+     *                  (0: smallest secure power for level)
+     * @param[in] level level (number of intermediate primes)
      * @return key ID
      */
     int32_t new_keys(const size_t power, const size_t level);
 
+    /**
+     * Get smallest power of polynomial modulus degree which keeps 128-bit
+     * security with coefficient modulus of level.
+     * @param[in] level level (number of intermediate primes)
+     * @return power
+     */
+    static size_t secure_power(const size_t level);
+
     /**
      * Delete keys.
      * @param[in] key_id key ID
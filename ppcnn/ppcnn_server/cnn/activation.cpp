@@ -19,98 +19,82 @@
 #include <exception>
 #include <fstream>
 #include <iostream>
+#include <map>
 
 #include <ppcnn_share/cnn_utils/define.h>
 #include <ppcnn_server/cnn/activation.hpp>
+#include <ppcnn_server/cnn/snapshot.hpp>
 
 using std::cout;
 using std::endl;
+using std::map;
 using std::move;
 using std::runtime_error;
 
-Activation::Activation(const string& name, const string& activation,
-                       OptOption& option)
-  : Layer(name, ACTIVATION), activation_(activation), option_(option)
+// activation functions selected by option
+const map<EActivation, string> OPTION_ACTIVATION_MAP{
+  {SQUARE, SQUARE_NAME},
+  {SWISH_RG3_DEG4, SWISH_RG3_DEG4_NAME},
+  {SWISH_RG4_DEG4, SWISH_RG4_DEG4_NAME},
+  {SWISH_RG5_DEG4, SWISH_RG5_DEG4_NAME},
+  {SWISH_RG6_DEG4, SWISH_RG6_DEG4_NAME},
+  {SWISH_RG7_DEG4, SWISH_RG7_DEG4_NAME},
+  {SWISH_RG8_DEG4, SWISH_RG8_DEG4_NAME},
+  {MISH_RG4_DEG4, MISH_RG4_DEG4_NAME},
+  {MISH_RG5_DEG4, MISH_RG5_DEG4_NAME},
+  {MISH_RG6_DEG4, MISH_RG6_DEG4_NAME}};
+
+const map<const string, const vector<float>&> ACTIVATION_COEFFS_MAP{
+  {SQUARE_NAME, SQUARE_COEFFS},
+  {SWISH_RG3_DEG4_NAME, SWISH_RG3_DEG4_COEFFS},
+  {SWISH_RG4_DEG4_NAME, SWISH_RG4_DEG4_COEFFS},
+  {SWISH_RG5_DEG4_NAME, SWISH_RG5_DEG4_COEFFS},
+  {SWISH_RG6_DEG4_NAME, SWISH_RG6_DEG4_COEFFS},
+  {SWISH_RG7_DEG4_NAME, SWISH_RG7_DEG4_COEFFS},
+  {SWISH_RG8_DEG4_NAME, SWISH_RG8_DEG4_COEFFS},
+  {MISH_RG4_DEG4_NAME, MISH_RG4_DEG4_COEFFS},
+  {MISH_RG5_DEG4_NAME, MISH_RG5_DEG4_COEFFS},
+  {MISH_RG6_DEG4_NAME, MISH_RG6_DEG4_COEFFS}};
+
+string resolveActivation(const string& activation,
+                         const EActivation& option_activation)
 {
-    if (activation_ == SQUARE_NAME || option.activation == SQUARE)
-    {
-        option.consumed_level++;
-    }
-    else if (activation_ == SWISH_RG4_DEG4_NAME ||
-             option.activation == SWISH_RG4_DEG4)
+    if (activation == LINEAR_NAME)
     {
-        Plaintext plain_coeff;
-        if (option_.enable_optimize_activation)
-        {
-            for (const float& coeff : SWISH_RG4_DEG4_OPT_COEFFS)
-            {
-                option_.encoder.encode(coeff, option_.scale_param, plain_coeff);
-                for (size_t lv = 0; lv < option.consumed_level + 1; ++lv)
-                {
-                    option_.evaluator.mod_switch_to_next_inplace(plain_coeff);
-                }
-                plain_poly_coeffs_.push_back(plain_coeff);
-            }
-            option_.evaluator.mod_switch_to_next_inplace(
-              plain_poly_coeffs_.back());
-            option.consumed_level += 2;
-        }
-        else
-        {
-            for (const float& coeff : SWISH_RG4_DEG4_COEFFS)
-            {
-                option_.encoder.encode(coeff, option_.scale_param, plain_coeff);
-                for (size_t lv = 0; lv < option.consumed_level + 2; ++lv)
-                {
-                    option_.evaluator.mod_switch_to_next_inplace(plain_coeff);
-                }
-                plain_poly_coeffs_.push_back(plain_coeff);
-            }
-            option_.evaluator.mod_switch_to_next_inplace(
-              plain_poly_coeffs_.back());
-            option.consumed_level += 3;
-        }
+        return activation;
     }
-    else if (activation_ == SWISH_RG6_DEG4_NAME ||
-             option.activation == SWISH_RG6_DEG4)
+    if (auto map_iter = OPTION_ACTIVATION_MAP.find(option_activation);
+        map_iter != OPTION_ACTIVATION_MAP.end())
     {
-        Plaintext plain_coeff;
-        if (option_.enable_optimize_activation)
-        {
-            for (const float& coeff : SWISH_RG6_DEG4_OPT_COEFFS)
-            {
-                option_.encoder.encode(coeff, option_.scale_param, plain_coeff);
-                for (size_t lv = 0; lv < option.consumed_level + 1; ++lv)
-                {
-                    option_.evaluator.mod_switch_to_next_inplace(plain_coeff);
-                }
-                plain_poly_coeffs_.push_back(plain_coeff);
-            }
-            option_.evaluator.mod_switch_to_next_inplace(
-              plain_poly_coeffs_.back());
-            option.consumed_level += 2;
-        }
-        else
-        {
-            for (const float& coeff : SWISH_RG6_DEG4_COEFFS)
-            {
-                option_.encoder.encode(coeff, option_.scale_param, plain_coeff);
-                for (size_t lv = 0; lv < option.consumed_level + 2; ++lv)
-                {
-                    option_.evaluator.mod_switch_to_next_inplace(plain_coeff);
-                }
-                plain_poly_coeffs_.push_back(plain_coeff);
-            }
-            option_.evaluator.mod_switch_to_next_inplace(
-              plain_poly_coeffs_.back());
-            option.consumed_level += 3;
-        }
+        return map_iter->second;
     }
-    else
+    return activation;
+}
+
+vector<float> activationCoeffs(const string& activation)
+{
+    if (auto map_iter = ACTIVATION_COEFFS_MAP.find(activation);
+        map_iter != ACTIVATION_COEFFS_MAP.end())
     {
-        throw runtime_error("\"" + activation_ +
-                            "\" is not registered as activation function");
+        return map_iter->second;
     }
+    throw runtime_error("\"" + activation +
+                        "\" is not registered as activation function");
+}
+
+Activation::Activation(const string& name, const string& activation,
+                       const PolynomialSchedule& schedule,
+                       const vector<Plaintext>& plain_poly_coeffs,
+                       const size_t& channels,
+                       const bool& lazy_relinearization, OptOption& option)
+  : Layer(name, ACTIVATION),
+    activation_(activation),
+    schedule_(schedule),
+    plain_poly_coeffs_(plain_poly_coeffs),
+    channels_(channels),
+    lazy_relinearization_(lazy_relinearization),
+    option_(option)
+{
 }
 Activation::~Activation()
 {
@@ -121,7 +105,36 @@ void Activation::printInfo() const
     cout << ACTIVATION_CLASS_NAME << ": " << name() << endl;
 }
 
-void Activation::forward(Ciphertext3D& input) const
+void Activation::save(SnapshotWriter& writer) const
+{
+    writer.writeString(ACTIVATION_CLASS_NAME);
+    writer.writeString(name());
+    writer.writeString(activation_);
+    writer.write<uint64_t>(schedule_.degree());
+    for (const bool nonzero : schedule_.nonzeroTerms())
+    {
+        writer.write<uint64_t>(nonzero);
+    }
+    writer.write<uint64_t>(schedule_.monic());
+    writer.write<uint64_t>(channels_);
+    writer.write<uint64_t>(lazy_relinearization_);
+    writer.write<uint64_t>(plain_poly_coeffs_.size());
+    writer.writePlaintexts(plain_poly_coeffs_.data(),
+                           plain_poly_coeffs_.size());
+}
+
+size_t Activation::weightBytes() const
+{
+    size_t bytes = 0;
+    for (const Plaintext& plain_coeff : plain_poly_coeffs_)
+    {
+        bytes += plaintextBytes(plain_coeff);
+    }
+    return bytes;
+}
+
+void Activation::forward(Ciphertext3D& input,
+                         const seal::RelinKeys& relin_keys) const
 {
     cout << "\tForwarding " << name() << "..." << endl;
     cout << "\t  input shape: " << input.shape()[0] << "x" << input.shape()[1]
@@ -147,7 +160,7 @@ void Activation::forward(Ciphertext3D& input) const
         {
             for (size_t c = 0; c < channels; ++c)
             {
-                input[h][w][c] = activate(input[h][w][c]);
+                input[h][w][c] = activate(input[h][w][c], c, relin_keys);
 #ifdef __DEBUG__
                 option_.decryptor->decrypt(input[h][w][c], plain);
                 option_.encoder.decode(plain, vec_tmp);
@@ -160,7 +173,8 @@ void Activation::forward(Ciphertext3D& input) const
     }
 }
 
-void Activation::forward(vector<Ciphertext>& input) const
+void Activation::forward(vector<Ciphertext>& input,
+                         const seal::RelinKeys& relin_keys) const
 {
     cout << "\tForwarding " << name() << "..." << endl;
     cout << "\t  input size: " << input.size() << endl;
@@ -178,7 +192,7 @@ void Activation::forward(vector<Ciphertext>& input) const
 #endif
     for (size_t u = 0; u < units; ++u)
     {
-        input[u] = activate(input[u]);
+        input[u] = activate(input[u], u, relin_keys);
 #ifdef __DEBUG__
         option.decryptor->decrypt(input[u], plain);
         option_.encoder.decode(plain, vec_tmp);
@@ -188,108 +202,35 @@ void Activation::forward(vector<Ciphertext>& input) const
     }
 }
 
-Ciphertext Activation::activate(Ciphertext& x) const
+bool Activation::isTileable() const
 {
-    if (activation_ == SQUARE_NAME)
-    {
-        return square(x);
-    }
-    else
-    {
-        if (option_.enable_optimize_activation)
-        {
-            return swishDeg4Opt(x);
-        }
-        else
-        {
-            return swishDeg4(x);
-        }
-    }
+    return true;
 }
 
-Ciphertext Activation::square(Ciphertext& x) const
+void Activation::forwardTile(Ciphertext3D& tile, const TileRegion& in_region,
+                             const TileRegion& out_region,
+                             const seal::RelinKeys& relin_keys) const
 {
-    Ciphertext y;
-
-    /* Assume that input level is l */
-    // Calculate x^2 (Level: l-1)
-    option_.evaluator.square(x, y);
-    option_.evaluator.relinearize_inplace(y, option_.relin_keys);
-    option_.evaluator.rescale_to_next_inplace(y);
-
-    return move(y);
-}
-
-Ciphertext Activation::swishDeg4(Ciphertext& x) const
-{
-    Ciphertext y, x2, x4, ax4, bx2, cx;
-
-    /* Assume that input level is l */
-    // Calculate x^2 (Level: l-1)
-    option_.evaluator.square(x, x2);
-    option_.evaluator.relinearize_inplace(x2, option_.relin_keys);
-    option_.evaluator.rescale_to_next_inplace(x2);
-    // Calculate x^4 (Level: l-2)
-    option_.evaluator.square(x2, x4);
-    option_.evaluator.relinearize_inplace(x4, option_.relin_keys);
-    option_.evaluator.rescale_to_next_inplace(x4);
-    // Reduce modulus of x^2 (Level: l-2)
-    option_.evaluator.mod_switch_to_next_inplace(x2);
-    // Reduce modulus of x (Level: l-2)
-    option_.evaluator.mod_switch_to_next_inplace(x);
-    option_.evaluator.mod_switch_to_next_inplace(x);
-
-    // Calculate ax^4 (Level: l-3)
-    option_.evaluator.multiply_plain(x4, plain_poly_coeffs_[0], ax4);
-    // Calculate bx^2 (Level: l-3)
-    option_.evaluator.multiply_plain(x2, plain_poly_coeffs_[1], bx2);
-    // Calculate cx (Level: l-3)
-    option_.evaluator.multiply_plain(x, plain_poly_coeffs_[2], cx);
-
-    // Normalize scales
-    ax4.scale() = option_.scale_param;
-    bx2.scale() = option_.scale_param;
-    cx.scale() = option_.scale_param;
-    // Calculate ax^4 + bx^2 + cx + d (Level: l-3)
-    option_.evaluator.add(ax4, bx2, y);
-    option_.evaluator.add_inplace(y, cx);
-    option_.evaluator.rescale_to_next_inplace(y);
-    y.scale() = option_.scale_param;
-    option_.evaluator.add_plain_inplace(y, plain_poly_coeffs_[3]);
-
-    return move(y);
+    const size_t channels = tile.shape()[2];
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (size_t i = 0; i < tile.num_elements(); ++i)
+    {
+        tile.data()[i] = activate(tile.data()[i], i % channels, relin_keys);
+    }
 }
 
-Ciphertext Activation::swishDeg4Opt(Ciphertext& x) const
+/**
+ * @param channel: channel (or unit) of x, which selects coefficients of
+ * batch normalization substituted for the channel
+ */
+Ciphertext Activation::activate(Ciphertext& x, const size_t& channel,
+                                const seal::RelinKeys& relin_keys) const
 {
-    Ciphertext y, x2, x4, bx2, cx;
-
-    /* Assume that input level is l */
-    // Calculate x^2 (Level: l-1)
-    option_.evaluator.square(x, x2);
-    option_.evaluator.relinearize_inplace(x2, option_.relin_keys);
-    option_.evaluator.rescale_to_next_inplace(x2);
-    // Calculate x^4 (Level: l-2)
-    option_.evaluator.square(x2, x4);
-    option_.evaluator.relinearize_inplace(x4, option_.relin_keys);
-    // Reduce modulus of x (Level: l-1)
-    option_.evaluator.mod_switch_to_next_inplace(x);
-
-    // Calculate b'x^2 (Level: l-2)
-    option_.evaluator.multiply_plain(x2, plain_poly_coeffs_[0], bx2);
-    // Calculate c'x (Level: l-2)
-    option_.evaluator.multiply_plain(x, plain_poly_coeffs_[1], cx);
-
-    // Normalize scales
-    x4.scale() = option_.scale_param;
-    bx2.scale() = option_.scale_param;
-    cx.scale() = option_.scale_param;
-    // Calculate x^4 + b'x^2 + c'x + d' (Level: l-2)
-    option_.evaluator.add(x4, bx2, y);
-    option_.evaluator.add_inplace(y, cx);
-    option_.evaluator.rescale_to_next_inplace(y);
-    y.scale() = option_.scale_param;
-    option_.evaluator.add_plain_inplace(y, plain_poly_coeffs_[2]);
-
-    return move(y);
+    // (square has no coefficient)
+    const Plaintext* coeffs = plain_poly_coeffs_.data() +
+                              (channel % channels_) * schedule_.coeffCount();
+    return evaluatePolynomial(x, schedule_, coeffs, relin_keys,
+                              !lazy_relinearization_, option_);
 }
@@ -20,31 +20,84 @@
 #include <functional>
 
 #include "layer.hpp"
+#include "polynomial.hpp"
 
 using std::function;
 
 const string ACTIVATION_CLASS_NAME = "Activation";
 const string SQUARE_NAME = "square";
+const string SWISH_RG3_DEG4_NAME = "swish_rg3_deg4";
 const string SWISH_RG4_DEG4_NAME = "swish_rg4_deg4";
+const string SWISH_RG5_DEG4_NAME = "swish_rg5_deg4";
 const string SWISH_RG6_DEG4_NAME = "swish_rg6_deg4";
+const string SWISH_RG7_DEG4_NAME = "swish_rg7_deg4";
+const string SWISH_RG8_DEG4_NAME = "swish_rg8_deg4";
+const string MISH_RG4_DEG4_NAME = "mish_rg4_deg4";
+const string MISH_RG5_DEG4_NAME = "mish_rg5_deg4";
+const string MISH_RG6_DEG4_NAME = "mish_rg6_deg4";
+const string LINEAR_NAME = "linear";
 
-class Activation : Layer
+/**
+ * Resolve activation function of layer
+ * Activation function selected by option (other than DEFAULT) replaces that
+ * of trained model, and "linear" is kept as it is.
+ */
+string resolveActivation(const string& activation,
+                         const EActivation& option_activation);
+
+/**
+ * Coefficients of registered polynomial activation function, from the
+ * highest degree term
+ *
+ * @throws std::runtime_error if activation function is not registered
+ */
+vector<float> activationCoeffs(const string& activation);
+
+/**
+ * Polynomial activation function
+ *
+ * Polynomial of any degree is evaluated by PolynomialSchedule. Coefficients
+ * are shared by all channels, or given for each channel when batch
+ * normalization of input is substituted into the polynomial.
+ * Monic polynomial has no coefficient of the highest degree term, which is
+ * folded into the next linear layer.
+ * Output may be left without relinearization (lazy relinearization), which
+ * is done by the next activation.
+ */
+class Activation : public Layer
 {
 public:
-    Activation(const string& name, const string& activation, OptOption& option);
+    Activation(const string& name, const string& activation,
+               const PolynomialSchedule& schedule,
+               const vector<Plaintext>& plain_poly_coeffs,
+               const size_t& channels, const bool& lazy_relinearization,
+               OptOption& option);
     ~Activation();
 
     void printInfo() const override;
-    void forward(Ciphertext3D& input) const;
-    void forward(vector<Ciphertext>& input) const;
+    void save(SnapshotWriter& writer) const override;
+    void forward(Ciphertext3D& input,
+                 const seal::RelinKeys& relin_keys) const;
+    void forward(vector<Ciphertext>& input,
+                 const seal::RelinKeys& relin_keys) const;
+    size_t weightBytes() const override;
+
+    bool isTileable() const override;
+    void forwardTile(Ciphertext3D& tile, const TileRegion& in_region,
+                     const TileRegion& out_region,
+                     const seal::RelinKeys& relin_keys) const override;
 
 private:
     string activation_;
+    PolynomialSchedule schedule_;
+    // coefficients of channel c are plain_poly_coeffs_[c * coeff_count] to
+    // plain_poly_coeffs_[(c + 1) * coeff_count - 1] in the order of
+    // schedule_.coeffDegrees()
     vector<Plaintext> plain_poly_coeffs_;
-    Ciphertext activate(Ciphertext& x) const;
-    Ciphertext square(Ciphertext& x) const;
-    Ciphertext swishDeg4(Ciphertext& x) const;
-    Ciphertext swishDeg4Opt(Ciphertext& x) const;
+    size_t channels_;
+    bool lazy_relinearization_;
+    Ciphertext activate(Ciphertext& x, const size_t& channel,
+                        const seal::RelinKeys& relin_keys) const;
 
     OptOption& option_;
 };
@@ -22,11 +22,14 @@
 #include <iostream>
 
 #include "average_pooling2d.hpp"
+#include "snapshot.hpp"
+#include "tensor_arena.hpp"
 
 using std::ceil;
 using std::cout;
 using std::endl;
 using std::max;
+using std::min;
 using std::move;
 
 AveragePooling2D::AveragePooling2D(
@@ -34,7 +37,7 @@ AveragePooling2D::AveragePooling2D(
   const size_t& in_channels, const size_t& pool_height,
   const size_t& pool_width, const size_t& stride_height,
   const size_t& stride_width, const string& padding,
-  const Plaintext& plain_mul_factor, OptOption& option)
+  const ScalarPlaintext& plain_mul_factor, OptOption& option)
   : Layer(name, AVERAGE_POOLING2D),
     in_height_(in_height),
     in_width_(in_width),
@@ -47,12 +50,11 @@ AveragePooling2D::AveragePooling2D(
     plain_mul_factor_(plain_mul_factor),
     option_(option)
 {
+    out_height_ =
+      outputSize(in_height_, pool_height_, stride_height_, padding_);
+    out_width_ = outputSize(in_width_, pool_width_, stride_width_, padding_);
     if (padding == "valid")
     {
-        out_height_ = ceil(static_cast<float>(in_height_ - pool_height_ + 1) /
-                           static_cast<float>(stride_height_));
-        out_width_ = ceil(static_cast<float>(in_width_ - pool_width_ + 1) /
-                          static_cast<float>(stride_width_));
         pad_top_ = 0;
         pad_bottom_ = 0;
         pad_left_ = 0;
@@ -60,11 +62,6 @@ AveragePooling2D::AveragePooling2D(
     }
     else if (padding == "same")
     {
-        out_height_ = ceil(static_cast<float>(in_height_) /
-                           static_cast<float>(stride_height_));
-        out_width_ = ceil(static_cast<float>(in_width_) /
-                          static_cast<float>(stride_width_));
-
         size_t pad_along_height, pad_along_width;
         if (size_t rem = in_height_ % stride_height_; rem == 0)
             pad_along_height =
@@ -83,11 +80,6 @@ AveragePooling2D::AveragePooling2D(
         pad_right_ = pad_along_width - pad_left_;
     }
     out_channels_ = in_channels_;
-
-    if (!option_.enable_optimize_pooling)
-    {
-        option.consumed_level++;
-    }
 }
 AveragePooling2D::~AveragePooling2D()
 {
@@ -98,138 +90,237 @@ void AveragePooling2D::printInfo() const
     cout << AVERAGE_POOLING2D_CLASS_NAME << ": " << name() << endl;
 }
 
-bool AveragePooling2D::isOutOfRangeInput(const int& target_x,
-                                         const int& target_y) const
+void AveragePooling2D::save(SnapshotWriter& writer) const
 {
-    return target_x < 0 || target_y < 0 || target_x >= in_width_ ||
-           target_y >= in_height_;
+    writer.writeString(AVERAGE_POOLING2D_CLASS_NAME);
+    writer.writeString(name());
+    writer.write<uint64_t>(in_height_);
+    writer.write<uint64_t>(in_width_);
+    writer.write<uint64_t>(in_channels_);
+    writer.write<uint64_t>(pool_height_);
+    writer.write<uint64_t>(pool_width_);
+    writer.write<uint64_t>(stride_height_);
+    writer.write<uint64_t>(stride_width_);
+    writer.writeString(padding_);
+    writer.writeScalarPlaintext(plain_mul_factor_);
 }
 
-void AveragePooling2D::forward(Ciphertext3D& input) const
+size_t AveragePooling2D::weightBytes() const
 {
-    cout << "\tForwarding " << name() << "..." << endl;
-    cout << "\t  input shape: " << input.shape()[0] << "x" << input.shape()[1]
-         << "x" << input.shape()[2] << endl;
-    Ciphertext3D output(boost::extents[out_height_][out_width_][out_channels_]);
+    return plaintextBytes(plain_mul_factor_);
+}
 
-    int target_top, target_left, target_x, target_y;
+/**
+ * Sum windows along an axis of ciphertexts laid out as [outer][length][inner]
+ * dst[o][l][i] is the sum of src[o][x][i] for x in window l within range.
+ * Overlapping windows are summed as differences of prefix sums, so that each
+ * input is added a bounded number of times regardless of the window size.
+ *
+ * @param src: input
+ * @param outer: size of outer axes
+ * @param in_length: input size of the axis
+ * @param inner: size of inner axes
+ * @param window: window size
+ * @param stride: stride
+ * @param pad: padding before the first input
+ * @param out_length: output size of the axis
+ * @param dst: output
+ * @param option: option holding the evaluator
+ */
+void AveragePooling2D::sumWindows(const Ciphertext* src, const size_t& outer,
+                                  const size_t& in_length,
+                                  const size_t& inner, const size_t& window,
+                                  const size_t& stride, const size_t& pad,
+                                  const size_t& out_length, Ciphertext* dst,
+                                  const OptOption& option)
+{
+    auto window_begin = [&](const size_t& ol) {
+        return static_cast<size_t>(
+          max(static_cast<long>(ol * stride) - static_cast<long>(pad), 0L));
+    };
+    auto window_end = [&](const size_t& ol) {
+        return static_cast<size_t>(
+          min(static_cast<long>(ol * stride + window) - static_cast<long>(pad),
+              static_cast<long>(in_length)));
+    };
 
-    if (option_.enable_optimize_pooling)
+    if (window <= stride || window <= 2)
     {
+        // windows overlap little, so that each is summed directly
 #ifdef _OPENMP
-#pragma omp parallel for collapse(2) private(target_top, target_left, \
-                                             target_x, target_y)
+#pragma omp parallel for collapse(3)
 #endif
-        for (size_t oh = 0; oh < out_height_; ++oh)
+        for (size_t o = 0; o < outer; ++o)
         {
-            for (size_t ow = 0; ow < out_width_; ++ow)
+            for (size_t ol = 0; ol < out_length; ++ol)
             {
-                target_top = oh * stride_height_ - pad_top_;
-                target_left = ow * stride_width_ - pad_left_;
-                for (size_t oc = 0; oc < out_channels_; ++oc)
+                for (size_t i = 0; i < inner; ++i)
                 {
-                    for (size_t ph = 0; ph < pool_height_; ++ph)
+                    Ciphertext& sum = dst[(o * out_length + ol) * inner + i];
+                    const size_t begin = window_begin(ol);
+                    const size_t end = window_end(ol);
+                    sum = src[(o * in_length + begin) * inner + i];
+                    for (size_t x = begin + 1; x < end; ++x)
                     {
-                        for (size_t pw = 0; pw < pool_width_; ++pw)
-                        {
-                            target_x = target_left + pw;
-                            target_y = target_top + ph;
-                            if (isOutOfRangeInput(target_x, target_y))
-                                continue;
-                            if (ph == 0 && pw == 0)
-                            {
-                                output[oh][ow][oc] =
-                                  input[target_y][target_x][oc];
-                            }
-                            else
-                            {
-                                option_.evaluator.add_inplace(
-                                  output[oh][ow][oc],
-                                  input[target_y][target_x][oc]);
-                            }
-                        }
+                        option.evaluator.add_inplace(
+                          sum, src[(o * in_length + x) * inner + i]);
                     }
                 }
             }
         }
+        return;
     }
-    else
+
+    // prefix[o][x][i] is the sum of src[o][0..x][i]
+    vector<Ciphertext> prefix(outer * in_length * inner);
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2)
+#endif
+    for (size_t o = 0; o < outer; ++o)
     {
+        for (size_t i = 0; i < inner; ++i)
+        {
+            prefix[o * in_length * inner + i] = src[o * in_length * inner + i];
+            for (size_t x = 1; x < in_length; ++x)
+            {
+                option.evaluator.add(
+                  prefix[(o * in_length + x - 1) * inner + i],
+                  src[(o * in_length + x) * inner + i],
+                  prefix[(o * in_length + x) * inner + i]);
+            }
+        }
+    }
 #ifdef _OPENMP
-#pragma omp parallel for collapse(2) private(target_top, target_left, \
-                                             target_x, target_y)
+#pragma omp parallel for collapse(3)
 #endif
-        for (size_t oh = 0; oh < out_height_; ++oh)
+    for (size_t o = 0; o < outer; ++o)
+    {
+        for (size_t ol = 0; ol < out_length; ++ol)
         {
-            for (size_t ow = 0; ow < out_width_; ++ow)
+            for (size_t i = 0; i < inner; ++i)
             {
-                target_top = oh * stride_height_ - pad_top_;
-                target_left = ow * stride_width_ - pad_left_;
-                for (size_t oc = 0; oc < out_channels_; ++oc)
+                Ciphertext& sum = dst[(o * out_length + ol) * inner + i];
+                const size_t begin = window_begin(ol);
+                const size_t end = window_end(ol);
+                sum = prefix[(o * in_length + end - 1) * inner + i];
+                if (begin > 0)
                 {
-                    for (size_t ph = 0; ph < pool_height_; ++ph)
-                    {
-                        for (size_t pw = 0; pw < pool_width_; ++pw)
-                        {
-                            target_x = target_left + pw;
-                            target_y = target_top + ph;
-                            if (isOutOfRangeInput(target_x, target_y))
-                                continue;
-                            if (ph == 0 && pw == 0)
-                            {
-                                output[oh][ow][oc] =
-                                  input[target_y][target_x][oc];
-                            }
-                            else
-                            {
-                                option_.evaluator.add_inplace(
-                                  output[oh][ow][oc],
-                                  input[target_y][target_x][oc]);
-                            }
-                        }
-                    }
-                    option_.evaluator.multiply_plain_inplace(output[oh][ow][oc],
-                                                             plain_mul_factor_);
-                    option_.evaluator.rescale_to_next_inplace(
-                      output[oh][ow][oc]);
+                    option.evaluator.sub_inplace(
+                      sum, prefix[(o * in_length + begin - 1) * inner + i]);
                 }
             }
         }
     }
+}
+
+bool AveragePooling2D::isTileable() const
+{
+    return true;
+}
+
+void AveragePooling2D::tileOutputSize(const size_t& in_height,
+                                      const size_t& in_width,
+                                      size_t& out_height,
+                                      size_t& out_width) const
+{
+    out_height = out_height_;
+    out_width = out_width_;
+}
+
+TileRegion AveragePooling2D::inputRegion(const TileRegion& out_region) const
+{
+    return windowRegion(out_region, pool_height_, pool_width_, stride_height_,
+                        stride_width_, pad_top_, pad_left_, in_height_,
+                        in_width_);
+}
+
+void AveragePooling2D::forwardTile(Ciphertext3D& tile,
+                                   const TileRegion& in_region,
+                                   const TileRegion& out_region,
+                                   const seal::RelinKeys& relin_keys) const
+{
+    Ciphertext3D output(
+      boost::extents[out_region.height][out_region.width][out_channels_]);
+    forwardRegion(tile, in_region, out_region, output);
+    moveTensor(output, tile);
+}
+
+/**
+ * Pool output region from input tile of its windows
+ * Padding is shifted to the input tile, so that windows clipped by the
+ * feature map are clipped by the tile alike.
+ *
+ * @param input: input tile
+ * @param in_region: region of input tile
+ * @param out_region: region of output
+ * @param output: output of out_region (of its shape)
+ */
+void AveragePooling2D::forwardRegion(const Ciphertext3D& input,
+                                     const TileRegion& in_region,
+                                     const TileRegion& out_region,
+                                     Ciphertext3D& output) const
+{
+    const size_t pad_top =
+      pad_top_ + in_region.top - out_region.top * stride_height_;
+    const size_t pad_left =
+      pad_left_ + in_region.left - out_region.left * stride_width_;
+
+    // Windows are summed along rows, and then the row sums along columns.
+    Ciphertext3D row_sums(
+      boost::extents[in_region.height][out_region.width][in_channels_]);
+    sumWindows(input.data(), in_region.height, in_region.width, in_channels_,
+               pool_width_, stride_width_, pad_left, out_region.width,
+               row_sums.data(), option_);
+    sumWindows(row_sums.data(), 1, in_region.height,
+               out_region.width * out_channels_, pool_height_, stride_height_,
+               pad_top, out_region.height, output.data(), option_);
+
+    if (plain_mul_factor_.coeff_mod_count() > 0)
+    {
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+        for (size_t i = 0; i < output.num_elements(); ++i)
+        {
+            multiplyScalarInplace(output.data()[i], plain_mul_factor_,
+                                  option_);
+            option_.evaluator.rescale_to_next_inplace(output.data()[i],
+                                                      option_.pool());
+        }
+    }
+}
+
+void AveragePooling2D::forward(TensorArena& arena) const
+{
+    const Ciphertext3D& input = arena.tensor();
+    cout << "\tForwarding " << name() << "..." << endl;
+    cout << "\t  input shape: " << input.shape()[0] << "x" << input.shape()[1]
+         << "x" << input.shape()[2] << endl;
+    Ciphertext3D& output =
+      arena.nextTensor(out_height_, out_width_, out_channels_);
+    forwardRegion(input, {0, 0, in_height_, in_width_},
+                  {0, 0, out_height_, out_width_}, output);
 
-    input.resize(boost::extents[out_height_][out_width_][out_channels_]);
 #ifdef __DEBUG__
     Plaintext plain;
     vector<double> vec_tmp;
     std::ofstream debug_file;
     debug_file.open(DEBUG_FILE_PATH, std::ios::app);
     debug_file << "In " << name() << ":" << endl;
-#endif
-#ifdef _OPENMP
-#pragma omp parallel for collapse(3)
-#endif
     for (size_t oh = 0; oh < out_height_; ++oh)
     {
         for (size_t ow = 0; ow < out_width_; ++ow)
         {
             for (size_t oc = 0; oc < out_channels_; ++oc)
             {
-                input[oh][ow][oc] = move(output[oh][ow][oc]);
-#ifdef __DEBUG__
-                // if (omp_get_thread_num() == 10) {
-                //   gTool.decryptor()->decrypt(input[oh][ow][oc], plain);
-                //   gTool.encoder()->decode(plain, vec_tmp);
-                //   debug_file << "\toutput[" << oh << "][" << ow << "][" << oc
-                //   << "]: " << vec_tmp[0] << ", " << vec_tmp[1] << ", " <<
-                //   vec_tmp[2] << endl;
-                // }
-                gTool.decryptor()->decrypt(input[oh][ow][oc], plain);
+                gTool.decryptor()->decrypt(output[oh][ow][oc], plain);
                 gTool.encoder()->decode(plain, vec_tmp);
                 debug_file << "\toutput[" << oh << "][" << ow << "][" << oc
                            << "]: " << vec_tmp[0] << ", " << vec_tmp[1] << ", "
                            << vec_tmp[2] << endl;
-#endif
             }
         }
     }
+#endif
+    arena.swapTensors();
 }
@@ -30,7 +30,8 @@ public:
                      const size_t& in_width, const size_t& in_channels,
                      const size_t& pool_height, const size_t& pool_width,
                      const size_t& stride_height, const size_t& stride_width,
-                     const string& padding, const Plaintext& plain_mul_factor,
+                     const string& padding,
+                     const ScalarPlaintext& plain_mul_factor,
                      OptOption& option);
     ~AveragePooling2D();
 
@@ -48,10 +49,28 @@ public:
     }
 
     void printInfo() const override;
-    bool isOutOfRangeInput(const int& target_x, const int& target_y) const;
-    void forward(Ciphertext3D& input) const;
+    void save(SnapshotWriter& writer) const override;
+    void forward(TensorArena& arena) const override;
+    size_t weightBytes() const override;
+
+    bool isTileable() const override;
+    void tileOutputSize(const size_t& in_height, const size_t& in_width,
+                        size_t& out_height, size_t& out_width) const override;
+    TileRegion inputRegion(const TileRegion& out_region) const override;
+    void forwardTile(Ciphertext3D& tile, const TileRegion& in_region,
+                     const TileRegion& out_region,
+                     const seal::RelinKeys& relin_keys) const override;
 
 private:
+    void forwardRegion(const Ciphertext3D& input, const TileRegion& in_region,
+                       const TileRegion& out_region,
+                       Ciphertext3D& output) const;
+    static void sumWindows(const Ciphertext* src, const size_t& outer,
+                           const size_t& in_length, const size_t& inner,
+                           const size_t& window, const size_t& stride,
+                           const size_t& pad, const size_t& out_length,
+                           Ciphertext* dst, const OptOption& option);
+
     size_t in_height_;
     size_t in_width_;
     size_t in_channels_;
@@ -67,7 +86,8 @@ private:
     size_t pad_bottom_;
     size_t pad_left_;
     size_t pad_right_;
-    Plaintext plain_mul_factor_;
+    // folded into the output if encoded, otherwise folded by later layer
+    ScalarPlaintext plain_mul_factor_;
 
     OptOption& option_;
 };
@@ -20,21 +20,20 @@
 #include <iostream>
 
 #include "batch_normalization.hpp"
+#include "snapshot.hpp"
 
 using std::cout;
 using std::endl;
 using std::sqrt;
 
-BatchNormalization::BatchNormalization(const string& name,
-                                       const vector<Plaintext>& plain_weights,
-                                       const vector<Plaintext>& plain_biases,
-                                       OptOption& option)
+BatchNormalization::BatchNormalization(
+  const string& name, const vector<ScalarPlaintext>& plain_weights,
+  const vector<Plaintext>& plain_biases, OptOption& option)
   : Layer(name, BATCH_NORMALIZATION),
     plain_weights_(plain_weights),
     plain_biases_(plain_biases),
     option_(option)
 {
-    option.consumed_level++;
 }
 BatchNormalization::~BatchNormalization()
 {
@@ -45,6 +44,26 @@ void BatchNormalization::printInfo() const
     cout << BATCH_NORMALIZATION_CLASS_NAME << ": " << name() << endl;
 }
 
+void BatchNormalization::save(SnapshotWriter& writer) const
+{
+    writer.writeString(BATCH_NORMALIZATION_CLASS_NAME);
+    writer.writeString(name());
+    writer.write<uint64_t>(plain_weights_.size());
+    writer.writeScalarPlaintexts(plain_weights_.data(), plain_weights_.size());
+    writer.writePlaintexts(plain_biases_.data(), plain_biases_.size());
+}
+
+size_t BatchNormalization::weightBytes() const
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < plain_weights_.size(); ++i)
+    {
+        bytes += plaintextBytes(plain_weights_[i]);
+        bytes += plaintextBytes(plain_biases_[i]);
+    }
+    return bytes;
+}
+
 void BatchNormalization::forward(Ciphertext3D& input) const
 {
     cout << "\tForwarding " << name() << "..." << endl;
@@ -70,10 +89,10 @@ void BatchNormalization::forward(Ciphertext3D& input) const
         {
             for (size_t c = 0; c < channels; ++c)
             {
-                option_.evaluator.multiply_plain_inplace(input[h][w][c],
-                                                         plain_weights_[c]);
-                option_.evaluator.rescale_to_next_inplace(input[h][w][c]);
-                input[h][w][c].scale() = option_.scale_param;
+                multiplyScalarInplace(input[h][w][c], plain_weights_[c],
+                                      option_);
+                option_.evaluator.rescale_to_next_inplace(input[h][w][c],
+                                                          option_.pool());
                 option_.evaluator.add_plain_inplace(input[h][w][c],
                                                     plain_biases_[c]);
 #ifdef __DEBUG__
@@ -95,6 +114,30 @@ void BatchNormalization::forward(Ciphertext3D& input) const
     }
 }
 
+bool BatchNormalization::isTileable() const
+{
+    return true;
+}
+
+void BatchNormalization::forwardTile(Ciphertext3D& tile,
+                                     const TileRegion& in_region,
+                                     const TileRegion& out_region,
+                                     const seal::RelinKeys& relin_keys) const
+{
+    const size_t channels = tile.shape()[2];
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (size_t i = 0; i < tile.num_elements(); ++i)
+    {
+        const size_t c = i % channels;
+        multiplyScalarInplace(tile.data()[i], plain_weights_[c], option_);
+        option_.evaluator.rescale_to_next_inplace(tile.data()[i],
+                                                  option_.pool());
+        option_.evaluator.add_plain_inplace(tile.data()[i], plain_biases_[c]);
+    }
+}
+
 void BatchNormalization::forward(vector<Ciphertext>& input) const
 {
     cout << "\tForwarding " << name() << "..." << endl;
@@ -113,9 +156,8 @@ void BatchNormalization::forward(vector<Ciphertext>& input) const
 #endif
     for (size_t u = 0; u < units; ++u)
     {
-        option_.evaluator.multiply_plain_inplace(input[u], plain_weights_[u]);
-        option_.evaluator.rescale_to_next_inplace(input[u]);
-        input[u].scale() = option_.scale_param;
+        multiplyScalarInplace(input[u], plain_weights_[u], option_);
+        option_.evaluator.rescale_to_next_inplace(input[u], option_.pool());
         option_.evaluator.add_plain_inplace(input[u], plain_biases_[u]);
 #ifdef __DEBUG__
         // if (omp_get_thread_num() == 10) {
@@ -29,17 +29,24 @@ class BatchNormalization : public Layer
 {
 public:
     BatchNormalization(const string& name,
-                       const vector<Plaintext>& plain_weights,
+                       const vector<ScalarPlaintext>& plain_weights,
                        const vector<Plaintext>& plain_biases,
                        OptOption& option);
     ~BatchNormalization();
 
     void printInfo() const override;
+    void save(SnapshotWriter& writer) const override;
     void forward(Ciphertext3D& input) const;
     void forward(vector<Ciphertext>& input) const;
+    size_t weightBytes() const override;
+
+    bool isTileable() const override;
+    void forwardTile(Ciphertext3D& tile, const TileRegion& in_region,
+                     const TileRegion& out_region,
+                     const seal::RelinKeys& relin_keys) const override;
 
 private:
-    vector<Plaintext> plain_weights_;
+    vector<ScalarPlaintext> plain_weights_;
     vector<Plaintext> plain_biases_;
 
     OptOption& option_;
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ciphertext_pool.hpp"
+
+using std::move;
+
+namespace
+{
+
+size_t ciphertextBytes(const Ciphertext& ciphertext)
+{
+    return ciphertext.uint64_count() * sizeof(std::uint64_t);
+}
+
+} /* namespace */
+
+/**
+ * @param max_bytes: max bytes of pooled ciphertexts
+ */
+CiphertextPool::CiphertextPool(const size_t& max_bytes)
+  : max_bytes_(max_bytes), bytes_(0)
+{
+}
+CiphertextPool::~CiphertextPool()
+{
+}
+
+/**
+ * Take ciphertexts into the list of their level
+ * Ciphertexts without buffer (moved or never written) are skipped, and
+ * those over max bytes are freed.
+ *
+ * @param ciphertexts: ciphertexts to take, which are left empty
+ * @param count: number of ciphertexts
+ */
+void CiphertextPool::release(Ciphertext* ciphertexts, const size_t& count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (ciphertexts[i].size() == 0)
+        {
+            continue;
+        }
+        const size_t bytes = ciphertextBytes(ciphertexts[i]);
+        if (bytes_ + bytes > max_bytes_)
+        {
+            ciphertexts[i] = Ciphertext();
+            continue;
+        }
+        bytes_ += bytes;
+        free_lists_[ciphertexts[i].parms_id()].push_back(
+          move(ciphertexts[i]));
+    }
+}
+
+/**
+ * Give ciphertexts of level to be overwritten
+ *
+ * @param parms_id: parms_id of the level
+ * @param ciphertexts: ciphertexts to be replaced by pooled ones
+ * @param count: number of ciphertexts
+ * @return number of ciphertexts replaced (from the beginning)
+ */
+size_t CiphertextPool::acquire(const seal::parms_id_type& parms_id,
+                               Ciphertext* ciphertexts, const size_t& count)
+{
+    auto found = free_lists_.find(parms_id);
+    if (found == free_lists_.end())
+    {
+        return 0;
+    }
+    vector<Ciphertext>& free_list = found->second;
+    size_t acquired = 0;
+    while (acquired < count && !free_list.empty())
+    {
+        bytes_ -= ciphertextBytes(free_list.back());
+        ciphertexts[acquired++] = move(free_list.back());
+        free_list.pop_back();
+    }
+    return acquired;
+}
+
+/**
+ * Drop lists of levels which are not of context (left by queries with other
+ * encryption parameters)
+ */
+void CiphertextPool::retain(const seal::SEALContext& context)
+{
+    for (auto it = free_lists_.begin(); it != free_lists_.end();)
+    {
+        if (context.get_context_data(it->first))
+        {
+            ++it;
+            continue;
+        }
+        for (const Ciphertext& ciphertext : it->second)
+        {
+            bytes_ -= ciphertextBytes(ciphertext);
+        }
+        it = free_lists_.erase(it);
+    }
+}
+
+/**
+ * Number of pooled ciphertexts of all levels
+ */
+size_t CiphertextPool::size() const
+{
+    size_t count = 0;
+    for (const auto& free_list : free_lists_)
+    {
+        count += free_list.second.size();
+    }
+    return count;
+}
+
+void CiphertextPool::clear()
+{
+    free_lists_.clear();
+    bytes_ = 0;
+}
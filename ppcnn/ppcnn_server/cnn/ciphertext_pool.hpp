@@ -0,0 +1,61 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <map>
+#include <seal/seal.h>
+#include <vector>
+
+using seal::Ciphertext;
+using std::size_t;
+using std::vector;
+
+/**
+ * Pool of ciphertexts of each level reused across queries
+ *
+ * Ciphertexts released by TensorArena keep their buffers, and are given back
+ * to arenas as outputs of layers at the same level, so that outputs written
+ * in place by evaluator (or by multiplyAccumulate) reuse the buffers instead
+ * of allocating new ones.
+ * Bytes held by the pool are limited, and ciphertexts released over the
+ * limit are freed. Lists of levels of other encryption parameters are dropped
+ * when a query with new parameters begins.
+ * The pool is not thread safe, and is owned by each calculation thread.
+ */
+class CiphertextPool
+{
+public:
+    CiphertextPool(const size_t& max_bytes);
+    ~CiphertextPool();
+
+    void release(Ciphertext* ciphertexts, const size_t& count);
+    size_t acquire(const seal::parms_id_type& parms_id,
+                   Ciphertext* ciphertexts, const size_t& count);
+    void retain(const seal::SEALContext& context);
+    size_t size() const;
+    size_t bytes() const
+    {
+        return bytes_;
+    }
+    void clear();
+
+private:
+    std::map<seal::parms_id_type, vector<Ciphertext>> free_lists_;
+    size_t max_bytes_;
+    size_t bytes_;
+};
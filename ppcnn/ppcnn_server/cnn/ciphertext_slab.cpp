@@ -0,0 +1,141 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <omp.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+
+#include "ciphertext_slab.hpp"
+
+using std::invalid_argument;
+using std::uint64_t;
+
+namespace
+{
+
+constexpr size_t SLAB_ALIGNMENT = 64;
+constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+} /* namespace */
+
+void CiphertextSlab::FreeDeleter::operator()(uint64_t* data) const
+{
+    std::free(data);
+}
+
+/**
+ * Pack ciphertexts into slab
+ *
+ * @param ciphertexts: ciphertexts in NTT form at the same level, of the same
+ * size and scale
+ * @param count: number of ciphertexts
+ * @param option: option holding the context
+ * @param layout: order of polynomials
+ * @throws std::invalid_argument if no ciphertext is given, or levels, sizes
+ * or scales of ciphertexts mismatch
+ */
+CiphertextSlab::CiphertextSlab(const seal::Ciphertext* ciphertexts,
+                               const size_t& count, const OptOption& option,
+                               const ESlabLayout& layout)
+  : layout_(layout), count_(count), option_(option)
+{
+    if (count == 0)
+    {
+        throw invalid_argument("no ciphertext to pack");
+    }
+    const seal::Ciphertext& front = ciphertexts[0];
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (ciphertexts[i].parms_id() != front.parms_id() ||
+            ciphertexts[i].size() != front.size() ||
+            ciphertexts[i].scale() != front.scale() ||
+            !ciphertexts[i].is_ntt_form())
+        {
+            throw invalid_argument("ciphertexts of slab mismatch");
+        }
+    }
+    size_ = front.size();
+    coeff_count_ = front.poly_modulus_degree();
+    coeff_mod_count_ = front.coeff_mod_count();
+    parms_id_ = front.parms_id();
+    scale_ = front.scale();
+
+    // Large slabs are aligned to huge pages, which cut TLB misses of kernels
+    // streaming through them.
+    const size_t bytes =
+      count_ * size_ * coeff_mod_count_ * coeff_count_ * sizeof(uint64_t);
+    const size_t alignment =
+      bytes >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : SLAB_ALIGNMENT;
+    void* data = nullptr;
+    if (posix_memalign(&data, alignment, bytes) != 0)
+    {
+        throw std::bad_alloc();
+    }
+#ifdef MADV_HUGEPAGE
+    if (alignment == HUGE_PAGE_SIZE)
+    {
+        madvise(data, bytes, MADV_HUGEPAGE);
+    }
+#endif
+    data_.reset(static_cast<uint64_t*>(data));
+
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2)
+#endif
+    for (size_t i = 0; i < count_; ++i)
+    {
+        for (size_t poly = 0; poly < size_; ++poly)
+        {
+            for (size_t limb = 0; limb < coeff_mod_count_; ++limb)
+            {
+                const uint64_t* src =
+                  ciphertexts[i].data(poly) + limb * coeff_count_;
+                std::copy(src, src + coeff_count_,
+                          data_.get() + offset(i, poly, limb));
+            }
+        }
+    }
+}
+CiphertextSlab::~CiphertextSlab()
+{
+}
+
+/**
+ * Copy ciphertext out of slab
+ *
+ * @param index: index of ciphertext
+ * @param destination: ciphertext to be overwritten
+ */
+void CiphertextSlab::unpack(const size_t& index,
+                            seal::Ciphertext& destination) const
+{
+    destination.resize(option_.context, parms_id_, size_);
+    for (size_t poly = 0; poly < size_; ++poly)
+    {
+        for (size_t limb = 0; limb < coeff_mod_count_; ++limb)
+        {
+            const uint64_t* src = data(index, poly, limb);
+            std::copy(src, src + coeff_count_,
+                      destination.data(poly) + limb * coeff_count_);
+        }
+    }
+    destination.is_ntt_form() = true;
+    destination.scale() = scale_;
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include <seal/seal.h>
+
+#include <ppcnn_share/cnn_utils/opt_option.hpp>
+
+/**
+ * Number of bands (of output rows or input units) by which layers pack input
+ * into slabs, so that a slab holds about 1/SLAB_BAND_COUNT of input (and halo
+ * of windows) rather than a copy of whole input
+ */
+constexpr size_t SLAB_BAND_COUNT = 8;
+
+/**
+ * Order of polynomials of ciphertexts in slab
+ *   CIPHERTEXT_MAJOR: [ciphertext][polynomial][prime][coefficient], each
+ *                     ciphertext laid out as SEAL does
+ *   LIMB_MAJOR: [polynomial][prime][ciphertext][coefficient], so that limbs
+ *               of neighboring ciphertexts (taps of a window) are adjacent
+ */
+enum ESlabLayout
+{
+    CIPHERTEXT_MAJOR,
+    LIMB_MAJOR
+};
+
+/**
+ * Ciphertexts of a tensor at the same level stored in one aligned buffer
+ *
+ * Ciphertexts of seal::Ciphertext are allocated separately, so that kernels
+ * reading many of them jump between pages. The slab holds polynomials of all
+ * ciphertexts contiguously (in huge pages if large), and kernels stream
+ * through it. Ciphertexts are packed from and unpacked to seal::Ciphertext,
+ * which is used by evaluator.
+ */
+class CiphertextSlab
+{
+public:
+    CiphertextSlab(const seal::Ciphertext* ciphertexts, const size_t& count,
+                   const OptOption& option,
+                   const ESlabLayout& layout = LIMB_MAJOR);
+    ~CiphertextSlab();
+
+    CiphertextSlab(const CiphertextSlab&) = delete;
+    CiphertextSlab& operator=(const CiphertextSlab&) = delete;
+
+    void unpack(const size_t& index, seal::Ciphertext& destination) const;
+
+    /**
+     * Coefficients of a polynomial of ciphertext at a prime
+     */
+    const std::uint64_t* data(const size_t& index, const size_t& poly,
+                              const size_t& limb) const
+    {
+        return data_.get() + offset(index, poly, limb);
+    }
+
+    size_t count() const
+    {
+        return count_;
+    }
+    size_t size() const
+    {
+        return size_;
+    }
+    const seal::parms_id_type& parms_id() const
+    {
+        return parms_id_;
+    }
+    double scale() const
+    {
+        return scale_;
+    }
+
+private:
+    struct FreeDeleter
+    {
+        void operator()(std::uint64_t* data) const;
+    };
+
+    size_t offset(const size_t& index, const size_t& poly,
+                  const size_t& limb) const
+    {
+        if (layout_ == LIMB_MAJOR)
+        {
+            return ((poly * coeff_mod_count_ + limb) * count_ + index) *
+                   coeff_count_;
+        }
+        return ((index * size_ + poly) * coeff_mod_count_ + limb) *
+               coeff_count_;
+    }
+
+    ESlabLayout layout_;
+    size_t count_;
+    size_t size_;
+    size_t coeff_count_;
+    size_t coeff_mod_count_;
+    seal::parms_id_type parms_id_;
+    double scale_;
+    std::unique_ptr<std::uint64_t, FreeDeleter> data_;
+    const OptOption& option_;
+};
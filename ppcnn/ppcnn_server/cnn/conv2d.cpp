@@ -18,15 +18,20 @@
 #include <omp.h>
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
 
 #include "conv2d.hpp"
+#include "multiply_accumulate.hpp"
+#include "snapshot.hpp"
+#include "tensor_arena.hpp"
 
 using std::ceil;
 using std::cout;
 using std::endl;
 using std::max;
+using std::min;
 using std::move;
 
 Conv2D::Conv2D(const string& name, const size_t& in_height,
@@ -34,7 +39,7 @@ Conv2D::Conv2D(const string& name, const size_t& in_height,
                const size_t& filter_size, const size_t& filter_height,
                const size_t& filter_width, const size_t& stride_height,
                const size_t& stride_width, const string& padding,
-               const string& activation, const Plaintext4D& plain_filters,
+               const string& activation, const ScalarPlaintext4D& plain_filters,
                const vector<Plaintext>& plain_biases, OptOption& option)
   : Layer(name, CONV2D),
     in_height_(in_height),
@@ -51,12 +56,11 @@ Conv2D::Conv2D(const string& name, const size_t& in_height,
     plain_biases_(plain_biases),
     option_(option)
 {
+    out_height_ =
+      outputSize(in_height_, filter_height_, stride_height_, padding_);
+    out_width_ = outputSize(in_width_, filter_width_, stride_width_, padding_);
     if (padding == "valid")
     {
-        out_height_ = ceil(static_cast<float>(in_height_ - filter_height_ + 1) /
-                           static_cast<float>(stride_height_));
-        out_width_ = ceil(static_cast<float>(in_width_ - filter_width_ + 1) /
-                          static_cast<float>(stride_width_));
         pad_top_ = 0;
         pad_bottom_ = 0;
         pad_left_ = 0;
@@ -64,11 +68,6 @@ Conv2D::Conv2D(const string& name, const size_t& in_height,
     }
     else if (padding == "same")
     {
-        out_height_ = ceil(static_cast<float>(in_height_) /
-                           static_cast<float>(stride_height_));
-        out_width_ = ceil(static_cast<float>(in_width_) /
-                          static_cast<float>(stride_width_));
-
         size_t pad_along_height, pad_along_width;
         if (size_t rem = in_height_ % stride_height_; rem == 0)
             pad_along_height =
@@ -88,8 +87,8 @@ Conv2D::Conv2D(const string& name, const size_t& in_height,
         pad_right_ = pad_along_width - pad_left_;
     }
     out_channels_ = filter_size_;
-
-    option_.consumed_level++;
+    buildTapLists();
+    buildFilterLists();
 }
 Conv2D::~Conv2D()
 {
@@ -100,103 +99,507 @@ void Conv2D::printInfo() const
     cout << CONV2D_CLASS_NAME << ": " << name() << endl;
 }
 
-bool Conv2D::isOutOfRangeInput(const int& target_x, const int& target_y) const
+void Conv2D::save(SnapshotWriter& writer) const
 {
-    return target_x < 0 || target_y < 0 || target_x >= in_width_ ||
-           target_y >= in_height_;
+    writer.writeString(CONV2D_CLASS_NAME);
+    saveParams(writer);
 }
 
-void Conv2D::forward(Ciphertext3D& input) const
+void Conv2D::saveParams(SnapshotWriter& writer) const
 {
-    cout << "\tForwarding " << name() << "..." << endl;
-    cout << "\t  input shape: " << input.shape()[0] << "x" << input.shape()[1]
-         << "x" << input.shape()[2] << endl;
-    Ciphertext3D output(boost::extents[out_height_][out_width_][out_channels_]);
+    writer.writeString(name());
+    writer.write<uint64_t>(in_height_);
+    writer.write<uint64_t>(in_width_);
+    writer.write<uint64_t>(in_channels_);
+    writer.write<uint64_t>(filter_size_);
+    writer.write<uint64_t>(filter_height_);
+    writer.write<uint64_t>(filter_width_);
+    writer.write<uint64_t>(stride_height_);
+    writer.write<uint64_t>(stride_width_);
+    writer.writeString(padding_);
+    writer.writeString(activation_);
+    writer.writeScalarPlaintexts(plain_filters_.data(),
+                                 plain_filters_.num_elements());
+    writer.writePlaintexts(plain_biases_.data(), plain_biases_.size());
+}
+
+size_t Conv2D::weightBytes() const
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < plain_filters_.num_elements(); ++i)
+    {
+        bytes += plaintextBytes(plain_filters_.data()[i]);
+    }
+    for (const Plaintext& plain_bias : plain_biases_)
+    {
+        bytes += plaintextBytes(plain_bias);
+    }
+    return bytes;
+}
+
+/**
+ * List taps of all output pixels of convolution, so that forwarding does not
+ * check range of each tap.
+ * Taps of output pixel p are pixel_taps[tap_offsets[p]] to
+ * pixel_taps[tap_offsets[p + 1] - 1].
+ */
+void listConvTaps(const size_t& in_height, const size_t& in_width,
+                  const size_t& filter_height, const size_t& filter_width,
+                  const size_t& stride_height, const size_t& stride_width,
+                  const size_t& pad_top, const size_t& pad_left,
+                  const size_t& out_height, const size_t& out_width,
+                  vector<size_t>& tap_offsets, vector<ConvTap>& pixel_taps)
+{
+    tap_offsets.assign(1, 0);
+    pixel_taps.clear();
+    for (size_t oh = 0; oh < out_height; ++oh)
+    {
+        for (size_t ow = 0; ow < out_width; ++ow)
+        {
+            const int target_top = static_cast<int>(oh * stride_height) -
+                                   static_cast<int>(pad_top);
+            const int target_left = static_cast<int>(ow * stride_width) -
+                                    static_cast<int>(pad_left);
+            for (size_t fh = 0; fh < filter_height; ++fh)
+            {
+                for (size_t fw = 0; fw < filter_width; ++fw)
+                {
+                    const int target_x = target_left + static_cast<int>(fw);
+                    const int target_y = target_top + static_cast<int>(fh);
+                    if (target_x < 0 || target_y < 0 ||
+                        target_x >= static_cast<int>(in_width) ||
+                        target_y >= static_cast<int>(in_height))
+                        continue;
+                    pixel_taps.push_back({target_y * in_width + target_x,
+                                          fh * filter_width + fw});
+                }
+            }
+            tap_offsets.push_back(pixel_taps.size());
+        }
+    }
+}
+
+/**
+ * Rows [in_begin, in_end) of input read by taps of output rows
+ * [out_begin, out_end) (in_begin >= in_end if no input is read)
+ */
+void convTapRows(const vector<size_t>& tap_offsets,
+                 const vector<ConvTap>& pixel_taps, const size_t& in_width,
+                 const size_t& out_width, const size_t& out_begin,
+                 const size_t& out_end, size_t& in_begin, size_t& in_end)
+{
+    in_begin = SIZE_MAX;
+    in_end = 0;
+    for (size_t t = tap_offsets[out_begin * out_width];
+         t < tap_offsets[out_end * out_width]; ++t)
+    {
+        const size_t row = pixel_taps[t].input_pixel / in_width;
+        in_begin = min(in_begin, row);
+        in_end = max(in_end, row + 1);
+    }
+}
+
+void Conv2D::buildTapLists()
+{
+    listConvTaps(in_height_, in_width_, filter_height_, filter_width_,
+                 stride_height_, stride_width_, pad_top_, pad_left_,
+                 out_height_, out_width_, tap_offsets_, pixel_taps_);
+}
+
+/**
+ * List filters with weights of each output channel, when some weights are
+ * dropped by sparsity threshold.
+ */
+void Conv2D::buildFilterLists()
+{
+    const size_t filter_count = filter_height_ * filter_width_ * in_channels_;
+    const ScalarPlaintext* filters = plain_filters_.data();
+    filter_offsets_.assign(1, 0);
+    filter_indices_.clear();
+    for (size_t oc = 0; oc < out_channels_; ++oc)
+    {
+        for (size_t f = 0; f < filter_count; ++f)
+        {
+            if (filters[f * filter_size_ + oc].coeff_mod_count() > 0)
+            {
+                filter_indices_.push_back(f);
+            }
+        }
+        filter_offsets_.push_back(filter_indices_.size());
+    }
+    is_sparse_ = filter_indices_.size() < filter_count * out_channels_;
+    max_filter_row_size_ = 0;
+    for (size_t oc = 0; oc < out_channels_; ++oc)
+    {
+        max_filter_row_size_ =
+          max(max_filter_row_size_,
+              filter_offsets_[oc + 1] - filter_offsets_[oc]);
+    }
+    if (!is_sparse_)
+    {
+        filter_offsets_.clear();
+        filter_indices_.clear();
+    }
+}
+
+/**
+ * Map each filter position to input pixel of output pixel (-1 if out of
+ * range)
+ */
+void Conv2D::mapFilterPixels(const size_t& oh, const size_t& ow,
+                             vector<long>& input_pixels) const
+{
+    const size_t pixel = oh * out_width_ + ow;
+    input_pixels.assign(filter_height_ * filter_width_, -1);
+    for (size_t t = tap_offsets_[pixel]; t < tap_offsets_[pixel + 1]; ++t)
+    {
+        input_pixels[pixel_taps_[t].filter_pixel] = pixel_taps_[t].input_pixel;
+    }
+}
+
+namespace
+{
+
+/**
+ * Index of input pixel in tile of input region
+ */
+inline size_t localPixel(const size_t& pixel, const size_t& in_width,
+                         const TileRegion& in_region)
+{
+    return (pixel / in_width - in_region.top) * in_region.width +
+           pixel % in_width - in_region.left;
+}
+
+/**
+ * Gather indices of input ciphertexts in tile and filters of taps of an output
+ * pixel
+ * TAPS is the number of taps if known at compile time (0 otherwise), so that
+ * the loop is unrolled for pixels with full 1x1, 3x3 and 5x5 windows.
+ */
+template <size_t TAPS>
+void gatherTaps(const ConvTap* pixel_taps, const size_t& runtime_tap_count,
+                const size_t& in_width, const TileRegion& in_region,
+                const ScalarPlaintext* filters, const size_t& in_channels,
+                const size_t& filter_size, vector<size_t>& taps,
+                vector<const ScalarPlaintext*>& tap_filters)
+{
+    const size_t tap_count = TAPS > 0 ? TAPS : runtime_tap_count;
+    for (size_t t = 0; t < tap_count; ++t)
+    {
+        const size_t input_pixel =
+          localPixel(pixel_taps[t].input_pixel, in_width, in_region) *
+          in_channels;
+        const ScalarPlaintext* filter_pixel =
+          filters + pixel_taps[t].filter_pixel * in_channels * filter_size;
+        for (size_t ic = 0; ic < in_channels; ++ic)
+        {
+            taps.push_back(input_pixel + ic);
+            tap_filters.push_back(filter_pixel + ic * filter_size);
+        }
+    }
+}
+
+} /* namespace */
+
+void Conv2D::collectTaps(const size_t& oh, const size_t& ow,
+                         const TileRegion& in_region, vector<size_t>& taps,
+                         vector<const ScalarPlaintext*>& tap_filters) const
+{
+    const size_t pixel = oh * out_width_ + ow;
+    const ConvTap* pixel_taps = pixel_taps_.data() + tap_offsets_[pixel];
+    const size_t tap_count = tap_offsets_[pixel + 1] - tap_offsets_[pixel];
+    taps.clear();
+    tap_filters.clear();
+    taps.reserve(filter_height_ * filter_width_ * in_channels_);
+    tap_filters.reserve(filter_height_ * filter_width_ * in_channels_);
+
+    auto gather = [&](auto gather_taps) {
+        gather_taps(pixel_taps, tap_count, in_width_, in_region,
+                    plain_filters_.data(), in_channels_, filter_size_, taps,
+                    tap_filters);
+    };
+    if (tap_count != filter_height_ * filter_width_)
+    {
+        // border pixel
+        gather(gatherTaps<0>);
+        return;
+    }
+    switch (tap_count)
+    {
+        case 1:
+            gather(gatherTaps<1>);
+            break;
+        case 9:
+            gather(gatherTaps<9>);
+            break;
+        case 25:
+            gather(gatherTaps<25>);
+            break;
+        default:
+            gather(gatherTaps<0>);
+            break;
+    }
+}
+
+bool Conv2D::isTileable() const
+{
+    return true;
+}
+
+void Conv2D::tileOutputSize(const size_t& in_height, const size_t& in_width,
+                            size_t& out_height, size_t& out_width) const
+{
+    out_height = out_height_;
+    out_width = out_width_;
+}
+
+TileRegion Conv2D::inputRegion(const TileRegion& out_region) const
+{
+    return windowRegion(out_region, filter_height_, filter_width_,
+                        stride_height_, stride_width_, pad_top_, pad_left_,
+                        in_height_, in_width_);
+}
+
+void Conv2D::forwardTile(Ciphertext3D& tile, const TileRegion& in_region,
+                         const TileRegion& out_region,
+                         const seal::RelinKeys& relin_keys) const
+{
+    Ciphertext3D output(
+      boost::extents[out_region.height][out_region.width][out_channels_]);
+    forwardRegion(tile, in_region, out_region, output);
+    moveTensor(output, tile);
+}
+
+/**
+ * Convolve output region from input tile of its windows
+ * Output is convolved by bands of rows. Input rows read by each band are
+ * packed into a slab, and taps are read from the slab by index, so that only
+ * a band of input is copied at a time.
+ *
+ * @param input: input tile
+ * @param in_region: region of input tile
+ * @param out_region: region of output
+ * @param output: output of out_region (of its shape), whose ciphertexts are
+ * overwritten in place
+ */
+void Conv2D::forwardRegion(const Ciphertext3D& input,
+                           const TileRegion& in_region,
+                           const TileRegion& out_region,
+                           Ciphertext3D& output) const
+{
+    const size_t out_width = out_region.width;
+    const size_t band_height =
+      (out_region.height + SLAB_BAND_COUNT - 1) / SLAB_BAND_COUNT;
+    // outputs without taps of weights are zero
+    const double product_scale =
+      input.data()[0].scale() *
+      weightScale(plain_filters_.data(), plain_filters_.num_elements());
+
+    vector<Ciphertext> partial_sums;
+    vector<size_t> taps, part_taps;
+    vector<const ScalarPlaintext*> tap_filters, weights;
+    vector<Ciphertext*> outputs;
+    vector<long> input_pixels;
+    for (size_t band_top = 0; band_top < out_region.height;
+         band_top += band_height)
+    {
+        const size_t band_end = min(band_top + band_height, out_region.height);
+        size_t in_top, in_end;
+        convTapRows(tap_offsets_, pixel_taps_, in_width_, out_width_,
+                    out_region.top + band_top, out_region.top + band_end,
+                    in_top, in_end);
+        in_top = max(in_top, in_region.top);
+        in_end = min(in_end, in_region.top + in_region.height);
+        if (in_top >= in_end)
+        {
+            // band reads no input, but the slab is still packed for its
+            // parameters
+            in_top = in_region.top;
+            in_end = in_top + 1;
+        }
+        const TileRegion slab_region = {in_top, in_region.left,
+                                        in_end - in_top, in_region.width};
+        const CiphertextSlab slab(
+          input.data() +
+            (in_top - in_region.top) * in_region.width * in_channels_,
+          slab_region.height * slab_region.width * in_channels_, option_);
+
+        // Small bands split taps of each pixel to keep all threads busy, and
+        // sum the partial sums afterwards.
+        const size_t pixel_count = (band_end - band_top) * out_width;
+        const size_t out_count = pixel_count * out_channels_;
+        const size_t out_offset = band_top * out_width * out_channels_;
+        const size_t split_count = reductionSplitCount(
+          pixel_count, is_sparse_
+                         ? max_filter_row_size_
+                         : filter_height_ * filter_width_ * in_channels_);
+        if (split_count > 1 && band_top == 0)
+        {
+            cout << "\t  split reduction into " << split_count << " parts"
+                 << endl;
+        }
+        // The first part of sums is accumulated into output, and the others
+        // into partial sums.
+        partial_sums.assign((split_count - 1) * out_count, Ciphertext());
+        auto partialSum = [&](const size_t& s,
+                              const size_t& o) -> Ciphertext& {
+            return s == 0 ? output.data()[out_offset + o]
+                          : partial_sums[(s - 1) * out_count + o];
+        };
 
-    int target_top, target_left, target_x, target_y;
-    size_t within_range_counter;
-    Ciphertext weighted_pixel;
 #ifdef _OPENMP
-#pragma omp parallel for collapse(2) private(                        \
-  target_top, target_left, target_x, target_y, within_range_counter, \
-  weighted_pixel)
+#pragma omp parallel for collapse(3) private(                              \
+  taps, part_taps, tap_filters, weights, outputs, input_pixels)
 #endif
-    for (size_t oh = 0; oh < out_height_; ++oh)
-    {
-        for (size_t ow = 0; ow < out_width_; ++ow)
+        for (size_t s = 0; s < split_count; ++s)
         {
-            target_top = oh * stride_height_ - pad_top_;
-            target_left = ow * stride_width_ - pad_left_;
-            for (size_t oc = 0; oc < out_channels_; ++oc)
+            for (size_t oh = band_top; oh < band_end; ++oh)
             {
-                within_range_counter = 0;
-                for (size_t fh = 0; fh < filter_height_; ++fh)
+                for (size_t ow = 0; ow < out_width; ++ow)
                 {
-                    for (size_t fw = 0; fw < filter_width_; ++fw)
+                    const size_t out_pixel = (oh - band_top) * out_width + ow;
+                    if (is_sparse_)
                     {
-                        target_x = target_left + fw;
-                        target_y = target_top + fh;
-                        if (isOutOfRangeInput(target_x, target_y))
-                            continue;
-                        within_range_counter++;
-                        for (size_t ic = 0; ic < in_channels_; ++ic)
+                        // Only taps with weights are multiplied for each
+                        // output channel.
+                        mapFilterPixels(out_region.top + oh,
+                                        out_region.left + ow, input_pixels);
+                        for (size_t oc = 0; oc < out_channels_; ++oc)
                         {
-                            option_.evaluator.multiply_plain(
-                              input[target_y][target_x][ic],
-                              plain_filters_[fh][fw][ic][oc], weighted_pixel);
-                            if (within_range_counter == 1 && ic == 0)
+                            const size_t row_begin = filter_offsets_[oc];
+                            const size_t row_size =
+                              filter_offsets_[oc + 1] - row_begin;
+                            part_taps.clear();
+                            weights.clear();
+                            for (size_t r =
+                                   row_begin + row_size * s / split_count;
+                                 r < row_begin +
+                                       row_size * (s + 1) / split_count;
+                                 ++r)
                             {
-                                output[oh][ow][oc] = weighted_pixel;
+                                const size_t f = filter_indices_[r];
+                                const long input_pixel =
+                                  input_pixels[f / in_channels_];
+                                if (input_pixel < 0)
+                                    continue;
+                                part_taps.push_back(
+                                  localPixel(input_pixel, in_width_,
+                                             slab_region) *
+                                    in_channels_ +
+                                  f % in_channels_);
+                                weights.push_back(
+                                  &plain_filters_
+                                     .data()[f * filter_size_ + oc]);
                             }
-                            else
+                            Ciphertext& partial_sum =
+                              partialSum(s, out_pixel * out_channels_ + oc);
+                            if (!part_taps.empty())
                             {
-                                option_.evaluator.add_inplace(
-                                  output[oh][ow][oc], weighted_pixel);
+                                multiplyAccumulate(slab, part_taps, weights,
+                                                   partial_sum, option_);
+                            }
+                            else if (s == 0)
+                            {
+                                setZero(slab.parms_id(), product_scale,
+                                        slab.size(), option_, partial_sum);
                             }
                         }
+                        continue;
                     }
+                    // Taps are shared by all output channels, so that each
+                    // input is multiplied by filters of all output channels
+                    // while in cache.
+                    collectTaps(out_region.top + oh, out_region.left + ow,
+                                slab_region, taps, tap_filters);
+                    const size_t tap_begin = taps.size() * s / split_count;
+                    const size_t tap_end = taps.size() * (s + 1) / split_count;
+                    if (tap_begin == tap_end)
+                    {
+                        for (size_t oc = 0; s == 0 && oc < out_channels_;
+                             ++oc)
+                        {
+                            setZero(
+                              slab.parms_id(), product_scale, slab.size(),
+                              option_,
+                              partialSum(s, out_pixel * out_channels_ + oc));
+                        }
+                        continue;
+                    }
+                    const size_t part_tap_count = tap_end - tap_begin;
+                    part_taps.assign(taps.begin() + tap_begin,
+                                     taps.begin() + tap_end);
+                    weights.resize(out_channels_ * part_tap_count);
+                    outputs.resize(out_channels_);
+                    for (size_t oc = 0; oc < out_channels_; ++oc)
+                    {
+                        for (size_t t = 0; t < part_tap_count; ++t)
+                        {
+                            weights[oc * part_tap_count + t] =
+                              tap_filters[tap_begin + t] + oc;
+                        }
+                        outputs[oc] =
+                          &partialSum(s, out_pixel * out_channels_ + oc);
+                    }
+                    multiplyAccumulate(slab, part_taps, weights, outputs,
+                                       option_);
                 }
-                option_.evaluator.rescale_to_next_inplace(output[oh][ow][oc]);
-                output[oh][ow][oc].scale() = option_.scale_param;
-                option_.evaluator.add_plain_inplace(output[oh][ow][oc],
-                                                    plain_biases_[oc]);
             }
         }
+        if (split_count > 1)
+        {
+            reducePartialSums(partial_sums.data(), split_count - 1,
+                              out_count, option_);
+        }
+
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+        for (size_t o = 0; o < out_count; ++o)
+        {
+            Ciphertext& destination = output.data()[out_offset + o];
+            if (split_count > 1 && partial_sums[o].size() > 0)
+            {
+                option_.evaluator.add_inplace(destination, partial_sums[o]);
+            }
+            option_.evaluator.rescale_to_next_inplace(destination,
+                                                      option_.pool());
+            option_.evaluator.add_plain_inplace(
+              destination, plain_biases_[o % out_channels_]);
+        }
     }
+}
+
+void Conv2D::forward(TensorArena& arena) const
+{
+    const Ciphertext3D& input = arena.tensor();
+    cout << "\tForwarding " << name() << "..." << endl;
+    cout << "\t  input shape: " << input.shape()[0] << "x" << input.shape()[1]
+         << "x" << input.shape()[2] << endl;
+    Ciphertext3D& output =
+      arena.nextTensor(out_height_, out_width_, out_channels_);
+    forwardRegion(input, {0, 0, in_height_, in_width_},
+                  {0, 0, out_height_, out_width_}, output);
 
-    input.resize(boost::extents[out_height_][out_width_][out_channels_]);
 #ifdef __DEBUG__
     Plaintext plain;
     vector<double> vec_tmp;
     std::ofstream debug_file;
     debug_file.open(DEBUG_FILE_PATH, std::ios::app);
     debug_file << "In " << name() << ":" << endl;
-#endif
-#ifdef _OPENMP
-#pragma omp parallel for collapse(3)
-#endif
     for (size_t oh = 0; oh < out_height_; ++oh)
     {
         for (size_t ow = 0; ow < out_width_; ++ow)
         {
             for (size_t oc = 0; oc < out_channels_; ++oc)
             {
-                input[oh][ow][oc] = move(output[oh][ow][oc]);
-#ifdef __DEBUG__
-                // if (omp_get_thread_num() == 10) {
-                //   gTool.decryptor()->decrypt(input[oh][ow][oc], plain);
-                //   gTool.encoder()->decode(plain, vec_tmp);
-                //   debug_file << "\toutput[" << oh << "][" << ow << "][" << oc
-                //   << "]: " << vec_tmp[0] << ", " << vec_tmp[1] << ", " <<
-                //   vec_tmp[2] << endl;
-                // }
-                gTool.decryptor()->decrypt(input[oh][ow][oc], plain);
+                gTool.decryptor()->decrypt(output[oh][ow][oc], plain);
                 gTool.encoder()->decode(plain, vec_tmp);
                 debug_file << "\toutput[" << oh << "][" << ow << "][" << oc
                            << "]: " << vec_tmp[0] << ", " << vec_tmp[1] << ", "
                            << vec_tmp[2] << endl;
-#endif
             }
         }
     }
+#endif
+    arena.swapTensors();
 }
@@ -23,6 +23,26 @@ using std::size_t;
 
 const string CONV2D_CLASS_NAME = "Conv2D";
 
+/**
+ * Pair of input pixel in range and filter position of an output pixel
+ */
+struct ConvTap
+{
+    size_t input_pixel;   // ih * in_width + iw
+    size_t filter_pixel;  // fh * filter_width + fw
+};
+
+void listConvTaps(const size_t& in_height, const size_t& in_width,
+                  const size_t& filter_height, const size_t& filter_width,
+                  const size_t& stride_height, const size_t& stride_width,
+                  const size_t& pad_top, const size_t& pad_left,
+                  const size_t& out_height, const size_t& out_width,
+                  vector<size_t>& tap_offsets, vector<ConvTap>& pixel_taps);
+void convTapRows(const vector<size_t>& tap_offsets,
+                 const vector<ConvTap>& pixel_taps, const size_t& in_width,
+                 const size_t& out_width, const size_t& out_begin,
+                 const size_t& out_end, size_t& in_begin, size_t& in_end);
+
 class Conv2D : public Layer
 {
 public:
@@ -31,7 +51,7 @@ public:
            const size_t& filter_height, const size_t& filter_width,
            const size_t& stride_height, const size_t& stride_width,
            const string& padding, const string& activation,
-           const Plaintext4D& plain_filters,
+           const ScalarPlaintext4D& plain_filters,
            const vector<Plaintext>& plain_biases, OptOption& option);
     ~Conv2D();
 
@@ -49,10 +69,33 @@ public:
     }
 
     void printInfo() const override;
-    bool isOutOfRangeInput(const int& target_x, const int& target_y) const;
-    void forward(Ciphertext3D& input) const;
+    void collectTaps(const size_t& oh, const size_t& ow,
+                     const TileRegion& in_region, vector<size_t>& taps,
+                     vector<const ScalarPlaintext*>& tap_filters) const;
+    void forward(TensorArena& arena) const override;
+    size_t weightBytes() const override;
+    void save(SnapshotWriter& writer) const override;
+
+    bool isTileable() const override;
+    void tileOutputSize(const size_t& in_height, const size_t& in_width,
+                        size_t& out_height, size_t& out_width) const override;
+    TileRegion inputRegion(const TileRegion& out_region) const override;
+    void forwardTile(Ciphertext3D& tile, const TileRegion& in_region,
+                     const TileRegion& out_region,
+                     const seal::RelinKeys& relin_keys) const override;
+
+protected:
+    void saveParams(SnapshotWriter& writer) const;
 
 private:
+    void forwardRegion(const Ciphertext3D& input, const TileRegion& in_region,
+                       const TileRegion& out_region,
+                       Ciphertext3D& output) const;
+    void buildTapLists();
+    void buildFilterLists();
+    void mapFilterPixels(const size_t& oh, const size_t& ow,
+                         vector<long>& input_pixels) const;
+
     size_t in_height_;
     size_t in_width_;
     size_t in_channels_;
@@ -70,7 +113,19 @@ private:
     size_t pad_bottom_;
     size_t pad_left_;
     size_t pad_right_;
-    Plaintext4D plain_filters_;
+    // taps of output pixel p are pixel_taps_[tap_offsets_[p]] to
+    // pixel_taps_[tap_offsets_[p + 1] - 1]
+    vector<size_t> tap_offsets_;
+    vector<ConvTap> pixel_taps_;
+    // With dropped (empty) weights, filters of output channel oc are
+    // plain_filters_ at filter_indices_[filter_offsets_[oc]] to
+    // filter_indices_[filter_offsets_[oc + 1] - 1], where the filter index is
+    // (fh * filter_width + fw) * in_channels + ic
+    bool is_sparse_;
+    vector<size_t> filter_offsets_;
+    vector<size_t> filter_indices_;
+    size_t max_filter_row_size_;
+    ScalarPlaintext4D plain_filters_;
     vector<Plaintext> plain_biases_;
 
     OptOption& option_;
@@ -16,6 +16,7 @@
  */
 
 #include "conv2d_fused_bn.hpp"
+#include "snapshot.hpp"
 
 using std::cout;
 using std::endl;
@@ -26,7 +27,7 @@ Conv2DFusedBN::Conv2DFusedBN(
   const size_t& filter_height, const size_t& filter_width,
   const size_t& stride_height, const size_t& stride_width,
   const string& padding, const string& activation,
-  const Plaintext4D& plain_filters, const vector<Plaintext>& plain_biases,
+  const ScalarPlaintext4D& plain_filters, const vector<Plaintext>& plain_biases,
   OptOption& option)
   : Conv2D(name, in_height, in_width, in_channels, filter_size, filter_height,
            filter_width, stride_height, stride_width, padding, activation,
@@ -41,3 +42,9 @@ void Conv2DFusedBN::printInfo() const
 {
     cout << CONV2D_FUSED_BN_CLASS_NAME << ": " << name() << endl;
 }
+
+void Conv2DFusedBN::save(SnapshotWriter& writer) const
+{
+    writer.writeString(CONV2D_FUSED_BN_CLASS_NAME);
+    saveParams(writer);
+}
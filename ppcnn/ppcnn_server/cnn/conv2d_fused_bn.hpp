@@ -31,11 +31,13 @@ public:
                   const size_t& filter_size, const size_t& filter_height,
                   const size_t& filter_width, const size_t& stride_height,
                   const size_t& stride_width, const string& padding,
-                  const string& activation, const Plaintext4D& plain_filters,
+                  const string& activation,
+                  const ScalarPlaintext4D& plain_filters,
                   const vector<Plaintext>& plain_biases, OptOption& option);
     ~Conv2DFusedBN();
 
     void printInfo() const override;
+    void save(SnapshotWriter& writer) const override;
 
 private:
 };
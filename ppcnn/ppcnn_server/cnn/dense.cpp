@@ -16,18 +16,25 @@
  */
 
 #include <omp.h>
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 
 #include "dense.hpp"
+#include "multiply_accumulate.hpp"
+#include "snapshot.hpp"
+#include "tensor_arena.hpp"
 
 using std::cout;
 using std::endl;
+using std::lower_bound;
+using std::max;
+using std::min;
 using std::move;
 
 Dense::Dense(const string& name, const size_t& in_units,
              const size_t& out_units, const string& activation,
-             const Plaintext2D& plain_weights,
+             const ScalarPlaintext2D& plain_weights,
              const vector<Plaintext>& plain_biases, OptOption& option)
   : Layer(name, DENSE),
     in_units_(in_units),
@@ -37,48 +44,167 @@ Dense::Dense(const string& name, const size_t& in_units,
     plain_biases_(plain_biases),
     option_(option)
 {
-    option_.consumed_level++;
+    buildWeightLists();
 }
 Dense::~Dense()
 {
 }
 
+void Dense::buildWeightLists()
+{
+    weight_offsets_.assign(1, 0);
+    weight_units_.clear();
+    max_weight_row_size_ = 0;
+    for (size_t ou = 0; ou < out_units_; ++ou)
+    {
+        for (size_t iu = 0; iu < in_units_; ++iu)
+        {
+            if (plain_weights_[iu][ou].coeff_mod_count() > 0)
+            {
+                weight_units_.push_back(iu);
+            }
+        }
+        weight_offsets_.push_back(weight_units_.size());
+        max_weight_row_size_ =
+          max(max_weight_row_size_,
+              weight_offsets_[ou + 1] - weight_offsets_[ou]);
+    }
+}
+
 void Dense::printInfo() const
 {
     cout << DENSE_CLASS_NAME << ": " << name() << endl;
 }
 
-void Dense::forward(vector<Ciphertext>& input) const
+void Dense::save(SnapshotWriter& writer) const
 {
+    writer.writeString(DENSE_CLASS_NAME);
+    saveParams(writer);
+}
+
+void Dense::saveParams(SnapshotWriter& writer) const
+{
+    writer.writeString(name());
+    writer.write<uint64_t>(in_units_);
+    writer.write<uint64_t>(out_units_);
+    writer.writeString(activation_);
+    writer.writeScalarPlaintexts(plain_weights_.data(),
+                                 plain_weights_.num_elements());
+    writer.writePlaintexts(plain_biases_.data(), plain_biases_.size());
+}
+
+size_t Dense::weightBytes() const
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < plain_weights_.num_elements(); ++i)
+    {
+        bytes += plaintextBytes(plain_weights_.data()[i]);
+    }
+    for (const Plaintext& plain_bias : plain_biases_)
+    {
+        bytes += plaintextBytes(plain_bias);
+    }
+    return bytes;
+}
+
+void Dense::forward(TensorArena& arena) const
+{
+    const vector<Ciphertext>& input = arena.units();
     cout << "\tForwarding " << name() << "..." << endl;
     cout << "\t  input size: " << input.size() << endl;
-    vector<Ciphertext> output(out_units_);
+    // Small layers split input units of each output unit to keep all
+    // threads busy, and sum the partial sums afterwards.
+    const size_t split_count =
+      reductionSplitCount(out_units_, max_weight_row_size_);
+    if (split_count > 1)
+    {
+        cout << "\t  split reduction into " << split_count << " parts"
+             << endl;
+    }
+    // output units without weights are zero
+    const double product_scale =
+      input[0].scale() *
+      weightScale(plain_weights_.data(), plain_weights_.num_elements());
+    vector<Ciphertext>& partial_sums =
+      arena.nextUnits(split_count * out_units_);
 
-    Ciphertext weighted_unit;
+    // Input units are packed into slabs by chunks, and partial sums of later
+    // chunks are added to those of the first chunk.
+    const size_t chunk_size =
+      (input.size() + SLAB_BAND_COUNT - 1) / SLAB_BAND_COUNT;
+    vector<Ciphertext> chunk_sums;
+    vector<size_t> taps;
+    vector<const ScalarPlaintext*> weights;
+    for (size_t chunk_begin = 0; chunk_begin < input.size();
+         chunk_begin += chunk_size)
+    {
+        const size_t chunk_end = min(chunk_begin + chunk_size, input.size());
+        const CiphertextSlab slab(input.data() + chunk_begin,
+                                  chunk_end - chunk_begin, option_);
+        vector<Ciphertext>& sums =
+          chunk_begin == 0 ? partial_sums : chunk_sums;
+        sums.resize(split_count * out_units_);
 #ifdef _OPENMP
-#pragma omp parallel for private(weighted_unit)
+#pragma omp parallel for collapse(2) private(taps, weights)
 #endif
-    for (size_t ou = 0; ou < out_units_; ++ou)
-    {
-        for (size_t iu = 0; iu < in_units_; ++iu)
+        for (size_t s = 0; s < split_count; ++s)
+        {
+            for (size_t ou = 0; ou < out_units_; ++ou)
+            {
+                // weights of a row are sorted by input unit
+                const auto row = weight_units_.begin();
+                const size_t row_begin =
+                  lower_bound(row + weight_offsets_[ou],
+                              row + weight_offsets_[ou + 1], chunk_begin) -
+                  row;
+                const size_t row_size =
+                  lower_bound(row + row_begin, row + weight_offsets_[ou + 1],
+                              chunk_end) -
+                  row - row_begin;
+                taps.clear();
+                weights.clear();
+                for (size_t r = row_begin + row_size * s / split_count;
+                     r < row_begin + row_size * (s + 1) / split_count; ++r)
+                {
+                    const size_t iu = weight_units_[r];
+                    taps.push_back(iu - chunk_begin);
+                    weights.push_back(&plain_weights_[iu][ou]);
+                }
+                Ciphertext& partial_sum = sums[s * out_units_ + ou];
+                if (taps.empty())
+                {
+                    // (empty partial sums are skipped by the reduction)
+                    partial_sum = Ciphertext();
+                }
+                else
+                {
+                    multiplyAccumulate(slab, taps, weights, partial_sum,
+                                       option_);
+                }
+            }
+        }
+        if (chunk_begin == 0)
+            continue;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+        for (size_t i = 0; i < split_count * out_units_; ++i)
         {
-            option_.evaluator.multiply_plain(input[iu], plain_weights_[iu][ou],
-                                             weighted_unit);
-            if (iu == 0)
+            if (chunk_sums[i].size() == 0)
+                continue;
+            if (partial_sums[i].size() == 0)
             {
-                output[ou] = weighted_unit;
+                partial_sums[i] = move(chunk_sums[i]);
             }
             else
             {
-                option_.evaluator.add_inplace(output[ou], weighted_unit);
+                option_.evaluator.add_inplace(partial_sums[i], chunk_sums[i]);
             }
         }
-        option_.evaluator.rescale_to_next_inplace(output[ou]);
-        output[ou].scale() = option_.scale_param;
-        option_.evaluator.add_plain_inplace(output[ou], plain_biases_[ou]);
     }
+    reducePartialSums(partial_sums.data(), split_count, out_units_, option_);
+    vector<Ciphertext>& output = arena.nextUnits(out_units_);
 
-    input.resize(out_units_);
 #ifdef __DEBUG__
     Plaintext plain;
     vector<double> vec_tmp;
@@ -91,18 +217,19 @@ void Dense::forward(vector<Ciphertext>& input) const
 #endif
     for (size_t ou = 0; ou < out_units_; ++ou)
     {
-        input[ou] = move(output[ou]);
+        if (output[ou].size() == 0)
+        {
+            setZero(input[0].parms_id(), product_scale, input[0].size(),
+                    option_, output[ou]);
+        }
+        option_.evaluator.rescale_to_next_inplace(output[ou], option_.pool());
+        option_.evaluator.add_plain_inplace(output[ou], plain_biases_[ou]);
 #ifdef __DEBUG__
-        // if (omp_get_thread_num() == 10) {
-        //   gTool.decryptor()->decrypt(input[ou], plain);
-        //   gTool.encoder()->decode(plain, vec_tmp);
-        //   debug_file << "\toutput[" << ou << "]: " << vec_tmp[0] << ", " <<
-        //   vec_tmp[1] << ", " << vec_tmp[2] << endl;
-        // }
-        gTool.decryptor()->decrypt(input[ou], plain);
+        gTool.decryptor()->decrypt(output[ou], plain);
         gTool.encoder()->decode(plain, vec_tmp);
         debug_file << "\toutput[" << ou << "]: " << vec_tmp[0] << ", "
                    << vec_tmp[1] << ", " << vec_tmp[2] << endl;
 #endif
     }
+    arena.swapUnits();
 }
@@ -27,18 +27,31 @@ class Dense : public Layer
 {
 public:
     Dense(const string& name, const size_t& in_units, const size_t& out_units,
-          const string& activation, const Plaintext2D& plain_weights,
+          const string& activation, const ScalarPlaintext2D& plain_weights,
           const vector<Plaintext>& plain_biases, OptOption& option);
     ~Dense();
 
     void printInfo() const override;
-    void forward(vector<Ciphertext>& input) const;
+    void forward(TensorArena& arena) const override;
+    size_t weightBytes() const override;
+    void save(SnapshotWriter& writer) const override;
+
+protected:
+    void saveParams(SnapshotWriter& writer) const;
 
 private:
+    void buildWeightLists();
+
     size_t in_units_;
     size_t out_units_;
     string activation_;
-    Plaintext2D plain_weights_;
+    ScalarPlaintext2D plain_weights_;
+    // input units with weights (not dropped by sparsity threshold) of output
+    // unit ou are weight_units_[weight_offsets_[ou]] to
+    // weight_units_[weight_offsets_[ou + 1] - 1]
+    vector<size_t> weight_offsets_;
+    vector<size_t> weight_units_;
+    size_t max_weight_row_size_;
     vector<Plaintext> plain_biases_;
 
     OptOption& option_;
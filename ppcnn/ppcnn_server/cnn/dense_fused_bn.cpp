@@ -16,13 +16,14 @@
  */
 
 #include "dense_fused_bn.hpp"
+#include "snapshot.hpp"
 
 using std::cout;
 using std::endl;
 
 DenseFusedBN::DenseFusedBN(const string& name, const size_t& in_units,
                            const size_t& out_units, const string& activation,
-                           const Plaintext2D& plain_weights,
+                           const ScalarPlaintext2D& plain_weights,
                            const vector<Plaintext>& plain_biases,
                            OptOption& option)
   : Dense(name, in_units, out_units, activation, plain_weights, plain_biases,
@@ -37,3 +38,9 @@ void DenseFusedBN::printInfo() const
 {
     cout << DENSE_FUSED_BN_CLASS_NAME << ": " << name() << endl;
 }
+
+void DenseFusedBN::save(SnapshotWriter& writer) const
+{
+    writer.writeString(DENSE_FUSED_BN_CLASS_NAME);
+    saveParams(writer);
+}
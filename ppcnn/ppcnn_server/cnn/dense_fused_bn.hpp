@@ -28,11 +28,12 @@ class DenseFusedBN : public Dense
 public:
     DenseFusedBN(const string& name, const size_t& in_units,
                  const size_t& out_units, const string& activation,
-                 const Plaintext2D& plain_weights,
+                 const ScalarPlaintext2D& plain_weights,
                  const vector<Plaintext>& plain_biases, OptOption& option);
     ~DenseFusedBN();
 
     void printInfo() const override;
+    void save(SnapshotWriter& writer) const override;
 
 private:
 };
@@ -0,0 +1,225 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <omp.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+#include "depthwise_conv2d.hpp"
+#include "multiply_accumulate.hpp"
+#include "snapshot.hpp"
+#include "tensor_arena.hpp"
+
+using std::cout;
+using std::endl;
+using std::min;
+using std::move;
+
+DepthwiseConv2D::DepthwiseConv2D(
+  const string& name, const size_t& in_height, const size_t& in_width,
+  const size_t& in_channels, const size_t& depth_multiplier,
+  const size_t& filter_height, const size_t& filter_width,
+  const size_t& stride_height, const size_t& stride_width,
+  const string& padding, const string& activation,
+  const ScalarPlaintext4D& plain_filters, const vector<Plaintext>& plain_biases,
+  OptOption& option)
+  : Layer(name, DEPTHWISE_CONV2D),
+    in_height_(in_height),
+    in_width_(in_width),
+    in_channels_(in_channels),
+    depth_multiplier_(depth_multiplier),
+    filter_height_(filter_height),
+    filter_width_(filter_width),
+    stride_height_(stride_height),
+    stride_width_(stride_width),
+    padding_(padding),
+    activation_(activation),
+    plain_filters_(plain_filters),
+    plain_biases_(plain_biases),
+    option_(option)
+{
+    out_height_ =
+      outputSize(in_height_, filter_height_, stride_height_, padding_);
+    out_width_ = outputSize(in_width_, filter_width_, stride_width_, padding_);
+    out_channels_ = in_channels_ * depth_multiplier_;
+    listConvTaps(
+      in_height_, in_width_, filter_height_, filter_width_, stride_height_,
+      stride_width_,
+      paddingBefore(in_height_, filter_height_, stride_height_, padding_),
+      paddingBefore(in_width_, filter_width_, stride_width_, padding_),
+      out_height_, out_width_, tap_offsets_, pixel_taps_);
+}
+DepthwiseConv2D::~DepthwiseConv2D()
+{
+}
+
+void DepthwiseConv2D::printInfo() const
+{
+    cout << DEPTHWISE_CONV2D_CLASS_NAME << ": " << name() << endl;
+}
+
+void DepthwiseConv2D::save(SnapshotWriter& writer) const
+{
+    writer.writeString(DEPTHWISE_CONV2D_CLASS_NAME);
+    saveParams(writer);
+}
+
+void DepthwiseConv2D::saveParams(SnapshotWriter& writer) const
+{
+    writer.writeString(name());
+    writer.write<uint64_t>(in_height_);
+    writer.write<uint64_t>(in_width_);
+    writer.write<uint64_t>(in_channels_);
+    writer.write<uint64_t>(depth_multiplier_);
+    writer.write<uint64_t>(filter_height_);
+    writer.write<uint64_t>(filter_width_);
+    writer.write<uint64_t>(stride_height_);
+    writer.write<uint64_t>(stride_width_);
+    writer.writeString(padding_);
+    writer.writeString(activation_);
+    writer.writeScalarPlaintexts(plain_filters_.data(),
+                                 plain_filters_.num_elements());
+    writer.write<uint64_t>(plain_biases_.size());
+    writer.writePlaintexts(plain_biases_.data(), plain_biases_.size());
+}
+
+size_t DepthwiseConv2D::weightBytes() const
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < plain_filters_.num_elements(); ++i)
+    {
+        bytes += plaintextBytes(plain_filters_.data()[i]);
+    }
+    for (const Plaintext& plain_bias : plain_biases_)
+    {
+        bytes += plaintextBytes(plain_bias);
+    }
+    return bytes;
+}
+
+void DepthwiseConv2D::forward(TensorArena& arena) const
+{
+    const Ciphertext3D& input = arena.tensor();
+    cout << "\tForwarding " << name() << "..." << endl;
+    cout << "\t  input shape: " << input.shape()[0] << "x" << input.shape()[1]
+         << "x" << input.shape()[2] << endl;
+    Ciphertext3D& output =
+      arena.nextTensor(out_height_, out_width_, out_channels_);
+    // Output is convolved by bands of rows, and input rows read by each band
+    // are packed into a slab.
+    const size_t band_height =
+      (out_height_ + SLAB_BAND_COUNT - 1) / SLAB_BAND_COUNT;
+    // outputs without taps of weights are zero
+    const double product_scale =
+      input.data()[0].scale() *
+      weightScale(plain_filters_.data(), plain_filters_.num_elements());
+
+    vector<size_t> taps;
+    vector<const ScalarPlaintext*> weights;
+    for (size_t band_top = 0; band_top < out_height_; band_top += band_height)
+    {
+        const size_t band_end = min(band_top + band_height, out_height_);
+        size_t in_top, in_end;
+        convTapRows(tap_offsets_, pixel_taps_, in_width_, out_width_,
+                    band_top, band_end, in_top, in_end);
+        if (in_top >= in_end)
+        {
+            // band reads no input, but the slab is still packed for its
+            // parameters
+            in_top = 0;
+            in_end = 1;
+        }
+        const size_t slab_offset = in_top * in_width_ * in_channels_;
+        const CiphertextSlab slab(input.data() + slab_offset,
+                                  (in_end - in_top) * in_width_ * in_channels_,
+                                  option_);
+
+#ifdef _OPENMP
+#pragma omp parallel for collapse(3) private(taps, weights)
+#endif
+        for (size_t oh = band_top; oh < band_end; ++oh)
+        {
+            for (size_t ow = 0; ow < out_width_; ++ow)
+            {
+                for (size_t oc = 0; oc < out_channels_; ++oc)
+                {
+                    const size_t ic = oc / depth_multiplier_;
+                    const size_t m = oc % depth_multiplier_;
+                    const size_t pixel = oh * out_width_ + ow;
+                    taps.clear();
+                    weights.clear();
+                    for (size_t t = tap_offsets_[pixel];
+                         t < tap_offsets_[pixel + 1]; ++t)
+                    {
+                        const ConvTap& tap = pixel_taps_[t];
+                        const ScalarPlaintext& weight = plain_filters_.data()
+                          [(tap.filter_pixel * in_channels_ + ic) *
+                             depth_multiplier_ +
+                           m];
+                        if (weight.coeff_mod_count() == 0)
+                            continue;
+                        taps.push_back(tap.input_pixel * in_channels_ + ic -
+                                       slab_offset);
+                        weights.push_back(&weight);
+                    }
+                    Ciphertext& destination = output[oh][ow][oc];
+                    if (taps.empty())
+                    {
+                        setZero(slab.parms_id(), product_scale, slab.size(),
+                                option_, destination);
+                    }
+                    else
+                    {
+                        multiplyAccumulate(slab, taps, weights, destination,
+                                           option_);
+                    }
+                    option_.evaluator.rescale_to_next_inplace(destination,
+                                                              option_.pool());
+                    if (!plain_biases_.empty())
+                    {
+                        option_.evaluator.add_plain_inplace(
+                          destination, plain_biases_[oc]);
+                    }
+                }
+            }
+        }
+    }
+
+#ifdef __DEBUG__
+    Plaintext plain;
+    vector<double> vec_tmp;
+    std::ofstream debug_file;
+    debug_file.open(DEBUG_FILE_PATH, std::ios::app);
+    debug_file << "In " << name() << ":" << endl;
+    for (size_t oh = 0; oh < out_height_; ++oh)
+    {
+        for (size_t ow = 0; ow < out_width_; ++ow)
+        {
+            for (size_t oc = 0; oc < out_channels_; ++oc)
+            {
+                gTool.decryptor()->decrypt(output[oh][ow][oc], plain);
+                gTool.encoder()->decode(plain, vec_tmp);
+                debug_file << "\toutput[" << oh << "][" << ow << "][" << oc
+                           << "]: " << vec_tmp[0] << ", " << vec_tmp[1] << ", "
+                           << vec_tmp[2] << endl;
+            }
+        }
+    }
+#endif
+    arena.swapTensors();
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "conv2d.hpp"
+
+using std::size_t;
+
+const string DEPTHWISE_CONV2D_CLASS_NAME = "DepthwiseConv2D";
+
+/**
+ * Depthwise convolution
+ * Each input channel is convolved with its own depth_multiplier filters, so
+ * that an output pixel costs filter_height * filter_width multiplications
+ * per output channel instead of filter_height * filter_width * in_channels.
+ * Output channel of input channel ic and multiplier m is
+ * ic * depth_multiplier + m as Keras.
+ */
+class DepthwiseConv2D : public Layer
+{
+public:
+    /**
+     * @param plain_filters: [filter_height][filter_width][in_channels]
+     * [depth_multiplier]
+     * @param plain_biases: biases of output channels (no bias if empty)
+     */
+    DepthwiseConv2D(const string& name, const size_t& in_height,
+                    const size_t& in_width, const size_t& in_channels,
+                    const size_t& depth_multiplier,
+                    const size_t& filter_height, const size_t& filter_width,
+                    const size_t& stride_height, const size_t& stride_width,
+                    const string& padding, const string& activation,
+                    const ScalarPlaintext4D& plain_filters,
+                    const vector<Plaintext>& plain_biases, OptOption& option);
+    ~DepthwiseConv2D();
+
+    const size_t& out_height() const
+    {
+        return out_height_;
+    }
+    const size_t& out_width() const
+    {
+        return out_width_;
+    }
+    const size_t& out_channels() const
+    {
+        return out_channels_;
+    }
+
+    void printInfo() const override;
+    void forward(TensorArena& arena) const override;
+    size_t weightBytes() const override;
+    void save(SnapshotWriter& writer) const override;
+
+protected:
+    void saveParams(SnapshotWriter& writer) const;
+
+private:
+    size_t in_height_;
+    size_t in_width_;
+    size_t in_channels_;
+    size_t depth_multiplier_;
+    size_t filter_height_;
+    size_t filter_width_;
+    size_t stride_height_;
+    size_t stride_width_;
+    string padding_;
+    string activation_;
+    size_t out_height_;
+    size_t out_width_;
+    size_t out_channels_;
+    // taps of output pixel p are pixel_taps_[tap_offsets_[p]] to
+    // pixel_taps_[tap_offsets_[p + 1] - 1]
+    vector<size_t> tap_offsets_;
+    vector<ConvTap> pixel_taps_;
+    ScalarPlaintext4D plain_filters_;
+    vector<Plaintext> plain_biases_;
+
+    OptOption& option_;
+};
@@ -16,6 +16,7 @@
  */
 
 #include "flatten.hpp"
+#include "snapshot.hpp"
 
 using std::cout;
 using std::endl;
@@ -40,6 +41,16 @@ void Flatten::printInfo() const
     cout << FLATTEN_CLASS_NAME << ": " << name() << endl;
 }
 
+void Flatten::save(SnapshotWriter& writer) const
+{
+    writer.writeString(FLATTEN_CLASS_NAME);
+    writer.writeString(name());
+    writer.write<uint64_t>(in_height_);
+    writer.write<uint64_t>(in_width_);
+    writer.write<uint64_t>(in_channels_);
+    writer.write<uint64_t>(out_units_);
+}
+
 vector<Ciphertext> Flatten::flatten(Ciphertext3D& input) const
 {
     cout << "\tForwarding " << name() << "..." << endl;
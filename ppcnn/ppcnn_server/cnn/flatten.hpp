@@ -31,6 +31,7 @@ public:
     ~Flatten();
 
     void printInfo() const override;
+    void save(SnapshotWriter& writer) const override;
     vector<Ciphertext> flatten(Ciphertext3D& input) const;
 
 private:
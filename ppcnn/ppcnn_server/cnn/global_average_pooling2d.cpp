@@ -18,6 +18,8 @@
 #include <memory>
 
 #include "global_average_pooling2d.hpp"
+#include "multiply_accumulate.hpp"
+#include "snapshot.hpp"
 
 using std::cout;
 using std::endl;
@@ -26,7 +28,7 @@ using std::move;
 GlobalAveragePooling2D::GlobalAveragePooling2D(
   const string& name, const size_t& in_height, const size_t& in_width,
   const size_t& in_channels, const size_t& out_units,
-  const Plaintext& plain_mul_factor, OptOption& option)
+  const ScalarPlaintext& plain_mul_factor, OptOption& option)
   : Layer(name, GLOBAL_AVERAGE_POOLING2D),
     in_height_(in_height),
     in_width_(in_width),
@@ -48,6 +50,22 @@ void GlobalAveragePooling2D::printInfo() const
     cout << GLOBAL_AVERAGE_POOLING2D_CLASS_NAME << ": " << name() << endl;
 }
 
+void GlobalAveragePooling2D::save(SnapshotWriter& writer) const
+{
+    writer.writeString(GLOBAL_AVERAGE_POOLING2D_CLASS_NAME);
+    writer.writeString(name());
+    writer.write<uint64_t>(in_height_);
+    writer.write<uint64_t>(in_width_);
+    writer.write<uint64_t>(in_channels_);
+    writer.write<uint64_t>(out_units_);
+    writer.writeScalarPlaintext(plain_mul_factor_);
+}
+
+size_t GlobalAveragePooling2D::weightBytes() const
+{
+    return plaintextBytes(plain_mul_factor_);
+}
+
 vector<Ciphertext> GlobalAveragePooling2D::flatten(Ciphertext3D& input) const
 {
     cout << "\tForwarding " << name() << "..." << endl;
@@ -55,41 +73,26 @@ vector<Ciphertext> GlobalAveragePooling2D::flatten(Ciphertext3D& input) const
          << "x" << input.shape()[2] << endl;
     vector<Ciphertext> flattened_input(out_units_);
 
+    // Pixels are summed by tree in parallel over pairs of pixels and
+    // channels, which takes log(H*W) steps of additions.
+    reducePartialSums(input.data(), in_height_ * in_width_, in_channels_,
+                      option_);
+
+    const bool should_fold_mul_factor = plain_mul_factor_.coeff_mod_count() > 0;
 #ifdef _OPENMP
 #pragma omp parallel for
 #endif
     for (size_t ou = 0; ou < out_units_; ++ou)
     {
         flattened_input[ou] = move(input[0][0][ou]);
-    }
-
-    // #ifdef _OPENMP
-    // #pragma omp parallel for collapse(2)
-    // #endif
-    for (size_t ih = 0; ih < in_height_; ++ih)
-    {
-        for (size_t iw = 0; iw < in_width_; ++iw)
+        if (should_fold_mul_factor)
         {
-            if (ih != 0 || iw != 0)
-            {
-                for (size_t ic = 0; ic < in_channels_; ++ic)
-                {
-                    option_.evaluator.add_inplace(flattened_input[ic],
-                                                  move(input[ih][iw][ic]));
-                }
-            }
+            multiplyScalarInplace(flattened_input[ou], plain_mul_factor_,
+                                  option_);
+            option_.evaluator.rescale_to_next_inplace(flattened_input[ou],
+                                                      option_.pool());
         }
     }
 
-    //   if (!gOption.enable_optimize_pooling()) {
-    // #ifdef _OPENMP
-    // #pragma omp parallel for
-    // #endif
-    //     for (size_t ou = 0; ou < out_units_; ++ou) {
-    //       option_.evaluator.multiply_plain_inplace(flattened_input[ou],
-    //       plain_mul_factor_);
-    //     }
-    //   }
-
     return flattened_input;
 }
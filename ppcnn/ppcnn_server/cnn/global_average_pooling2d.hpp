@@ -29,19 +29,22 @@ public:
     GlobalAveragePooling2D(const string& name, const size_t& in_height,
                            const size_t& in_width, const size_t& in_channels,
                            const size_t& out_units,
-                           const Plaintext& plain_mul_factor,
+                           const ScalarPlaintext& plain_mul_factor,
                            OptOption& option);
     ~GlobalAveragePooling2D();
 
     void printInfo() const override;
+    void save(SnapshotWriter& writer) const override;
     vector<Ciphertext> flatten(Ciphertext3D& input) const;
+    size_t weightBytes() const override;
 
 private:
     size_t in_height_;
     size_t in_width_;
     size_t in_channels_;
     size_t out_units_;
-    Plaintext plain_mul_factor_;
+    // folded into the output if encoded, otherwise folded by later layer
+    ScalarPlaintext plain_mul_factor_;
 
     OptOption& option_;
 };
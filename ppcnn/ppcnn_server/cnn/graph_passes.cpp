@@ -0,0 +1,791 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "activation.hpp"
+#include "average_pooling2d.hpp"
+#include "batch_normalization.hpp"
+#include "conv2d.hpp"
+#include "conv2d_fused_bn.hpp"
+#include "dense.hpp"
+#include "dense_fused_bn.hpp"
+#include "depthwise_conv2d.hpp"
+#include "flatten.hpp"
+#include "global_average_pooling2d.hpp"
+#include "graph_passes.hpp"
+#include "separable_conv2d.hpp"
+
+using std::cout;
+using std::endl;
+using std::make_unique;
+using std::move;
+using std::pow;
+using std::remove_if;
+
+/**
+ * Key of kernel whose last axis is output channel (empty if the layer has
+ * no kernel)
+ */
+string outputKernelKey(const string& class_name)
+{
+    if (class_name == CONV2D_CLASS_NAME ||
+        class_name == CONV2D_FUSED_BN_CLASS_NAME ||
+        class_name == DENSE_CLASS_NAME ||
+        class_name == DENSE_FUSED_BN_CLASS_NAME)
+    {
+        return "kernel";
+    }
+    if (class_name == DEPTHWISE_CONV2D_CLASS_NAME)
+    {
+        return "depthwise_kernel";
+    }
+    if (class_name == SEPARABLE_CONV2D_CLASS_NAME)
+    {
+        return "pointwise_kernel";
+    }
+    return "";
+}
+
+/**
+ * Key of weights multiplied to input of linear layer
+ */
+string inputWeightKey(const string& class_name)
+{
+    if (class_name == DEPTHWISE_CONV2D_CLASS_NAME ||
+        class_name == SEPARABLE_CONV2D_CLASS_NAME)
+    {
+        return "depthwise_kernel";
+    }
+    if (class_name == BATCH_NORMALIZATION_CLASS_NAME)
+    {
+        return "weight";
+    }
+    return "kernel";
+}
+
+/**
+ * Number of consecutive weights multiplied to the same input channel
+ */
+size_t inputWeightStride(const GraphNode& node)
+{
+    if (node.class_name == BATCH_NORMALIZATION_CLASS_NAME)
+    {
+        return 1;
+    }
+    if (node.class_name == DEPTHWISE_CONV2D_CLASS_NAME ||
+        node.class_name == SEPARABLE_CONV2D_CLASS_NAME)
+    {
+        return node.sizeAttr("depth_multiplier");
+    }
+    return node.out_shape.back();
+}
+
+/**
+ * Factors of output channels of layer deferred to the next linear layer (a
+ * single factor if it is common to all channels)
+ */
+vector<double> outputFactors(const GraphNode& node)
+{
+    if (node.class_name != ACTIVATION_CLASS_NAME)
+    {
+        return {node.scale};
+    }
+    const size_t coeff_count = node.sizeAttr("polynomial_degree") + 1;
+    const vector<float>& coeffs = node.params.at("coeffs");
+    vector<double> factors(coeffs.size() / coeff_count);
+    for (size_t c = 0; c < factors.size(); ++c)
+    {
+        factors[c] = coeffs[c * coeff_count];
+    }
+    return factors;
+}
+
+bool hasChannelFactors(const GraphNode* node)
+{
+    return outputFactors(*node).size() > 1;
+}
+
+bool isDense(const GraphNode& node)
+{
+    return node.class_name == DENSE_CLASS_NAME ||
+           node.class_name == DENSE_FUSED_BN_CLASS_NAME;
+}
+
+/**
+ * Whether per channel affine map of input can be folded into the layer
+ * Zero padding of convolution is not mapped, so that only convolution
+ * without padding can fold it.
+ */
+bool canFoldChannelAffine(const GraphNode& node)
+{
+    if (isDense(node))
+    {
+        return true;
+    }
+    if (node.class_name == CONV2D_CLASS_NAME ||
+        node.class_name == CONV2D_FUSED_BN_CLASS_NAME)
+    {
+        return node.stringAttr("padding") == "valid" ||
+               (node.sizeAttr("kernel_size", 0) == 1 &&
+                node.sizeAttr("kernel_size", 1) == 1);
+    }
+    return false;
+}
+
+/**
+ * Fold batch normalization into weights and biases of the next layer
+ * Input channel of kernel element i is (i / out_channels) % channels for
+ * both of convolution kernel and dense kernel of flattened images.
+ */
+void foldBatchNormalization(const GraphNode& bn, GraphNode& node)
+{
+    const vector<float>& bn_weights = bn.params.at("weight");
+    const vector<float>& bn_biases = bn.params.at("bias");
+    const size_t channels = bn_weights.size();
+    vector<float>& kernel = node.params["kernel"];
+    vector<float>& biases = node.params["bias"];
+    const size_t out_channels = biases.size();
+
+    vector<double> shifts(out_channels, 0);
+    for (size_t i = 0; i < kernel.size(); ++i)
+    {
+        const size_t c = (i / out_channels) % channels;
+        shifts[i % out_channels] += kernel[i] * bn_biases[c];
+        kernel[i] *= bn_weights[c];
+    }
+    for (size_t oc = 0; oc < out_channels; ++oc)
+    {
+        biases[oc] += shifts[oc];
+    }
+    node.name = bn.name + "-folded-with-" + node.name;
+}
+
+/**
+ * Fold dense layer without activation into the next dense layer
+ */
+void foldDense(const GraphNode& first, GraphNode& second)
+{
+    const size_t in_units = first.in_shape[0];
+    const size_t mid_units = first.out_shape[0];
+    const size_t out_units = second.out_shape[0];
+    const vector<float>& first_weights = first.params.at("kernel");
+    const vector<float>& first_biases = first.params.at("bias");
+    const vector<float>& second_weights = second.params.at("kernel");
+    const vector<float>& second_biases = second.params.at("bias");
+
+    vector<float> weights(in_units * out_units), biases(out_units);
+    for (size_t iu = 0; iu < in_units; ++iu)
+    {
+        for (size_t ou = 0; ou < out_units; ++ou)
+        {
+            double sum = 0;
+            for (size_t mu = 0; mu < mid_units; ++mu)
+            {
+                sum += first_weights[iu * mid_units + mu] *
+                       second_weights[mu * out_units + ou];
+            }
+            weights[iu * out_units + ou] = sum;
+        }
+    }
+    for (size_t ou = 0; ou < out_units; ++ou)
+    {
+        double sum = second_biases[ou];
+        for (size_t mu = 0; mu < mid_units; ++mu)
+        {
+            sum += first_biases[mu] * second_weights[mu * out_units + ou];
+        }
+        biases[ou] = sum;
+    }
+
+    second.params["kernel"] = move(weights);
+    second.params["bias"] = move(biases);
+    second.in_shape = first.in_shape;
+    second.name = first.name + "-folded-with-" + second.name;
+}
+
+picojson::value sizePair(const size_t& first, const size_t& second)
+{
+    return picojson::value(picojson::array{
+      picojson::value(static_cast<double>(first)),
+      picojson::value(static_cast<double>(second))});
+}
+
+/**
+ * Fold average pooling (without padding) into kernel of convolution
+ * Output (oh, ow) of the fused convolution covers the pooled pixels of
+ * (oh, ow) of the convolution, so that its kernel is
+ * (kernel - 1) * pool stride + pool size and its stride is the product of
+ * the strides.
+ */
+void foldPoolingIntoConv2D(const GraphNode& pool, GraphNode& conv)
+{
+    const size_t pool_height = pool.sizeAttr("pool_size", 0);
+    const size_t pool_width = pool.sizeAttr("pool_size", 1);
+    const size_t pool_stride_height = pool.sizeAttr("strides", 0);
+    const size_t pool_stride_width = pool.sizeAttr("strides", 1);
+    const size_t filter_height = conv.sizeAttr("kernel_size", 0);
+    const size_t filter_width = conv.sizeAttr("kernel_size", 1);
+    const size_t channels = conv.in_shape[2];
+    const size_t filter_size = conv.out_shape[2];
+    const size_t fused_height =
+      (filter_height - 1) * pool_stride_height + pool_height;
+    const size_t fused_width =
+      (filter_width - 1) * pool_stride_width + pool_width;
+    const vector<float>& filters = conv.params.at("kernel");
+
+    vector<float> fused(fused_height * fused_width * channels * filter_size, 0);
+    for (size_t fh = 0; fh < filter_height; ++fh)
+    {
+        for (size_t fw = 0; fw < filter_width; ++fw)
+        {
+            for (size_t ph = 0; ph < pool_height; ++ph)
+            {
+                for (size_t pw = 0; pw < pool_width; ++pw)
+                {
+                    const size_t h = fh * pool_stride_height + ph;
+                    const size_t w = fw * pool_stride_width + pw;
+                    const size_t src = (fh * filter_width + fw) * channels;
+                    const size_t dst = (h * fused_width + w) * channels;
+                    for (size_t i = 0; i < channels * filter_size; ++i)
+                    {
+                        fused[dst * filter_size + i] +=
+                          pool.scale * filters[src * filter_size + i];
+                    }
+                }
+            }
+        }
+    }
+
+    conv.params["kernel"] = move(fused);
+    conv.config["kernel_size"] = sizePair(fused_height, fused_width);
+    conv.config["strides"] =
+      sizePair(conv.sizeAttr("strides", 0) * pool_stride_height,
+               conv.sizeAttr("strides", 1) * pool_stride_width);
+    // 1x1 convolution with "same" padding pads nothing
+    conv.config["padding"] = picojson::value("valid");
+    // Winograd convolution is only for 3x3 kernel
+    conv.config.erase("winograd_tile");
+    conv.in_shape = pool.in_shape;
+}
+
+/**
+ * Fold average pooling (without padding) into weights of dense layer taking
+ * flattened pooled images
+ */
+void foldPoolingIntoDense(const GraphNode& pool, GraphNode& dense)
+{
+    const size_t pool_height = pool.sizeAttr("pool_size", 0);
+    const size_t pool_width = pool.sizeAttr("pool_size", 1);
+    const size_t stride_height = pool.sizeAttr("strides", 0);
+    const size_t stride_width = pool.sizeAttr("strides", 1);
+    const size_t in_width = pool.in_shape[1];
+    const size_t pooled_height = pool.out_shape[0];
+    const size_t pooled_width = pool.out_shape[1];
+    const size_t channels = pool.out_shape[2];
+    const size_t out_units = dense.out_shape[0];
+    const vector<float>& weights = dense.params.at("kernel");
+
+    vector<float> fused(pool.in_shape[0] * in_width * channels * out_units,
+                        0);
+    for (size_t y = 0; y < pooled_height; ++y)
+    {
+        for (size_t x = 0; x < pooled_width; ++x)
+        {
+            for (size_t ph = 0; ph < pool_height; ++ph)
+            {
+                for (size_t pw = 0; pw < pool_width; ++pw)
+                {
+                    const size_t h = y * stride_height + ph;
+                    const size_t w = x * stride_width + pw;
+                    const size_t src = (y * pooled_width + x) * channels;
+                    const size_t dst = (h * in_width + w) * channels;
+                    for (size_t i = 0; i < channels * out_units; ++i)
+                    {
+                        fused[dst * out_units + i] +=
+                          pool.scale * weights[src * out_units + i];
+                    }
+                }
+            }
+        }
+    }
+
+    dense.params["kernel"] = move(fused);
+    dense.in_shape = {pool.in_shape[0] * in_width * channels};
+}
+
+string RemoveDeadLayersPass::name() const
+{
+    return "remove-dead-layers";
+}
+
+void RemoveDeadLayersPass::run(ModelGraph& graph) const
+{
+    vector<GraphNode> live_nodes;
+    for (GraphNode& node : graph.nodes())
+    {
+        const bool is_dead =
+          node.class_name == DROPOUT_CLASS_NAME ||
+          node.class_name == INPUT_LAYER_CLASS_NAME ||
+          (node.class_name == ACTIVATION_CLASS_NAME &&
+           node.stringAttr("activation") == LINEAR_NAME) ||
+          (node.class_name == FLATTEN_CLASS_NAME && node.in_shape.size() == 1);
+        if (!is_dead)
+        {
+            live_nodes.push_back(move(node));
+        }
+    }
+    graph.nodes() = move(live_nodes);
+}
+
+string FuseBatchNormalizationPass::name() const
+{
+    return "fuse-batch-normalization";
+}
+
+void FuseBatchNormalizationPass::run(ModelGraph& graph) const
+{
+    vector<GraphNode>& nodes = graph.nodes();
+    vector<GraphNode> fused_nodes;
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        GraphNode& node = nodes[i];
+        const string kernel_key = outputKernelKey(node.class_name);
+        if (!kernel_key.empty() && i + 1 < nodes.size() &&
+            nodes[i + 1].class_name == BATCH_NORMALIZATION_CLASS_NAME)
+        {
+            const GraphNode& bn = nodes[i + 1];
+            const vector<float>& bn_weights = bn.params.at("weight");
+            const vector<float>& bn_biases = bn.params.at("bias");
+            const size_t out_channels = bn_weights.size();
+
+            // element i of kernel belongs to output channel
+            // i % out_channels (ic * depth_multiplier + m of depthwise)
+            vector<float>& kernel = node.params[kernel_key];
+            for (size_t j = 0; j < kernel.size(); ++j)
+            {
+                kernel[j] *= bn_weights[j % out_channels];
+            }
+            vector<float>& biases = node.params["bias"];
+            biases.resize(out_channels, 0);
+            for (size_t oc = 0; oc < out_channels; ++oc)
+            {
+                biases[oc] = biases[oc] * bn_weights[oc] + bn_biases[oc];
+            }
+
+            if (node.class_name == CONV2D_CLASS_NAME)
+            {
+                node.class_name = CONV2D_FUSED_BN_CLASS_NAME;
+            }
+            else if (node.class_name == DENSE_CLASS_NAME)
+            {
+                node.class_name = DENSE_FUSED_BN_CLASS_NAME;
+            }
+            node.name += "-fused-with-" + bn.name;
+            ++i;
+        }
+        fused_nodes.push_back(move(node));
+    }
+    nodes = move(fused_nodes);
+}
+
+string FoldLinearLayersPass::name() const
+{
+    return "fold-linear-layers";
+}
+
+void FoldLinearLayersPass::run(ModelGraph& graph) const
+{
+    vector<GraphNode> folded_nodes;
+    for (GraphNode& node : graph.nodes())
+    {
+        const size_t count = folded_nodes.size();
+        if (isDense(node) && count >= 1 && isDense(folded_nodes.back()) &&
+            folded_nodes.back().stringAttr("activation") == LINEAR_NAME)
+        {
+            foldDense(folded_nodes.back(), node);
+            folded_nodes.pop_back();
+        }
+        else if (canFoldChannelAffine(node) && count >= 1 &&
+                 folded_nodes.back().class_name ==
+                   BATCH_NORMALIZATION_CLASS_NAME)
+        {
+            foldBatchNormalization(folded_nodes.back(), node);
+            folded_nodes.pop_back();
+        }
+        else if (isDense(node) && count >= 2 &&
+                 folded_nodes.back().class_name == FLATTEN_CLASS_NAME &&
+                 folded_nodes[count - 2].class_name ==
+                   BATCH_NORMALIZATION_CLASS_NAME)
+        {
+            foldBatchNormalization(folded_nodes[count - 2], node);
+            folded_nodes.erase(folded_nodes.end() - 2);
+        }
+        folded_nodes.push_back(move(node));
+    }
+    graph.nodes() = move(folded_nodes);
+}
+
+string FoldBatchNormalizationIntoActivationPass::name() const
+{
+    return "fold-batch-normalization-into-activation";
+}
+
+/**
+ * Coefficients of p(s * x + t) are
+ * q_j = sum_{k >= j} p_k * C(k, j) * s^j * t^(k - j) for each channel.
+ * Batch normalization is folded only when the substituted polynomial (which
+ * has all terms) takes fewer levels than batch normalization and the
+ * polynomial, e.g. square is left as it is.
+ */
+void FoldBatchNormalizationIntoActivationPass::run(ModelGraph& graph) const
+{
+    vector<GraphNode>& nodes = graph.nodes();
+    vector<GraphNode> folded_nodes;
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        GraphNode& bn = nodes[i];
+        if (bn.class_name != BATCH_NORMALIZATION_CLASS_NAME ||
+            i + 1 == nodes.size() ||
+            nodes[i + 1].class_name != ACTIVATION_CLASS_NAME ||
+            nodes[i + 1].stringAttr("activation") == LINEAR_NAME)
+        {
+            folded_nodes.push_back(move(bn));
+            continue;
+        }
+        const GraphNode& act = nodes[i + 1];
+        const size_t degree = act.sizeAttr("polynomial_degree");
+        const vector<float>& poly_coeffs = act.params.at("coeffs");
+
+        const vector<float>& bn_weights = bn.params.at("weight");
+        const vector<float>& bn_biases = bn.params.at("bias");
+        const size_t channels = bn_weights.size();
+        GraphNode folded = act;
+        vector<float>& coeffs = folded.params["coeffs"];
+        coeffs.assign(channels * (degree + 1), 0);
+        for (size_t c = 0; c < channels; ++c)
+        {
+            const double s = bn_weights[c];
+            const double t = bn_biases[c];
+            for (size_t j = 0; j <= degree; ++j)
+            {
+                double q = 0;
+                // C(k, j) for k = j, j + 1, ...
+                double binomial = 1;
+                for (size_t k = j; k <= degree; ++k)
+                {
+                    q += poly_coeffs[degree - k] * binomial * pow(s, j) *
+                         pow(t, k - j);
+                    binomial = binomial * (k + 1) / (k + 1 - j);
+                }
+                // from the highest degree
+                coeffs[c * (degree + 1) + degree - j] = q;
+            }
+        }
+        if (ModelGraph::nodeCost(folded).levels >=
+            ModelGraph::nodeCost(bn).levels + ModelGraph::nodeCost(act).levels)
+        {
+            folded_nodes.push_back(move(bn));
+            continue;
+        }
+        folded.in_shape = bn.in_shape;
+        folded.name = bn.name + "-folded-with-" + act.name;
+        folded_nodes.push_back(move(folded));
+        ++i;
+    }
+    nodes = move(folded_nodes);
+}
+
+string FuseAveragePoolingPass::name() const
+{
+    return "fuse-average-pooling";
+}
+
+void FuseAveragePoolingPass::run(ModelGraph& graph) const
+{
+    vector<GraphNode>& nodes = graph.nodes();
+    vector<GraphNode> fused_nodes;
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        GraphNode& pool = nodes[i];
+        if (pool.class_name != AVERAGE_POOLING2D_CLASS_NAME ||
+            pool.stringAttr("padding") != "valid" || i + 1 == nodes.size())
+        {
+            fused_nodes.push_back(move(pool));
+            continue;
+        }
+
+        const bool has_flatten =
+          nodes[i + 1].class_name == FLATTEN_CLASS_NAME &&
+          i + 2 < nodes.size() && isDense(nodes[i + 2]);
+        const size_t next = has_flatten ? i + 2 : i + 1;
+        GraphNode fused = nodes[next];
+        if (isDense(fused) && has_flatten)
+        {
+            foldPoolingIntoDense(pool, fused);
+        }
+        else if (canFoldChannelAffine(fused) && !isDense(fused))
+        {
+            foldPoolingIntoConv2D(pool, fused);
+            if (ModelGraph::outputShape(fused) != fused.out_shape)
+            {
+                fused_nodes.push_back(move(pool));
+                continue;
+            }
+        }
+        else
+        {
+            fused_nodes.push_back(move(pool));
+            continue;
+        }
+
+        const GraphCost fused_cost = ModelGraph::nodeCost(fused);
+        const size_t unfused_operations =
+          ModelGraph::nodeCost(pool).operations() +
+          ModelGraph::nodeCost(nodes[next]).operations();
+        if (fused_cost.operations() >= unfused_operations)
+        {
+            fused_nodes.push_back(move(pool));
+            continue;
+        }
+
+        if (has_flatten)
+        {
+            GraphNode& flatten = nodes[i + 1];
+            flatten.in_shape = pool.in_shape;
+            flatten.out_shape = ModelGraph::outputShape(flatten);
+            fused_nodes.push_back(move(flatten));
+        }
+        fused.name = pool.name + "-fused-with-" + fused.name;
+        fused_nodes.push_back(move(fused));
+        i = next;
+    }
+    nodes = move(fused_nodes);
+}
+
+FoldScalingPass::FoldScalingPass(const bool& defer_pooling,
+                                 const bool& defer_activation)
+  : defer_pooling_(defer_pooling), defer_activation_(defer_activation)
+{
+}
+
+string FoldScalingPass::name() const
+{
+    return "fold-scaling";
+}
+
+void FoldScalingPass::run(ModelGraph& graph) const
+{
+    // layers whose factors are deferred when a linear layer follows
+    vector<GraphNode*> pending;
+    for (GraphNode& node : graph.nodes())
+    {
+        const bool is_pooling =
+          node.class_name == AVERAGE_POOLING2D_CLASS_NAME ||
+          node.class_name == GLOBAL_AVERAGE_POOLING2D_CLASS_NAME;
+        if (node.isLinear() || (is_pooling && !defer_pooling_))
+        {
+            if (is_pooling)
+            {
+                // pooling multiplies a factor common to all channels
+                pending.erase(remove_if(pending.begin(), pending.end(),
+                                        hasChannelFactors),
+                              pending.end());
+            }
+            if (pending.empty())
+            {
+                continue;
+            }
+            vector<double> factors = {1};
+            for (GraphNode* deferred_node : pending)
+            {
+                deferred_node->deferred = true;
+                const vector<double> node_factors =
+                  outputFactors(*deferred_node);
+                if (node_factors.size() > factors.size())
+                {
+                    factors.resize(node_factors.size(), factors[0]);
+                }
+                for (size_t c = 0; c < factors.size(); ++c)
+                {
+                    factors[c] *= node_factors[c % node_factors.size()];
+                }
+            }
+            pending.clear();
+
+            if (is_pooling)
+            {
+                node.scale *= factors[0];
+                continue;
+            }
+            const size_t stride = inputWeightStride(node);
+            vector<float>& weights =
+              node.params[inputWeightKey(node.class_name)];
+            for (size_t i = 0; i < weights.size(); ++i)
+            {
+                weights[i] *= factors[(i / stride) % factors.size()];
+            }
+        }
+        else if (is_pooling)
+        {
+            pending.push_back(&node);
+        }
+        else if (node.class_name == ACTIVATION_CLASS_NAME)
+        {
+            // factors cannot pass through activation, and a polynomial whose
+            // highest degree coefficient is 0 (or which is of degree 1)
+            // cannot be monic, and that whose coefficients are 1 is already
+            // monic
+            pending.clear();
+            if (!defer_activation_ ||
+                node.stringAttr("activation") == LINEAR_NAME ||
+                node.sizeAttr("polynomial_degree") < 2)
+            {
+                continue;
+            }
+            const vector<double> node_factors = outputFactors(node);
+            if (std::find(node_factors.begin(), node_factors.end(), 0.0) ==
+                  node_factors.end() &&
+                size_t(std::count(node_factors.begin(), node_factors.end(),
+                                  1.0)) < node_factors.size())
+            {
+                pending.push_back(&node);
+            }
+        }
+    }
+}
+
+string PlaceRelinearizationPass::name() const
+{
+    return "place-relinearization";
+}
+
+void PlaceRelinearizationPass::run(ModelGraph& graph) const
+{
+    vector<GraphNode>& nodes = graph.nodes();
+    for (GraphNode& node : nodes)
+    {
+        node.lazy_relinearization = false;
+    }
+    // primes of the first level
+    const size_t total_primes = graph.cost().levels + 1;
+    size_t consumed_level = 0;
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        GraphNode& node = nodes[i];
+        const GraphCost node_cost = ModelGraph::nodeCost(node);
+        if (node.class_name != ACTIVATION_CLASS_NAME ||
+            node.stringAttr("activation") == LINEAR_NAME ||
+            !activationSchedule(node).relinearizesSum())
+        {
+            consumed_level += node_cost.levels;
+            continue;
+        }
+        // the sum is relinearized before its rescaling
+        const size_t product_level = consumed_level + node_cost.levels - 1;
+        const size_t eager_cost =
+          elementCount(node.out_shape) *
+          relinearizationCost(total_primes - product_level);
+
+        // operations on ciphertexts of size 3 until the next activation
+        size_t lazy_operations = 0;
+        size_t level = consumed_level + node_cost.levels;
+        size_t j = i + 1;
+        for (; j < nodes.size(); ++j)
+        {
+            if (nodes[j].class_name == ACTIVATION_CLASS_NAME &&
+                nodes[j].stringAttr("activation") != LINEAR_NAME)
+            {
+                break;
+            }
+            const GraphCost cost = ModelGraph::nodeCost(nodes[j]);
+            lazy_operations += cost.operations();
+            level += cost.levels;
+        }
+        const size_t lazy_count = j < nodes.size()
+                                    ? elementCount(nodes[j].in_shape)
+                                    : elementCount(nodes.back().out_shape);
+        const size_t lazy_cost =
+          lazy_operations / 2 +
+          lazy_count * relinearizationCost(total_primes - level);
+        node.lazy_relinearization = lazy_cost < eager_cost;
+        consumed_level += node_cost.levels;
+    }
+}
+
+PassManager::PassManager(const GraphOption& option)
+{
+    addPass(make_unique<RemoveDeadLayersPass>());
+    if (option.enable_fuse_layers)
+    {
+        addPass(make_unique<FuseBatchNormalizationPass>());
+        addPass(make_unique<FoldLinearLayersPass>());
+        addPass(make_unique<FoldBatchNormalizationIntoActivationPass>());
+    }
+    if (option.enable_fuse_layers || option.enable_optimize_pooling)
+    {
+        addPass(make_unique<FuseAveragePoolingPass>());
+    }
+    if (option.enable_optimize_pooling || option.enable_optimize_activation)
+    {
+        addPass(make_unique<FoldScalingPass>(
+          option.enable_optimize_pooling, option.enable_optimize_activation));
+    }
+    addPass(make_unique<PlaceRelinearizationPass>());
+}
+PassManager::~PassManager()
+{
+}
+
+void PassManager::addPass(unique_ptr<GraphPass> pass)
+{
+    passes_.push_back(move(pass));
+}
+
+/**
+ * Run passes in order of addition, and report layers, levels and operations
+ * saved by each pass
+ */
+void PassManager::run(ModelGraph& graph) const
+{
+    for (const unique_ptr<GraphPass>& pass : passes_)
+    {
+        const size_t layer_count = graph.nodes().size();
+        const GraphCost before = graph.cost();
+        pass->run(graph);
+        const GraphCost after = graph.cost();
+        cout << "  Pass " << pass->name() << ": " << layer_count << " -> "
+             << graph.nodes().size() << " layers, saved "
+             << static_cast<long long>(before.levels - after.levels)
+             << " levels, "
+             << static_cast<long long>(before.multiplications -
+                                       after.multiplications)
+             << " multiplications, "
+             << static_cast<long long>(before.additions - after.additions)
+             << " additions and "
+             << static_cast<long long>(before.relinearizations -
+                                       after.relinearizations)
+             << " relinearizations" << endl;
+    }
+    const GraphCost cost = graph.cost();
+    cout << "  Model graph: " << graph.nodes().size() << " layers, "
+         << cost.levels << " levels, " << cost.multiplications
+         << " multiplications, " << cost.additions << " additions, "
+         << cost.relinearizations << " relinearizations" << endl;
+}
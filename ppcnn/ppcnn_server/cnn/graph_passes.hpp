@@ -0,0 +1,151 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <memory>
+
+#include "model_graph.hpp"
+
+using std::unique_ptr;
+
+/**
+ * Rewriting of model graph which keeps output of the model
+ */
+class GraphPass
+{
+public:
+    virtual ~GraphPass() = default;
+
+    virtual string name() const = 0;
+    virtual void run(ModelGraph& graph) const = 0;
+};
+
+/**
+ * Remove layers which do nothing on inference (Dropout, InputLayer, linear
+ * Activation, and Flatten of flattened input)
+ */
+class RemoveDeadLayersPass : public GraphPass
+{
+public:
+    string name() const override;
+    void run(ModelGraph& graph) const override;
+};
+
+/**
+ * Fuse BatchNormalization into weights and biases of the preceding
+ * convolution or dense layer
+ */
+class FuseBatchNormalizationPass : public GraphPass
+{
+public:
+    string name() const override;
+    void run(ModelGraph& graph) const override;
+};
+
+/**
+ * Fold consecutive linear layers into one layer
+ *   - Dense without activation followed by Dense
+ *   - BatchNormalization followed by Dense (through Flatten), or by Conv2D
+ *     without zero padding
+ */
+class FoldLinearLayersPass : public GraphPass
+{
+public:
+    string name() const override;
+    void run(ModelGraph& graph) const override;
+};
+
+/**
+ * Substitute BatchNormalization into the next polynomial activation, which
+ * gets coefficients of each channel
+ * This saves the level of batch normalization which cannot be folded into a
+ * linear layer.
+ */
+class FoldBatchNormalizationIntoActivationPass : public GraphPass
+{
+public:
+    string name() const override;
+    void run(ModelGraph& graph) const override;
+};
+
+/**
+ * Fuse AveragePooling2D into the next linear layer when it takes fewer
+ * operations, which saves the pass over the pooled tensor and the level of
+ * its multiplication
+ *   - Conv2D without zero padding becomes a strided convolution with a larger
+ *     kernel covering the pooling windows
+ *   - Dense (through Flatten) becomes a dense layer of unpooled input
+ */
+class FuseAveragePoolingPass : public GraphPass
+{
+public:
+    string name() const override;
+    void run(ModelGraph& graph) const override;
+};
+
+/**
+ * Defer constant factors of pooling (1 / pool area) and of polynomial
+ * activation (highest degree coefficient) to the next linear layer, which
+ * folds them into its weights
+ * A factor is deferred only when a linear layer follows before the next
+ * activation, so that the layer keeps it otherwise.
+ */
+class FoldScalingPass : public GraphPass
+{
+public:
+    FoldScalingPass(const bool& defer_pooling, const bool& defer_activation);
+
+    string name() const override;
+    void run(ModelGraph& graph) const override;
+
+private:
+    bool defer_pooling_;
+    bool defer_activation_;
+};
+
+/**
+ * Leave output of polynomial activation without relinearization when it is
+ * cheaper to relinearize at the next activation (or at the end of network)
+ * Linear layers and pooling between them take ciphertexts of size 3, which
+ * makes their multiplications and additions half as costly again, while a
+ * dense layer reducing many units to few relinearizes far fewer ciphertexts
+ * at lower level.
+ */
+class PlaceRelinearizationPass : public GraphPass
+{
+public:
+    string name() const override;
+    void run(ModelGraph& graph) const override;
+};
+
+/**
+ * Runner of graph passes enabled by optimization option
+ * Layers, levels and operations saved by each pass are reported.
+ */
+class PassManager
+{
+public:
+    explicit PassManager(const GraphOption& option);
+    ~PassManager();
+
+    void addPass(unique_ptr<GraphPass> pass);
+    void run(ModelGraph& graph) const;
+
+private:
+    vector<unique_ptr<GraphPass>> passes_;
+};
@@ -15,6 +15,9 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <stdexcept>
+
 #include "layer.hpp"
 
 Layer::Layer(const string& name, const ELayerClass& layer_class)
@@ -32,3 +35,145 @@ void Layer::forward(Ciphertext3D& input) const
 void Layer::forward(vector<Ciphertext>& input) const
 {
 }
+
+void Layer::forward(TensorArena& arena) const
+{
+}
+
+size_t Layer::weightBytes() const
+{
+    return 0;
+}
+
+bool Layer::isTileable() const
+{
+    return false;
+}
+
+/**
+ * Output size of feature map of input size (the same unless the layer
+ * changes it)
+ */
+void Layer::tileOutputSize(const size_t& in_height, const size_t& in_width,
+                           size_t& out_height, size_t& out_width) const
+{
+    out_height = in_height;
+    out_width = in_width;
+}
+
+/**
+ * Region of input which output region is computed from (the same region
+ * unless the layer has windows)
+ */
+TileRegion Layer::inputRegion(const TileRegion& out_region) const
+{
+    return out_region;
+}
+
+/**
+ * Forward tile of input region, which is replaced by tile of output region
+ *
+ * @param tile: input tile (with halo of windows), replaced by output tile
+ * @param in_region: region of input tile, as returned by inputRegion
+ * @param out_region: region of output tile
+ * @param relin_keys: relinearization keys (used by activation)
+ * @throws std::logic_error if the layer is not tileable
+ */
+void Layer::forwardTile(Ciphertext3D& tile, const TileRegion& in_region,
+                        const TileRegion& out_region,
+                        const seal::RelinKeys& relin_keys) const
+{
+    throw std::logic_error(name_ + " is not forwarded by tiles");
+}
+
+/**
+ * Input region of windows of output region, clipped to input
+ */
+TileRegion Layer::windowRegion(const TileRegion& out_region,
+                               const size_t& window_height,
+                               const size_t& window_width,
+                               const size_t& stride_height,
+                               const size_t& stride_width,
+                               const size_t& pad_top, const size_t& pad_left,
+                               const size_t& in_height, const size_t& in_width)
+{
+    auto window_range = [](const size_t& out_begin, const size_t& out_length,
+                           const size_t& window, const size_t& stride,
+                           const size_t& pad, const size_t& in_length,
+                           size_t& in_begin, size_t& in_length_of_range) {
+        const long begin = std::max(
+          static_cast<long>(out_begin * stride) - static_cast<long>(pad), 0L);
+        const long end =
+          std::min(static_cast<long>((out_begin + out_length - 1) * stride +
+                                     window) -
+                     static_cast<long>(pad),
+                   static_cast<long>(in_length));
+        in_begin = begin;
+        in_length_of_range = end - begin;
+    };
+    TileRegion in_region;
+    window_range(out_region.top, out_region.height, window_height,
+                 stride_height, pad_top, in_height, in_region.top,
+                 in_region.height);
+    window_range(out_region.left, out_region.width, window_width, stride_width,
+                 pad_left, in_width, in_region.left, in_region.width);
+    return in_region;
+}
+
+/**
+ * Move ciphertexts of tensor into tensor of its shape
+ */
+void Layer::moveTensor(Ciphertext3D& src, Ciphertext3D& dst)
+{
+    dst.resize(boost::extents[src.shape()[0]][src.shape()[1]][src.shape()[2]]);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (size_t i = 0; i < src.num_elements(); ++i)
+    {
+        dst.data()[i] = std::move(src.data()[i]);
+    }
+}
+
+/**
+ * Output size of a spatial dimension of convolution or pooling
+ *
+ * @param in_size: input size
+ * @param kernel_size: filter or pool size
+ * @param stride: stride
+ * @param padding: "valid" or "same"
+ * @return output size
+ */
+size_t Layer::outputSize(const size_t& in_size, const size_t& kernel_size,
+                         const size_t& stride, const string& padding)
+{
+    if (padding == "same")
+    {
+        return (in_size + stride - 1) / stride;
+    }
+    return (in_size - kernel_size + stride) / stride;
+}
+
+/**
+ * Padding before (top or left of) a spatial dimension of convolution or
+ * pooling
+ * As Keras does, "same" padding puts the extra one after when the total
+ * padding is odd.
+ *
+ * @param in_size: input size
+ * @param kernel_size: filter or pool size
+ * @param stride: stride
+ * @param padding: "valid" or "same"
+ * @return padding size
+ */
+size_t Layer::paddingBefore(const size_t& in_size, const size_t& kernel_size,
+                            const size_t& stride, const string& padding)
+{
+    if (padding != "same")
+    {
+        return 0;
+    }
+    const size_t rem = in_size % stride;
+    const size_t covered = rem == 0 ? stride : rem;
+    return kernel_size > covered ? (kernel_size - covered) / 2 : 0;
+}
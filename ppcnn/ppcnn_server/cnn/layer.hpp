@@ -20,6 +20,7 @@
 #include <seal/seal.h>
 
 #include <ppcnn_share/cnn_utils/opt_option.hpp>
+#include "scalar_plaintext.hpp"
 #include <string>
 #include <vector>
 
@@ -28,6 +29,21 @@ using seal::Plaintext;
 using std::string;
 using std::vector;
 
+class SnapshotWriter;
+class TensorArena;
+
+/**
+ * Rectangle of pixels of feature map,
+ * [top, top + height) x [left, left + width)
+ */
+struct TileRegion
+{
+    size_t top;
+    size_t left;
+    size_t height;
+    size_t width;
+};
+
 class Layer
 {
 public:
@@ -46,6 +62,50 @@ public:
     virtual void printInfo() const = 0;
     virtual void forward(Ciphertext3D& input) const;
     virtual void forward(vector<Ciphertext>& input) const;
+    // Layers with output of other shape than input write it to the next
+    // buffer of arena.
+    virtual void forward(TensorArena& arena) const;
+    virtual size_t weightBytes() const;
+    virtual void save(SnapshotWriter& writer) const = 0;
+
+    // Layers computing each output pixel from a window of input pixels (or
+    // from the pixel itself) can be forwarded by spatial tiles of output (see
+    // TiledSegment).
+    virtual bool isTileable() const;
+    virtual void tileOutputSize(const size_t& in_height,
+                                const size_t& in_width, size_t& out_height,
+                                size_t& out_width) const;
+    virtual TileRegion inputRegion(const TileRegion& out_region) const;
+    virtual void forwardTile(Ciphertext3D& tile, const TileRegion& in_region,
+                             const TileRegion& out_region,
+                             const seal::RelinKeys& relin_keys) const;
+
+    static size_t outputSize(const size_t& in_size, const size_t& kernel_size,
+                             const size_t& stride, const string& padding);
+    static size_t paddingBefore(const size_t& in_size,
+                                const size_t& kernel_size, const size_t& stride,
+                                const string& padding);
+
+protected:
+    static TileRegion windowRegion(const TileRegion& out_region,
+                                   const size_t& window_height,
+                                   const size_t& window_width,
+                                   const size_t& stride_height,
+                                   const size_t& stride_width,
+                                   const size_t& pad_top,
+                                   const size_t& pad_left,
+                                   const size_t& in_height,
+                                   const size_t& in_width);
+    static void moveTensor(Ciphertext3D& src, Ciphertext3D& dst);
+
+    static size_t plaintextBytes(const Plaintext& plain)
+    {
+        return plain.coeff_count() * sizeof(std::uint64_t);
+    }
+    static size_t plaintextBytes(const ScalarPlaintext& plain)
+    {
+        return plain.coeff_mod_count() * sizeof(std::uint64_t);
+    }
 
 private:
     string name_;
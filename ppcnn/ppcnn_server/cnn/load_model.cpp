@@ -15,6 +15,7 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <iterator>
@@ -30,9 +31,13 @@
 #include "conv2d_fused_bn.hpp"
 #include "dense.hpp"
 #include "dense_fused_bn.hpp"
+#include "depthwise_conv2d.hpp"
 #include "flatten.hpp"
 #include "global_average_pooling2d.hpp"
+#include "graph_passes.hpp"
 #include "load_model.hpp"
+#include "separable_conv2d.hpp"
+#include "winograd_conv2d.hpp"
 
 using namespace H5;
 using std::cout;
@@ -40,6 +45,7 @@ using std::endl;
 using std::ifstream;
 using std::ios;
 using std::istreambuf_iterator;
+using std::make_shared;
 using std::map;
 using std::move;
 using std::runtime_error;
@@ -47,27 +53,28 @@ using std::size_t;
 using std::sqrt;
 
 const string KERNEL_KEY = "kernel:0";
+const string DEPTHWISE_KERNEL_KEY = "depthwise_kernel:0";
+const string POINTWISE_KERNEL_KEY = "pointwise_kernel:0";
 const string BIAS_KEY = "bias:0";
 const string BETA_KEY = "beta:0";
 const string GAMMA_KEY = "gamma:0";
 const string MOVING_MEAN_KEY = "moving_mean:0";
 const string MOVING_VARIANCE_KEY = "moving_variance:0";
 
-const map<const string,
-          Layer* (*)(picojson::object&, const string&, OptOption&)>
-  BUILD_LAYER_MAP{
-    {CONV2D_CLASS_NAME, buildConv2D},
-    {AVERAGE_POOLING2D_CLASS_NAME, buildAveragePooling2D},
-    {BATCH_NORMALIZATION_CLASS_NAME, buildBatchNormalization},
-    {FLATTEN_CLASS_NAME, buildFlatten},
-    {DENSE_CLASS_NAME, buildDense},
-    {ACTIVATION_CLASS_NAME, buildActivation},
-    {GLOBAL_AVERAGE_POOLING2D_CLASS_NAME, buildGlobalAveragePooling2D}};
-
-size_t next_layer_in_height;
-size_t next_layer_in_width;
-size_t next_layer_in_channels;
-size_t next_layer_in_units;
+const map<const string, void (ModelBuilder::*)(const GraphNode&)>
+  ModelBuilder::PLAN_LAYER_MAP{
+    {CONV2D_CLASS_NAME, &ModelBuilder::planConv2D},
+    {CONV2D_FUSED_BN_CLASS_NAME, &ModelBuilder::planConv2D},
+    {DEPTHWISE_CONV2D_CLASS_NAME, &ModelBuilder::planDepthwiseConv2D},
+    {SEPARABLE_CONV2D_CLASS_NAME, &ModelBuilder::planSeparableConv2D},
+    {AVERAGE_POOLING2D_CLASS_NAME, &ModelBuilder::planAveragePooling2D},
+    {BATCH_NORMALIZATION_CLASS_NAME, &ModelBuilder::planBatchNormalization},
+    {FLATTEN_CLASS_NAME, &ModelBuilder::planFlatten},
+    {DENSE_CLASS_NAME, &ModelBuilder::planDense},
+    {DENSE_FUSED_BN_CLASS_NAME, &ModelBuilder::planDense},
+    {ACTIVATION_CLASS_NAME, &ModelBuilder::planActivation},
+    {GLOBAL_AVERAGE_POOLING2D_CLASS_NAME,
+     &ModelBuilder::planGlobalAveragePooling2D}};
 
 /**
  * Round target encode value when smaller than threshold (EPSILON)
@@ -82,6 +89,32 @@ void roundValue(float& value)
     value = EPSILON * sign;
 }
 
+/**
+ * Output tile size of Winograd convolution selected for the layer by
+ * "winograd_tile" of its config (0 for direct convolution if not given)
+ *
+ * @throws std::runtime_error if Winograd convolution is selected for other
+ * than stride 1 3x3 convolution
+ */
+size_t winogradTile(const GraphNode& node)
+{
+    if (node.config.find("winograd_tile") == node.config.end())
+    {
+        return 0;
+    }
+    const size_t tile = node.sizeAttr("winograd_tile");
+    if (tile > 0 &&
+        (node.sizeAttr("kernel_size", 0) != 3 ||
+         node.sizeAttr("kernel_size", 1) != 3 ||
+         node.sizeAttr("strides", 0) != 1 || node.sizeAttr("strides", 1) != 1))
+    {
+        throw runtime_error("Winograd convolution is only for stride 1 3x3 "
+                            "convolution (" +
+                            node.name + ")");
+    }
+    return tile;
+}
+
 /**
  * Get picojson object from JSON file
  *
@@ -127,711 +160,911 @@ picojson::array loadLayers(const string& model_structure_path)
     return json_obj["config"].get<picojson::array>();
 }
 
+GraphLoader::GraphLoader(const string& model_weights_path,
+                         const GraphOption& option)
+  : param_file_(model_weights_path, H5F_ACC_RDONLY), option_(option)
+{
+}
+GraphLoader::~GraphLoader()
+{
+}
+
 /**
- * Create layer of CNN
+ * Read layers and their trained parameters into model graph
  *
- * @param layer: picojson::object
- * @param layer_class_name: class_name of layer
- * @param model_weights_path: path of HDF5 (trained model parameters)
- * @return pointer of Layer object
  * @throws std::runtime_error if layer class name is not found from map
  */
-Layer* buildLayer(picojson::object& layer, const string& layer_class_name,
-                  const string& model_weights_path, OptOption& option)
+ModelGraph GraphLoader::load(const picojson::array& layers)
 {
-    if (auto map_iter = BUILD_LAYER_MAP.find(layer_class_name);
-        map_iter != BUILD_LAYER_MAP.end())
-    {
-        picojson::object layer_info = layer["config"].get<picojson::object>();
-        return move(map_iter->second(layer_info, model_weights_path, option));
-    }
-    else
+    ModelGraph graph;
+    for (const picojson::value& layer_value : layers)
     {
-        throw runtime_error("\"" + layer_class_name +
-                            "\" is not registered as layer class");
+        picojson::object layer = layer_value.get<picojson::object>();
+        GraphNode node;
+        node.class_name = layer["class_name"].get<string>();
+        node.config = layer["config"].get<picojson::object>();
+        node.name = node.config["name"].get<string>();
+        if (!ModelBuilder::isLayerClass(node.class_name) &&
+            node.class_name != DROPOUT_CLASS_NAME &&
+            node.class_name != INPUT_LAYER_CLASS_NAME)
+        {
+            throw runtime_error("\"" + node.class_name +
+                                "\" is not registered as layer class");
+        }
+        if (auto it = node.config.find("batch_input_shape");
+            it != node.config.end())
+        {
+            const picojson::array& batch_input_shape =
+              it->second.get<picojson::array>();
+            for (size_t i = 1; i < batch_input_shape.size(); ++i)
+            {
+                node.in_shape.push_back(batch_input_shape[i].get<double>());
+            }
+        }
+
+        graph.addNode(move(node));
+        loadParams(graph.nodes().back());
     }
+    return graph;
 }
 
 /**
- * Create layer of CNN
- *
- * @param layer: picojson::object
- * @param next_layer: picojson::object
- * @param layer_class_name: class_name of layer
- * @param model_weights_path: path of HDF5 (trained model parameters)
- * @return pointer of Layer object
- * @throws std::runtime_error if layer class name is not found from map
+ * Read trained parameters of layer, and set constant factor of its output
  */
-Layer* buildLayer(picojson::object& layer, picojson::object& next_layer,
-                  const string& layer_class_name,
-                  const string& model_weights_path,
-                  picojson::array::const_iterator& layers_iterator,
-                  OptOption& option)
+void GraphLoader::loadParams(GraphNode& node)
 {
-    const string next_layer_class_name = next_layer["class_name"].get<string>();
+    const string& class_name = node.class_name;
+    const string& name = node.name;
+    const vector<size_t>& in = node.in_shape;
+    const vector<size_t>& out = node.out_shape;
 
-    if (layer_class_name == CONV2D_CLASS_NAME &&
-        next_layer_class_name == BATCH_NORMALIZATION_CLASS_NAME)
+    if (class_name == CONV2D_CLASS_NAME)
     {
-        picojson::object conv2d_layer_info =
-          layer["config"].get<picojson::object>();
-        picojson::object bn_layer_info =
-          next_layer["config"].get<picojson::object>();
-        layers_iterator++;
-        return move(buildConv2DFusedBN(conv2d_layer_info, bn_layer_info,
-                                       model_weights_path, option));
+        const size_t window_size =
+          node.sizeAttr("kernel_size", 0) * node.sizeAttr("kernel_size", 1);
+        readParam(name, KERNEL_KEY, node.params["kernel"],
+                  window_size * in[2] * out[2]);
+        readParam(name, BIAS_KEY, node.params["bias"], out[2]);
     }
-    if (layer_class_name == DENSE_CLASS_NAME &&
-        next_layer_class_name == BATCH_NORMALIZATION_CLASS_NAME)
+    else if (class_name == DEPTHWISE_CONV2D_CLASS_NAME)
     {
-        picojson::object dense_layer_info =
-          layer["config"].get<picojson::object>();
-        picojson::object bn_layer_info =
-          next_layer["config"].get<picojson::object>();
-        layers_iterator++;
-        return move(buildDenseFusedBN(dense_layer_info, bn_layer_info,
-                                      model_weights_path, option));
+        const size_t window_size =
+          node.sizeAttr("kernel_size", 0) * node.sizeAttr("kernel_size", 1);
+        readParam(name, DEPTHWISE_KERNEL_KEY, node.params["depthwise_kernel"],
+                  window_size * out[2]);
+        if (node.config["use_bias"].get<bool>())
+        {
+            readParam(name, BIAS_KEY, node.params["bias"], out[2]);
+        }
     }
-
-    return move(
-      buildLayer(layer, layer_class_name, model_weights_path, option));
-}
-
-Layer* buildConv2D(picojson::object& layer_info,
-                   const string& model_weights_path, OptOption& option)
-{
-    const string layer_name = layer_info["name"].get<string>();
-    size_t in_height, in_width, in_channels;
-    try
+    else if (class_name == SEPARABLE_CONV2D_CLASS_NAME)
     {
-        const picojson::array batch_input_shape =
-          layer_info["batch_input_shape"].get<picojson::array>();
-
-        in_height = batch_input_shape[1].get<double>();
-        in_width = batch_input_shape[2].get<double>();
-        in_channels = batch_input_shape[3].get<double>();
+        const size_t window_size =
+          node.sizeAttr("kernel_size", 0) * node.sizeAttr("kernel_size", 1);
+        const size_t mid_channels = in[2] * node.sizeAttr("depth_multiplier");
+        readParam(name, DEPTHWISE_KERNEL_KEY, node.params["depthwise_kernel"],
+                  window_size * mid_channels);
+        readParam(name, POINTWISE_KERNEL_KEY, node.params["pointwise_kernel"],
+                  mid_channels * out[2]);
+        // the pointwise convolution adds biases even if the layer has none
+        if (node.config["use_bias"].get<bool>())
+        {
+            readParam(name, BIAS_KEY, node.params["bias"], out[2]);
+        }
+        else
+        {
+            node.params["bias"].assign(out[2], 0);
+        }
     }
-    catch (runtime_error& re)
+    else if (class_name == DENSE_CLASS_NAME)
     {
-        in_height = next_layer_in_height;
-        in_width = next_layer_in_width;
-        in_channels = next_layer_in_channels;
+        readParam(name, KERNEL_KEY, node.params["kernel"], in[0] * out[0]);
+        readParam(name, BIAS_KEY, node.params["bias"], out[0]);
     }
-    const size_t filter_size = layer_info["filters"].get<double>();
-    const picojson::array filter_hw =
-      layer_info["kernel_size"].get<picojson::array>();
-    const size_t filter_height = filter_hw[0].get<double>();
-    const size_t filter_width = filter_hw[1].get<double>();
-    const picojson::array stride_hw =
-      layer_info["strides"].get<picojson::array>();
-    const size_t stride_height = stride_hw[0].get<double>();
-    const size_t stride_width = stride_hw[1].get<double>();
-    const string padding = layer_info["padding"].get<string>();
-    const string activation = layer_info["activation"].get<string>();
-
-    cout << "  Building " << layer_name << "..." << endl;
-
-    H5File param_file(model_weights_path, H5F_ACC_RDONLY);
-    Group group = param_file.openGroup("/" + layer_name + "/" + layer_name);
-    DataSet kernel_ds = group.openDataSet(KERNEL_KEY);
-    DataSet bias_ds = group.openDataSet(BIAS_KEY);
-
-    float4D filters(
-      boost::extents[filter_height][filter_width][in_channels][filter_size]);
-    Plaintext4D plain_filters(
-      boost::extents[filter_height][filter_width][in_channels][filter_size]);
-    vector<float> biases(filter_size);
-    vector<Plaintext> plain_biases(filter_size);
-
-    kernel_ds.read(filters.data(), PredType::NATIVE_FLOAT);
-    bias_ds.read(biases.data(), PredType::NATIVE_FLOAT);
-
-    float folding_value = 1, weight;
-    if (option.enable_optimize_activation && option.should_multiply_coeff &&
-        option.enable_optimize_pooling && option.should_multiply_pool)
+    else if (class_name == BATCH_NORMALIZATION_CLASS_NAME)
     {
-        folding_value =
-          option.highest_deg_coeff * option.current_pooling_mul_factor;
-        option.should_multiply_coeff = false;
-        option.should_multiply_pool = false;
+        const size_t dim = in.back();
+        vector<float> beta, gamma, moving_mean, moving_variance;
+        readParam(name, BETA_KEY, beta, dim);
+        readParam(name, GAMMA_KEY, gamma, dim);
+        readParam(name, MOVING_MEAN_KEY, moving_mean, dim);
+        readParam(name, MOVING_VARIANCE_KEY, moving_variance, dim);
+
+        vector<float>& weights = node.params["weight"];
+        vector<float>& biases = node.params["bias"];
+        weights.resize(dim);
+        biases.resize(dim);
+        for (size_t i = 0; i < dim; ++i)
+        {
+            weights[i] = gamma[i] / sqrt(moving_variance[i] + BN_EPSILON);
+            biases[i] = beta[i] - (weights[i] * moving_mean[i]);
+        }
     }
-    else if (option.enable_optimize_activation && option.should_multiply_coeff)
+    else if (class_name == AVERAGE_POOLING2D_CLASS_NAME)
     {
-        folding_value = option.highest_deg_coeff;
-        option.should_multiply_coeff = false;
+        node.scale = 1.0 / (node.sizeAttr("pool_size", 0) *
+                            node.sizeAttr("pool_size", 1));
     }
-    else if (option.enable_optimize_pooling && option.should_multiply_pool)
+    else if (class_name == GLOBAL_AVERAGE_POOLING2D_CLASS_NAME)
     {
-        folding_value = option.current_pooling_mul_factor;
-        option.should_multiply_pool = false;
+        node.scale = 1.0 / (in[0] * in[1]);
     }
-
-#ifdef _OPENMP
-#pragma omp parallel for collapse(4) private(weight)
-#endif
-    for (size_t fh = 0; fh < filter_height; ++fh)
+    else if (class_name == ACTIVATION_CLASS_NAME)
     {
-        for (size_t fw = 0; fw < filter_width; ++fw)
+        const string activation =
+          resolveActivation(node.stringAttr("activation"), option_.activation);
+        node.config["activation"] = picojson::value(activation);
+        if (activation == LINEAR_NAME)
         {
-            for (size_t ic = 0; ic < in_channels; ++ic)
+            return;
+        }
+        // polynomial given by model metadata, or registered one
+        vector<float> coeffs;
+        const auto coeffs_it = node.config.find("polynomial_coeffs");
+        if (option_.activation == DEFAULT && coeffs_it != node.config.end())
+        {
+            for (const picojson::value& coeff :
+                 coeffs_it->second.get<picojson::array>())
             {
-                for (size_t fs = 0; fs < filter_size; ++fs)
-                {
-                    weight = folding_value * filters[fh][fw][ic][fs];
-                    if (fabs(weight) < EPSILON)
-                    {
-                        roundValue(weight);
-                    }
-                    option.encoder.encode(weight, option.scale_param,
-                                          plain_filters[fh][fw][ic][fs]);
-                    for (size_t lv = 0; lv < option.consumed_level; ++lv)
-                    {
-                        option.evaluator.mod_switch_to_next_inplace(
-                          plain_filters[fh][fw][ic][fs]);
-                    }
-                }
+                coeffs.push_back(coeff.get<double>());
             }
         }
+        else
+        {
+            coeffs = activationCoeffs(activation);
+        }
+        if (coeffs.size() < 2 || coeffs.front() == 0)
+        {
+            throw runtime_error("Polynomial activation must be of degree 1 "
+                                "or more with nonzero highest degree "
+                                "coefficient (" +
+                                node.name + ")");
+        }
+        node.config["polynomial_degree"] =
+          picojson::value(double(coeffs.size() - 1));
+        node.params["coeffs"] = coeffs;
     }
+}
 
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif
-    for (size_t fs = 0; fs < filter_size; ++fs)
+void GraphLoader::readParam(const string& layer_name, const string& key,
+                            vector<float>& dst, const size_t& size)
+{
+    dst.resize(size);
+    Group group = param_file_.openGroup("/" + layer_name + "/" + layer_name);
+    DataSet dataset = group.openDataSet(key);
+    dataset.read(dst.data(), PredType::NATIVE_FLOAT);
+}
+
+/**
+ * Plan levels of model
+ *
+ * @param model_structure_path: JSON file path
+ * @param model_weights_path: HDF5 file path of trained parameters
+ * @param option: optimization and activation options
+ * @return levels consumed by model and by each of its layers
+ * @throws std::runtime_error if layer class name is not found from map
+ */
+LevelPlan planLevels(const string& model_structure_path,
+                     const string& model_weights_path,
+                     const GraphOption& option)
+{
+    ModelGraph graph = GraphLoader(model_weights_path, option)
+                         .load(loadLayers(model_structure_path));
+    PassManager(option).run(graph);
+    const LevelPlan plan = graph.levelPlan();
+    for (const LevelPlan::LayerLevels& layer : plan.layers)
     {
-        option.encoder.encode(biases[fs], option.scale_param, plain_biases[fs]);
-        for (size_t lv = 0; lv < option.consumed_level + 1; ++lv)
+        if (layer.levels > 0)
         {
-            option.evaluator.mod_switch_to_next_inplace(plain_biases[fs]);
+            cout << "    " << layer.name << " (" << layer.class_name
+                 << "): levels " << layer.first_level << " -> "
+                 << layer.first_level + layer.levels << endl;
         }
     }
-
-    Conv2D* conv2d =
-      new Conv2D(layer_name, in_height, in_width, in_channels, filter_size,
-                 filter_height, filter_width, stride_height, stride_width,
-                 padding, activation, plain_filters, plain_biases, option);
-
-    next_layer_in_height = conv2d->out_height();
-    next_layer_in_width = conv2d->out_width();
-    next_layer_in_channels = conv2d->out_channels();
-
-    return move((Layer*)conv2d);
+    cout << "  Level plan: " << plan.levels << " levels" << endl;
+    return plan;
 }
 
-Layer* buildAveragePooling2D(picojson::object& layer_info,
-                             const string& model_weights_path,
-                             OptOption& option)
+ModelBuilder::ModelBuilder(const string& model_weights_path,
+                           OptOption& option)
+  : model_weights_path_(model_weights_path),
+    option_(option),
+    scale_(option.scale_param),
+    weight_count_(0),
+    dropped_weight_count_(0),
+    total_weight_count_(0),
+    total_dropped_weight_count_(0)
 {
-    const string layer_name = layer_info["name"].get<string>();
-    const picojson::array pool_hw =
-      layer_info["pool_size"].get<picojson::array>();
-    const size_t pool_height = pool_hw[0].get<double>();
-    const size_t pool_width = pool_hw[1].get<double>();
-    const picojson::array stride_hw =
-      layer_info["strides"].get<picojson::array>();
-    const size_t stride_height = stride_hw[0].get<double>();
-    const size_t stride_width = stride_hw[1].get<double>();
-    const string padding = layer_info["padding"].get<string>();
-
-    cout << "  Building " << layer_name << "..." << endl;
+}
+ModelBuilder::~ModelBuilder()
+{
+}
 
-    Plaintext plain_mul_factor;
+/**
+ * Build network
+ *
+ * @param layers: picojson::array loaded by loadLayers
+ * @return network
+ * @throws std::runtime_error if layer class name is not found from map
+ */
+Network ModelBuilder::build(const picojson::array& layers)
+{
+    ModelGraph graph = GraphLoader(model_weights_path_, option_).load(layers);
+    PassManager(option_).run(graph);
 
-    if (option.enable_optimize_pooling)
+    const LevelPlan plan = graph.levelPlan();
+    if (plan.levels >= option_.level_parms_ids.size())
     {
-        option.current_pooling_mul_factor = 1.0 / (pool_height * pool_width);
-        option.should_multiply_pool = true;
+        throw runtime_error(
+          "Model consumes " + std::to_string(plan.levels) +
+          " levels, but encryption parameters have only " +
+          std::to_string(option_.level_parms_ids.size() - 1) + " levels");
     }
-    else if (option.enable_optimize_activation && option.should_multiply_coeff)
+    for (size_t i = 0; i < graph.nodes().size(); ++i)
     {
-        option.encoder.encode(
-          option.highest_deg_coeff / (pool_height * pool_width),
-          option.scale_param, plain_mul_factor);
-        option.should_multiply_coeff = false;
-        for (size_t lv = 0; lv < option.consumed_level; ++lv)
+        const size_t first_level = option_.consumed_level;
+        planNode(graph.nodes()[i]);
+        if (option_.consumed_level - first_level != plan.layers[i].levels)
         {
-            option.evaluator.mod_switch_to_next_inplace(plain_mul_factor);
+            throw runtime_error("Levels consumed by " + graph.nodes()[i].name +
+                                " differ from level plan");
         }
     }
-    else
+
+    if (option_.sparsity_threshold > 0)
     {
-        option.encoder.encode(1.0 / (pool_height * pool_width),
-                              option.scale_param, plain_mul_factor);
-        for (size_t lv = 0; lv < option.consumed_level; ++lv)
-        {
-            option.evaluator.mod_switch_to_next_inplace(plain_mul_factor);
-        }
+        cout << "  Dropped " << total_dropped_weight_count_ << " of "
+             << total_weight_count_ << " weights (sparsity threshold "
+             << option_.sparsity_threshold << ")" << endl;
     }
 
-    AveragePooling2D* average_pooling2d = new AveragePooling2D(
-      layer_name, next_layer_in_height, next_layer_in_width,
-      next_layer_in_channels, pool_height, pool_width, stride_height,
-      stride_width, padding, plain_mul_factor, option);
+    encodeAll();
 
-    next_layer_in_height = average_pooling2d->out_height();
-    next_layer_in_width = average_pooling2d->out_width();
-    next_layer_in_channels = average_pooling2d->out_channels();
+    Network network;
+    for (function<Layer*()>& factory : layer_factories_)
+    {
+        network.addLayer(factory());
+        // release parameters copied by the layer
+        factory = nullptr;
+    }
+    layer_factories_.clear();
 
-    return move((Layer*)average_pooling2d);
+    return network;
 }
 
-Layer* buildBatchNormalization(picojson::object& layer_info,
-                               const string& model_weights_path,
-                               OptOption& option)
+bool ModelBuilder::isLayerClass(const string& class_name)
 {
-    const string layer_name = layer_info["name"].get<string>();
-    // const size_t axis       =
-    // layer_info["axis"].get<picojson::array>()[0].get<double>();
-
-    cout << "  Building " << layer_name << "..." << endl;
-
-    H5File param_file(model_weights_path, H5F_ACC_RDONLY);
-    Group group = param_file.openGroup("/" + layer_name + "/" + layer_name);
-    DataSet beta_ds = group.openDataSet(BETA_KEY);
-    DataSet gamma_ds = group.openDataSet(GAMMA_KEY);
-    DataSet moving_mean_ds = group.openDataSet(MOVING_MEAN_KEY);
-    DataSet moving_variance_ds = group.openDataSet(MOVING_VARIANCE_KEY);
-
-    const size_t dim =
-      next_layer_in_units != 0 ? next_layer_in_units : next_layer_in_channels;
-
-    vector<float> beta(dim), gamma(dim), moving_mean(dim), moving_variance(dim);
-
-    beta_ds.read(beta.data(), PredType::NATIVE_FLOAT);
-    gamma_ds.read(gamma.data(), PredType::NATIVE_FLOAT);
-    moving_mean_ds.read(moving_mean.data(), PredType::NATIVE_FLOAT);
-    moving_variance_ds.read(moving_variance.data(), PredType::NATIVE_FLOAT);
-
-    float weight, bias;
-    vector<Plaintext> plain_weights(dim), plain_biases(dim);
+    return PLAN_LAYER_MAP.find(class_name) != PLAN_LAYER_MAP.end();
+}
 
-#ifdef _OPENMP
-#pragma omp parallel for private(weight, bias)
-#endif
-    for (size_t i = 0; i < dim; ++i)
+/**
+ * @throws std::runtime_error if layer class name is not found from map
+ */
+void ModelBuilder::planNode(const GraphNode& node)
+{
+    if (auto map_iter = PLAN_LAYER_MAP.find(node.class_name);
+        map_iter != PLAN_LAYER_MAP.end())
     {
-        weight = gamma[i] / sqrt(moving_variance[i] + BN_EPSILON);
-        bias = beta[i] - (weight * moving_mean[i]);
-
-        option.encoder.encode(weight, option.scale_param, plain_weights[i]);
-        option.encoder.encode(bias, option.scale_param, plain_biases[i]);
-        for (size_t lv = 0; lv < option.consumed_level; ++lv)
-        {
-            option.evaluator.mod_switch_to_next_inplace(plain_weights[i]);
-            option.evaluator.mod_switch_to_next_inplace(plain_biases[i]);
-        }
-        option.evaluator.mod_switch_to_next_inplace(plain_biases[i]);
+        (this->*(map_iter->second))(node);
+    }
+    else
+    {
+        throw runtime_error("\"" + node.class_name +
+                            "\" is not registered as layer class");
     }
-
-    return move((Layer*)new BatchNormalization(layer_name, plain_weights,
-                                               plain_biases, option));
 }
 
-Layer* buildFlatten(picojson::object& layer_info,
-                    const string& model_weights_path, OptOption& option)
+/**
+ * @throws std::runtime_error if level exceeds modulus chain
+ */
+void ModelBuilder::checkLevel(const size_t& level) const
 {
-    const string layer_name = layer_info["name"].get<string>();
-    next_layer_in_units =
-      next_layer_in_height * next_layer_in_width * next_layer_in_channels;
-
-    cout << "  Building " << layer_name << "..." << endl;
-
-    return move((Layer*)new Flatten(layer_name, next_layer_in_height,
-                                    next_layer_in_width, next_layer_in_channels,
-                                    next_layer_in_units));
+    if (level >= option_.level_parms_ids.size())
+    {
+        throw runtime_error(
+          "Model consumes more levels than encryption parameters (level " +
+          std::to_string(level) + " of " +
+          std::to_string(option_.level_parms_ids.size()) + ")");
+    }
 }
 
-Layer* buildDense(picojson::object& layer_info,
-                  const string& model_weights_path, OptOption& option)
+/**
+ * Prime dropped by rescaling ciphertexts at level
+ */
+double ModelBuilder::rescalePrime(const size_t& level) const
 {
-    const string layer_name = layer_info["name"].get<string>();
-    const size_t out_units = layer_info["units"].get<double>();
-    const string activation = layer_info["activation"].get<string>();
+    checkLevel(level + 1);
+    return static_cast<double>(option_.context
+                                 ->get_context_data(
+                                   option_.level_parms_ids[level])
+                                 ->parms()
+                                 .coeff_modulus()
+                                 .back()
+                                 .value());
+}
 
-    cout << "  Building " << layer_name << "..." << endl;
+/**
+ * Scale of plaintext multiplied to ciphertexts at level, with which the
+ * product is at scale_param after rescaling
+ */
+double ModelBuilder::multiplierScale(const size_t& level) const
+{
+    return rescalePrime(level) * option_.scale_param / scale_;
+}
 
-    H5File param_file(model_weights_path, H5F_ACC_RDONLY);
-    Group group = param_file.openGroup("/" + layer_name + "/" + layer_name);
-    DataSet kernel_ds = group.openDataSet(KERNEL_KEY);
-    DataSet bias_ds = group.openDataSet(BIAS_KEY);
+/**
+ * Track scale of ciphertexts multiplied by plaintext and rescaled at level
+ * in the same way as evaluator computes it
+ */
+void ModelBuilder::trackRescale(const double& multiplier_scale,
+                                const size_t& level)
+{
+    scale_ = scale_ * multiplier_scale / rescalePrime(level);
+}
 
-    float2D weights(boost::extents[next_layer_in_units][out_units]);
-    Plaintext2D plain_weights(boost::extents[next_layer_in_units][out_units]);
-    vector<float> biases(out_units);
-    vector<Plaintext> plain_biases(out_units);
+/**
+ * Plan encoding of parameter at level where it is consumed
+ *
+ * @throws std::runtime_error if level exceeds modulus chain
+ */
+void ModelBuilder::addEncodeTask(const double& value, const size_t& level,
+                                 const double& scale, Plaintext& plain)
+{
+    checkLevel(level);
+    encode_tasks_.push_back({value, level, scale, &plain, nullptr});
+}
 
-    kernel_ds.read(weights.data(), PredType::NATIVE_FLOAT);
-    bias_ds.read(biases.data(), PredType::NATIVE_FLOAT);
+void ModelBuilder::addEncodeTask(const double& value, const size_t& level,
+                                 const double& scale, ScalarPlaintext& scalar)
+{
+    checkLevel(level);
+    encode_tasks_.push_back({value, level, scale, nullptr, &scalar});
+}
 
-    float folding_value = 1, weight;
-    if (option.enable_optimize_activation && option.should_multiply_coeff &&
-        option.enable_optimize_pooling && option.should_multiply_pool)
+/**
+ * Plan encoding of weight multiplied to ciphertexts
+ * Weight smaller than sparsity threshold is dropped (left empty), and the
+ * layer skips its multiplication. Otherwise weight smaller than EPSILON is
+ * rounded to EPSILON.
+ */
+void ModelBuilder::addWeightEncodeTask(float weight, const size_t& level,
+                                       const double& scale,
+                                       ScalarPlaintext& scalar)
+{
+    ++weight_count_;
+    if (fabs(weight) < option_.sparsity_threshold)
     {
-        folding_value =
-          option.highest_deg_coeff * option.current_pooling_mul_factor;
-        option.should_multiply_coeff = false;
-        option.should_multiply_pool = false;
+        ++dropped_weight_count_;
+        return;
     }
-    else if (option.enable_optimize_activation && option.should_multiply_coeff)
+    if (fabs(weight) < EPSILON)
     {
-        folding_value = option.highest_deg_coeff;
-        option.should_multiply_coeff = false;
+        roundValue(weight);
     }
-    else if (option.enable_optimize_pooling && option.should_multiply_pool)
+    addEncodeTask(weight, level, scale, scalar);
+}
+
+/**
+ * Report weights dropped in the layer by sparsity threshold
+ */
+void ModelBuilder::reportDroppedWeights()
+{
+    if (option_.sparsity_threshold > 0)
     {
-        folding_value = option.current_pooling_mul_factor;
-        option.should_multiply_pool = false;
+        cout << "    dropped " << dropped_weight_count_ << " of "
+             << weight_count_ << " weights" << endl;
     }
+    total_weight_count_ += weight_count_;
+    total_dropped_weight_count_ += dropped_weight_count_;
+    weight_count_ = 0;
+    dropped_weight_count_ = 0;
+}
+
+/**
+ * Encode parameters of all layers
+ * Tasks of all layers are distributed at once, so that small layers do not
+ * leave cores idle. Each parameter is encoded with the primes of its level
+ * only, instead of being encoded at the first level and switched down.
+ */
+void ModelBuilder::encodeAll()
+{
+    cout << "  Encoding " << encode_tasks_.size() << " parameters..." << endl;
 
 #ifdef _OPENMP
-#pragma omp parallel for collapse(2) private(weight)
+#pragma omp parallel for schedule(dynamic, 64)
 #endif
-    for (size_t iu = 0; iu < next_layer_in_units; ++iu)
+    for (size_t i = 0; i < encode_tasks_.size(); ++i)
     {
-        for (size_t ou = 0; ou < out_units; ++ou)
+        const EncodeTask& task = encode_tasks_[i];
+        if (task.scalar)
         {
-            weight = folding_value * weights[iu][ou];
-            if (fabs(weight) < EPSILON)
-            {
-                roundValue(weight);
-            }
-            option.encoder.encode(weight, option.scale_param,
-                                  plain_weights[iu][ou]);
-            for (size_t lv = 0; lv < option.consumed_level; ++lv)
-            {
-                option.evaluator.mod_switch_to_next_inplace(
-                  plain_weights[iu][ou]);
-            }
+            encodeScalar(task.value, option_.level_parms_ids[task.level],
+                         task.scale, option_, *task.scalar);
         }
-    }
-
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif
-    for (size_t ou = 0; ou < out_units; ++ou)
-    {
-        option.encoder.encode(biases[ou], option.scale_param, plain_biases[ou]);
-        for (size_t lv = 0; lv < option.consumed_level + 1; ++lv)
+        else
         {
-            option.evaluator.mod_switch_to_next_inplace(plain_biases[ou]);
+            option_.encoder.encode(task.value,
+                                   option_.level_parms_ids[task.level],
+                                   task.scale, *task.plain);
         }
     }
-
-    Dense* dense = new Dense(layer_name, next_layer_in_units, out_units,
-                             activation, plain_weights, plain_biases, option);
-
-    next_layer_in_units = out_units;
-
-    return move((Layer*)dense);
+    encode_tasks_.clear();
 }
 
-Layer* buildActivation(picojson::object& layer_info,
-                       const string& model_weights_path, OptOption& option)
+void ModelBuilder::planConv2D(const GraphNode& node)
 {
-    const string layer_name = layer_info["name"].get<string>();
-    const string activation = layer_info["activation"].get<string>();
+    const string layer_name = node.name;
+    const size_t in_height = node.in_shape[0];
+    const size_t in_width = node.in_shape[1];
+    const size_t in_channels = node.in_shape[2];
+    const size_t filter_size = node.out_shape[2];
+    const size_t filter_height = node.sizeAttr("kernel_size", 0);
+    const size_t filter_width = node.sizeAttr("kernel_size", 1);
+    const size_t stride_height = node.sizeAttr("strides", 0);
+    const size_t stride_width = node.sizeAttr("strides", 1);
+    const string padding = node.stringAttr("padding");
+    const string activation = node.stringAttr("activation");
+    const bool is_fused = node.class_name == CONV2D_FUSED_BN_CLASS_NAME;
+    const size_t winograd_tile = winogradTile(node);
 
     cout << "  Building " << layer_name << "..." << endl;
 
-    if (option.enable_optimize_activation)
+    if (winograd_tile > 0)
+    {
+        planWinogradConv2D(node, winograd_tile);
+        return;
+    }
+
+    const vector<float>& filters = node.params.at("kernel");
+    const vector<float>& biases = node.params.at("bias");
+    auto plain_filters = make_shared<ScalarPlaintext4D>(
+      boost::extents[filter_height][filter_width][in_channels][filter_size]);
+    auto plain_biases = make_shared<vector<Plaintext>>(filter_size);
+
+    const size_t level = option_.consumed_level;
+    const double filter_scale = multiplierScale(level);
+    for (size_t i = 0; i < filters.size(); ++i)
     {
-        option.should_multiply_coeff = true;
+        addWeightEncodeTask(filters[i], level, filter_scale,
+                            plain_filters->data()[i]);
     }
+    reportDroppedWeights();
+    trackRescale(filter_scale, level);
+    for (size_t fs = 0; fs < filter_size; ++fs)
+    {
+        addEncodeTask(biases[fs], level + 1, scale_, (*plain_biases)[fs]);
+    }
+
+    layer_factories_.emplace_back([=]() -> Layer* {
+        if (is_fused)
+        {
+            return new Conv2DFusedBN(
+              layer_name, in_height, in_width, in_channels, filter_size,
+              filter_height, filter_width, stride_height, stride_width,
+              padding, activation, *plain_filters, *plain_biases, option_);
+        }
+        return new Conv2D(layer_name, in_height, in_width, in_channels,
+                          filter_size, filter_height, filter_width,
+                          stride_height, stride_width, padding, activation,
+                          *plain_filters, *plain_biases, option_);
+    });
 
-    return move((Layer*)new Activation(layer_name, activation, option));
+    option_.consumed_level++;
 }
 
-Layer* buildGlobalAveragePooling2D(picojson::object& layer_info,
-                                   const string& model_weights_path,
-                                   OptOption& option)
+void ModelBuilder::planDepthwiseConv2D(const GraphNode& node)
 {
-    const string layer_name = layer_info["name"].get<string>();
-    next_layer_in_units = next_layer_in_channels;
+    const string layer_name = node.name;
+    const size_t in_height = node.in_shape[0];
+    const size_t in_width = node.in_shape[1];
+    const size_t in_channels = node.in_shape[2];
+    const size_t depth_multiplier = node.sizeAttr("depth_multiplier");
+    const size_t filter_height = node.sizeAttr("kernel_size", 0);
+    const size_t filter_width = node.sizeAttr("kernel_size", 1);
+    const size_t stride_height = node.sizeAttr("strides", 0);
+    const size_t stride_width = node.sizeAttr("strides", 1);
+    const string padding = node.stringAttr("padding");
+    const string activation = node.stringAttr("activation");
+    const size_t out_channels = node.out_shape[2];
 
     cout << "  Building " << layer_name << "..." << endl;
 
-    Plaintext plain_mul_factor;
-
-    // if (option.enable_optimize_pooling) {
-    if (true || option.enable_optimize_pooling)
+    const vector<float>& filters = node.params.at("depthwise_kernel");
+    auto plain_filters = make_shared<ScalarPlaintext4D>(
+      boost::extents[filter_height][filter_width][in_channels]
+                    [depth_multiplier]);
+    // biases are also given by fused batch normalization
+    const auto bias_it = node.params.find("bias");
+    const bool has_bias = bias_it != node.params.end();
+    auto plain_biases =
+      make_shared<vector<Plaintext>>(has_bias ? out_channels : 0);
+
+    const size_t level = option_.consumed_level;
+    const double filter_scale = multiplierScale(level);
+    for (size_t i = 0; i < filters.size(); ++i)
     {
-        if (option.should_multiply_pool)
-        {
-            option.current_pooling_mul_factor *=
-              (1.0 / (next_layer_in_height * next_layer_in_width));
-        }
-        else
-        {
-            option.current_pooling_mul_factor =
-              1.0 / (next_layer_in_height * next_layer_in_width);
-        }
-        option.should_multiply_pool = true;
+        addWeightEncodeTask(filters[i], level, filter_scale,
+                            plain_filters->data()[i]);
     }
-    else
+    reportDroppedWeights();
+    trackRescale(filter_scale, level);
+    if (has_bias)
     {
-        option.encoder.encode(
-          1.0 / (next_layer_in_height * next_layer_in_width),
-          option.scale_param, plain_mul_factor);
-        for (size_t lv = 0; lv < option.consumed_level; ++lv)
+        for (size_t oc = 0; oc < out_channels; ++oc)
         {
-            option.evaluator.mod_switch_to_next_inplace(plain_mul_factor);
+            addEncodeTask(bias_it->second[oc], level + 1, scale_,
+                          (*plain_biases)[oc]);
         }
     }
 
-    return move((Layer*)new GlobalAveragePooling2D(
-      layer_name, next_layer_in_height, next_layer_in_width,
-      next_layer_in_channels, next_layer_in_units, plain_mul_factor, option));
+    layer_factories_.emplace_back([=]() {
+        return new DepthwiseConv2D(layer_name, in_height, in_width,
+                                   in_channels, depth_multiplier,
+                                   filter_height, filter_width, stride_height,
+                                   stride_width, padding, activation,
+                                   *plain_filters, *plain_biases, option_);
+    });
+
+    option_.consumed_level++;
 }
 
-Layer* buildConv2DFusedBN(picojson::object& conv2d_layer_info,
-                          picojson::object& bn_layer_info,
-                          const string& model_weights_path, OptOption& option)
+/**
+ * Plan depthwise convolution (without bias) at the current level, and
+ * pointwise convolution with biases at the next level
+ */
+void ModelBuilder::planSeparableConv2D(const GraphNode& node)
 {
-    // read variables of conv2d
-    const string conv2d_layer_name = conv2d_layer_info["name"].get<string>();
-    size_t in_height, in_width, in_channels;
-    try
-    {
-        const picojson::array batch_input_shape =
-          conv2d_layer_info["batch_input_shape"].get<picojson::array>();
+    const string layer_name = node.name;
+    const size_t in_height = node.in_shape[0];
+    const size_t in_width = node.in_shape[1];
+    const size_t in_channels = node.in_shape[2];
+    const size_t filter_size = node.out_shape[2];
+    const size_t depth_multiplier = node.sizeAttr("depth_multiplier");
+    const size_t filter_height = node.sizeAttr("kernel_size", 0);
+    const size_t filter_width = node.sizeAttr("kernel_size", 1);
+    const size_t stride_height = node.sizeAttr("strides", 0);
+    const size_t stride_width = node.sizeAttr("strides", 1);
+    const string padding = node.stringAttr("padding");
+    const string activation = node.stringAttr("activation");
+    const size_t mid_channels = in_channels * depth_multiplier;
+    const size_t out_height = node.out_shape[0];
+    const size_t out_width = node.out_shape[1];
+
+    cout << "  Building " << layer_name << "..." << endl;
 
-        in_height = batch_input_shape[1].get<double>();
-        in_width = batch_input_shape[2].get<double>();
-        in_channels = batch_input_shape[3].get<double>();
+    const vector<float>& depthwise_filters = node.params.at("depthwise_kernel");
+    const vector<float>& pointwise_filters = node.params.at("pointwise_kernel");
+    const vector<float>& biases = node.params.at("bias");
+
+    auto plain_depthwise_filters = make_shared<ScalarPlaintext4D>(
+      boost::extents[filter_height][filter_width][in_channels]
+                    [depth_multiplier]);
+    auto plain_pointwise_filters = make_shared<ScalarPlaintext4D>(
+      boost::extents[1][1][mid_channels][filter_size]);
+    auto plain_biases = make_shared<vector<Plaintext>>(filter_size);
+
+    const size_t level = option_.consumed_level;
+    checkLevel(level + 2);
+    const double depthwise_scale = multiplierScale(level);
+    for (size_t i = 0; i < depthwise_filters.size(); ++i)
+    {
+        addWeightEncodeTask(depthwise_filters[i], level, depthwise_scale,
+                            plain_depthwise_filters->data()[i]);
+    }
+    trackRescale(depthwise_scale, level);
+    const double pointwise_scale = multiplierScale(level + 1);
+    for (size_t i = 0; i < pointwise_filters.size(); ++i)
+    {
+        addWeightEncodeTask(pointwise_filters[i], level + 1, pointwise_scale,
+                            plain_pointwise_filters->data()[i]);
     }
-    catch (runtime_error& re)
+    reportDroppedWeights();
+    trackRescale(pointwise_scale, level + 1);
+    for (size_t fs = 0; fs < filter_size; ++fs)
     {
-        in_height = next_layer_in_height;
-        in_width = next_layer_in_width;
-        in_channels = next_layer_in_channels;
+        addEncodeTask(biases[fs], level + 2, scale_, (*plain_biases)[fs]);
     }
-    const size_t filter_size = conv2d_layer_info["filters"].get<double>();
-    const picojson::array filter_hw =
-      conv2d_layer_info["kernel_size"].get<picojson::array>();
-    const size_t filter_height = filter_hw[0].get<double>();
-    const size_t filter_width = filter_hw[1].get<double>();
-    const picojson::array stride_hw =
-      conv2d_layer_info["strides"].get<picojson::array>();
-    const size_t stride_height = stride_hw[0].get<double>();
-    const size_t stride_width = stride_hw[1].get<double>();
-    const string padding = conv2d_layer_info["padding"].get<string>();
-    const string activation = conv2d_layer_info["activation"].get<string>();
 
-    // read variables of batch normalization
-    const string bn_layer_name = bn_layer_info["name"].get<string>();
+    layer_factories_.emplace_back([=]() {
+        auto depthwise = make_shared<DepthwiseConv2D>(
+          layer_name + "/depthwise", in_height, in_width, in_channels,
+          depth_multiplier, filter_height, filter_width, stride_height,
+          stride_width, padding, "linear", *plain_depthwise_filters,
+          vector<Plaintext>(), option_);
+        auto pointwise = make_shared<Conv2D>(
+          layer_name + "/pointwise", out_height, out_width, mid_channels,
+          filter_size, 1, 1, 1, 1, "valid", activation,
+          *plain_pointwise_filters, *plain_biases, option_);
+        return new SeparableConv2D(layer_name, depthwise, pointwise);
+    });
+
+    option_.consumed_level += 2;
+}
 
-    const string layer_name =
-      conv2d_layer_name + "-fused-with-" + bn_layer_name;
+/**
+ * Plan Winograd convolution
+ * Filters are transformed after folding, and the error added against direct
+ * convolution by encoding the transformed filters is reported.
+ */
+void ModelBuilder::planWinogradConv2D(const GraphNode& node,
+                                      const size_t& tile)
+{
+    const string layer_name = node.name;
+    const size_t in_height = node.in_shape[0];
+    const size_t in_width = node.in_shape[1];
+    const size_t in_channels = node.in_shape[2];
+    const size_t filter_size = node.out_shape[2];
+    const string padding = node.stringAttr("padding");
+    const string activation = node.stringAttr("activation");
+    const vector<float>& kernel = node.params.at("kernel");
+    const vector<float>& biases = node.params.at("bias");
+
+    float4D filters(boost::extents[3][3][in_channels][filter_size]);
+    std::copy(kernel.begin(), kernel.end(), filters.data());
+    vector<double> transformed;
+    WinogradConv2D::transformFilters(tile, filters, transformed);
+    cout << "    Winograd F(" << tile << "x" << tile
+         << ", 3x3) max error against direct convolution: "
+         << WinogradConv2D::maxTransformError(tile, filters, transformed,
+                                              option_.scale_param)
+         << endl;
+
+    const size_t n = tile + 2;
+    auto plain_filters = make_shared<ScalarPlaintext4D>(
+      boost::extents[n][n][in_channels][filter_size]);
+    auto plain_biases = make_shared<vector<Plaintext>>(filter_size);
+    const size_t level = option_.consumed_level;
+    const double filter_scale = multiplierScale(level);
+    for (size_t i = 0; i < transformed.size(); ++i)
+    {
+        addEncodeTask(transformed[i], level, filter_scale,
+                      plain_filters->data()[i]);
+    }
+    trackRescale(filter_scale, level);
+    for (size_t fs = 0; fs < filter_size; ++fs)
+    {
+        addEncodeTask(biases[fs], level + 1, scale_, (*plain_biases)[fs]);
+    }
 
-    cout << "  Building " << layer_name << "..." << endl;
+    layer_factories_.emplace_back([=]() {
+        return new WinogradConv2D(layer_name, in_height, in_width,
+                                  in_channels, filter_size, tile, padding,
+                                  activation, *plain_filters, *plain_biases,
+                                  option_);
+    });
 
-    H5File param_file(model_weights_path, H5F_ACC_RDONLY);
-    Group conv2d_group =
-      param_file.openGroup("/" + conv2d_layer_name + "/" + conv2d_layer_name);
-    Group bn_group =
-      param_file.openGroup("/" + bn_layer_name + "/" + bn_layer_name);
+    option_.consumed_level++;
+}
 
-    DataSet kernel_ds = conv2d_group.openDataSet(KERNEL_KEY);
-    DataSet bias_ds = conv2d_group.openDataSet(BIAS_KEY);
-    DataSet beta_ds = bn_group.openDataSet(BETA_KEY);
-    DataSet gamma_ds = bn_group.openDataSet(GAMMA_KEY);
-    DataSet moving_mean_ds = bn_group.openDataSet(MOVING_MEAN_KEY);
-    DataSet moving_variance_ds = bn_group.openDataSet(MOVING_VARIANCE_KEY);
+/**
+ * Plan average pooling, which multiplies 1 / pool area (and factors folded
+ * into it) unless the factor is deferred to the next linear layer
+ */
+void ModelBuilder::planAveragePooling2D(const GraphNode& node)
+{
+    const string layer_name = node.name;
+    const size_t pool_height = node.sizeAttr("pool_size", 0);
+    const size_t pool_width = node.sizeAttr("pool_size", 1);
+    const size_t stride_height = node.sizeAttr("strides", 0);
+    const size_t stride_width = node.sizeAttr("strides", 1);
+    const string padding = node.stringAttr("padding");
+    const size_t in_height = node.in_shape[0];
+    const size_t in_width = node.in_shape[1];
+    const size_t in_channels = node.in_shape[2];
 
-    float4D filters(
-      boost::extents[filter_height][filter_width][in_channels][filter_size]);
-    Plaintext4D plain_filters(
-      boost::extents[filter_height][filter_width][in_channels][filter_size]);
-    vector<float> biases(filter_size), beta(filter_size), gamma(filter_size),
-      moving_mean(filter_size), moving_variance(filter_size),
-      weights_bn(filter_size), biases_bn(filter_size);
-    vector<Plaintext> plain_biases(filter_size);
-
-    kernel_ds.read(filters.data(), PredType::NATIVE_FLOAT);
-    bias_ds.read(biases.data(), PredType::NATIVE_FLOAT);
-    beta_ds.read(beta.data(), PredType::NATIVE_FLOAT);
-    gamma_ds.read(gamma.data(), PredType::NATIVE_FLOAT);
-    moving_mean_ds.read(moving_mean.data(), PredType::NATIVE_FLOAT);
-    moving_variance_ds.read(moving_variance.data(), PredType::NATIVE_FLOAT);
+    cout << "  Building " << layer_name << "..." << endl;
 
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif
-    for (size_t fs = 0; fs < filter_size; ++fs)
+    auto plain_mul_factor = make_shared<ScalarPlaintext>();
+    if (!node.deferred)
     {
-        weights_bn[fs] = gamma[fs] / sqrt(moving_variance[fs] + BN_EPSILON);
-        biases_bn[fs] = beta[fs] - (weights_bn[fs] * moving_mean[fs]);
-        biases[fs] = biases[fs] * weights_bn[fs] + biases_bn[fs];
-        option.encoder.encode(biases[fs], option.scale_param, plain_biases[fs]);
-        for (size_t lv = 0; lv < option.consumed_level + 1; ++lv)
-        {
-            option.evaluator.mod_switch_to_next_inplace(plain_biases[fs]);
-        }
+        const double factor_scale = multiplierScale(option_.consumed_level);
+        addEncodeTask(node.scale, option_.consumed_level, factor_scale,
+                      *plain_mul_factor);
+        trackRescale(factor_scale, option_.consumed_level);
     }
 
-    float folding_value = 1, weight;
-    if (option.enable_optimize_activation && option.should_multiply_coeff &&
-        option.enable_optimize_pooling && option.should_multiply_pool)
-    {
-        folding_value =
-          option.highest_deg_coeff * option.current_pooling_mul_factor;
-        option.should_multiply_coeff = false;
-        option.should_multiply_pool = false;
-    }
-    else if (option.enable_optimize_activation && option.should_multiply_coeff)
-    {
-        folding_value = option.highest_deg_coeff;
-        option.should_multiply_coeff = false;
-    }
-    else if (option.enable_optimize_pooling && option.should_multiply_pool)
+    layer_factories_.emplace_back([=]() {
+        return new AveragePooling2D(layer_name, in_height, in_width,
+                                    in_channels, pool_height, pool_width,
+                                    stride_height, stride_width, padding,
+                                    *plain_mul_factor, option_);
+    });
+
+    if (!node.deferred)
     {
-        folding_value = option.current_pooling_mul_factor;
-        option.should_multiply_pool = false;
+        option_.consumed_level++;
     }
+}
 
-#ifdef _OPENMP
-#pragma omp parallel for collapse(4) private(weight)
-#endif
-    for (size_t fh = 0; fh < filter_height; ++fh)
+void ModelBuilder::planBatchNormalization(const GraphNode& node)
+{
+    const string layer_name = node.name;
+
+    cout << "  Building " << layer_name << "..." << endl;
+
+    const vector<float>& weights = node.params.at("weight");
+    const vector<float>& biases = node.params.at("bias");
+    const size_t dim = weights.size();
+    auto plain_weights = make_shared<vector<ScalarPlaintext>>(dim);
+    auto plain_biases = make_shared<vector<Plaintext>>(dim);
+
+    const size_t level = option_.consumed_level;
+    const double weight_scale = multiplierScale(level);
+    trackRescale(weight_scale, level);
+    for (size_t i = 0; i < dim; ++i)
     {
-        for (size_t fw = 0; fw < filter_width; ++fw)
-        {
-            for (size_t ic = 0; ic < in_channels; ++ic)
-            {
-                for (size_t fs = 0; fs < filter_size; ++fs)
-                {
-                    weight =
-                      folding_value * filters[fh][fw][ic][fs] * weights_bn[fs];
-                    if (fabs(weight) < EPSILON)
-                    {
-                        roundValue(weight);
-                    }
-                    option.encoder.encode(weight, option.scale_param,
-                                          plain_filters[fh][fw][ic][fs]);
-                    for (size_t lv = 0; lv < option.consumed_level; ++lv)
-                    {
-                        option.evaluator.mod_switch_to_next_inplace(
-                          plain_filters[fh][fw][ic][fs]);
-                    }
-                }
-            }
-        }
+        addEncodeTask(weights[i], level, weight_scale, (*plain_weights)[i]);
+        addEncodeTask(biases[i], level + 1, scale_, (*plain_biases)[i]);
     }
 
-    Conv2DFusedBN* conv2d_fused_bn = new Conv2DFusedBN(
-      layer_name, in_height, in_width, in_channels, filter_size, filter_height,
-      filter_width, stride_height, stride_width, padding, activation,
-      plain_filters, plain_biases, option);
+    layer_factories_.emplace_back([=]() {
+        return new BatchNormalization(layer_name, *plain_weights,
+                                      *plain_biases, option_);
+    });
 
-    next_layer_in_height = conv2d_fused_bn->out_height();
-    next_layer_in_width = conv2d_fused_bn->out_width();
-    next_layer_in_channels = conv2d_fused_bn->out_channels();
-
-    return move((Layer*)conv2d_fused_bn);
+    option_.consumed_level++;
 }
 
-Layer* buildDenseFusedBN(picojson::object& dense_layer_info,
-                         picojson::object& bn_layer_info,
-                         const string& model_weights_path, OptOption& option)
+void ModelBuilder::planFlatten(const GraphNode& node)
 {
-    // read variables of dense
-    const string dense_layer_name = dense_layer_info["name"].get<string>();
-    const size_t out_units = dense_layer_info["units"].get<double>();
-    const string activation = dense_layer_info["activation"].get<string>();
+    const string layer_name = node.name;
+    const size_t in_height = node.in_shape[0];
+    const size_t in_width = node.in_shape[1];
+    const size_t in_channels = node.in_shape[2];
+    const size_t out_units = node.out_shape[0];
 
-    // read variables of batch normalization
-    const string bn_layer_name = bn_layer_info["name"].get<string>();
+    cout << "  Building " << layer_name << "..." << endl;
 
-    const string layer_name = dense_layer_name + "-fused-with-" + bn_layer_name;
+    layer_factories_.emplace_back([=]() {
+        return new Flatten(layer_name, in_height, in_width, in_channels,
+                           out_units);
+    });
+}
+
+void ModelBuilder::planDense(const GraphNode& node)
+{
+    const string layer_name = node.name;
+    const size_t in_units = node.in_shape[0];
+    const size_t out_units = node.out_shape[0];
+    const string activation = node.stringAttr("activation");
+    const bool is_fused = node.class_name == DENSE_FUSED_BN_CLASS_NAME;
 
     cout << "  Building " << layer_name << "..." << endl;
 
-    H5File param_file(model_weights_path, H5F_ACC_RDONLY);
-    Group dense_group =
-      param_file.openGroup("/" + dense_layer_name + "/" + layer_name);
-    Group bn_group =
-      param_file.openGroup("/" + bn_layer_name + "/" + bn_layer_name);
-
-    DataSet kernel_ds = dense_group.openDataSet(KERNEL_KEY);
-    DataSet bias_ds = dense_group.openDataSet(BIAS_KEY);
-    DataSet beta_ds = bn_group.openDataSet(BETA_KEY);
-    DataSet gamma_ds = bn_group.openDataSet(GAMMA_KEY);
-    DataSet moving_mean_ds = bn_group.openDataSet(MOVING_MEAN_KEY);
-    DataSet moving_variance_ds = bn_group.openDataSet(MOVING_VARIANCE_KEY);
-
-    float2D weights(boost::extents[next_layer_in_units][out_units]);
-    Plaintext2D plain_weights(boost::extents[next_layer_in_units][out_units]);
-    vector<float> biases(out_units), beta(out_units), gamma(out_units),
-      moving_mean(out_units), moving_variance(out_units), weights_bn(out_units),
-      biases_bn(out_units);
-    vector<Plaintext> plain_biases(out_units);
-
-    kernel_ds.read(weights.data(), PredType::NATIVE_FLOAT);
-    bias_ds.read(biases.data(), PredType::NATIVE_FLOAT);
-    beta_ds.read(beta.data(), PredType::NATIVE_FLOAT);
-    gamma_ds.read(gamma.data(), PredType::NATIVE_FLOAT);
-    moving_mean_ds.read(moving_mean.data(), PredType::NATIVE_FLOAT);
-    moving_variance_ds.read(moving_variance.data(), PredType::NATIVE_FLOAT);
+    const vector<float>& weights = node.params.at("kernel");
+    const vector<float>& biases = node.params.at("bias");
+    auto plain_weights =
+      make_shared<ScalarPlaintext2D>(boost::extents[in_units][out_units]);
+    auto plain_biases = make_shared<vector<Plaintext>>(out_units);
 
+    const size_t level = option_.consumed_level;
+    const double weight_scale = multiplierScale(level);
+    for (size_t i = 0; i < weights.size(); ++i)
+    {
+        addWeightEncodeTask(weights[i], level, weight_scale,
+                            plain_weights->data()[i]);
+    }
+    reportDroppedWeights();
+    trackRescale(weight_scale, level);
     for (size_t ou = 0; ou < out_units; ++ou)
     {
-        weights_bn[ou] = gamma[ou] / sqrt(moving_variance[ou] + BN_EPSILON);
-        biases_bn[ou] = beta[ou] - (weights_bn[ou] * moving_mean[ou]);
-        biases[ou] = biases[ou] * weights_bn[ou] + biases_bn[ou];
-        option.encoder.encode(biases[ou], option.scale_param, plain_biases[ou]);
-        for (size_t lv = 0; lv < option.consumed_level + 1; ++lv)
+        addEncodeTask(biases[ou], level + 1, scale_, (*plain_biases)[ou]);
+    }
+
+    layer_factories_.emplace_back([=]() -> Layer* {
+        if (is_fused)
         {
-            option.evaluator.mod_switch_to_next_inplace(plain_biases[ou]);
+            return new DenseFusedBN(layer_name, in_units, out_units,
+                                    activation, *plain_weights,
+                                    *plain_biases, option_);
         }
-    }
+        return new Dense(layer_name, in_units, out_units, activation,
+                         *plain_weights, *plain_biases, option_);
+    });
 
-    float folding_value = 1, weight;
-    if (option.enable_optimize_activation && option.should_multiply_coeff &&
-        option.enable_optimize_pooling && option.should_multiply_pool)
-    {
-        folding_value =
-          option.highest_deg_coeff * option.current_pooling_mul_factor;
-        option.should_multiply_coeff = false;
-        option.should_multiply_pool = false;
-    }
-    else if (option.enable_optimize_activation && option.should_multiply_coeff)
-    {
-        folding_value = option.highest_deg_coeff;
-        option.should_multiply_coeff = false;
-    }
-    else if (option.enable_optimize_pooling && option.should_multiply_pool)
+    option_.consumed_level++;
+}
+
+/**
+ * Plan polynomial activation, which is monic when its highest degree
+ * coefficients are deferred to the next linear layer, and has coefficients
+ * of each channel when batch normalization is substituted into it
+ * Coefficients of terms evaluated by the schedule are encoded at their
+ * levels, and those smaller than EPSILON are rounded to EPSILON (which keeps
+ * the products of zero coefficients from being transparent).
+ */
+void ModelBuilder::planActivation(const GraphNode& node)
+{
+    const string layer_name = node.name;
+    const string activation = node.stringAttr("activation");
+
+    cout << "  Building " << layer_name << "..." << endl;
+
+    const PolynomialSchedule schedule = activationSchedule(node);
+    const size_t degree = schedule.degree();
+    const vector<float>& coeffs = node.params.at("coeffs");
+    const size_t channels = coeffs.size() / (degree + 1);
+    const vector<size_t> coeff_degrees = schedule.coeffDegrees();
+    const vector<size_t> coeff_levels = schedule.coeffLevels();
+    const size_t coeff_count = coeff_degrees.size();
+    const bool lazy_relinearization = node.lazy_relinearization;
+    cout << "    degree " << degree << (schedule.monic() ? " (monic)" : "")
+         << ", depth " << schedule.depth() << ", "
+         << schedule.multiplications() << " multiplications"
+         << (lazy_relinearization ? ", lazy relinearization" : "") << endl;
+
+    // scales of coefficients with which all terms are summed at the same
+    // scale
+    vector<double> primes;
+    for (size_t r = 0; r < schedule.depth(); ++r)
     {
-        folding_value = option.current_pooling_mul_factor;
-        option.should_multiply_pool = false;
+        primes.push_back(rescalePrime(option_.consumed_level + r));
     }
+    double out_scale;
+    const vector<double> coeff_scales = schedule.coeffScales(
+      primes, scale_, option_.scale_param, out_scale);
 
-#ifdef _OPENMP
-#pragma omp parallel for collapse(2) private(weight)
-#endif
-    for (size_t iu = 0; iu < next_layer_in_units; ++iu)
+    auto plain_poly_coeffs =
+      make_shared<vector<Plaintext>>(channels * coeff_count);
+    for (size_t c = 0; c < channels; ++c)
     {
-        for (size_t ou = 0; ou < out_units; ++ou)
+        const float* channel_coeffs = &coeffs[c * (degree + 1)];
+        for (size_t i = 0; i < coeff_count; ++i)
         {
-            weight = folding_value * weights[iu][ou] * weights_bn[ou];
-            if (fabs(weight) < EPSILON)
+            float coeff = channel_coeffs[degree - coeff_degrees[i]];
+            if (node.deferred)
             {
-                roundValue(weight);
+                coeff /= channel_coeffs[0];
             }
-            option.encoder.encode(weight, option.scale_param,
-                                  plain_weights[iu][ou]);
-            for (size_t lv = 0; lv < option.consumed_level; ++lv)
+            if (fabs(coeff) < EPSILON)
             {
-                option.evaluator.mod_switch_to_next_inplace(
-                  plain_weights[iu][ou]);
+                roundValue(coeff);
             }
+            addEncodeTask(coeff, option_.consumed_level + coeff_levels[i],
+                          coeff_scales[i],
+                          (*plain_poly_coeffs)[c * coeff_count + i]);
         }
     }
 
-    DenseFusedBN* dense_fused_bn =
-      new DenseFusedBN(layer_name, next_layer_in_units, out_units, activation,
-                       plain_weights, plain_biases, option);
+    layer_factories_.emplace_back([=]() {
+        return new Activation(layer_name, activation, schedule,
+                              *plain_poly_coeffs, channels,
+                              lazy_relinearization, option_);
+    });
+
+    option_.consumed_level += schedule.depth();
+    scale_ = out_scale;
+}
+
+void ModelBuilder::planGlobalAveragePooling2D(const GraphNode& node)
+{
+    const string layer_name = node.name;
+    const size_t in_height = node.in_shape[0];
+    const size_t in_width = node.in_shape[1];
+    const size_t in_channels = node.in_shape[2];
+    const size_t out_units = node.out_shape[0];
+
+    cout << "  Building " << layer_name << "..." << endl;
+
+    // the factor is multiplied by the layer itself as AveragePooling2D does
+    // unless it is deferred to the next linear layer
+    auto plain_mul_factor = make_shared<ScalarPlaintext>();
+    if (!node.deferred)
+    {
+        const double factor_scale = multiplierScale(option_.consumed_level);
+        addEncodeTask(node.scale, option_.consumed_level, factor_scale,
+                      *plain_mul_factor);
+        trackRescale(factor_scale, option_.consumed_level);
+    }
 
-    next_layer_in_units = out_units;
+    layer_factories_.emplace_back([=]() {
+        return new GlobalAveragePooling2D(layer_name, in_height, in_width,
+                                          in_channels, out_units,
+                                          *plain_mul_factor, option_);
+    });
 
-    return move((Layer*)dense_fused_bn);
+    if (!node.deferred)
+    {
+        option_.consumed_level++;
+    }
 }
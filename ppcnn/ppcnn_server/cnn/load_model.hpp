@@ -17,48 +17,131 @@
 
 #pragma once
 
+#include <functional>
+#include <map>
+#include <H5Cpp.h>
+
 #include "layer.hpp"
+#include "model_graph.hpp"
+#include "network.hpp"
 #include "picojson.h"
 
+using std::function;
+
 picojson::array loadLayers(const string& model_structure_path);
 
-Layer* buildLayer(picojson::object& layer, const string& layer_class_name,
-                  const string& model_weights_path, OptOption& option);
+/**
+ * Loader of model graph from trained model
+ *
+ * Layers are read with their trained parameters, and activations are resolved
+ * by the activation option. Loading does not depend on encryption parameters,
+ * so that levels of the model can be planned before keys are generated.
+ */
+class GraphLoader
+{
+public:
+    GraphLoader(const string& model_weights_path, const GraphOption& option);
+    ~GraphLoader();
+
+    ModelGraph load(const picojson::array& layers);
 
-Layer* buildLayer(picojson::object& layer, picojson::object& next_layer,
-                  const string& layer_class_name,
-                  const string& model_weight_path,
-                  picojson::array::const_iterator& layers_itrator,
-                  OptOption& option);
+private:
+    void loadParams(GraphNode& node);
+    void readParam(const string& layer_name, const string& key,
+                   vector<float>& dst, const size_t& size);
 
-Layer* buildConv2D(picojson::object& layer_info,
-                   const string& model_weights_path, OptOption& option);
+    H5::H5File param_file_;
+    const GraphOption& option_;
+};
 
-Layer* buildAveragePooling2D(picojson::object& layer_info,
-                             const string& model_weights_path,
-                             OptOption& option);
+/**
+ * Plan levels consumed by model under optimization and activation options
+ * The model graph is rewritten by the same graph passes as the builder, so
+ * that total levels are the minimal level of encryption parameters which the
+ * network is built with.
+ */
+LevelPlan planLevels(const string& model_structure_path,
+                     const string& model_weights_path,
+                     const GraphOption& option);
+
+/**
+ * Builder of network from trained model
+ *
+ * All state of building (consumed level and opened HDF5 file) is held by the
+ * object, so that several models can be built at once by different objects.
+ * Building is done in 4 passes.
+ *   1. read layers and trained parameters into model graph (by GraphLoader)
+ *   2. rewrite model graph by graph passes enabled by option
+ *   3. plan levels of all layers and encoding of their parameters
+ *      (levels consumed by each layer are checked against the static level
+ *      plan of the graph)
+ *   4. encode parameters of all layers in parallel
+ *      (weights multiplied to ciphertexts are encoded as ScalarPlaintext),
+ *      and construct layers
+ * Scale of ciphertexts is tracked through the layers as evaluator computes
+ * it, and each parameter is encoded at the scale which keeps ciphertexts at
+ * scale_param after rescaling by primes other than scale_param, instead of
+ * overwriting the scale of ciphertexts.
+ */
+class ModelBuilder
+{
+public:
+    ModelBuilder(const string& model_weights_path, OptOption& option);
+    ~ModelBuilder();
 
-Layer* buildBatchNormalization(picojson::object& layer_info,
-                               const string& model_weights_path,
-                               OptOption& option);
+    Network build(const picojson::array& layers);
 
-Layer* buildFlatten(picojson::object& layer_info,
-                    const string& model_weights_path, OptOption& option);
+    static bool isLayerClass(const string& class_name);
 
-Layer* buildDense(picojson::object& layer_info,
-                  const string& model_weights_path, OptOption& option);
+private:
+    struct EncodeTask
+    {
+        double value;
+        size_t level;
+        double scale;
+        Plaintext* plain;
+        ScalarPlaintext* scalar;
+    };
 
-Layer* buildActivation(picojson::object& layer_info,
-                       const string& model_weights_path, OptOption& option);
+    void planNode(const GraphNode& node);
+    void planConv2D(const GraphNode& node);
+    void planDepthwiseConv2D(const GraphNode& node);
+    void planSeparableConv2D(const GraphNode& node);
+    void planAveragePooling2D(const GraphNode& node);
+    void planBatchNormalization(const GraphNode& node);
+    void planFlatten(const GraphNode& node);
+    void planDense(const GraphNode& node);
+    void planActivation(const GraphNode& node);
+    void planGlobalAveragePooling2D(const GraphNode& node);
+    void planWinogradConv2D(const GraphNode& node, const size_t& tile);
 
-Layer* buildGlobalAveragePooling2D(picojson::object& layer_info,
-                                   const string& model_weights_path,
-                                   OptOption& option);
+    void checkLevel(const size_t& level) const;
+    double rescalePrime(const size_t& level) const;
+    double multiplierScale(const size_t& level) const;
+    void trackRescale(const double& multiplier_scale, const size_t& level);
+    void addEncodeTask(const double& value, const size_t& level,
+                       const double& scale, Plaintext& plain);
+    void addEncodeTask(const double& value, const size_t& level,
+                       const double& scale, ScalarPlaintext& scalar);
+    void addWeightEncodeTask(float weight, const size_t& level,
+                             const double& scale, ScalarPlaintext& scalar);
+    void reportDroppedWeights();
+    void encodeAll();
 
-Layer* buildConv2DFusedBN(picojson::object& conv2d_layer_info,
-                          picojson::object& bn_layer_info,
-                          const string& model_weights_path, OptOption& option);
+    static const std::map<const string,
+                          void (ModelBuilder::*)(const GraphNode&)>
+      PLAN_LAYER_MAP;
 
-Layer* buildDenseFusedBN(picojson::object& dense_layer_info,
-                         picojson::object& bn_layer_info,
-                         const string& model_weights_path, OptOption& option);
+    string model_weights_path_;
+    OptOption& option_;
+    // scale of ciphertexts at the consumed level
+    double scale_;
+    // weights of the current layer and of all layers, and those dropped by
+    // sparsity threshold
+    size_t weight_count_;
+    size_t dropped_weight_count_;
+    size_t total_weight_count_;
+    size_t total_dropped_weight_count_;
+    vector<EncodeTask> encode_tasks_;
+    vector<function<Layer*()>> layer_factories_;
+};
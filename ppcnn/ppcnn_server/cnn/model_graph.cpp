@@ -0,0 +1,321 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdexcept>
+
+#include "activation.hpp"
+#include "average_pooling2d.hpp"
+#include "batch_normalization.hpp"
+#include "conv2d.hpp"
+#include "conv2d_fused_bn.hpp"
+#include "dense.hpp"
+#include "dense_fused_bn.hpp"
+#include "depthwise_conv2d.hpp"
+#include "flatten.hpp"
+#include "global_average_pooling2d.hpp"
+#include "model_graph.hpp"
+#include "separable_conv2d.hpp"
+
+using std::move;
+using std::runtime_error;
+
+size_t elementCount(const vector<size_t>& shape)
+{
+    size_t count = 1;
+    for (const size_t& size : shape)
+    {
+        count *= size;
+    }
+    return count;
+}
+
+PolynomialSchedule activationSchedule(const GraphNode& node)
+{
+    const size_t degree = node.sizeAttr("polynomial_degree");
+    const vector<float>& coeffs = node.params.at("coeffs");
+    const size_t channels = coeffs.size() / (degree + 1);
+    vector<bool> nonzero_terms(degree + 1, false);
+    bool is_leading_one = true;
+    for (size_t c = 0; c < channels; ++c)
+    {
+        const float* channel_coeffs = &coeffs[c * (degree + 1)];
+        for (size_t k = 0; k <= degree; ++k)
+        {
+            if (channel_coeffs[degree - k] != 0)
+            {
+                nonzero_terms[k] = true;
+            }
+        }
+        is_leading_one = is_leading_one && channel_coeffs[0] == 1;
+    }
+    nonzero_terms[degree] = true;
+    return PolynomialSchedule(degree, nonzero_terms,
+                              degree >= 2 && (node.deferred || is_leading_one));
+}
+
+size_t GraphNode::sizeAttr(const string& key) const
+{
+    return config.at(key).get<double>();
+}
+
+size_t GraphNode::sizeAttr(const string& key, const size_t& index) const
+{
+    return config.at(key).get<picojson::array>()[index].get<double>();
+}
+
+string GraphNode::stringAttr(const string& key) const
+{
+    return config.at(key).get<string>();
+}
+
+/**
+ * Whether the layer multiplies its input by trained weights, so that
+ * constant factors of earlier layers can be folded into the weights
+ */
+bool GraphNode::isLinear() const
+{
+    return class_name == CONV2D_CLASS_NAME ||
+           class_name == CONV2D_FUSED_BN_CLASS_NAME ||
+           class_name == DEPTHWISE_CONV2D_CLASS_NAME ||
+           class_name == SEPARABLE_CONV2D_CLASS_NAME ||
+           class_name == DENSE_CLASS_NAME ||
+           class_name == DENSE_FUSED_BN_CLASS_NAME ||
+           class_name == BATCH_NORMALIZATION_CLASS_NAME;
+}
+
+size_t GraphCost::operations() const
+{
+    return multiplications + additions;
+}
+
+size_t relinearizationCost(const size_t& primes)
+{
+    return 4 * (primes + 1);
+}
+
+ModelGraph::ModelGraph()
+{
+}
+ModelGraph::~ModelGraph()
+{
+}
+
+/**
+ * Append layer taking output of the last layer
+ *
+ * @throws std::runtime_error if input shape of layer is unknown
+ */
+void ModelGraph::addNode(GraphNode node)
+{
+    if (node.in_shape.empty())
+    {
+        if (nodes_.empty())
+        {
+            throw runtime_error("Input shape of " + node.name +
+                                " is not given");
+        }
+        node.in_shape = nodes_.back().out_shape;
+    }
+    node.out_shape = outputShape(node);
+    nodes_.push_back(move(node));
+}
+
+vector<GraphNode>& ModelGraph::nodes()
+{
+    return nodes_;
+}
+
+const vector<GraphNode>& ModelGraph::nodes() const
+{
+    return nodes_;
+}
+
+GraphCost ModelGraph::cost() const
+{
+    GraphCost cost = {0, 0, 0, 0};
+    // whether output of the last activation is left without
+    // relinearization
+    bool is_lazy = false;
+    for (const GraphNode& node : nodes_)
+    {
+        const GraphCost node_cost = nodeCost(node);
+        cost.levels += node_cost.levels;
+        cost.multiplications += node_cost.multiplications;
+        cost.additions += node_cost.additions;
+        cost.relinearizations += node_cost.relinearizations;
+        if (node.class_name == ACTIVATION_CLASS_NAME &&
+            node.stringAttr("activation") != LINEAR_NAME)
+        {
+            if (is_lazy)
+            {
+                cost.relinearizations += elementCount(node.in_shape);
+            }
+            is_lazy = node.lazy_relinearization;
+        }
+    }
+    if (is_lazy && !nodes_.empty())
+    {
+        cost.relinearizations += elementCount(nodes_.back().out_shape);
+    }
+    return cost;
+}
+
+/**
+ * Plan levels of layers statically, in the order the builder consumes them
+ */
+LevelPlan ModelGraph::levelPlan() const
+{
+    LevelPlan plan = {0, {}};
+    for (const GraphNode& node : nodes_)
+    {
+        const size_t levels = nodeCost(node).levels;
+        plan.layers.push_back(
+          {node.name, node.class_name, plan.levels, levels});
+        plan.levels += levels;
+    }
+    return plan;
+}
+
+vector<size_t> ModelGraph::outputShape(const GraphNode& node)
+{
+    const vector<size_t>& in = node.in_shape;
+    const string& class_name = node.class_name;
+    if (class_name == CONV2D_CLASS_NAME ||
+        class_name == CONV2D_FUSED_BN_CLASS_NAME ||
+        class_name == DEPTHWISE_CONV2D_CLASS_NAME ||
+        class_name == SEPARABLE_CONV2D_CLASS_NAME ||
+        class_name == AVERAGE_POOLING2D_CLASS_NAME)
+    {
+        const string window_key = class_name == AVERAGE_POOLING2D_CLASS_NAME
+                                    ? "pool_size"
+                                    : "kernel_size";
+        const string padding = node.stringAttr("padding");
+        size_t out_channels = in[2];
+        if (class_name == DEPTHWISE_CONV2D_CLASS_NAME)
+        {
+            out_channels *= node.sizeAttr("depth_multiplier");
+        }
+        else if (class_name != AVERAGE_POOLING2D_CLASS_NAME)
+        {
+            out_channels = node.sizeAttr("filters");
+        }
+        return {Layer::outputSize(in[0], node.sizeAttr(window_key, 0),
+                                  node.sizeAttr("strides", 0), padding),
+                Layer::outputSize(in[1], node.sizeAttr(window_key, 1),
+                                  node.sizeAttr("strides", 1), padding),
+                out_channels};
+    }
+    if (class_name == GLOBAL_AVERAGE_POOLING2D_CLASS_NAME)
+    {
+        return {in[2]};
+    }
+    if (class_name == FLATTEN_CLASS_NAME)
+    {
+        size_t units = 1;
+        for (const size_t& size : in)
+        {
+            units *= size;
+        }
+        return {units};
+    }
+    if (class_name == DENSE_CLASS_NAME ||
+        class_name == DENSE_FUSED_BN_CLASS_NAME)
+    {
+        return {node.sizeAttr("units")};
+    }
+    return in;
+}
+
+/**
+ * Estimated cost of layer
+ * Linear layers add a product (or a bias) per multiplication.
+ */
+GraphCost ModelGraph::nodeCost(const GraphNode& node)
+{
+    const string& class_name = node.class_name;
+    const size_t out_elements = elementCount(node.out_shape);
+
+    size_t levels = 0;
+    size_t multiplications = 0;
+    size_t additions = 0;
+    size_t relinearizations = 0;
+    if (class_name == CONV2D_CLASS_NAME ||
+        class_name == CONV2D_FUSED_BN_CLASS_NAME)
+    {
+        levels = 1;
+        multiplications = out_elements * node.sizeAttr("kernel_size", 0) *
+                          node.sizeAttr("kernel_size", 1) * node.in_shape[2];
+        additions = multiplications;
+    }
+    else if (class_name == DEPTHWISE_CONV2D_CLASS_NAME)
+    {
+        levels = 1;
+        multiplications = out_elements * node.sizeAttr("kernel_size", 0) *
+                          node.sizeAttr("kernel_size", 1);
+        additions = multiplications;
+    }
+    else if (class_name == SEPARABLE_CONV2D_CLASS_NAME)
+    {
+        const size_t mid_channels =
+          node.in_shape[2] * node.sizeAttr("depth_multiplier");
+        const size_t pixels = out_elements / node.out_shape[2];
+        levels = 2;
+        multiplications = pixels * mid_channels *
+                          (node.sizeAttr("kernel_size", 0) *
+                             node.sizeAttr("kernel_size", 1) +
+                           node.out_shape[2]);
+        additions = multiplications;
+    }
+    else if (class_name == DENSE_CLASS_NAME ||
+             class_name == DENSE_FUSED_BN_CLASS_NAME)
+    {
+        levels = 1;
+        multiplications = node.in_shape[0] * out_elements;
+        additions = multiplications;
+    }
+    else if (class_name == BATCH_NORMALIZATION_CLASS_NAME)
+    {
+        levels = 1;
+        multiplications = out_elements;
+        additions = out_elements;
+    }
+    else if (class_name == AVERAGE_POOLING2D_CLASS_NAME ||
+             class_name == GLOBAL_AVERAGE_POOLING2D_CLASS_NAME)
+    {
+        const size_t window_size =
+          class_name == AVERAGE_POOLING2D_CLASS_NAME
+            ? node.sizeAttr("pool_size", 0) * node.sizeAttr("pool_size", 1)
+            : node.in_shape[0] * node.in_shape[1];
+        levels = node.deferred ? 0 : 1;
+        multiplications = node.deferred ? 0 : out_elements;
+        additions = out_elements * (window_size - 1);
+    }
+    else if (class_name == ACTIVATION_CLASS_NAME)
+    {
+        if (node.stringAttr("activation") != LINEAR_NAME)
+        {
+            const PolynomialSchedule schedule = activationSchedule(node);
+            levels = schedule.depth();
+            multiplications = out_elements * schedule.multiplications();
+            additions = out_elements * schedule.additions();
+            relinearizations =
+              out_elements * (schedule.relinearizations() -
+                              (node.lazy_relinearization ? 1 : 0));
+        }
+    }
+    return {levels, multiplications, additions, relinearizations};
+}
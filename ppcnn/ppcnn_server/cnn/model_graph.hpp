@@ -0,0 +1,147 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <map>
+
+#include "layer.hpp"
+#include "picojson.h"
+#include "polynomial.hpp"
+
+using std::map;
+
+const string DROPOUT_CLASS_NAME = "Dropout";
+const string INPUT_LAYER_CLASS_NAME = "InputLayer";
+
+/**
+ * Layer of model graph
+ *
+ * Trained parameters are held as read from the model file (or as rewritten
+ * by graph passes), and are encoded when the network is built.
+ */
+struct GraphNode
+{
+    size_t sizeAttr(const string& key) const;
+    size_t sizeAttr(const string& key, const size_t& index) const;
+    string stringAttr(const string& key) const;
+    bool isLinear() const;
+
+    string class_name;
+    string name;
+    picojson::object config;
+    // (height, width, channels) of images, or (units) after flatten
+    vector<size_t> in_shape;
+    vector<size_t> out_shape;
+    // trained parameters by key ("kernel", "depthwise_kernel",
+    // "pointwise_kernel" and "bias", "weight" and "bias" of batch
+    // normalization, or "coeffs" of activation, which are coefficients of
+    // the polynomial from the highest degree, for each channel when batch
+    // normalization is substituted into it)
+    map<string, vector<float>> params;
+    // constant factor of output (1 / pool area of pooling), which is
+    // multiplied by the layer itself unless it is deferred to the next linear
+    // layer (highest degree coefficients of activation are deferred instead
+    // when deferred is set)
+    double scale = 1.0;
+    bool deferred = false;
+    // output of activation is left without relinearization, and is
+    // relinearized by the next activation (or at the end of network)
+    bool lazy_relinearization = false;
+};
+
+/**
+ * Number of ciphertexts of tensor of the shape
+ */
+size_t elementCount(const vector<size_t>& shape);
+
+/**
+ * Schedule of evaluating polynomial activation of node ("polynomial_degree"
+ * of config and "coeffs" of params)
+ * The polynomial is monic when its highest degree coefficients are deferred
+ * to the next linear layer, or are all 1.
+ */
+PolynomialSchedule activationSchedule(const GraphNode& node);
+
+/**
+ * Estimated cost of evaluating layers on ciphertexts
+ * Multiplications count ciphertext-plaintext and ciphertext-ciphertext
+ * multiplications per packed ciphertext, and additions count additions of
+ * ciphertexts and plaintexts.
+ */
+struct GraphCost
+{
+    size_t operations() const;
+
+    size_t levels;
+    size_t multiplications;
+    size_t additions;
+    size_t relinearizations;
+};
+
+/**
+ * Estimated cost of relinearizing a ciphertext of given number of primes,
+ * in multiplications by plaintext
+ * Key switching transforms each prime to all primes and the special prime by
+ * NTT, which takes several multiplications each.
+ */
+size_t relinearizationCost(const size_t& primes);
+
+/**
+ * Levels consumed by layers of model graph
+ * Total levels are the multiplicative depth of the model, which is the number
+ * of intermediate primes the coefficient modulus needs (ciphertexts are kept
+ * at scale_param after every rescaling, so the primes are all of the same
+ * size).
+ */
+struct LevelPlan
+{
+    struct LayerLevels
+    {
+        string name;
+        string class_name;
+        // level of input, and levels consumed by the layer
+        size_t first_level;
+        size_t levels;
+    };
+
+    size_t levels;
+    vector<LayerLevels> layers;
+};
+
+/**
+ * Model as sequence of layers, rewritten by graph passes before the network
+ * is built
+ */
+class ModelGraph
+{
+public:
+    ModelGraph();
+    ~ModelGraph();
+
+    void addNode(GraphNode node);
+    vector<GraphNode>& nodes();
+    const vector<GraphNode>& nodes() const;
+    GraphCost cost() const;
+    LevelPlan levelPlan() const;
+
+    static vector<size_t> outputShape(const GraphNode& node);
+    static GraphCost nodeCost(const GraphNode& node);
+
+private:
+    vector<GraphNode> nodes_;
+};
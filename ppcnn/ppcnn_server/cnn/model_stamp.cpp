@@ -0,0 +1,68 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/stat.h>
+#include <stdexcept>
+#include <tuple>
+
+#include "model_stamp.hpp"
+
+using std::runtime_error;
+
+namespace
+{
+
+void stampFile(const string& path, std::uint64_t& size, std::int64_t& mtime)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+    {
+        throw runtime_error("Failed to stat model file (" + path + ")");
+    }
+    size = static_cast<std::uint64_t>(st.st_size);
+    mtime = static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+            st.st_mtim.tv_nsec;
+}
+
+} /* namespace */
+
+bool ModelStamp::operator<(const ModelStamp& other) const
+{
+    return std::tie(structure_size, structure_mtime, weights_size,
+                    weights_mtime) < std::tie(other.structure_size,
+                                              other.structure_mtime,
+                                              other.weights_size,
+                                              other.weights_mtime);
+}
+
+bool ModelStamp::operator==(const ModelStamp& other) const
+{
+    return std::tie(structure_size, structure_mtime, weights_size,
+                    weights_mtime) == std::tie(other.structure_size,
+                                               other.structure_mtime,
+                                               other.weights_size,
+                                               other.weights_mtime);
+}
+
+ModelStamp stampModel(const string& structure_path,
+                      const string& weights_path)
+{
+    ModelStamp stamp;
+    stampFile(structure_path, stamp.structure_size, stamp.structure_mtime);
+    stampFile(weights_path, stamp.weights_size, stamp.weights_mtime);
+    return stamp;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+using std::string;
+
+/**
+ * Sizes and modification times of files of a trained model
+ *
+ * The stamp identifies the model files a network is built from, so that
+ * networks (and their snapshots) of a model retrained or reconfigured under
+ * the same name are not used for the new one.
+ */
+struct ModelStamp
+{
+    std::uint64_t structure_size;
+    std::int64_t structure_mtime; // nanoseconds since epoch
+    std::uint64_t weights_size;
+    std::int64_t weights_mtime; // nanoseconds since epoch
+
+    bool operator<(const ModelStamp& other) const;
+    bool operator==(const ModelStamp& other) const;
+    bool operator!=(const ModelStamp& other) const
+    {
+        return !(*this == other);
+    }
+};
+
+/**
+ * Stamp files of a trained model
+ *
+ * @param structure_path: path of model structure (JSON)
+ * @param weights_path: path of model weights (HDF5)
+ * @return stamp of the files
+ * @throws std::runtime_error if fail to stat the files
+ */
+ModelStamp stampModel(const string& structure_path,
+                      const string& weights_path);
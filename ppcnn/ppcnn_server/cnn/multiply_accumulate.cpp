@@ -0,0 +1,701 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <omp.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define PPCNN_MAC_X86
+#endif
+
+#include <seal/util/uintarithsmallmod.h>
+
+#include "multiply_accumulate.hpp"
+
+using std::invalid_argument;
+using std::max;
+using std::min;
+using std::uint64_t;
+using std::vector;
+
+using uint128_t = unsigned __int128;
+
+namespace
+{
+
+// Kernel to compute dst[o][k] = sum_t src[t][k] * weights[t][o] mod modulus
+// for all outputs o, where row t of weights is weights + t * weight_stride
+using MacKernel = void (*)(const uint64_t* const* src, const uint64_t* weights,
+                           const size_t weight_stride, const size_t out_count,
+                           const size_t tap_count, const size_t coeff_begin,
+                           const size_t coeff_end,
+                           const seal::SmallModulus& modulus,
+                           uint64_t* const* dst);
+
+// Min number of taps of a part of split reduction
+constexpr size_t MIN_SPLIT_TAP_COUNT = 16;
+
+constexpr size_t DEFAULT_L2_CACHE_SIZE = 1024 * 1024;
+// Number of coefficients to which the coefficient block is aligned
+constexpr size_t COEFF_BLOCK_ALIGN = 8;
+
+size_t l2CacheSize()
+{
+    const long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    return size > 0 ? static_cast<size_t>(size) : DEFAULT_L2_CACHE_SIZE;
+}
+
+// Number of coefficients of each input and output processed at once, so that
+// the block of all taps stays in the half of L2 cache while it is multiplied
+// by all outputs
+size_t coeffBlockSize(const size_t& tap_count, const size_t& out_count,
+                      const size_t& coeff_count)
+{
+    static const size_t cache_size = l2CacheSize();
+    const size_t bytes_per_coeff =
+      (tap_count + out_count) * sizeof(uint64_t);
+    size_t block_size = cache_size / 2 / bytes_per_coeff;
+    block_size -= block_size % COEFF_BLOCK_ALIGN;
+    return min(max(block_size, COEFF_BLOCK_ALIGN), coeff_count);
+}
+
+// Max number of products accumulated into 128 bits without reduction, where
+// the accumulator is less than modulus after a reduction
+size_t lazyTapCount(const uint64_t modulus)
+{
+    const uint128_t max_product =
+      static_cast<uint128_t>(modulus - 1) * (modulus - 1);
+    if (max_product == 0)
+    {
+        return SIZE_MAX;
+    }
+    const uint128_t count = (~static_cast<uint128_t>(0) - modulus) / max_product;
+    return count > SIZE_MAX ? SIZE_MAX : static_cast<size_t>(count);
+}
+
+/**
+ * Reduce 128-bit accumulator modulo modulus
+ * Barrett reduction of SEAL is used instead of 128-bit division, which is a
+ * library call. (It is exact for all 128-bit inputs, since the quotient is
+ * underestimated by at most 1.)
+ */
+inline uint64_t reduce(const uint128_t& acc, const seal::SmallModulus& modulus)
+{
+    const uint64_t words[2] = {static_cast<uint64_t>(acc),
+                               static_cast<uint64_t>(acc >> 64)};
+    return seal::util::barrett_reduce_128(words, modulus);
+}
+
+/**
+ * Kernels process a block of OUTS outputs at once, so that each input
+ * coefficient is loaded once for the block.
+ */
+struct PortableKernel
+{
+    static constexpr size_t MAX_OUTS = 4;
+
+    template <size_t OUTS>
+    static void block(const uint64_t* const* src, const uint64_t* weights,
+                      const size_t weight_stride, const size_t tap_count,
+                      const size_t coeff_begin, const size_t coeff_end,
+                      const seal::SmallModulus& modulus, uint64_t* const* dst)
+    {
+        const size_t lazy_tap_count = lazyTapCount(modulus.value());
+        for (size_t k = coeff_begin; k < coeff_end; ++k)
+        {
+            uint128_t acc[OUTS] = {0};
+            size_t lazy_count = 0;
+            for (size_t t = 0; t < tap_count; ++t)
+            {
+                const uint128_t x = src[t][k];
+                const uint64_t* w = weights + t * weight_stride;
+                for (size_t b = 0; b < OUTS; ++b)
+                {
+                    acc[b] += x * w[b];
+                }
+                if (++lazy_count == lazy_tap_count)
+                {
+                    for (size_t b = 0; b < OUTS; ++b)
+                    {
+                        acc[b] = reduce(acc[b], modulus);
+                    }
+                    lazy_count = 0;
+                }
+            }
+            for (size_t b = 0; b < OUTS; ++b)
+            {
+                dst[b][k] = reduce(acc[b], modulus);
+            }
+        }
+    }
+};
+
+/**
+ * Run kernel K for all outputs in blocks of K::MAX_OUTS, and the rest in
+ * smaller blocks
+ */
+template <class K>
+void macBlocks(const uint64_t* const* src, const uint64_t* weights,
+               const size_t weight_stride, const size_t out_count,
+               const size_t tap_count, const size_t coeff_begin,
+               const size_t coeff_end, const seal::SmallModulus& modulus,
+               uint64_t* const* dst)
+{
+    size_t o = 0;
+    for (; o + K::MAX_OUTS <= out_count; o += K::MAX_OUTS)
+    {
+        K::template block<K::MAX_OUTS>(src, weights + o, weight_stride,
+                                       tap_count, coeff_begin, coeff_end,
+                                       modulus, dst + o);
+    }
+    if constexpr (K::MAX_OUTS > 4)
+    {
+        if (out_count - o >= 4)
+        {
+            K::template block<4>(src, weights + o, weight_stride, tap_count,
+                                 coeff_begin, coeff_end, modulus, dst + o);
+            o += 4;
+        }
+    }
+    if constexpr (K::MAX_OUTS > 2)
+    {
+        if (out_count - o >= 2)
+        {
+            K::template block<2>(src, weights + o, weight_stride, tap_count,
+                                 coeff_begin, coeff_end, modulus, dst + o);
+            o += 2;
+        }
+    }
+    if (out_count - o >= 1)
+    {
+        K::template block<1>(src, weights + o, weight_stride, tap_count,
+                             coeff_begin, coeff_end, modulus, dst + o);
+    }
+}
+
+#ifdef PPCNN_MAC_X86
+
+// The 32-bit kernels split each product of primes less than 2^32 into
+// lower and upper 32 bits, so that 2^32 products fit in 64-bit lanes.
+constexpr size_t LAZY_TAP_COUNT_32 = (static_cast<size_t>(1) << 32) - 1;
+// The IFMA kernel splits each product of primes less than 2^52 into lower
+// and upper 52 bits, so that 2^12 products fit in 64-bit lanes.
+constexpr size_t LAZY_TAP_COUNT_52 = static_cast<size_t>(1) << 12;
+
+struct Avx2Kernel
+{
+    static constexpr size_t MAX_OUTS = 4;
+
+    template <size_t OUTS>
+    __attribute__((target("avx2"))) static void block(
+      const uint64_t* const* src, const uint64_t* weights,
+      const size_t weight_stride, const size_t tap_count,
+      const size_t coeff_begin, const size_t coeff_end,
+      const seal::SmallModulus& modulus, uint64_t* const* dst)
+    {
+        constexpr size_t LANES = 4;
+        const __m256i mask32 = _mm256_set1_epi64x(0xFFFFFFFF);
+        alignas(32) uint64_t lo_lanes[LANES], hi_lanes[LANES];
+        size_t k = coeff_begin;
+        for (; k + LANES <= coeff_end; k += LANES)
+        {
+            uint128_t acc[OUTS][LANES] = {{0}};
+            for (size_t t0 = 0; t0 < tap_count; t0 += LAZY_TAP_COUNT_32)
+            {
+                const size_t t1 = min(tap_count, t0 + LAZY_TAP_COUNT_32);
+                __m256i lo[OUTS], hi[OUTS];
+                for (size_t b = 0; b < OUTS; ++b)
+                {
+                    lo[b] = _mm256_setzero_si256();
+                    hi[b] = _mm256_setzero_si256();
+                }
+                for (size_t t = t0; t < t1; ++t)
+                {
+                    const __m256i x = _mm256_loadu_si256(
+                      reinterpret_cast<const __m256i*>(src[t] + k));
+                    const uint64_t* w = weights + t * weight_stride;
+                    for (size_t b = 0; b < OUTS; ++b)
+                    {
+                        const __m256i p = _mm256_mul_epu32(
+                          x, _mm256_set1_epi64x(static_cast<long long>(w[b])));
+                        lo[b] =
+                          _mm256_add_epi64(lo[b], _mm256_and_si256(p, mask32));
+                        hi[b] = _mm256_add_epi64(hi[b], _mm256_srli_epi64(p, 32));
+                    }
+                }
+                for (size_t b = 0; b < OUTS; ++b)
+                {
+                    _mm256_store_si256(reinterpret_cast<__m256i*>(lo_lanes),
+                                       lo[b]);
+                    _mm256_store_si256(reinterpret_cast<__m256i*>(hi_lanes),
+                                       hi[b]);
+                    for (size_t l = 0; l < LANES; ++l)
+                    {
+                        acc[b][l] +=
+                          (static_cast<uint128_t>(hi_lanes[l]) << 32) +
+                          lo_lanes[l];
+                    }
+                }
+            }
+            for (size_t b = 0; b < OUTS; ++b)
+            {
+                for (size_t l = 0; l < LANES; ++l)
+                {
+                    dst[b][k + l] = reduce(acc[b][l], modulus);
+                }
+            }
+        }
+        PortableKernel::block<OUTS>(src, weights, weight_stride, tap_count, k,
+                                    coeff_end, modulus, dst);
+    }
+};
+
+struct Avx512Kernel
+{
+    static constexpr size_t MAX_OUTS = 8;
+
+    template <size_t OUTS>
+    __attribute__((target("avx512f"))) static void block(
+      const uint64_t* const* src, const uint64_t* weights,
+      const size_t weight_stride, const size_t tap_count,
+      const size_t coeff_begin, const size_t coeff_end,
+      const seal::SmallModulus& modulus, uint64_t* const* dst)
+    {
+        constexpr size_t LANES = 8;
+        const __m512i mask32 = _mm512_set1_epi64(0xFFFFFFFF);
+        alignas(64) uint64_t lo_lanes[LANES], hi_lanes[LANES];
+        size_t k = coeff_begin;
+        for (; k + LANES <= coeff_end; k += LANES)
+        {
+            uint128_t acc[OUTS][LANES] = {{0}};
+            for (size_t t0 = 0; t0 < tap_count; t0 += LAZY_TAP_COUNT_32)
+            {
+                const size_t t1 = min(tap_count, t0 + LAZY_TAP_COUNT_32);
+                __m512i lo[OUTS], hi[OUTS];
+                for (size_t b = 0; b < OUTS; ++b)
+                {
+                    lo[b] = _mm512_setzero_si512();
+                    hi[b] = _mm512_setzero_si512();
+                }
+                for (size_t t = t0; t < t1; ++t)
+                {
+                    const __m512i x = _mm512_loadu_si512(src[t] + k);
+                    const uint64_t* w = weights + t * weight_stride;
+                    for (size_t b = 0; b < OUTS; ++b)
+                    {
+                        const __m512i p = _mm512_mul_epu32(
+                          x, _mm512_set1_epi64(static_cast<long long>(w[b])));
+                        lo[b] =
+                          _mm512_add_epi64(lo[b], _mm512_and_si512(p, mask32));
+                        hi[b] = _mm512_add_epi64(hi[b], _mm512_srli_epi64(p, 32));
+                    }
+                }
+                for (size_t b = 0; b < OUTS; ++b)
+                {
+                    _mm512_store_si512(lo_lanes, lo[b]);
+                    _mm512_store_si512(hi_lanes, hi[b]);
+                    for (size_t l = 0; l < LANES; ++l)
+                    {
+                        acc[b][l] +=
+                          (static_cast<uint128_t>(hi_lanes[l]) << 32) +
+                          lo_lanes[l];
+                    }
+                }
+            }
+            for (size_t b = 0; b < OUTS; ++b)
+            {
+                for (size_t l = 0; l < LANES; ++l)
+                {
+                    dst[b][k + l] = reduce(acc[b][l], modulus);
+                }
+            }
+        }
+        PortableKernel::block<OUTS>(src, weights, weight_stride, tap_count, k,
+                                    coeff_end, modulus, dst);
+    }
+};
+
+struct Avx512IfmaKernel
+{
+    static constexpr size_t MAX_OUTS = 8;
+
+    template <size_t OUTS>
+    __attribute__((target("avx512f,avx512ifma"))) static void block(
+      const uint64_t* const* src, const uint64_t* weights,
+      const size_t weight_stride, const size_t tap_count,
+      const size_t coeff_begin, const size_t coeff_end,
+      const seal::SmallModulus& modulus, uint64_t* const* dst)
+    {
+        constexpr size_t LANES = 8;
+        alignas(64) uint64_t lo_lanes[LANES], hi_lanes[LANES];
+        size_t k = coeff_begin;
+        for (; k + LANES <= coeff_end; k += LANES)
+        {
+            uint128_t acc[OUTS][LANES] = {{0}};
+            for (size_t t0 = 0; t0 < tap_count; t0 += LAZY_TAP_COUNT_52)
+            {
+                const size_t t1 = min(tap_count, t0 + LAZY_TAP_COUNT_52);
+                __m512i lo[OUTS], hi[OUTS];
+                for (size_t b = 0; b < OUTS; ++b)
+                {
+                    lo[b] = _mm512_setzero_si512();
+                    hi[b] = _mm512_setzero_si512();
+                }
+                for (size_t t = t0; t < t1; ++t)
+                {
+                    const __m512i x = _mm512_loadu_si512(src[t] + k);
+                    const uint64_t* w = weights + t * weight_stride;
+                    for (size_t b = 0; b < OUTS; ++b)
+                    {
+                        const __m512i wb =
+                          _mm512_set1_epi64(static_cast<long long>(w[b]));
+                        lo[b] = _mm512_madd52lo_epu64(lo[b], x, wb);
+                        hi[b] = _mm512_madd52hi_epu64(hi[b], x, wb);
+                    }
+                }
+                for (size_t b = 0; b < OUTS; ++b)
+                {
+                    _mm512_store_si512(lo_lanes, lo[b]);
+                    _mm512_store_si512(hi_lanes, hi[b]);
+                    for (size_t l = 0; l < LANES; ++l)
+                    {
+                        acc[b][l] +=
+                          (static_cast<uint128_t>(hi_lanes[l]) << 52) +
+                          lo_lanes[l];
+                    }
+                }
+            }
+            for (size_t b = 0; b < OUTS; ++b)
+            {
+                for (size_t l = 0; l < LANES; ++l)
+                {
+                    dst[b][k + l] = reduce(acc[b][l], modulus);
+                }
+            }
+        }
+        PortableKernel::block<OUTS>(src, weights, weight_stride, tap_count, k,
+                                    coeff_end, modulus, dst);
+    }
+};
+
+struct CpuFeatures
+{
+    bool avx2;
+    bool avx512f;
+    bool avx512ifma;
+
+    CpuFeatures()
+    {
+        __builtin_cpu_init();
+        avx2 = __builtin_cpu_supports("avx2");
+        avx512f = __builtin_cpu_supports("avx512f");
+        avx512ifma = avx512f && __builtin_cpu_supports("avx512ifma");
+    }
+};
+
+#endif /* PPCNN_MAC_X86 */
+
+struct MacKernelEntry
+{
+    MacKernel kernel;
+    const char* name;
+};
+
+MacKernelEntry selectKernel(const uint64_t modulus)
+{
+#ifdef PPCNN_MAC_X86
+    static const CpuFeatures features;
+    if (modulus < (static_cast<uint64_t>(1) << 32))
+    {
+        if (features.avx512f)
+        {
+            return {macBlocks<Avx512Kernel>, "avx512"};
+        }
+        if (features.avx2)
+        {
+            return {macBlocks<Avx2Kernel>, "avx2"};
+        }
+    }
+    if (modulus < (static_cast<uint64_t>(1) << 52) && features.avx512ifma)
+    {
+        return {macBlocks<Avx512IfmaKernel>, "avx512ifma"};
+    }
+#endif
+    return {macBlocks<PortableKernel>, "portable"};
+}
+
+/**
+ * Compute sums of products of taps into destinations, where the coefficients
+ * of polynomial i of tap t at prime j begin at tap_data(t, i, j)
+ */
+template <typename TapData>
+void accumulate(const TapData& tap_data, const size_t& tap_count,
+                const vector<const ScalarPlaintext*>& scalars,
+                const vector<seal::Ciphertext*>& destinations,
+                const seal::parms_id_type& parms_id, const size_t& size,
+                const double& new_scale, const OptOption& option)
+{
+    const size_t out_count = destinations.size();
+    auto context_data = option.context->get_context_data(parms_id);
+    const auto& coeff_modulus = context_data->parms().coeff_modulus();
+    const size_t coeff_count = context_data->parms().poly_modulus_degree();
+    const size_t coeff_mod_count = coeff_modulus.size();
+    if (std::log2(new_scale) >= context_data->total_coeff_modulus_bit_count())
+    {
+        throw invalid_argument("scale out of bounds");
+    }
+
+    for (seal::Ciphertext* destination : destinations)
+    {
+        destination->resize(option.context, parms_id, size);
+        destination->is_ntt_form() = true;
+        destination->scale() = new_scale;
+    }
+
+    const size_t coeff_block_size =
+      coeffBlockSize(tap_count, out_count, coeff_count);
+    vector<const uint64_t*> src(tap_count);
+    vector<uint64_t*> dst(out_count);
+    // weights of limb transposed to [tap][output]
+    vector<uint64_t> weights(tap_count * out_count);
+    for (size_t j = 0; j < coeff_mod_count; ++j)
+    {
+        const seal::SmallModulus& modulus = coeff_modulus[j];
+        const MacKernel kernel = selectKernel(modulus.value()).kernel;
+        for (size_t o = 0; o < out_count; ++o)
+        {
+            for (size_t t = 0; t < tap_count; ++t)
+            {
+                weights[t * out_count + o] =
+                  scalars[o * tap_count + t]->data()[j];
+            }
+        }
+        for (size_t i = 0; i < size; ++i)
+        {
+            for (size_t t = 0; t < tap_count; ++t)
+            {
+                src[t] = tap_data(t, i, j, coeff_count);
+            }
+            for (size_t o = 0; o < out_count; ++o)
+            {
+                dst[o] = destinations[o]->data(i) + j * coeff_count;
+            }
+            // all outputs are computed for a block of coefficients while the
+            // block of inputs is in cache
+            for (size_t k = 0; k < coeff_count; k += coeff_block_size)
+            {
+                kernel(src.data(), weights.data(), out_count, out_count,
+                       tap_count, k, min(k + coeff_block_size, coeff_count),
+                       modulus, dst.data());
+            }
+        }
+    }
+}
+
+} /* namespace */
+
+void multiplyAccumulate(const vector<const seal::Ciphertext*>& encrypted,
+                        const vector<const ScalarPlaintext*>& scalars,
+                        const vector<seal::Ciphertext*>& destinations,
+                        const OptOption& option)
+{
+    const size_t tap_count = encrypted.size();
+    const size_t out_count = destinations.size();
+    if (tap_count == 0 || out_count == 0 ||
+        scalars.size() != tap_count * out_count)
+    {
+        throw invalid_argument("number of ciphertexts and scalars mismatch");
+    }
+    const seal::Ciphertext& front = *encrypted.front();
+    const double new_scale = front.scale() * scalars.front()->scale();
+    for (size_t t = 0; t < tap_count; ++t)
+    {
+        if (encrypted[t]->parms_id() != front.parms_id())
+        {
+            throw invalid_argument("encrypted parameter mismatch");
+        }
+        if (!encrypted[t]->is_ntt_form())
+        {
+            throw invalid_argument("encrypted must be in NTT form");
+        }
+        if (encrypted[t]->size() != front.size())
+        {
+            throw invalid_argument("encrypted size mismatch");
+        }
+        for (size_t o = 0; o < out_count; ++o)
+        {
+            const ScalarPlaintext& scalar = *scalars[o * tap_count + t];
+            if (scalar.parms_id() != front.parms_id())
+            {
+                throw invalid_argument(
+                  "encrypted and scalar parameter mismatch");
+            }
+            if (encrypted[t]->scale() * scalar.scale() != new_scale)
+            {
+                throw invalid_argument("scale mismatch");
+            }
+        }
+    }
+    accumulate(
+      [&](const size_t& t, const size_t& i, const size_t& j,
+          const size_t& coeff_count) {
+          return encrypted[t]->data(i) + j * coeff_count;
+      },
+      tap_count, scalars, destinations, front.parms_id(), front.size(),
+      new_scale, option);
+}
+
+void multiplyAccumulate(const CiphertextSlab& slab, const vector<size_t>& taps,
+                        const vector<const ScalarPlaintext*>& scalars,
+                        const vector<seal::Ciphertext*>& destinations,
+                        const OptOption& option)
+{
+    const size_t tap_count = taps.size();
+    const size_t out_count = destinations.size();
+    if (tap_count == 0 || out_count == 0 ||
+        scalars.size() != tap_count * out_count)
+    {
+        throw invalid_argument("number of taps and scalars mismatch");
+    }
+    const double new_scale = slab.scale() * scalars.front()->scale();
+    for (const size_t& tap : taps)
+    {
+        if (tap >= slab.count())
+        {
+            throw invalid_argument("tap out of slab");
+        }
+    }
+    for (const ScalarPlaintext* scalar : scalars)
+    {
+        if (scalar->parms_id() != slab.parms_id())
+        {
+            throw invalid_argument("encrypted and scalar parameter mismatch");
+        }
+        if (slab.scale() * scalar->scale() != new_scale)
+        {
+            throw invalid_argument("scale mismatch");
+        }
+    }
+    accumulate(
+      [&](const size_t& t, const size_t& i, const size_t& j, const size_t&) {
+          return slab.data(taps[t], i, j);
+      },
+      tap_count, scalars, destinations, slab.parms_id(), slab.size(),
+      new_scale, option);
+}
+
+void multiplyAccumulate(const vector<const seal::Ciphertext*>& encrypted,
+                        const vector<const ScalarPlaintext*>& scalars,
+                        seal::Ciphertext& destination, const OptOption& option)
+{
+    multiplyAccumulate(encrypted, scalars, vector<seal::Ciphertext*>{&destination},
+                       option);
+}
+
+void multiplyAccumulate(const CiphertextSlab& slab, const vector<size_t>& taps,
+                        const vector<const ScalarPlaintext*>& scalars,
+                        seal::Ciphertext& destination, const OptOption& option)
+{
+    multiplyAccumulate(slab, taps, scalars,
+                       vector<seal::Ciphertext*>{&destination}, option);
+}
+
+void setZero(const seal::parms_id_type& parms_id, const double& scale,
+             const size_t& size, const OptOption& option,
+             seal::Ciphertext& destination)
+{
+    destination.resize(option.context, parms_id, size);
+    std::fill(destination.data(),
+              destination.data() + destination.uint64_count(), 0);
+    destination.is_ntt_form() = true;
+    destination.scale() = scale;
+}
+
+double weightScale(const ScalarPlaintext* weights, const size_t& count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (weights[i].coeff_mod_count() > 0)
+        {
+            return weights[i].scale();
+        }
+    }
+    return 1.0;
+}
+
+size_t reductionSplitCount(const size_t& out_count, const size_t& tap_count)
+{
+#ifdef _OPENMP
+    const size_t thread_count = omp_get_max_threads();
+#else
+    const size_t thread_count = 1;
+#endif
+    if (out_count >= thread_count)
+    {
+        return 1;
+    }
+    const size_t split_count = (thread_count + out_count - 1) / out_count;
+    return max(min(split_count, tap_count / MIN_SPLIT_TAP_COUNT),
+               static_cast<size_t>(1));
+}
+
+void reducePartialSums(seal::Ciphertext* partial_sums,
+                       const size_t& split_count, const size_t& out_count,
+                       const OptOption& option)
+{
+    for (size_t stride = 1; stride < split_count; stride *= 2)
+    {
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2)
+#endif
+        for (size_t s = 0; s < split_count; s += 2 * stride)
+        {
+            for (size_t o = 0; o < out_count; ++o)
+            {
+                if (s + stride >= split_count)
+                {
+                    continue;
+                }
+                seal::Ciphertext& dst = partial_sums[s * out_count + o];
+                seal::Ciphertext& src =
+                  partial_sums[(s + stride) * out_count + o];
+                if (src.size() == 0)
+                {
+                    continue;
+                }
+                if (dst.size() == 0)
+                {
+                    dst = std::move(src);
+                }
+                else
+                {
+                    option.evaluator.add_inplace(dst, src);
+                }
+            }
+        }
+    }
+}
+
+const char* multiplyAccumulateKernelName(const uint64_t& modulus)
+{
+    return selectKernel(modulus).name;
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <seal/seal.h>
+
+#include <ppcnn_share/cnn_utils/opt_option.hpp>
+#include "ciphertext_slab.hpp"
+#include "scalar_plaintext.hpp"
+
+/**
+ * Compute sum of ciphertexts multiplied by encoded scalars
+ * Same as multiplyScalar and add_inplace for each term, but each coefficient
+ * of the sum is accumulated without modular reduction and reduced once.
+ * The kernel is selected at runtime from AVX-512 IFMA, AVX-512, AVX2 and
+ * portable versions by the CPU and the bit size of each prime.
+ *
+ * @param encrypted: ciphertexts in NTT form at the same level
+ * @param scalars: scalars encoded at the level of encrypted
+ * @param destination: sum of products (must not be one of encrypted)
+ * @param option: option holding the context
+ * @throws std::invalid_argument if no term is given, or levels, sizes or
+ * scales of the terms mismatch
+ */
+void multiplyAccumulate(const std::vector<const seal::Ciphertext*>& encrypted,
+                        const std::vector<const ScalarPlaintext*>& scalars,
+                        seal::Ciphertext& destination,
+                        const OptOption& option);
+
+/**
+ * Compute sums of the same ciphertexts multiplied by different scalars
+ * Each block of coefficients of the inputs is loaded to cache once and
+ * multiplied by the scalars of all outputs, instead of being loaded for each
+ * output. The size of the block is chosen from L2 cache size.
+ *
+ * @param encrypted: ciphertexts in NTT form at the same level
+ * @param scalars: scalars of output o and ciphertext t at
+ * [o * encrypted.size() + t]
+ * @param destinations: sums of products (must not be one of encrypted)
+ * @param option: option holding the context
+ * @throws std::invalid_argument if no term is given, or levels, sizes or
+ * scales of the terms mismatch
+ */
+void multiplyAccumulate(const std::vector<const seal::Ciphertext*>& encrypted,
+                        const std::vector<const ScalarPlaintext*>& scalars,
+                        const std::vector<seal::Ciphertext*>& destinations,
+                        const OptOption& option);
+
+/**
+ * Compute sums of ciphertexts of slab multiplied by different scalars
+ * Same as multiplyAccumulate of ciphertexts, but limbs of taps are read from
+ * the slab.
+ *
+ * @param slab: slab of ciphertexts
+ * @param taps: indices of ciphertexts in slab
+ * @param scalars: scalars of output o and tap t at [o * taps.size() + t]
+ * @param destinations: sums of products
+ * @param option: option holding the context
+ * @throws std::invalid_argument if no tap is given, or tap is out of slab,
+ * or levels or scales of scalars mismatch
+ */
+void multiplyAccumulate(const CiphertextSlab& slab,
+                        const std::vector<size_t>& taps,
+                        const std::vector<const ScalarPlaintext*>& scalars,
+                        const std::vector<seal::Ciphertext*>& destinations,
+                        const OptOption& option);
+void multiplyAccumulate(const CiphertextSlab& slab,
+                        const std::vector<size_t>& taps,
+                        const std::vector<const ScalarPlaintext*>& scalars,
+                        seal::Ciphertext& destination,
+                        const OptOption& option);
+
+/**
+ * Set ciphertext to zero without encryption
+ * Used for outputs all of whose weights are dropped.
+ *
+ * @param parms_id: parms_id of the level
+ * @param scale: scale
+ * @param size: number of polynomials (3 for ciphertext left without
+ * relinearization)
+ * @param option: option holding the context
+ * @param destination: zero ciphertext in NTT form
+ */
+void setZero(const seal::parms_id_type& parms_id, const double& scale,
+             const size_t& size, const OptOption& option,
+             seal::Ciphertext& destination);
+
+/**
+ * Scale of weights of layer, which are all encoded at the same scale (1 if
+ * all weights are dropped)
+ *
+ * @param weights: encoded weights
+ * @param count: number of weights
+ */
+double weightScale(const ScalarPlaintext* weights, const size_t& count);
+
+/**
+ * Number of parts to split the taps of each output into
+ * Outputs are computed in parallel when there are as many outputs as
+ * threads. Otherwise the taps of each output are split so that all threads
+ * compute partial sums, while each part keeps enough taps to amortize the
+ * additions of the partial sums.
+ *
+ * @param out_count: number of outputs computed in parallel
+ * @param tap_count: number of taps of each output
+ * @return number of parts (1 if outputs are computed in parallel)
+ */
+size_t reductionSplitCount(const size_t& out_count, const size_t& tap_count);
+
+/**
+ * Sum partial sums of outputs by parallel tree reduction
+ *
+ * @param partial_sums: partial sum of part s of output o at
+ * [s * out_count + o], where the sum is stored at [o] (an empty ciphertext is
+ * an empty partial sum)
+ * @param split_count: number of parts
+ * @param out_count: number of outputs
+ * @param option: option holding the evaluator
+ */
+void reducePartialSums(seal::Ciphertext* partial_sums,
+                       const size_t& split_count, const size_t& out_count,
+                       const OptOption& option);
+
+/**
+ * Name of the kernel used for prime
+ *
+ * @param modulus: prime
+ * @return kernel name
+ */
+const char* multiplyAccumulateKernelName(const std::uint64_t& modulus);
@@ -16,8 +16,11 @@
  */
 
 #include "network.hpp"
+#include "activation.hpp"
 #include "flatten.hpp"
 #include "global_average_pooling2d.hpp"
+#include "tensor_arena.hpp"
+#include "tiled_segment.hpp"
 
 using std::cout;
 using std::dynamic_pointer_cast;
@@ -45,43 +48,111 @@ void Network::printStructure() const noexcept
          << endl;
 }
 
+/**
+ * Total size of the encoded weights held by the layers
+ *
+ * @return size in bytes
+ */
+size_t Network::weightBytes() const noexcept
+{
+    size_t bytes = 0;
+    for (const shared_ptr<Layer>& layer : layers_)
+    {
+        bytes += layer->weightBytes();
+    }
+    return bytes;
+}
+
 /**
  * Predict label from encrypted image
  *
- * @param input_image: 3D encrypted image
+ * @param arena: arena holding 3D encrypted image as its tensor, whose buffers
+ * hold outputs of layers
+ * @param relin_keys: relinearization keys of the client
+ * @param option: option holding evaluator relinearizing output left without
+ * relinearization by the last activation
+ * @param tile_size: height and width of output tiles by which chains of
+ * Conv2D and the following layers are forwarded (0 forwards whole feature
+ * maps, and nothing is spilled under memory budget of the arena)
  * @return result of prediction (encrypted)
  * @throws InvalidDowncastException if fail to conversion from Layer to Flatten
+ * @throws std::runtime_error if feature map read by a layer which is not tiled
+ * does not fit in memory budget of the arena
  */
-vector<Ciphertext> Network::predict(Ciphertext3D& encrypted_3d) const
+vector<Ciphertext> Network::predict(TensorArena& arena,
+                                    const seal::RelinKeys& relin_keys,
+                                    const OptOption& option,
+                                    const size_t& tile_size) const
   noexcept(false)
 {
-    vector<Ciphertext> encrypted_units;
     size_t input_dim = 3;
 
-    for (const shared_ptr<Layer>& layer : layers_)
+    for (size_t i = 0; i < layers_.size(); ++i)
     {
+        const shared_ptr<Layer>& layer = layers_[i];
+        const size_t segment_length =
+          tile_size > 0 && input_dim == 3 ? TiledSegment::length(layers_, i)
+                                          : 0;
+        if (segment_length > 1)
+        {
+            TiledSegment segment(
+              vector<shared_ptr<Layer>>(layers_.begin() + i,
+                                        layers_.begin() + i + segment_length),
+              tile_size);
+            // output is spilled only if the next segment reads it by tiles
+            const bool spillable =
+              TiledSegment::length(layers_, i + segment_length) > 1;
+            segment.forward(arena, relin_keys, option, spillable);
+            i += segment_length - 1;
+            continue;
+        }
         switch (layer->layer_class())
         {
             case CONV2D:
+            case DEPTHWISE_CONV2D:
+            case SEPARABLE_CONV2D:
+            case WINOGRAD_CONV2D:
             case AVERAGE_POOLING2D:
-                layer->forward(encrypted_3d);
+            case DENSE:
+                layer->forward(arena);
                 break;
             case ACTIVATION:
+                if (shared_ptr<Activation> activation_layer =
+                      dynamic_pointer_cast<Activation>(layer))
+                {
+                    if (input_dim == 1)
+                    {
+                        activation_layer->forward(arena.units(), relin_keys);
+                    }
+                    else
+                    {
+                        activation_layer->forward(arena.tensor(), relin_keys);
+                    }
+                }
+                else
+                {
+                    throw InvalidDowncastException(
+                      "Failed to downcast from Layer to Activation "
+                      "(layer_name: " +
+                      layer->name() + ")");
+                }
+                break;
             case BATCH_NORMALIZATION:
                 if (input_dim == 1)
                 {
-                    layer->forward(encrypted_units);
+                    layer->forward(arena.units());
                 }
                 else
                 {
-                    layer->forward(encrypted_3d);
+                    layer->forward(arena.tensor());
                 }
                 break;
             case FLATTEN:
                 if (shared_ptr<Flatten> flatten_layer =
                       dynamic_pointer_cast<Flatten>(layer))
                 {
-                    encrypted_units = flatten_layer->flatten(encrypted_3d);
+                    arena.units() = flatten_layer->flatten(arena.tensor());
+                    arena.releaseTensors();
                     input_dim = 1;
                 }
                 else
@@ -96,8 +167,9 @@ vector<Ciphertext> Network::predict(Ciphertext3D& encrypted_3d) const
                       global_average_pooling2d_layer =
                         dynamic_pointer_cast<GlobalAveragePooling2D>(layer))
                 {
-                    encrypted_units =
-                      global_average_pooling2d_layer->flatten(encrypted_3d);
+                    arena.units() =
+                      global_average_pooling2d_layer->flatten(arena.tensor());
+                    arena.releaseTensors();
                     input_dim = 1;
                 }
                 else
@@ -108,11 +180,22 @@ vector<Ciphertext> Network::predict(Ciphertext3D& encrypted_3d) const
                       global_average_pooling2d_layer->name() + ")");
                 }
                 break;
-            case DENSE:
-                layer->forward(encrypted_units);
-                break;
         }
     }
 
-    return encrypted_units;
+    // output of the last activation may be left without relinearization
+    vector<Ciphertext>& encrypted_units = arena.units();
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (size_t i = 0; i < encrypted_units.size(); ++i)
+    {
+        if (encrypted_units[i].size() > 2)
+        {
+            option.evaluator.relinearize_inplace(encrypted_units[i],
+                                                 relin_keys, option.pool());
+        }
+    }
+
+    return std::move(encrypted_units);
 }
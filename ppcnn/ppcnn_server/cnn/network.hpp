@@ -44,7 +44,12 @@ public:
         layers_.push_back(shared_ptr<Layer>(layer));
     }
     void printStructure() const noexcept;
-    vector<Ciphertext> predict(Ciphertext3D& input_3d) const noexcept(false);
+    size_t weightBytes() const noexcept;
+    vector<Ciphertext> predict(TensorArena& arena,
+                               const seal::RelinKeys& relin_keys,
+                               const OptOption& option,
+                               const size_t& tile_size = 0) const
+      noexcept(false);
 
 private:
     vector<shared_ptr<Layer>> layers_;
@@ -0,0 +1,460 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+
+#include "polynomial.hpp"
+
+using seal::Ciphertext;
+using seal::Plaintext;
+using std::invalid_argument;
+using std::max;
+using std::move;
+
+/**
+ * Largest power of 2 below k (k >= 2), which x^k is split at
+ */
+size_t splitPower(const size_t& k)
+{
+    return size_t(1) << (PolynomialSchedule::powerDepth(k) - 1);
+}
+
+/**
+ * Mark x^k and the powers it is computed from as computed
+ *
+ * @return number of powers newly computed
+ */
+size_t addPower(const size_t& k, vector<bool>& computed)
+{
+    if (computed[k])
+    {
+        return 0;
+    }
+    computed[k] = true;
+    const size_t h = splitPower(k);
+    return 1 + addPower(h, computed) + addPower(k - h, computed);
+}
+
+PolynomialSchedule::PolynomialSchedule(const size_t& degree,
+                                       const vector<bool>& nonzero_terms,
+                                       const bool& monic)
+  : degree_(degree), monic_(monic), depth_(0), nonzero_terms_(nonzero_terms)
+{
+    if (degree_ == 0 || nonzero_terms_.size() != degree_ + 1 ||
+        !nonzero_terms_[degree_])
+    {
+        throw invalid_argument("Invalid terms of polynomial of degree " +
+                               std::to_string(degree_));
+    }
+    if (monic_ && degree_ < 2)
+    {
+        throw invalid_argument("Monic polynomial must be of degree 2 or more");
+    }
+
+    // depth of each term multiplied by its coefficient directly or after
+    // split, and that of the whole polynomial
+    for (size_t k = 1; k <= degree_; ++k)
+    {
+        if (!nonzero_terms_[k])
+        {
+            continue;
+        }
+        size_t term_depth = powerDepth(k) + 1;
+        if (k == degree_ && monic_)
+        {
+            term_depth = powerDepth(k);
+        }
+        for (size_t a = 1; a < k; ++a)
+        {
+            term_depth = std::min(
+              term_depth, max(powerDepth(a) + 1, powerDepth(k - a)) + 1);
+        }
+        depth_ = max(depth_, term_depth);
+    }
+
+    // Terms from the highest degree take the way of computing them with the
+    // fewest operations within the depth, which is multiplying the
+    // coefficient to x^k or to x^a (then multiplied by x^(k - a) without
+    // relinearization). Computing a power takes a multiplication and a
+    // relinearization.
+    vector<bool> computed(degree_ + 1, false);
+    computed[1] = true;
+    for (size_t k = degree_; k >= 1; --k)
+    {
+        if (!nonzero_terms_[k])
+        {
+            continue;
+        }
+        if (k == degree_ && monic_)
+        {
+            const size_t low = splitPower(k);
+            addPower(low, computed);
+            addPower(k - low, computed);
+            terms_.push_back({k, low, false});
+            continue;
+        }
+        size_t best_low = 0;
+        size_t best_cost = SIZE_MAX;
+        if (powerDepth(k) + 1 <= depth_)
+        {
+            vector<bool> tmp = computed;
+            best_cost = 2 * addPower(k, tmp);
+        }
+        for (size_t a = 1; a < k; ++a)
+        {
+            if (max(powerDepth(a) + 1, powerDepth(k - a)) + 1 > depth_)
+            {
+                continue;
+            }
+            vector<bool> tmp = computed;
+            const size_t cost =
+              2 * (addPower(a, tmp) + addPower(k - a, tmp)) + 1;
+            if (cost < best_cost)
+            {
+                best_low = a;
+                best_cost = cost;
+            }
+        }
+        if (best_low == 0)
+        {
+            addPower(k, computed);
+        }
+        else
+        {
+            addPower(best_low, computed);
+            addPower(k - best_low, computed);
+        }
+        terms_.push_back({k, best_low, true});
+    }
+    for (size_t k = 2; k <= degree_; ++k)
+    {
+        if (computed[k])
+        {
+            powers_.push_back(k);
+        }
+    }
+}
+PolynomialSchedule::~PolynomialSchedule()
+{
+}
+
+size_t PolynomialSchedule::degree() const
+{
+    return degree_;
+}
+
+bool PolynomialSchedule::monic() const
+{
+    return monic_;
+}
+
+size_t PolynomialSchedule::depth() const
+{
+    return depth_;
+}
+
+const vector<bool>& PolynomialSchedule::nonzeroTerms() const
+{
+    return nonzero_terms_;
+}
+
+const vector<size_t>& PolynomialSchedule::powers() const
+{
+    return powers_;
+}
+
+const vector<PolynomialTerm>& PolynomialSchedule::terms() const
+{
+    return terms_;
+}
+
+bool PolynomialSchedule::hasConstant() const
+{
+    return nonzero_terms_[0];
+}
+
+size_t PolynomialSchedule::coeffCount() const
+{
+    size_t count = hasConstant() ? 1 : 0;
+    for (const PolynomialTerm& term : terms_)
+    {
+        count += term.has_coeff ? 1 : 0;
+    }
+    return count;
+}
+
+vector<size_t> PolynomialSchedule::coeffDegrees() const
+{
+    vector<size_t> degrees;
+    for (const PolynomialTerm& term : terms_)
+    {
+        if (term.has_coeff)
+        {
+            degrees.push_back(term.degree);
+        }
+    }
+    if (hasConstant())
+    {
+        degrees.push_back(0);
+    }
+    return degrees;
+}
+
+vector<size_t> PolynomialSchedule::coeffLevels() const
+{
+    vector<size_t> levels;
+    for (const PolynomialTerm& term : terms_)
+    {
+        if (term.has_coeff)
+        {
+            levels.push_back(term.low == 0 ? depth_ - 1
+                                           : powerDepth(term.low));
+        }
+    }
+    if (hasConstant())
+    {
+        levels.push_back(depth_);
+    }
+    return levels;
+}
+
+vector<double> PolynomialSchedule::coeffScales(const vector<double>& primes,
+                                               const double& in_scale,
+                                               const double& target_scale,
+                                               double& out_scale) const
+{
+    if (primes.size() < depth_)
+    {
+        throw invalid_argument("Primes fewer than depth of polynomial");
+    }
+    vector<double> power_scales(degree_ + 1);
+    power_scales[1] = in_scale;
+    for (const size_t k : powers_)
+    {
+        const size_t h = splitPower(k);
+        power_scales[k] =
+          power_scales[h] * power_scales[k - h] / primes[powerDepth(k) - 1];
+    }
+
+    // scale of terms before rescaling
+    const PolynomialTerm& front = terms_.front();
+    const double product_scale =
+      front.has_coeff
+        ? target_scale * primes[depth_ - 1]
+        : power_scales[front.low] * power_scales[front.degree - front.low];
+    vector<double> scales;
+    double sum_scale = 0;
+    for (const PolynomialTerm& term : terms_)
+    {
+        double term_scale;
+        if (term.low == 0)
+        {
+            const double coeff_scale = product_scale / power_scales[term.degree];
+            scales.push_back(coeff_scale);
+            term_scale = power_scales[term.degree] * coeff_scale;
+        }
+        else
+        {
+            const double high_scale = power_scales[term.degree - term.low];
+            double low_scale = power_scales[term.low];
+            if (term.has_coeff)
+            {
+                const double prime = primes[powerDepth(term.low)];
+                const double coeff_scale =
+                  product_scale * prime / (low_scale * high_scale);
+                scales.push_back(coeff_scale);
+                low_scale = low_scale * coeff_scale / prime;
+            }
+            term_scale = low_scale * high_scale;
+        }
+        if (sum_scale == 0)
+        {
+            sum_scale = term_scale;
+        }
+    }
+    out_scale = sum_scale / primes[depth_ - 1];
+    if (hasConstant())
+    {
+        scales.push_back(out_scale);
+    }
+    return scales;
+}
+
+size_t PolynomialSchedule::multiplications() const
+{
+    size_t count = powers_.size();
+    for (const PolynomialTerm& term : terms_)
+    {
+        count += term.low > 0 && term.has_coeff ? 2 : 1;
+    }
+    return count;
+}
+
+size_t PolynomialSchedule::additions() const
+{
+    return terms_.size() - 1 + (hasConstant() ? 1 : 0);
+}
+
+size_t PolynomialSchedule::relinearizations() const
+{
+    return powers_.size() + (relinearizesSum() ? 1 : 0);
+}
+
+bool PolynomialSchedule::relinearizesSum() const
+{
+    for (const PolynomialTerm& term : terms_)
+    {
+        if (term.low > 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t PolynomialSchedule::powerDepth(const size_t& k)
+{
+    size_t depth = 0;
+    while ((size_t(1) << depth) < k)
+    {
+        ++depth;
+    }
+    return depth;
+}
+
+/**
+ * Index of level of ciphertext in option
+ *
+ * @throws std::invalid_argument if ciphertext is not at any level of option
+ */
+size_t levelIndex(const Ciphertext& encrypted, const OptOption& option)
+{
+    const auto& ids = option.level_parms_ids;
+    const auto it = std::find(ids.begin(), ids.end(), encrypted.parms_id());
+    if (it == ids.end())
+    {
+        throw invalid_argument("Ciphertext is not at any level of option");
+    }
+    return it - ids.begin();
+}
+
+/**
+ * Set scale of term to that of the sum, which differs only by rounding of
+ * the scales planned by coeffScales
+ *
+ * @throws std::invalid_argument if the scales differ more than rounding
+ */
+void alignScale(Ciphertext& term, const double& scale)
+{
+    if (std::fabs(term.scale() - scale) > scale * 1e-12)
+    {
+        throw invalid_argument("Scales of terms of polynomial mismatch");
+    }
+    term.scale() = scale;
+}
+
+seal::Ciphertext evaluatePolynomial(seal::Ciphertext& x,
+                                    const PolynomialSchedule& schedule,
+                                    const seal::Plaintext* coeffs,
+                                    const seal::RelinKeys& relin_keys,
+                                    const bool& relinearize_sum,
+                                    OptOption& option)
+{
+    if (x.size() > 2)
+    {
+        option.evaluator.relinearize_inplace(x, relin_keys, option.pool());
+    }
+    const size_t base = levelIndex(x, option);
+    const seal::parms_id_type& product_parms_id =
+      option.level_parms_ids[base + schedule.depth() - 1];
+
+    /* Assume that input level is l */
+    // Calculate x^k (Level: l-ceil(log2 k))
+    vector<Ciphertext> powers(schedule.degree() + 1);
+    powers[1] = move(x);
+    Ciphertext operand;
+    for (const size_t k : schedule.powers())
+    {
+        const size_t h = splitPower(k);
+        option.evaluator.mod_switch_to(powers[k - h], powers[h].parms_id(),
+                                       operand, option.pool());
+        option.evaluator.multiply(powers[h], operand, powers[k], option.pool());
+        option.evaluator.relinearize_inplace(powers[k], relin_keys,
+                                             option.pool());
+        option.evaluator.rescale_to_next_inplace(powers[k], option.pool());
+    }
+
+    // Calculate each term (Level: l-depth+1) and their sum without
+    // relinearization (powers are left at their levels, since the same
+    // power may be used at another level by other term)
+    Ciphertext y, term, low;
+    for (const PolynomialTerm& t : schedule.terms())
+    {
+        if (t.low == 0)
+        {
+            option.evaluator.mod_switch_to(powers[t.degree], product_parms_id,
+                                           operand, option.pool());
+            option.evaluator.multiply_plain(operand, *coeffs++, term,
+                                            option.pool());
+        }
+        else
+        {
+            if (t.has_coeff)
+            {
+                // Calculate c * x^a (Level: l-ceil(log2 a)-1)
+                option.evaluator.multiply_plain(powers[t.low], *coeffs++, low,
+                                                option.pool());
+                option.evaluator.rescale_to_next_inplace(low, option.pool());
+                option.evaluator.mod_switch_to_inplace(low, product_parms_id,
+                                                       option.pool());
+            }
+            else
+            {
+                option.evaluator.mod_switch_to(powers[t.low], product_parms_id,
+                                               low, option.pool());
+            }
+            option.evaluator.mod_switch_to(powers[t.degree - t.low],
+                                           product_parms_id, operand,
+                                           option.pool());
+            option.evaluator.multiply(low, operand, term, option.pool());
+        }
+        if (y.size() == 0)
+        {
+            y = move(term);
+        }
+        else
+        {
+            alignScale(term, y.scale());
+            option.evaluator.add_inplace(y, term);
+        }
+    }
+    if (relinearize_sum && schedule.relinearizesSum())
+    {
+        option.evaluator.relinearize_inplace(y, relin_keys, option.pool());
+    }
+    // (Level: l-depth)
+    option.evaluator.rescale_to_next_inplace(y, option.pool());
+    if (schedule.hasConstant())
+    {
+        option.evaluator.add_plain_inplace(y, *coeffs);
+    }
+
+    return y;
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <seal/seal.h>
+
+#include <ppcnn_share/cnn_utils/opt_option.hpp>
+
+using std::size_t;
+using std::vector;
+
+/**
+ * Term of polynomial evaluated by PolynomialSchedule
+ * Coefficient is multiplied to x^degree (plain term), or to x^low which is
+ * multiplied by x^(degree - low) afterwards (split term). Highest degree
+ * term of monic polynomial has no coefficient and is x^low * x^(degree -
+ * low).
+ */
+struct PolynomialTerm
+{
+    size_t degree;
+    // 0 for plain term
+    size_t low;
+    bool has_coeff;
+};
+
+/**
+ * Schedule of evaluating polynomial of ciphertext with the minimum depth
+ *
+ * Powers x^k are computed by squaring (x^k = x^h * x^(k - h) with h the
+ * largest power of 2 below k), so x^k is at depth ceil(log2 k). Coefficient
+ * of each term is multiplied to x^k, or to lower x^a before it is multiplied
+ * by x^(k - a) if that keeps the depth of the term. All terms are multiplied
+ * at the same level and summed before a single relinearization and
+ * rescaling, and the constant term is added at last.
+ *
+ * Coefficients are given in the order of terms() followed by the constant
+ * term (if any), each encoded at the level of coeffLevels() relative to the
+ * input.
+ */
+class PolynomialSchedule
+{
+public:
+    /**
+     * @param degree: degree of polynomial (at least 1)
+     * @param nonzero_terms: whether the coefficient of x^k is not zero, for
+     * k = 0 to degree
+     * @param monic: whether the highest degree coefficient is 1 (degree must
+     * be at least 2), which is not multiplied
+     * @throws std::invalid_argument if degree or nonzero_terms is invalid
+     */
+    PolynomialSchedule(const size_t& degree,
+                       const vector<bool>& nonzero_terms, const bool& monic);
+    ~PolynomialSchedule();
+
+    size_t degree() const;
+    bool monic() const;
+    // levels consumed by evaluation
+    size_t depth() const;
+    const vector<bool>& nonzeroTerms() const;
+    // powers x^k (k >= 2) computed from x, in ascending order
+    const vector<size_t>& powers() const;
+    const vector<PolynomialTerm>& terms() const;
+    bool hasConstant() const;
+
+    // coefficients per polynomial, and their degrees and levels
+    size_t coeffCount() const;
+    vector<size_t> coeffDegrees() const;
+    vector<size_t> coeffLevels() const;
+
+    /**
+     * Scales of coefficients with which all terms are at the same scale,
+     * computed in the same way as evaluator computes scales of ciphertexts
+     *
+     * @param primes: primes dropped by rescaling at each of depth() levels
+     * from the input
+     * @param in_scale: scale of input
+     * @param target_scale: scale of output (unless monic, whose highest
+     * degree term decides the scale)
+     * @param out_scale: scale of output (output)
+     * @return scales of coefficients in the order of coeffDegrees()
+     */
+    vector<double> coeffScales(const vector<double>& primes,
+                               const double& in_scale,
+                               const double& target_scale,
+                               double& out_scale) const;
+
+    // operations per ciphertext
+    size_t multiplications() const;
+    size_t additions() const;
+    size_t relinearizations() const;
+    // whether the sum of terms has ciphertext products to be relinearized
+    bool relinearizesSum() const;
+
+    /**
+     * Depth of x^k computed by squaring (ceil(log2 k))
+     */
+    static size_t powerDepth(const size_t& k);
+
+private:
+    size_t degree_;
+    bool monic_;
+    size_t depth_;
+    vector<bool> nonzero_terms_;
+    vector<size_t> powers_;
+    vector<PolynomialTerm> terms_;
+};
+
+/**
+ * Evaluate polynomial of ciphertext by schedule
+ *
+ * @param x: input ciphertext at one of the levels of option (moved out),
+ * which is relinearized first if it was left without relinearization
+ * @param schedule: schedule of the polynomial
+ * @param coeffs: coefficients encoded at the levels of schedule.coeffLevels()
+ * relative to x and at the scales of schedule.coeffScales()
+ * @param relin_keys: relinearization keys
+ * @param relinearize_sum: whether the sum of terms is relinearized (or left
+ * for the next layer multiplying ciphertexts)
+ * @param option: option holding the evaluator and levels
+ * @return polynomial of x at depth schedule.depth() below x
+ */
+seal::Ciphertext evaluatePolynomial(seal::Ciphertext& x,
+                                    const PolynomialSchedule& schedule,
+                                    const seal::Plaintext* coeffs,
+                                    const seal::RelinKeys& relin_keys,
+                                    const bool& relinearize_sum,
+                                    OptOption& option);
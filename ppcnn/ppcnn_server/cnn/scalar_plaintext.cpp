@@ -0,0 +1,115 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmath>
+#include <stdexcept>
+
+#include <seal/util/polyarithsmallmod.h>
+
+#include "scalar_plaintext.hpp"
+
+using std::invalid_argument;
+
+void encodeScalar(const double& value, const seal::parms_id_type& parms_id,
+                  const double& scale, const OptOption& option,
+                  ScalarPlaintext& destination)
+{
+    auto context_data = option.context->get_context_data(parms_id);
+    if (!context_data)
+    {
+        throw invalid_argument(
+          "parms_id is not valid for encryption parameters");
+    }
+    const auto& coeff_modulus = context_data->parms().coeff_modulus();
+    const size_t coeff_mod_count = coeff_modulus.size();
+
+    const double coeffd = std::round(value * scale);
+    const int coeff_bit_count =
+      coeffd == 0.0 ? 0 : static_cast<int>(std::log2(std::fabs(coeffd))) + 2;
+    if (coeff_bit_count >= context_data->total_coeff_modulus_bit_count())
+    {
+        throw invalid_argument("encoded value is too large");
+    }
+
+    destination.resize(coeff_mod_count);
+    if (coeff_bit_count <= 64)
+    {
+        const bool is_negative = std::signbit(coeffd);
+        const std::uint64_t coeffu =
+          static_cast<std::uint64_t>(std::fabs(coeffd));
+        for (size_t j = 0; j < coeff_mod_count; ++j)
+        {
+            const std::uint64_t modulus = coeff_modulus[j].value();
+            const std::uint64_t rem = coeffu % modulus;
+            destination.data()[j] = (is_negative && rem) ? modulus - rem : rem;
+        }
+    }
+    else
+    {
+        // CKKSEncoder decomposes value of more than 64 bits to RNS
+        const size_t coeff_count = context_data->parms().poly_modulus_degree();
+        seal::Plaintext plain;
+        option.encoder.encode(value, parms_id, scale, plain);
+        for (size_t j = 0; j < coeff_mod_count; ++j)
+        {
+            destination.data()[j] = plain.data()[j * coeff_count];
+        }
+    }
+    destination.parms_id() = parms_id;
+    destination.scale() = scale;
+}
+
+void multiplyScalar(const seal::Ciphertext& encrypted,
+                    const ScalarPlaintext& scalar,
+                    seal::Ciphertext& destination, const OptOption& option)
+{
+    if (encrypted.parms_id() != scalar.parms_id())
+    {
+        throw invalid_argument("encrypted and scalar parameter mismatch");
+    }
+    if (!encrypted.is_ntt_form())
+    {
+        throw invalid_argument("encrypted must be in NTT form");
+    }
+    auto context_data = option.context->get_context_data(encrypted.parms_id());
+    const auto& coeff_modulus = context_data->parms().coeff_modulus();
+    const size_t coeff_count = context_data->parms().poly_modulus_degree();
+    const size_t coeff_mod_count = coeff_modulus.size();
+    const double new_scale = encrypted.scale() * scalar.scale();
+    if (std::log2(new_scale) >= context_data->total_coeff_modulus_bit_count())
+    {
+        throw invalid_argument("scale out of bounds");
+    }
+
+    if (&destination != &encrypted)
+    {
+        destination.resize(option.context, encrypted.parms_id(),
+                           encrypted.size());
+        destination.is_ntt_form() = true;
+    }
+    for (size_t i = 0; i < encrypted.size(); ++i)
+    {
+        for (size_t j = 0; j < coeff_mod_count; ++j)
+        {
+            seal::util::multiply_poly_scalar_coeffmod(
+              encrypted.data(i) + j * coeff_count, coeff_count,
+              scalar.data()[j], coeff_modulus[j],
+              destination.data(i) + j * coeff_count);
+        }
+    }
+    destination.scale() = new_scale;
+}
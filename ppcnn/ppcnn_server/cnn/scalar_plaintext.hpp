@@ -0,0 +1,118 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <boost/multi_array.hpp>
+#include <seal/seal.h>
+
+#include <ppcnn_share/cnn_utils/opt_option.hpp>
+
+/**
+ * Scalar constant encoded for CKKS
+ *
+ * A scalar encoded by CKKSEncoder has the same coefficient in all N
+ * coefficients of each RNS limb, so only one word per limb is held instead
+ * of N words of Plaintext.
+ */
+class ScalarPlaintext
+{
+public:
+    ScalarPlaintext() : parms_id_(seal::parms_id_zero), scale_(1.0)
+    {
+    }
+
+    seal::parms_id_type& parms_id()
+    {
+        return parms_id_;
+    }
+    const seal::parms_id_type& parms_id() const
+    {
+        return parms_id_;
+    }
+    double& scale()
+    {
+        return scale_;
+    }
+    const double& scale() const
+    {
+        return scale_;
+    }
+    size_t coeff_mod_count() const
+    {
+        return limbs_.size();
+    }
+    std::uint64_t* data()
+    {
+        return limbs_.data();
+    }
+    const std::uint64_t* data() const
+    {
+        return limbs_.data();
+    }
+    void resize(const size_t& coeff_mod_count)
+    {
+        limbs_.resize(coeff_mod_count);
+    }
+
+private:
+    seal::parms_id_type parms_id_;
+    double scale_;
+    std::vector<std::uint64_t> limbs_;
+};
+
+using ScalarPlaintext2D = boost::multi_array<ScalarPlaintext, 2>;
+using ScalarPlaintext4D = boost::multi_array<ScalarPlaintext, 4>;
+
+/**
+ * Encode scalar in the same way as CKKSEncoder::encode(double, ...)
+ *
+ * @param value: value to encode
+ * @param parms_id: parms_id of the level to encode at
+ * @param scale: scale
+ * @param option: option holding the context
+ * @param destination: encoded scalar
+ * @throws std::invalid_argument if parms_id is not valid or value is too large
+ */
+void encodeScalar(const double& value, const seal::parms_id_type& parms_id,
+                  const double& scale, const OptOption& option,
+                  ScalarPlaintext& destination);
+
+/**
+ * Multiply ciphertext by encoded scalar
+ * Same as Evaluator::multiply_plain with the Plaintext of the scalar, but
+ * each RNS limb is multiplied by a word instead of N coefficients.
+ *
+ * @param encrypted: ciphertext in NTT form
+ * @param scalar: scalar encoded at the same level as encrypted
+ * @param destination: product (may be encrypted itself)
+ * @param option: option holding the context
+ * @throws std::invalid_argument if levels mismatch or scale is out of bounds
+ */
+void multiplyScalar(const seal::Ciphertext& encrypted,
+                    const ScalarPlaintext& scalar,
+                    seal::Ciphertext& destination, const OptOption& option);
+
+inline void multiplyScalarInplace(seal::Ciphertext& encrypted,
+                                  const ScalarPlaintext& scalar,
+                                  const OptOption& option)
+{
+    multiplyScalar(encrypted, scalar, encrypted, option);
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <iostream>
+
+#include "separable_conv2d.hpp"
+#include "snapshot.hpp"
+
+using std::cout;
+using std::endl;
+
+SeparableConv2D::SeparableConv2D(const string& name,
+                                 const shared_ptr<DepthwiseConv2D>& depthwise,
+                                 const shared_ptr<Conv2D>& pointwise)
+  : Layer(name, SEPARABLE_CONV2D), depthwise_(depthwise), pointwise_(pointwise)
+{
+}
+SeparableConv2D::~SeparableConv2D()
+{
+}
+
+void SeparableConv2D::printInfo() const
+{
+    cout << SEPARABLE_CONV2D_CLASS_NAME << ": " << name() << endl;
+}
+
+/**
+ * Save the depthwise and pointwise parts as layers following the name
+ */
+void SeparableConv2D::save(SnapshotWriter& writer) const
+{
+    writer.writeString(SEPARABLE_CONV2D_CLASS_NAME);
+    writer.writeString(name());
+    depthwise_->save(writer);
+    pointwise_->save(writer);
+}
+
+size_t SeparableConv2D::weightBytes() const
+{
+    return depthwise_->weightBytes() + pointwise_->weightBytes();
+}
+
+void SeparableConv2D::forward(TensorArena& arena) const
+{
+    cout << "\tForwarding " << name() << "..." << endl;
+    depthwise_->forward(arena);
+    pointwise_->forward(arena);
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <memory>
+
+#include "conv2d.hpp"
+#include "depthwise_conv2d.hpp"
+
+using std::shared_ptr;
+
+const string SEPARABLE_CONV2D_CLASS_NAME = "SeparableConv2D";
+
+/**
+ * Depthwise separable convolution
+ * Depthwise convolution followed by pointwise (1x1) convolution, which
+ * consumes 2 levels. The depthwise part has no bias, and the pointwise part
+ * has biases of the layer.
+ */
+class SeparableConv2D : public Layer
+{
+public:
+    SeparableConv2D(const string& name,
+                    const shared_ptr<DepthwiseConv2D>& depthwise,
+                    const shared_ptr<Conv2D>& pointwise);
+    ~SeparableConv2D();
+
+    void printInfo() const override;
+    void forward(TensorArena& arena) const override;
+    size_t weightBytes() const override;
+    void save(SnapshotWriter& writer) const override;
+
+private:
+    shared_ptr<DepthwiseConv2D> depthwise_;
+    shared_ptr<Conv2D> pointwise_;
+};
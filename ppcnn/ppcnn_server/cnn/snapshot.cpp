@@ -0,0 +1,543 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+
+#include "activation.hpp"
+#include "average_pooling2d.hpp"
+#include "batch_normalization.hpp"
+#include "conv2d.hpp"
+#include "conv2d_fused_bn.hpp"
+#include "dense.hpp"
+#include "dense_fused_bn.hpp"
+#include "depthwise_conv2d.hpp"
+#include "flatten.hpp"
+#include "global_average_pooling2d.hpp"
+#include "separable_conv2d.hpp"
+#include "snapshot.hpp"
+#include "winograd_conv2d.hpp"
+
+using std::cout;
+using std::endl;
+using std::map;
+using std::uint64_t;
+
+namespace
+{
+
+constexpr size_t SNAPSHOT_ALIGNMENT = 8;
+
+size_t paddingSize(const size_t& offset)
+{
+    return (SNAPSHOT_ALIGNMENT - offset % SNAPSHOT_ALIGNMENT) %
+           SNAPSHOT_ALIGNMENT;
+}
+
+template <class T>
+Layer* loadConv2D(SnapshotReader& reader, OptOption& option)
+{
+    const string name = reader.readString();
+    const size_t in_height = reader.read<uint64_t>();
+    const size_t in_width = reader.read<uint64_t>();
+    const size_t in_channels = reader.read<uint64_t>();
+    const size_t filter_size = reader.read<uint64_t>();
+    const size_t filter_height = reader.read<uint64_t>();
+    const size_t filter_width = reader.read<uint64_t>();
+    const size_t stride_height = reader.read<uint64_t>();
+    const size_t stride_width = reader.read<uint64_t>();
+    const string padding = reader.readString();
+    const string activation = reader.readString();
+
+    ScalarPlaintext4D plain_filters(
+      boost::extents[filter_height][filter_width][in_channels][filter_size]);
+    vector<Plaintext> plain_biases(filter_size);
+    reader.readScalarPlaintexts(plain_filters.data(),
+                                plain_filters.num_elements());
+    reader.readPlaintexts(plain_biases.data(), plain_biases.size());
+
+    return new T(name, in_height, in_width, in_channels, filter_size,
+                 filter_height, filter_width, stride_height, stride_width,
+                 padding, activation, plain_filters, plain_biases, option);
+}
+
+Layer* loadDepthwiseConv2D(SnapshotReader& reader, OptOption& option)
+{
+    const string name = reader.readString();
+    const size_t in_height = reader.read<uint64_t>();
+    const size_t in_width = reader.read<uint64_t>();
+    const size_t in_channels = reader.read<uint64_t>();
+    const size_t depth_multiplier = reader.read<uint64_t>();
+    const size_t filter_height = reader.read<uint64_t>();
+    const size_t filter_width = reader.read<uint64_t>();
+    const size_t stride_height = reader.read<uint64_t>();
+    const size_t stride_width = reader.read<uint64_t>();
+    const string padding = reader.readString();
+    const string activation = reader.readString();
+
+    ScalarPlaintext4D plain_filters(
+      boost::extents[filter_height][filter_width][in_channels]
+                    [depth_multiplier]);
+    reader.readScalarPlaintexts(plain_filters.data(),
+                                plain_filters.num_elements());
+    vector<Plaintext> plain_biases(reader.read<uint64_t>());
+    reader.readPlaintexts(plain_biases.data(), plain_biases.size());
+
+    return new DepthwiseConv2D(name, in_height, in_width, in_channels,
+                               depth_multiplier, filter_height, filter_width,
+                               stride_height, stride_width, padding,
+                               activation, plain_filters, plain_biases,
+                               option);
+}
+
+void checkLayerClass(SnapshotReader& reader, const string& layer_class_name)
+{
+    if (reader.readString() != layer_class_name)
+    {
+        throw runtime_error("Snapshot does not have " + layer_class_name +
+                            " part of layer");
+    }
+}
+
+Layer* loadSeparableConv2D(SnapshotReader& reader, OptOption& option)
+{
+    const string name = reader.readString();
+    checkLayerClass(reader, DEPTHWISE_CONV2D_CLASS_NAME);
+    shared_ptr<DepthwiseConv2D> depthwise(
+      static_cast<DepthwiseConv2D*>(loadDepthwiseConv2D(reader, option)));
+    checkLayerClass(reader, CONV2D_CLASS_NAME);
+    shared_ptr<Conv2D> pointwise(
+      static_cast<Conv2D*>(loadConv2D<Conv2D>(reader, option)));
+
+    return new SeparableConv2D(name, depthwise, pointwise);
+}
+
+Layer* loadWinogradConv2D(SnapshotReader& reader, OptOption& option)
+{
+    const string name = reader.readString();
+    const size_t in_height = reader.read<uint64_t>();
+    const size_t in_width = reader.read<uint64_t>();
+    const size_t in_channels = reader.read<uint64_t>();
+    const size_t filter_size = reader.read<uint64_t>();
+    const size_t tile = reader.read<uint64_t>();
+    const string padding = reader.readString();
+    const string activation = reader.readString();
+
+    const size_t n = WinogradConv2D::transform(tile).size;
+    ScalarPlaintext4D plain_filters(
+      boost::extents[n][n][in_channels][filter_size]);
+    vector<Plaintext> plain_biases(filter_size);
+    reader.readScalarPlaintexts(plain_filters.data(),
+                                plain_filters.num_elements());
+    reader.readPlaintexts(plain_biases.data(), plain_biases.size());
+
+    return new WinogradConv2D(name, in_height, in_width, in_channels,
+                              filter_size, tile, padding, activation,
+                              plain_filters, plain_biases, option);
+}
+
+template <class T>
+Layer* loadDense(SnapshotReader& reader, OptOption& option)
+{
+    const string name = reader.readString();
+    const size_t in_units = reader.read<uint64_t>();
+    const size_t out_units = reader.read<uint64_t>();
+    const string activation = reader.readString();
+
+    ScalarPlaintext2D plain_weights(boost::extents[in_units][out_units]);
+    vector<Plaintext> plain_biases(out_units);
+    reader.readScalarPlaintexts(plain_weights.data(),
+                                plain_weights.num_elements());
+    reader.readPlaintexts(plain_biases.data(), plain_biases.size());
+
+    return new T(name, in_units, out_units, activation, plain_weights,
+                 plain_biases, option);
+}
+
+Layer* loadAveragePooling2D(SnapshotReader& reader, OptOption& option)
+{
+    const string name = reader.readString();
+    const size_t in_height = reader.read<uint64_t>();
+    const size_t in_width = reader.read<uint64_t>();
+    const size_t in_channels = reader.read<uint64_t>();
+    const size_t pool_height = reader.read<uint64_t>();
+    const size_t pool_width = reader.read<uint64_t>();
+    const size_t stride_height = reader.read<uint64_t>();
+    const size_t stride_width = reader.read<uint64_t>();
+    const string padding = reader.readString();
+    ScalarPlaintext plain_mul_factor;
+    reader.readScalarPlaintext(plain_mul_factor);
+
+    return new AveragePooling2D(name, in_height, in_width, in_channels,
+                                pool_height, pool_width, stride_height,
+                                stride_width, padding, plain_mul_factor,
+                                option);
+}
+
+Layer* loadBatchNormalization(SnapshotReader& reader, OptOption& option)
+{
+    const string name = reader.readString();
+    const size_t dim = reader.read<uint64_t>();
+    vector<ScalarPlaintext> plain_weights(dim);
+    vector<Plaintext> plain_biases(dim);
+    reader.readScalarPlaintexts(plain_weights.data(), dim);
+    reader.readPlaintexts(plain_biases.data(), dim);
+
+    return new BatchNormalization(name, plain_weights, plain_biases, option);
+}
+
+Layer* loadFlatten(SnapshotReader& reader, OptOption& option)
+{
+    const string name = reader.readString();
+    const size_t in_height = reader.read<uint64_t>();
+    const size_t in_width = reader.read<uint64_t>();
+    const size_t in_channels = reader.read<uint64_t>();
+    const size_t out_units = reader.read<uint64_t>();
+
+    return new Flatten(name, in_height, in_width, in_channels, out_units);
+}
+
+Layer* loadActivation(SnapshotReader& reader, OptOption& option)
+{
+    const string name = reader.readString();
+    const string activation = reader.readString();
+    const size_t degree = reader.read<uint64_t>();
+    vector<bool> nonzero_terms(degree + 1);
+    for (size_t k = 0; k <= degree; ++k)
+    {
+        nonzero_terms[k] = reader.read<uint64_t>();
+    }
+    const bool monic = reader.read<uint64_t>();
+    const size_t channels = reader.read<uint64_t>();
+    const bool lazy_relinearization = reader.read<uint64_t>();
+    const size_t coeff_size = reader.read<uint64_t>();
+    vector<Plaintext> plain_poly_coeffs(coeff_size);
+    reader.readPlaintexts(plain_poly_coeffs.data(), coeff_size);
+
+    return new Activation(name, activation,
+                          PolynomialSchedule(degree, nonzero_terms, monic),
+                          plain_poly_coeffs, channels, lazy_relinearization,
+                          option);
+}
+
+Layer* loadGlobalAveragePooling2D(SnapshotReader& reader, OptOption& option)
+{
+    const string name = reader.readString();
+    const size_t in_height = reader.read<uint64_t>();
+    const size_t in_width = reader.read<uint64_t>();
+    const size_t in_channels = reader.read<uint64_t>();
+    const size_t out_units = reader.read<uint64_t>();
+    ScalarPlaintext plain_mul_factor;
+    reader.readScalarPlaintext(plain_mul_factor);
+
+    return new GlobalAveragePooling2D(name, in_height, in_width, in_channels,
+                                      out_units, plain_mul_factor, option);
+}
+
+const map<const string, Layer* (*)(SnapshotReader&, OptOption&)>
+  LOAD_LAYER_MAP{
+    {CONV2D_CLASS_NAME, loadConv2D<Conv2D>},
+    {CONV2D_FUSED_BN_CLASS_NAME, loadConv2D<Conv2DFusedBN>},
+    {DEPTHWISE_CONV2D_CLASS_NAME, loadDepthwiseConv2D},
+    {SEPARABLE_CONV2D_CLASS_NAME, loadSeparableConv2D},
+    {WINOGRAD_CONV2D_CLASS_NAME, loadWinogradConv2D},
+    {AVERAGE_POOLING2D_CLASS_NAME, loadAveragePooling2D},
+    {BATCH_NORMALIZATION_CLASS_NAME, loadBatchNormalization},
+    {FLATTEN_CLASS_NAME, loadFlatten},
+    {DENSE_CLASS_NAME, loadDense<Dense>},
+    {DENSE_FUSED_BN_CLASS_NAME, loadDense<DenseFusedBN>},
+    {ACTIVATION_CLASS_NAME, loadActivation},
+    {GLOBAL_AVERAGE_POOLING2D_CLASS_NAME, loadGlobalAveragePooling2D}};
+
+} // namespace
+
+SnapshotWriter::SnapshotWriter(const string& path) : offset_(0)
+{
+    ofs_.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (ofs_.fail())
+    {
+        throw runtime_error("Failed to open snapshot file (" + path + ")");
+    }
+}
+SnapshotWriter::~SnapshotWriter()
+{
+}
+
+void SnapshotWriter::writeBytes(const void* src, const size_t& size)
+{
+    static const char zeros[SNAPSHOT_ALIGNMENT] = {0};
+    ofs_.write(static_cast<const char*>(src), size);
+    offset_ += size;
+    const size_t padding = paddingSize(offset_);
+    ofs_.write(zeros, padding);
+    offset_ += padding;
+    if (ofs_.fail())
+    {
+        throw runtime_error("Failed to write snapshot file");
+    }
+}
+
+void SnapshotWriter::writeString(const string& str)
+{
+    write<uint64_t>(str.size());
+    writeBytes(str.data(), str.size());
+}
+
+void SnapshotWriter::writePlaintext(const Plaintext& plain)
+{
+    write(plain.parms_id());
+    write(plain.scale());
+    write<uint64_t>(plain.coeff_count());
+    writeBytes(plain.data(), plain.coeff_count() * sizeof(uint64_t));
+}
+
+void SnapshotWriter::writePlaintexts(const Plaintext* plains,
+                                     const size_t& count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        writePlaintext(plains[i]);
+    }
+}
+
+void SnapshotWriter::writeScalarPlaintext(const ScalarPlaintext& plain)
+{
+    write(plain.parms_id());
+    write(plain.scale());
+    write<uint64_t>(plain.coeff_mod_count());
+    writeBytes(plain.data(), plain.coeff_mod_count() * sizeof(uint64_t));
+}
+
+void SnapshotWriter::writeScalarPlaintexts(const ScalarPlaintext* plains,
+                                           const size_t& count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        writeScalarPlaintext(plains[i]);
+    }
+}
+
+void SnapshotWriter::close()
+{
+    ofs_.close();
+    if (ofs_.fail())
+    {
+        throw runtime_error("Failed to close snapshot file");
+    }
+}
+
+SnapshotReader::SnapshotReader(const string& path)
+  : path_(path), fd_(-1), data_(nullptr), size_(0), offset_(0)
+{
+    fd_ = open(path.c_str(), O_RDONLY);
+    if (fd_ < 0)
+    {
+        throw runtime_error("Failed to open snapshot file (" + path + ")");
+    }
+    struct stat st;
+    if (fstat(fd_, &st) != 0 || st.st_size == 0)
+    {
+        ::close(fd_);
+        throw runtime_error("Failed to stat snapshot file (" + path + ")");
+    }
+    size_ = st.st_size;
+    void* addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (addr == MAP_FAILED)
+    {
+        ::close(fd_);
+        throw runtime_error("Failed to map snapshot file (" + path + ")");
+    }
+    madvise(addr, size_, MADV_SEQUENTIAL);
+    madvise(addr, size_, MADV_WILLNEED);
+    data_ = static_cast<const std::uint8_t*>(addr);
+}
+SnapshotReader::~SnapshotReader()
+{
+    munmap(const_cast<std::uint8_t*>(data_), size_);
+    ::close(fd_);
+}
+
+const std::uint8_t* SnapshotReader::take(const size_t& size)
+{
+    const size_t padded_size = size + paddingSize(offset_ + size);
+    if (size_ - offset_ < padded_size)
+    {
+        throw runtime_error("Snapshot file is truncated (" + path_ + ")");
+    }
+    const std::uint8_t* src = data_ + offset_;
+    offset_ += padded_size;
+    return src;
+}
+
+void SnapshotReader::readBytes(void* dst, const size_t& size)
+{
+    std::memcpy(dst, take(size), size);
+}
+
+string SnapshotReader::readString()
+{
+    const size_t size = read<uint64_t>();
+    const char* src = reinterpret_cast<const char*>(take(size));
+    return string(src, size);
+}
+
+void SnapshotReader::readPlaintext(Plaintext& plain)
+{
+    const auto parms_id = read<seal::parms_id_type>();
+    const double scale = read<double>();
+    const size_t coeff_count = read<uint64_t>();
+    const std::uint8_t* src = take(coeff_count * sizeof(uint64_t));
+
+    // Plaintext in NTT form can not be resized
+    plain.parms_id() = seal::parms_id_zero;
+    plain.resize(coeff_count);
+    std::memcpy(plain.data(), src, coeff_count * sizeof(uint64_t));
+    plain.parms_id() = parms_id;
+    plain.scale() = scale;
+}
+
+void SnapshotReader::readPlaintexts(Plaintext* plains, const size_t& count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        readPlaintext(plains[i]);
+    }
+}
+
+void SnapshotReader::readScalarPlaintext(ScalarPlaintext& plain)
+{
+    plain.parms_id() = read<seal::parms_id_type>();
+    plain.scale() = read<double>();
+    const size_t coeff_mod_count = read<uint64_t>();
+    plain.resize(coeff_mod_count);
+    readBytes(plain.data(), coeff_mod_count * sizeof(uint64_t));
+}
+
+void SnapshotReader::readScalarPlaintexts(ScalarPlaintext* plains,
+                                          const size_t& count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        readScalarPlaintext(plains[i]);
+    }
+}
+
+void saveSnapshot(const string& path, const Network& network,
+                  const seal::parms_id_type& parms_id,
+                  const EOptLevel& opt_level, const ModelStamp& model_stamp,
+                  const OptOption& option)
+{
+    const string tmp_path = path + ".tmp";
+    try
+    {
+        SnapshotWriter writer(tmp_path);
+        writer.write(SNAPSHOT_MAGIC);
+        writer.write(SNAPSHOT_VERSION);
+        writer.write(parms_id);
+        writer.write<int32_t>(opt_level);
+        writer.write<int32_t>(option.activation);
+        writer.write(option.scale_param);
+        writer.write(option.sparsity_threshold);
+        writer.write(model_stamp.structure_size);
+        writer.write(model_stamp.structure_mtime);
+        writer.write(model_stamp.weights_size);
+        writer.write(model_stamp.weights_mtime);
+        writer.write<uint64_t>(option.consumed_level);
+        writer.write<uint64_t>(network.getLayerSize());
+        for (const shared_ptr<Layer>& layer : network.getLayers())
+        {
+            layer->save(writer);
+        }
+        writer.close();
+    }
+    catch (...)
+    {
+        std::remove(tmp_path.c_str());
+        throw;
+    }
+
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        std::remove(tmp_path.c_str());
+        throw runtime_error("Failed to rename snapshot file (" + path + ")");
+    }
+}
+
+Network loadSnapshot(const string& path, const seal::parms_id_type& parms_id,
+                     const EOptLevel& opt_level, const ModelStamp& model_stamp,
+                     OptOption& option)
+{
+    SnapshotReader reader(path);
+
+    const auto magic = reader.read<std::array<char, sizeof(SNAPSHOT_MAGIC)>>();
+    if (std::memcmp(magic.data(), SNAPSHOT_MAGIC, magic.size()) != 0)
+    {
+        throw SnapshotMismatchException("\"" + path +
+                                        "\" is not a snapshot file");
+    }
+    if (reader.read<std::uint32_t>() != SNAPSHOT_VERSION)
+    {
+        throw SnapshotMismatchException("Snapshot version is not " +
+                                        std::to_string(SNAPSHOT_VERSION));
+    }
+    if (reader.read<seal::parms_id_type>() != parms_id ||
+        reader.read<int32_t>() != opt_level ||
+        reader.read<int32_t>() != option.activation ||
+        reader.read<double>() != option.scale_param ||
+        reader.read<float>() != option.sparsity_threshold)
+    {
+        throw SnapshotMismatchException(
+          "Snapshot was built for other parameters");
+    }
+    ModelStamp snapshot_stamp;
+    snapshot_stamp.structure_size = reader.read<std::uint64_t>();
+    snapshot_stamp.structure_mtime = reader.read<std::int64_t>();
+    snapshot_stamp.weights_size = reader.read<std::uint64_t>();
+    snapshot_stamp.weights_mtime = reader.read<std::int64_t>();
+    if (snapshot_stamp != model_stamp)
+    {
+        throw SnapshotMismatchException(
+          "Snapshot was built from other model files");
+    }
+    option.consumed_level = reader.read<uint64_t>();
+    const size_t layer_size = reader.read<uint64_t>();
+
+    Network network;
+    for (size_t i = 0; i < layer_size; ++i)
+    {
+        const string layer_class_name = reader.readString();
+        auto map_iter = LOAD_LAYER_MAP.find(layer_class_name);
+        if (map_iter == LOAD_LAYER_MAP.end())
+        {
+            throw runtime_error("\"" + layer_class_name +
+                                "\" is not registered as layer class");
+        }
+        network.addLayer(map_iter->second(reader, option));
+    }
+
+    cout << "  Loaded " << layer_size << " layers from snapshot (" << path
+         << ")" << endl;
+
+    return network;
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+
+#include "model_stamp.hpp"
+#include "network.hpp"
+
+using std::runtime_error;
+
+/**
+ * Snapshot file layout (native byte order, every field is 8-byte aligned)
+ *
+ *   header : magic, version, parms_id, opt_level, activation, scale_param,
+ *            sparsity_threshold, sizes and modification times of model
+ *            structure and weights, consumed_level, number of layers
+ *   layers : class name, constructor parameters and encoded weights of each
+ *            layer in network order
+ *
+ * A Plaintext is stored as parms_id, scale, coeff_count and coefficients, so
+ * that it can be copied from the mapped file without encoding.
+ * A ScalarPlaintext is stored in the same way with a word per RNS limb.
+ * SNAPSHOT_VERSION must be incremented whenever the layout changes.
+ */
+const char SNAPSHOT_MAGIC[8] = {'P', 'P', 'C', 'N', 'N', 'S', 'N', 'P'};
+constexpr std::uint32_t SNAPSHOT_VERSION = 11;
+
+class SnapshotWriter
+{
+public:
+    explicit SnapshotWriter(const string& path);
+    ~SnapshotWriter();
+
+    template <typename T>
+    void write(const T& value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "snapshot field must be trivially copyable");
+        writeBytes(&value, sizeof(T));
+    }
+    void writeString(const string& str);
+    void writePlaintext(const Plaintext& plain);
+    void writePlaintexts(const Plaintext* plains, const size_t& count);
+    void writeScalarPlaintext(const ScalarPlaintext& plain);
+    void writeScalarPlaintexts(const ScalarPlaintext* plains,
+                               const size_t& count);
+    void close();
+
+private:
+    void writeBytes(const void* src, const size_t& size);
+
+    std::ofstream ofs_;
+    size_t offset_;
+};
+
+class SnapshotReader
+{
+public:
+    explicit SnapshotReader(const string& path);
+    ~SnapshotReader();
+
+    template <typename T>
+    T read()
+    {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "snapshot field must be trivially copyable");
+        T value;
+        readBytes(&value, sizeof(T));
+        return value;
+    }
+    string readString();
+    void readPlaintext(Plaintext& plain);
+    void readPlaintexts(Plaintext* plains, const size_t& count);
+    void readScalarPlaintext(ScalarPlaintext& plain);
+    void readScalarPlaintexts(ScalarPlaintext* plains, const size_t& count);
+
+private:
+    void readBytes(void* dst, const size_t& size);
+    const std::uint8_t* take(const size_t& size);
+
+    string path_;
+    int fd_;
+    const std::uint8_t* data_;
+    size_t size_;
+    size_t offset_;
+};
+
+class SnapshotMismatchException : public runtime_error
+{
+public:
+    SnapshotMismatchException(const string& message) : runtime_error(message)
+    {
+    }
+};
+
+/**
+ * Save built network to snapshot file
+ * The file is written to a temporary path and renamed, so that a reader
+ * never sees a partially written snapshot.
+ *
+ * @param path: snapshot file path
+ * @param network: built network
+ * @param parms_id: parms_id of the encryption parameters used to encode
+ * @param opt_level: optimization level used to build
+ * @param model_stamp: stamp of model files the network is built from
+ * @param option: option after building the network
+ * @throws std::runtime_error if fail to write file
+ */
+void saveSnapshot(const string& path, const Network& network,
+                  const seal::parms_id_type& parms_id,
+                  const EOptLevel& opt_level, const ModelStamp& model_stamp,
+                  const OptOption& option);
+
+/**
+ * Load network from snapshot file
+ * The level bookkeeping in option is restored as after building.
+ *
+ * @param path: snapshot file path
+ * @param parms_id: parms_id of the current encryption parameters
+ * @param opt_level: current optimization level
+ * @param model_stamp: stamp of current model files
+ * @param option: option to be referenced by the loaded layers
+ * @return loaded network
+ * @throws SnapshotMismatchException if the snapshot is not for the given
+ * parameters or model files, or has an other version
+ * @throws std::runtime_error if fail to read file
+ */
+Network loadSnapshot(const string& path, const seal::parms_id_type& parms_id,
+                     const EOptLevel& opt_level, const ModelStamp& model_stamp,
+                     OptOption& option);
@@ -0,0 +1,212 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <omp.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include "spill_store.hpp"
+
+using std::invalid_argument;
+using std::runtime_error;
+using std::uint64_t;
+
+/**
+ * Create spill file of feature map
+ *
+ * @param directory: directory of spill file (on local disk)
+ * @param height: height of feature map
+ * @param width: width of feature map
+ * @param channels: channels of feature map
+ * @param prototype: ciphertext of the level, size and scale of all
+ * ciphertexts of feature map
+ * @param option: option holding the context
+ * @throws std::runtime_error if spill file can not be created or allocated
+ */
+SpillStore::SpillStore(const string& directory, const size_t& height,
+                       const size_t& width, const size_t& channels,
+                       const seal::Ciphertext& prototype,
+                       const OptOption& option)
+  : height_(height),
+    width_(width),
+    channels_(channels),
+    parms_id_(prototype.parms_id()),
+    size_(prototype.size()),
+    scale_(prototype.scale()),
+    record_size_(prototype.uint64_count()),
+    bytes_(height * width * channels * record_size_ * sizeof(uint64_t)),
+    fd_(-1),
+    data_(nullptr),
+    option_(option)
+{
+    const string pattern =
+      (directory.empty() ? "." : directory) + "/ppcnn_spill_XXXXXX";
+    std::vector<char> path(pattern.begin(), pattern.end());
+    path.push_back('\0');
+    fd_ = mkstemp(path.data());
+    if (fd_ < 0)
+    {
+        throw runtime_error("failed to create spill file in " + directory);
+    }
+    unlink(path.data());
+
+    // Blocks are allocated up front, so that running out of disk is an
+    // error here instead of SIGBUS on writing to the mapping.
+    if (posix_fallocate(fd_, 0, bytes_) != 0)
+    {
+        close(fd_);
+        throw runtime_error("failed to allocate spill file of " +
+                            std::to_string(bytes_) + " bytes");
+    }
+    void* data =
+      mmap(nullptr, bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (data == MAP_FAILED)
+    {
+        close(fd_);
+        throw runtime_error("failed to map spill file");
+    }
+    data_ = static_cast<uint64_t*>(data);
+}
+SpillStore::~SpillStore()
+{
+    munmap(data_, bytes_);
+    close(fd_);
+}
+
+/**
+ * Write ciphertexts of region to spill file
+ * Writeback of the region is started at once, so that the pages can be
+ * reclaimed before the memory is needed by the next tiles.
+ *
+ * @param region: region of feature map
+ * @param tile: ciphertexts of region (of its shape)
+ * @throws std::invalid_argument if level, size or scale of ciphertexts
+ * mismatch
+ */
+void SpillStore::write(const TileRegion& region, const Ciphertext3D& tile)
+{
+    const Ciphertext* ciphertexts = tile.data();
+    for (size_t i = 0; i < tile.num_elements(); ++i)
+    {
+        if (ciphertexts[i].parms_id() != parms_id_ ||
+            ciphertexts[i].size() != size_ ||
+            ciphertexts[i].scale() != scale_ ||
+            !ciphertexts[i].is_ntt_form())
+        {
+            throw invalid_argument("spilled ciphertexts mismatch");
+        }
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel for collapse(3)
+#endif
+    for (size_t h = 0; h < region.height; ++h)
+    {
+        for (size_t w = 0; w < region.width; ++w)
+        {
+            for (size_t c = 0; c < channels_; ++c)
+            {
+                const uint64_t* src = tile[h][w][c].data();
+                std::copy(src, src + record_size_,
+                          record(region.top + h, region.left + w, c));
+            }
+        }
+    }
+    forEachRow(region, [&](const size_t& offset, const size_t& length) {
+        sync_file_range(fd_, offset, length, SYNC_FILE_RANGE_WRITE);
+    });
+}
+
+/**
+ * Read ciphertexts of region from spill file
+ *
+ * @param region: region of feature map
+ * @param tile: ciphertexts of region (of its shape) to be overwritten
+ */
+void SpillStore::read(const TileRegion& region, Ciphertext3D& tile) const
+{
+#ifdef _OPENMP
+#pragma omp parallel for collapse(3)
+#endif
+    for (size_t h = 0; h < region.height; ++h)
+    {
+        for (size_t w = 0; w < region.width; ++w)
+        {
+            for (size_t c = 0; c < channels_; ++c)
+            {
+                Ciphertext& destination = tile[h][w][c];
+                destination.resize(option_.context, parms_id_, size_);
+                const uint64_t* src =
+                  record(region.top + h, region.left + w, c);
+                std::copy(src, src + record_size_, destination.data());
+                destination.is_ntt_form() = true;
+                destination.scale() = scale_;
+            }
+        }
+    }
+}
+
+/**
+ * Start reading region from disk in background, so that it is in page cache
+ * when it is read
+ */
+void SpillStore::prefetch(const TileRegion& region) const
+{
+    forEachRow(region, [&](const size_t& offset, const size_t& length) {
+        madvise(reinterpret_cast<char*>(data_) + offset, length,
+                MADV_WILLNEED);
+    });
+}
+
+/**
+ * Drop pages of region from memory (region is read again from disk)
+ */
+void SpillStore::evict(const TileRegion& region) const
+{
+    forEachRow(region, [&](const size_t& offset, const size_t& length) {
+        madvise(reinterpret_cast<char*>(data_) + offset, length,
+                MADV_DONTNEED);
+        posix_fadvise(fd_, offset, length, POSIX_FADV_DONTNEED);
+    });
+}
+
+/**
+ * Call f with offset and length of range of spill file holding each row of
+ * region, extended to page boundaries
+ */
+void SpillStore::forEachRow(
+  const TileRegion& region,
+  const std::function<void(const size_t&, const size_t&)>& f) const
+{
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    for (size_t h = region.top; h < region.top + region.height; ++h)
+    {
+        const size_t begin =
+          (record(h, region.left, 0) - data_) * sizeof(uint64_t);
+        const size_t end =
+          (record(h, region.left + region.width, 0) - data_) *
+          sizeof(uint64_t);
+        const size_t page_begin = begin / page_size * page_size;
+        const size_t page_end =
+          std::min((end + page_size - 1) / page_size * page_size, bytes_);
+        f(page_begin, page_end - page_begin);
+    }
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include <seal/seal.h>
+
+#include <ppcnn_share/cnn_utils/opt_option.hpp>
+#include <ppcnn_share/cnn_utils/types.h>
+#include "layer.hpp"
+
+/**
+ * Feature map of ciphertexts spilled to a memory-mapped file on local disk
+ *
+ * Feature maps which do not fit in memory budget of a query are written to
+ * the file by regions, and read back by regions as input of the next tiled
+ * segment. Pages of the file are page cache, which the kernel writes back and
+ * reclaims under memory pressure instead of killing the process. The file is
+ * unlinked as soon as it is created, so that its space is freed when the
+ * store is destroyed or the process dies.
+ *
+ * All ciphertexts have the same level, size and scale, and are stored as
+ * records of the same size in order of pixels and channels.
+ */
+class SpillStore
+{
+public:
+    SpillStore(const string& directory, const size_t& height,
+               const size_t& width, const size_t& channels,
+               const seal::Ciphertext& prototype, const OptOption& option);
+    ~SpillStore();
+
+    SpillStore(const SpillStore&) = delete;
+    SpillStore& operator=(const SpillStore&) = delete;
+
+    void write(const TileRegion& region, const Ciphertext3D& tile);
+    void read(const TileRegion& region, Ciphertext3D& tile) const;
+    void prefetch(const TileRegion& region) const;
+    void evict(const TileRegion& region) const;
+
+    size_t height() const
+    {
+        return height_;
+    }
+    size_t width() const
+    {
+        return width_;
+    }
+    size_t channels() const
+    {
+        return channels_;
+    }
+    const seal::parms_id_type& parms_id() const
+    {
+        return parms_id_;
+    }
+    size_t bytes() const
+    {
+        return bytes_;
+    }
+
+private:
+    std::uint64_t* record(const size_t& h, const size_t& w,
+                          const size_t& c) const
+    {
+        return data_ + ((h * width_ + w) * channels_ + c) * record_size_;
+    }
+    void forEachRow(
+      const TileRegion& region,
+      const std::function<void(const size_t&, const size_t&)>& f) const;
+
+    size_t height_;
+    size_t width_;
+    size_t channels_;
+    seal::parms_id_type parms_id_;
+    size_t size_;
+    double scale_;
+    // number of uint64_t of a ciphertext
+    size_t record_size_;
+    size_t bytes_;
+    int fd_;
+    std::uint64_t* data_;
+    const OptOption& option_;
+};
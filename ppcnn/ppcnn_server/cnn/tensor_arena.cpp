@@ -0,0 +1,229 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <array>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "tensor_arena.hpp"
+
+TensorArena::TensorArena(CiphertextPool* pool, const size_t& memory_budget,
+                         const string& spill_dir)
+  : current_tensor_(0),
+    current_units_(0),
+    pool_(pool),
+    memory_budget_(memory_budget),
+    spill_dir_(spill_dir)
+{
+}
+TensorArena::~TensorArena()
+{
+    releaseTensors();
+    for (vector<Ciphertext>& units : units_)
+    {
+        release(units.data(), units.size());
+    }
+}
+
+/**
+ * Input of the next layer
+ * Spilled input is read back into memory.
+ *
+ * @return input feature map
+ * @throws std::runtime_error if spilled input does not fit in memory budget
+ */
+Ciphertext3D& TensorArena::tensor()
+{
+    Ciphertext3D& input = tensors_[current_tensor_];
+    std::unique_ptr<SpillStore>& spill = spills_[current_tensor_];
+    if (spill)
+    {
+        // (layers which are not tiled hold the whole map in memory)
+        if (memory_budget_ > 0 &&
+            spill->bytes() + pooledBytes() > memory_budget_)
+        {
+            throw std::runtime_error(
+              "spilled feature map of " + std::to_string(spill->bytes()) +
+              " bytes does not fit in memory budget of " +
+              std::to_string(memory_budget_) +
+              " bytes to be read by a layer which is not tiled");
+        }
+        std::cout << "\t  reading back spilled feature map of "
+                  << spill->bytes() << " bytes" << std::endl;
+        // (buffer was emptied when the input was spilled)
+        input.resize(boost::extents[spill->height()][spill->width()]
+                                   [spill->channels()]);
+        acquire(spill->parms_id(), input.data(), input.num_elements());
+        spill->read({0, 0, spill->height(), spill->width()}, input);
+        spill.reset();
+    }
+    return input;
+}
+
+/**
+ * Input of the next layer if it is spilled, and nullptr otherwise
+ */
+SpillStore* TensorArena::spilledTensor()
+{
+    return spills_[current_tensor_].get();
+}
+
+vector<Ciphertext>& TensorArena::units()
+{
+    return units_[current_units_];
+}
+
+/**
+ * Buffer of output of the next layer, which becomes input by swapTensors
+ * Ciphertexts in the buffer are to be overwritten in place. Layers which move
+ * their results into the buffer instead do not reuse ciphertexts, which are
+ * released to the pool and left empty.
+ *
+ * @param height: height of output
+ * @param width: width of output
+ * @param channels: channels of output
+ * @param reuse: whether output is written into ciphertexts of the buffer
+ * @return output buffer of the shape
+ */
+Ciphertext3D& TensorArena::nextTensor(const size_t& height,
+                                      const size_t& width,
+                                      const size_t& channels,
+                                      const bool& reuse)
+{
+    Ciphertext3D& next = tensors_[1 - current_tensor_];
+    spills_[1 - current_tensor_].reset();
+    const size_t count = height * width * channels;
+    if (next.num_elements() == count)
+    {
+        next.reshape(std::array<size_t, 3>{height, width, channels});
+        if (!reuse)
+        {
+            release(next.data(), count);
+        }
+        return next;
+    }
+
+    release(next.data(), next.num_elements());
+    // (resizing copies ciphertexts kept in both shapes)
+    next.resize(boost::extents[0][0][0]);
+    next.resize(boost::extents[height][width][channels]);
+    const Ciphertext3D& input = tensors_[current_tensor_];
+    if (!reuse)
+    {
+        return next;
+    }
+    if (spills_[current_tensor_])
+    {
+        acquire(spills_[current_tensor_]->parms_id(), next.data(), count);
+    }
+    else if (input.num_elements() > 0 && input.data()[0].size() > 0)
+    {
+        acquire(input.data()[0].parms_id(), next.data(), count);
+    }
+    return next;
+}
+
+/**
+ * Spill store of output of the next layer, which becomes input by
+ * swapTensors
+ * Ciphertexts in the buffer of output are released.
+ *
+ * @param height: height of output
+ * @param width: width of output
+ * @param channels: channels of output
+ * @param prototype: ciphertext of the level, size and scale of output
+ * @param option: option holding the context
+ * @return spill store of the shape
+ * @throws std::runtime_error if spill file can not be created
+ */
+SpillStore& TensorArena::nextSpilledTensor(const size_t& height,
+                                           const size_t& width,
+                                           const size_t& channels,
+                                           const seal::Ciphertext& prototype,
+                                           const OptOption& option)
+{
+    Ciphertext3D& next = tensors_[1 - current_tensor_];
+    release(next.data(), next.num_elements());
+    next.resize(boost::extents[0][0][0]);
+    spills_[1 - current_tensor_].reset(new SpillStore(
+      spill_dir_, height, width, channels, prototype, option));
+    return *spills_[1 - current_tensor_];
+}
+
+/**
+ * Buffer of output units of the next layer, which becomes input by swapUnits
+ */
+vector<Ciphertext>& TensorArena::nextUnits(const size_t& count)
+{
+    vector<Ciphertext>& next = units_[1 - current_units_];
+    if (next.size() > count)
+    {
+        release(next.data() + count, next.size() - count);
+    }
+    const size_t kept = next.size();
+    next.resize(count);
+    const vector<Ciphertext>& input = units();
+    if (kept < count && !input.empty() && input[0].size() > 0)
+    {
+        acquire(input[0].parms_id(), next.data() + kept, count - kept);
+    }
+    return next;
+}
+
+void TensorArena::swapTensors()
+{
+    current_tensor_ = 1 - current_tensor_;
+}
+
+void TensorArena::swapUnits()
+{
+    current_units_ = 1 - current_units_;
+}
+
+/**
+ * Release both buffers of feature maps (when they are flattened into units)
+ */
+void TensorArena::releaseTensors()
+{
+    for (Ciphertext3D& tensor : tensors_)
+    {
+        release(tensor.data(), tensor.num_elements());
+        tensor.resize(boost::extents[0][0][0]);
+    }
+    for (std::unique_ptr<SpillStore>& spill : spills_)
+    {
+        spill.reset();
+    }
+}
+
+void TensorArena::release(Ciphertext* ciphertexts, const size_t& count)
+{
+    if (pool_)
+    {
+        pool_->release(ciphertexts, count);
+    }
+}
+
+void TensorArena::acquire(const seal::parms_id_type& parms_id,
+                          Ciphertext* ciphertexts, const size_t& count)
+{
+    if (pool_)
+    {
+        pool_->acquire(parms_id, ciphertexts, count);
+    }
+}
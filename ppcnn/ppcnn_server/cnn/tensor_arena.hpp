@@ -0,0 +1,95 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <memory>
+
+#include <ppcnn_share/cnn_utils/types.h>
+#include "ciphertext_pool.hpp"
+#include "spill_store.hpp"
+
+/**
+ * Ping-pong buffers of feature maps (and of units after flatten) of a query
+ *
+ * Layers read input from one buffer and write output to the other, and then
+ * the buffers swap their roles for the next layer, so that output is not
+ * moved back to input. Ciphertexts left in the other buffer by the layer
+ * before are overwritten when its shape keeps the number of ciphertexts, and
+ * are returned to CiphertextPool otherwise (and when the arena is
+ * destroyed), which gives them back to outputs of the same level.
+ *
+ * Under memory budget of the query, output which does not fit in the budget
+ * is written to SpillStore instead of the buffer (by TiledSegment), which
+ * reads spilled input by tiles. Spilled input is read back into the buffer
+ * when tensor() is called, so that layers which are not tiled see it as a
+ * feature map in memory, unless it does not fit in the budget.
+ */
+class TensorArena
+{
+public:
+    TensorArena(CiphertextPool* pool = nullptr,
+                const size_t& memory_budget = 0,
+                const string& spill_dir = "");
+    ~TensorArena();
+
+    /**
+     * Bytes of feature maps held in memory by a query (0: unlimited)
+     */
+    size_t memory_budget() const
+    {
+        return memory_budget_;
+    }
+
+    /**
+     * Bytes of free ciphertexts held by the pool, which count toward memory
+     * held during a query
+     */
+    size_t pooledBytes() const
+    {
+        return pool_ ? pool_->bytes() : 0;
+    }
+
+    Ciphertext3D& tensor();
+    SpillStore* spilledTensor();
+    SpillStore& nextSpilledTensor(const size_t& height, const size_t& width,
+                                  const size_t& channels,
+                                  const seal::Ciphertext& prototype,
+                                  const OptOption& option);
+    vector<Ciphertext>& units();
+    Ciphertext3D& nextTensor(const size_t& height, const size_t& width,
+                             const size_t& channels,
+                             const bool& reuse = true);
+    vector<Ciphertext>& nextUnits(const size_t& count);
+    void swapTensors();
+    void swapUnits();
+    void releaseTensors();
+
+private:
+    void release(Ciphertext* ciphertexts, const size_t& count);
+    void acquire(const seal::parms_id_type& parms_id,
+                 Ciphertext* ciphertexts, const size_t& count);
+
+    Ciphertext3D tensors_[2];
+    std::unique_ptr<SpillStore> spills_[2];
+    vector<Ciphertext> units_[2];
+    size_t current_tensor_;
+    size_t current_units_;
+    CiphertextPool* pool_;
+    size_t memory_budget_;
+    string spill_dir_;
+};
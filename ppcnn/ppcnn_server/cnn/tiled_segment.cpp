@@ -0,0 +1,289 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <omp.h>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "ciphertext_slab.hpp"
+#include "tensor_arena.hpp"
+#include "tiled_segment.hpp"
+
+using std::cout;
+using std::endl;
+using std::max;
+using std::min;
+using std::move;
+
+namespace
+{
+
+size_t tensorBytes(const Ciphertext3D& tensor)
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < tensor.num_elements(); ++i)
+    {
+        bytes += tensor.data()[i].uint64_count() * sizeof(std::uint64_t);
+    }
+    return bytes;
+}
+
+} /* namespace */
+
+TiledSegment::TiledSegment(const vector<shared_ptr<Layer>>& layers,
+                           const size_t& tile_size)
+  : layers_(layers), tile_size_(tile_size)
+{
+}
+TiledSegment::~TiledSegment()
+{
+}
+
+size_t TiledSegment::length(const vector<shared_ptr<Layer>>& layers,
+                            const size_t& begin)
+{
+    if (begin >= layers.size() || layers[begin]->layer_class() != CONV2D ||
+        !layers[begin]->isTileable())
+    {
+        return 0;
+    }
+    size_t end = begin + 1;
+    while (end < layers.size() && layers[end]->layer_class() != CONV2D &&
+           layers[end]->isTileable())
+    {
+        ++end;
+    }
+    return end - begin;
+}
+
+/**
+ * Forward input through all layers of segment tile by tile
+ * Output is spilled to disk if input, output and working set of tiles do
+ * not fit in memory budget of the arena. Spilled input is read by tiles in
+ * the order of output tiles, and input region of the next tile is prefetched
+ * while the current tile is forwarded.
+ *
+ * @param arena: arena holding input of the first layer, to which output of
+ * the last layer is written
+ * @param relin_keys: relinearization keys of the client
+ * @param option: option holding the context
+ * @param spillable: whether output is read by tiles by the next segment, so
+ * that it can be spilled
+ * @throws std::runtime_error if output does not fit in memory budget and is
+ * not spillable (found by the first tile, before the other tiles are
+ * forwarded)
+ */
+void TiledSegment::forward(TensorArena& arena,
+                           const seal::RelinKeys& relin_keys,
+                           const OptOption& option,
+                           const bool& spillable) const
+{
+    // spilled input is not read back into memory
+    SpillStore* spilled_input = arena.spilledTensor();
+    const Ciphertext3D* input = spilled_input ? nullptr : &arena.tensor();
+    const size_t in_height =
+      spilled_input ? spilled_input->height() : input->shape()[0];
+    const size_t in_width =
+      spilled_input ? spilled_input->width() : input->shape()[1];
+    const size_t channels =
+      spilled_input ? spilled_input->channels() : input->shape()[2];
+    cout << "\tForwarding";
+    for (const shared_ptr<Layer>& layer : layers_)
+    {
+        cout << " " << layer->name();
+    }
+    cout << " by tiles..." << endl;
+    cout << "\t  input shape: " << in_height << "x" << in_width << "x"
+         << channels << (spilled_input ? " (spilled)" : "") << endl;
+
+    // sizes of output of each layer
+    const size_t layer_count = layers_.size();
+    vector<size_t> heights(layer_count + 1), widths(layer_count + 1);
+    heights[0] = in_height;
+    widths[0] = in_width;
+    for (size_t l = 0; l < layer_count; ++l)
+    {
+        layers_[l]->tileOutputSize(heights[l], widths[l], heights[l + 1],
+                                   widths[l + 1]);
+    }
+    const size_t out_height = heights[layer_count];
+    const size_t out_width = widths[layer_count];
+    const size_t tile_rows = (out_height + tile_size_ - 1) / tile_size_;
+    const size_t tile_cols = (out_width + tile_size_ - 1) / tile_size_;
+    cout << "\t  " << tile_rows << "x" << tile_cols << " tiles of "
+         << tile_size_ << "x" << tile_size_ << " output pixels" << endl;
+
+    // regions are traced back from output tile to input
+    auto traceRegions = [&](const size_t& tr, const size_t& tc,
+                            vector<TileRegion>& regions) {
+        const size_t top = tr * tile_size_;
+        const size_t left = tc * tile_size_;
+        regions[layer_count] = {top, left, min(tile_size_, out_height - top),
+                                min(tile_size_, out_width - left)};
+        for (size_t l = layer_count; l > 0; --l)
+        {
+            regions[l - 1] = layers_[l - 1]->inputRegion(regions[l]);
+        }
+    };
+
+    Ciphertext3D* output = nullptr;
+    SpillStore* spilled_output = nullptr;
+    size_t working_bytes = 0;
+    vector<TileRegion> regions(layer_count + 1);
+    vector<TileRegion> next_regions(layer_count + 1);
+    traceRegions(0, 0, regions);
+    if (spilled_input)
+    {
+        spilled_input->prefetch(regions[0]);
+    }
+    for (size_t tr = 0; tr < tile_rows; ++tr)
+    {
+        for (size_t tc = 0; tc < tile_cols; ++tc)
+        {
+            const bool row_end = tc + 1 == tile_cols;
+            const bool has_next = !row_end || tr + 1 < tile_rows;
+            if (has_next)
+            {
+                traceRegions(row_end ? tr + 1 : tr, row_end ? 0 : tc + 1,
+                             next_regions);
+                if (spilled_input)
+                {
+                    spilled_input->prefetch(next_regions[0]);
+                }
+            }
+
+            const TileRegion& in_region = regions[0];
+            Ciphertext3D tile(
+              boost::extents[in_region.height][in_region.width][channels]);
+            if (spilled_input)
+            {
+                spilled_input->read(in_region, tile);
+            }
+            else
+            {
+                const Ciphertext3D& in = *input;
+#ifdef _OPENMP
+#pragma omp parallel for collapse(3)
+#endif
+                for (size_t h = 0; h < in_region.height; ++h)
+                {
+                    for (size_t w = 0; w < in_region.width; ++w)
+                    {
+                        for (size_t c = 0; c < channels; ++c)
+                        {
+                            tile[h][w][c] =
+                              in[in_region.top + h][in_region.left + w][c];
+                        }
+                    }
+                }
+            }
+
+            // intermediate of each layer is released by the next layer
+            const bool is_first = !output && !spilled_output;
+            for (size_t l = 0; l < layer_count; ++l)
+            {
+                const size_t in_tile_bytes = is_first ? tensorBytes(tile) : 0;
+                layers_[l]->forwardTile(tile, regions[l], regions[l + 1],
+                                        relin_keys);
+                if (is_first)
+                {
+                    // Layer holds its input tile, its output and a slab of a
+                    // band of input at once.
+                    working_bytes = max(working_bytes,
+                                        in_tile_bytes + tensorBytes(tile) +
+                                          in_tile_bytes / SLAB_BAND_COUNT);
+                }
+            }
+
+            const TileRegion& out_region = regions[layer_count];
+            const size_t out_channels = tile.shape()[2];
+            if (is_first)
+            {
+                // Input and output are held with working set of tiles (and
+                // free ciphertexts of the pool), measured by the first tile.
+                const size_t ciphertext_bytes =
+                  tile.data()[0].uint64_count() * sizeof(std::uint64_t);
+                const size_t output_bytes =
+                  out_height * out_width * out_channels * ciphertext_bytes;
+                const size_t input_bytes = input ? tensorBytes(*input) : 0;
+                const size_t held_bytes = input_bytes + output_bytes +
+                                          working_bytes + arena.pooledBytes();
+                if (arena.memory_budget() > 0 &&
+                    held_bytes > arena.memory_budget() && !spillable)
+                {
+                    // the next layer would read the whole output back
+                    throw std::runtime_error(
+                      "output of " + std::to_string(output_bytes) +
+                      " bytes does not fit in memory budget of " +
+                      std::to_string(arena.memory_budget()) +
+                      " bytes, and is read by a layer which is not tiled");
+                }
+                if (arena.memory_budget() > 0 &&
+                    held_bytes > arena.memory_budget())
+                {
+                    cout << "\t  spilling output of " << output_bytes
+                         << " bytes to disk" << endl;
+                    spilled_output = &arena.nextSpilledTensor(
+                      out_height, out_width, out_channels, tile.data()[0],
+                      option);
+                }
+                else
+                {
+                    // (tiles are moved into output)
+                    output = &arena.nextTensor(out_height, out_width,
+                                               out_channels, false);
+                }
+            }
+            if (spilled_output)
+            {
+                spilled_output->write(out_region, tile);
+            }
+            else
+            {
+                Ciphertext3D& out = *output;
+#ifdef _OPENMP
+#pragma omp parallel for collapse(3)
+#endif
+                for (size_t h = 0; h < out_region.height; ++h)
+                {
+                    for (size_t w = 0; w < out_region.width; ++w)
+                    {
+                        for (size_t c = 0; c < out_channels; ++c)
+                        {
+                            out[out_region.top + h][out_region.left + w][c] =
+                              move(tile[h][w][c]);
+                        }
+                    }
+                }
+            }
+
+            // input rows above the next row of tiles are not read again
+            if (spilled_input && row_end && has_next &&
+                next_regions[0].top > in_region.top)
+            {
+                spilled_input->evict({in_region.top, 0,
+                                      next_regions[0].top - in_region.top,
+                                      in_width});
+            }
+            regions.swap(next_regions);
+        }
+    }
+
+    arena.swapTensors();
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <memory>
+
+#include "layer.hpp"
+
+using std::shared_ptr;
+
+/**
+ * Chain of layers forwarded by spatial tiles of output
+ *
+ * Segment begins with a Conv2D and continues with the following pixelwise or
+ * windowed layers (BatchNormalization, Activation and AveragePooling2D).
+ * Input region of each output tile (with halo of receptive field) is cut from
+ * input, and the tile is forwarded through all layers of the segment before
+ * the next tile, so that intermediate feature maps of the segment exist only
+ * for one tile at a time. Segment begins at a convolution so that no
+ * convolution is computed twice on overlapping halos.
+ *
+ * Output of segment is spilled to disk (SpillStore) if it does not fit in
+ * memory budget of the query, and the next segment reads it tile by tile.
+ * Output read by other layers than a segment is not spilled, and fails the
+ * query if it does not fit.
+ */
+class TiledSegment
+{
+public:
+    TiledSegment(const vector<shared_ptr<Layer>>& layers,
+                 const size_t& tile_size);
+    ~TiledSegment();
+
+    void forward(TensorArena& arena, const seal::RelinKeys& relin_keys,
+                 const OptOption& option, const bool& spillable) const;
+
+    /**
+     * Number of layers of segment beginning at layers[begin]
+     *
+     * @return 0 if segment can not begin at layers[begin]
+     */
+    static size_t length(const vector<shared_ptr<Layer>>& layers,
+                         const size_t& begin);
+
+private:
+    vector<shared_ptr<Layer>> layers_;
+    size_t tile_size_;
+};
@@ -0,0 +1,591 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <omp.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+
+#include "multiply_accumulate.hpp"
+#include "snapshot.hpp"
+#include "tensor_arena.hpp"
+#include "winograd_conv2d.hpp"
+
+using std::cout;
+using std::endl;
+using std::invalid_argument;
+using std::max;
+using std::min;
+
+namespace
+{
+
+const WinogradTransform F2X2_3X3{2,
+                                 4,
+                                 {1, 0, -1, 0,   //
+                                  0, 1, 1, 0,    //
+                                  0, -1, 1, 0,   //
+                                  0, 1, 0, -1},  //
+                                 {1, 1, 1, 0,    //
+                                  0, 1, -1, -1},
+                                 {1.0, 0.0, 0.0,     //
+                                  0.5, 0.5, 0.5,     //
+                                  0.5, -0.5, 0.5,    //
+                                  0.0, 0.0, 1.0}};
+
+const WinogradTransform F4X4_3X3{4,
+                                 6,
+                                 {4, 0, -5, 0, 1, 0,     //
+                                  0, -4, -4, 1, 1, 0,    //
+                                  0, 4, -4, -1, 1, 0,    //
+                                  0, -2, -1, 2, 1, 0,    //
+                                  0, 2, -1, -2, 1, 0,    //
+                                  0, 4, 0, -5, 0, 1},    //
+                                 {1, 1, 1, 1, 1, 0,      //
+                                  0, 1, -1, 2, -2, 0,    //
+                                  0, 1, 1, 4, 4, 0,      //
+                                  0, 1, -1, 8, -8, 1},
+                                 {1.0 / 4, 0.0, 0.0,             //
+                                  -1.0 / 6, -1.0 / 6, -1.0 / 6,  //
+                                  -1.0 / 6, 1.0 / 6, -1.0 / 6,   //
+                                  1.0 / 24, 1.0 / 12, 1.0 / 6,   //
+                                  1.0 / 24, -1.0 / 12, 1.0 / 6,  //
+                                  0.0, 0.0, 1.0}};
+
+/**
+ * Multiply ciphertext by integer without changing scale
+ */
+void multiplyIntegerInplace(Ciphertext& encrypted, const int& value,
+                            const OptOption& option)
+{
+    if (value == 1)
+    {
+        return;
+    }
+    if (value == -1)
+    {
+        option.evaluator.negate_inplace(encrypted);
+        return;
+    }
+    ScalarPlaintext scalar;
+    encodeScalar(value, encrypted.parms_id(), 1.0, option, scalar);
+    multiplyScalarInplace(encrypted, scalar, option);
+}
+
+/**
+ * Linear combination of ciphertexts with integer coefficients
+ * Missing (nullptr or empty) terms are zero, and destination is left empty
+ * if all terms are zero. The buffer of destination is reused otherwise.
+ */
+void combine(const Ciphertext* const* terms, const int* coeffs,
+             const size_t& count, Ciphertext& destination,
+             const OptOption& option)
+{
+    bool is_zero = true;
+    Ciphertext term;
+    for (size_t k = 0; k < count; ++k)
+    {
+        if (coeffs[k] == 0 || !terms[k] || terms[k]->size() == 0)
+            continue;
+        if (is_zero)
+        {
+            destination = *terms[k];
+            multiplyIntegerInplace(destination, coeffs[k], option);
+            is_zero = false;
+        }
+        else if (coeffs[k] == 1)
+        {
+            option.evaluator.add_inplace(destination, *terms[k]);
+        }
+        else if (coeffs[k] == -1)
+        {
+            option.evaluator.sub_inplace(destination, *terms[k]);
+        }
+        else
+        {
+            term = *terms[k];
+            multiplyIntegerInplace(term, std::abs(coeffs[k]), option);
+            if (coeffs[k] > 0)
+                option.evaluator.add_inplace(destination, term);
+            else
+                option.evaluator.sub_inplace(destination, term);
+        }
+    }
+    if (is_zero)
+    {
+        destination = Ciphertext();
+    }
+}
+
+/**
+ * result = left * tile * right^T for row-major matrices of rows x inner
+ * (left) and cols x inner (right)
+ */
+void sandwich(const int* left, const int* right, const size_t& rows,
+              const size_t& cols, const size_t& inner,
+              const Ciphertext* const* tile, Ciphertext* const* result,
+              const OptOption& option)
+{
+    vector<Ciphertext> half(rows * inner);
+    vector<const Ciphertext*> terms(inner);
+    for (size_t i = 0; i < rows; ++i)
+    {
+        for (size_t j = 0; j < inner; ++j)
+        {
+            for (size_t k = 0; k < inner; ++k)
+            {
+                terms[k] = tile[k * inner + j];
+            }
+            combine(terms.data(), left + i * inner, inner,
+                    half[i * inner + j], option);
+        }
+    }
+    for (size_t i = 0; i < rows; ++i)
+    {
+        for (size_t k = 0; k < inner; ++k)
+        {
+            terms[k] = &half[i * inner + k];
+        }
+        for (size_t j = 0; j < cols; ++j)
+        {
+            combine(terms.data(), right + j * inner, inner,
+                    *result[i * cols + j], option);
+        }
+    }
+}
+
+} /* namespace */
+
+WinogradConv2D::WinogradConv2D(
+  const string& name, const size_t& in_height, const size_t& in_width,
+  const size_t& in_channels, const size_t& filter_size, const size_t& tile,
+  const string& padding, const string& activation,
+  const ScalarPlaintext4D& plain_filters, const vector<Plaintext>& plain_biases,
+  OptOption& option)
+  : Layer(name, WINOGRAD_CONV2D),
+    in_height_(in_height),
+    in_width_(in_width),
+    in_channels_(in_channels),
+    filter_size_(filter_size),
+    tile_(tile),
+    padding_(padding),
+    activation_(activation),
+    plain_filters_(plain_filters),
+    plain_biases_(plain_biases),
+    option_(option)
+{
+    transform(tile_);
+    out_height_ = outputSize(in_height_, 3, 1, padding_);
+    out_width_ = outputSize(in_width_, 3, 1, padding_);
+    pad_top_ = paddingBefore(in_height_, 3, 1, padding_);
+    pad_left_ = paddingBefore(in_width_, 3, 1, padding_);
+    tiles_height_ = (out_height_ + tile_ - 1) / tile_;
+    tiles_width_ = (out_width_ + tile_ - 1) / tile_;
+}
+WinogradConv2D::~WinogradConv2D()
+{
+}
+
+void WinogradConv2D::printInfo() const
+{
+    cout << WINOGRAD_CONV2D_CLASS_NAME << ": " << name() << " (F(" << tile_
+         << "x" << tile_ << ", 3x3))" << endl;
+}
+
+void WinogradConv2D::save(SnapshotWriter& writer) const
+{
+    writer.writeString(WINOGRAD_CONV2D_CLASS_NAME);
+    writer.writeString(name());
+    writer.write<uint64_t>(in_height_);
+    writer.write<uint64_t>(in_width_);
+    writer.write<uint64_t>(in_channels_);
+    writer.write<uint64_t>(filter_size_);
+    writer.write<uint64_t>(tile_);
+    writer.writeString(padding_);
+    writer.writeString(activation_);
+    writer.writeScalarPlaintexts(plain_filters_.data(),
+                                 plain_filters_.num_elements());
+    writer.writePlaintexts(plain_biases_.data(), plain_biases_.size());
+}
+
+size_t WinogradConv2D::weightBytes() const
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < plain_filters_.num_elements(); ++i)
+    {
+        bytes += plaintextBytes(plain_filters_.data()[i]);
+    }
+    for (const Plaintext& plain_bias : plain_biases_)
+    {
+        bytes += plaintextBytes(plain_bias);
+    }
+    return bytes;
+}
+
+/**
+ * Transform matrices of output tile size
+ *
+ * @param tile: output tile size (2 or 4)
+ * @throws std::invalid_argument if tile size is not supported
+ */
+const WinogradTransform& WinogradConv2D::transform(const size_t& tile)
+{
+    switch (tile)
+    {
+        case 2:
+            return F2X2_3X3;
+        case 4:
+            return F4X4_3X3;
+        default:
+            throw invalid_argument("Winograd tile size must be 2 or 4 (" +
+                                   std::to_string(tile) + ")");
+    }
+}
+
+/**
+ * Transform filters to G g G^T
+ *
+ * @param tile: output tile size
+ * @param filters: 3x3 filters at [3][3][in_channels][filter_size]
+ * @param transformed: transformed filters at [n][n][in_channels][filter_size]
+ */
+void WinogradConv2D::transformFilters(const size_t& tile,
+                                      const float4D& filters,
+                                      vector<double>& transformed)
+{
+    const WinogradTransform& t = transform(tile);
+    const size_t channel_count = filters.shape()[2] * filters.shape()[3];
+    transformed.assign(t.size * t.size * channel_count, 0.0);
+    for (size_t c = 0; c < channel_count; ++c)
+    {
+        for (size_t i = 0; i < t.size; ++i)
+        {
+            for (size_t j = 0; j < t.size; ++j)
+            {
+                double sum = 0.0;
+                for (size_t k = 0; k < 3; ++k)
+                {
+                    for (size_t l = 0; l < 3; ++l)
+                    {
+                        sum += t.filter[i * 3 + k] *
+                               filters.data()[(k * 3 + l) * channel_count + c] *
+                               t.filter[j * 3 + l];
+                    }
+                }
+                transformed[(i * t.size + j) * channel_count + c] = sum;
+            }
+        }
+    }
+}
+
+/**
+ * Max error of Winograd against direct convolution added by encoding
+ * Both are computed in plaintext for a random input tile, with weights
+ * rounded to the precision of scale.
+ *
+ * @param tile: output tile size
+ * @param filters: 3x3 filters at [3][3][in_channels][filter_size]
+ * @param transformed: filters transformed by transformFilters
+ * @param scale: scale of encoded weights
+ * @return max absolute error of output tile
+ */
+double WinogradConv2D::maxTransformError(const size_t& tile,
+                                         const float4D& filters,
+                                         const vector<double>& transformed,
+                                         const double& scale)
+{
+    const WinogradTransform& t = transform(tile);
+    const size_t n = t.size;
+    const size_t in_channels = filters.shape()[2];
+    const size_t filter_size = filters.shape()[3];
+    auto quantize = [&](const double& value) {
+        return std::round(value * scale) / scale;
+    };
+
+    std::mt19937 engine(0);
+    std::uniform_real_distribution<double> dist(-1.0, 1.0);
+    vector<double> input(in_channels * n * n);
+    for (double& value : input)
+    {
+        value = dist(engine);
+    }
+    // B^T d B of each input channel
+    vector<double> input_transformed(in_channels * n * n, 0.0);
+    for (size_t ic = 0; ic < in_channels; ++ic)
+    {
+        const double* d = &input[ic * n * n];
+        for (size_t i = 0; i < n; ++i)
+        {
+            for (size_t j = 0; j < n; ++j)
+            {
+                double sum = 0.0;
+                for (size_t k = 0; k < n; ++k)
+                {
+                    for (size_t l = 0; l < n; ++l)
+                    {
+                        sum += t.input[i * n + k] * d[k * n + l] *
+                               t.input[j * n + l];
+                    }
+                }
+                input_transformed[(ic * n + i) * n + j] = sum;
+            }
+        }
+    }
+
+    double max_error = 0.0;
+    vector<double> product(n * n);
+    for (size_t oc = 0; oc < filter_size; ++oc)
+    {
+        for (size_t p = 0; p < n * n; ++p)
+        {
+            product[p] = 0.0;
+            for (size_t ic = 0; ic < in_channels; ++ic)
+            {
+                product[p] +=
+                  quantize(transformed[(p * in_channels + ic) * filter_size +
+                                       oc]) *
+                  input_transformed[ic * n * n + p];
+            }
+        }
+        for (size_t y = 0; y < tile; ++y)
+        {
+            for (size_t x = 0; x < tile; ++x)
+            {
+                double winograd = 0.0;
+                for (size_t k = 0; k < n; ++k)
+                {
+                    for (size_t l = 0; l < n; ++l)
+                    {
+                        winograd += t.output[y * n + k] * product[k * n + l] *
+                                    t.output[x * n + l];
+                    }
+                }
+                double direct = 0.0;
+                for (size_t ic = 0; ic < in_channels; ++ic)
+                {
+                    for (size_t fh = 0; fh < 3; ++fh)
+                    {
+                        for (size_t fw = 0; fw < 3; ++fw)
+                        {
+                            direct +=
+                              quantize(filters[fh][fw][ic][oc]) *
+                              input[(ic * n + y + fh) * n + x + fw];
+                        }
+                    }
+                }
+                max_error = max(max_error, std::fabs(winograd - direct));
+            }
+        }
+    }
+    return max_error;
+}
+
+void WinogradConv2D::forward(TensorArena& arena) const
+{
+    const Ciphertext3D& input = arena.tensor();
+    cout << "\tForwarding " << name() << "..." << endl;
+    cout << "\t  input shape: " << input.shape()[0] << "x" << input.shape()[1]
+         << "x" << input.shape()[2] << endl;
+    const WinogradTransform& t = transform(tile_);
+    const size_t n = t.size;
+    // outputs without taps of weights are zero
+    const seal::parms_id_type input_parms_id = input.data()[0].parms_id();
+    const size_t input_size = input.data()[0].size();
+    const double product_scale =
+      input.data()[0].scale() *
+      weightScale(plain_filters_.data(), plain_filters_.num_elements());
+
+    // Tiles are transformed, multiplied and transformed back by rows of
+    // tiles, so that transformed inputs and products are held only for one
+    // row of tiles (and their buffers are reused by the next row).
+    Ciphertext3D& output =
+      arena.nextTensor(out_height_, out_width_, filter_size_);
+    vector<Ciphertext> transformed(tiles_width_ * n * n * in_channels_);
+    vector<Ciphertext> products(tiles_width_ * n * n * filter_size_);
+    vector<const Ciphertext*> taps;
+    vector<size_t> tap_channels;
+    vector<const ScalarPlaintext*> weights;
+    vector<Ciphertext*> outputs;
+    for (size_t th = 0; th < tiles_height_; ++th)
+    {
+        // B^T d B of input tiles at [tile][n * n][in_channels]
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2)
+#endif
+        for (size_t tw = 0; tw < tiles_width_; ++tw)
+        {
+            for (size_t ic = 0; ic < in_channels_; ++ic)
+            {
+                vector<const Ciphertext*> tile(n * n, nullptr);
+                for (size_t i = 0; i < n; ++i)
+                {
+                    for (size_t j = 0; j < n; ++j)
+                    {
+                        const long ih = static_cast<long>(th * tile_ + i) -
+                                        static_cast<long>(pad_top_);
+                        const long iw = static_cast<long>(tw * tile_ + j) -
+                                        static_cast<long>(pad_left_);
+                        if (ih < 0 || iw < 0 ||
+                            ih >= static_cast<long>(in_height_) ||
+                            iw >= static_cast<long>(in_width_))
+                            continue;
+                        tile[i * n + j] = &input[ih][iw][ic];
+                    }
+                }
+                vector<Ciphertext*> result(n * n);
+                for (size_t p = 0; p < n * n; ++p)
+                {
+                    result[p] =
+                      &transformed[(tw * n * n + p) * in_channels_ + ic];
+                }
+                sandwich(t.input.data(), t.input.data(), n, n, n, tile.data(),
+                         result.data(), option_);
+            }
+        }
+
+        // elementwise products summed over input channels at
+        // [tile][n * n][filter_size]
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2) private(taps, tap_channels, weights, \
+                                             outputs)
+#endif
+        for (size_t tw = 0; tw < tiles_width_; ++tw)
+        {
+            for (size_t p = 0; p < n * n; ++p)
+            {
+                taps.clear();
+                tap_channels.clear();
+                for (size_t ic = 0; ic < in_channels_; ++ic)
+                {
+                    const Ciphertext& tap =
+                      transformed[(tw * n * n + p) * in_channels_ + ic];
+                    if (tap.size() > 0)
+                    {
+                        taps.push_back(&tap);
+                        tap_channels.push_back(ic);
+                    }
+                }
+                if (taps.empty())
+                {
+                    // (products left by the row before are zero here)
+                    for (size_t oc = 0; oc < filter_size_; ++oc)
+                    {
+                        products[(tw * n * n + p) * filter_size_ + oc] =
+                          Ciphertext();
+                    }
+                    continue;
+                }
+                weights.resize(filter_size_ * taps.size());
+                outputs.resize(filter_size_);
+                for (size_t oc = 0; oc < filter_size_; ++oc)
+                {
+                    for (size_t k = 0; k < taps.size(); ++k)
+                    {
+                        weights[oc * taps.size() + k] =
+                          &plain_filters_.data()[(p * in_channels_ +
+                                                  tap_channels[k]) *
+                                                   filter_size_ +
+                                                 oc];
+                    }
+                    outputs[oc] =
+                      &products[(tw * n * n + p) * filter_size_ + oc];
+                }
+                multiplyAccumulate(taps, weights, outputs, option_);
+            }
+        }
+
+        // A^T M A of output tiles, then rescale and add biases
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2)
+#endif
+        for (size_t tw = 0; tw < tiles_width_; ++tw)
+        {
+            for (size_t oc = 0; oc < filter_size_; ++oc)
+            {
+                vector<const Ciphertext*> tile(n * n);
+                for (size_t p = 0; p < n * n; ++p)
+                {
+                    tile[p] = &products[(tw * n * n + p) * filter_size_ + oc];
+                }
+                // output tile is written in place, and its pixels out of
+                // output to scratch
+                vector<Ciphertext> scratch(tile_ * tile_);
+                vector<Ciphertext*> result(tile_ * tile_);
+                for (size_t y = 0; y < tile_; ++y)
+                {
+                    for (size_t x = 0; x < tile_; ++x)
+                    {
+                        const size_t oh = th * tile_ + y;
+                        const size_t ow = tw * tile_ + x;
+                        result[y * tile_ + x] =
+                          oh < out_height_ && ow < out_width_
+                            ? &output[oh][ow][oc]
+                            : &scratch[y * tile_ + x];
+                    }
+                }
+                sandwich(t.output.data(), t.output.data(), tile_, tile_, n,
+                         tile.data(), result.data(), option_);
+                for (size_t y = 0; y < tile_; ++y)
+                {
+                    for (size_t x = 0; x < tile_; ++x)
+                    {
+                        const size_t oh = th * tile_ + y;
+                        const size_t ow = tw * tile_ + x;
+                        if (oh >= out_height_ || ow >= out_width_)
+                            continue;
+                        Ciphertext& destination = output[oh][ow][oc];
+                        if (destination.size() == 0)
+                        {
+                            setZero(input_parms_id, product_scale,
+                                    input_size, option_, destination);
+                        }
+                        option_.evaluator.rescale_to_next_inplace(
+                          destination, option_.pool());
+                        option_.evaluator.add_plain_inplace(destination,
+                                                            plain_biases_[oc]);
+                    }
+                }
+            }
+        }
+    }
+
+#ifdef __DEBUG__
+    Plaintext plain;
+    vector<double> vec_tmp;
+    std::ofstream debug_file;
+    debug_file.open(DEBUG_FILE_PATH, std::ios::app);
+    debug_file << "In " << name() << ":" << endl;
+    for (size_t oh = 0; oh < out_height_; ++oh)
+    {
+        for (size_t ow = 0; ow < out_width_; ++ow)
+        {
+            for (size_t oc = 0; oc < filter_size_; ++oc)
+            {
+                gTool.decryptor()->decrypt(output[oh][ow][oc], plain);
+                gTool.encoder()->decode(plain, vec_tmp);
+                debug_file << "\toutput[" << oh << "][" << ow << "][" << oc
+                           << "]: " << vec_tmp[0] << ", " << vec_tmp[1] << ", "
+                           << vec_tmp[2] << endl;
+            }
+        }
+    }
+#endif
+    arena.swapTensors();
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "layer.hpp"
+
+using std::size_t;
+
+const string WINOGRAD_CONV2D_CLASS_NAME = "WinogradConv2D";
+
+/**
+ * Transform matrices of Winograd minimal filtering F(m x m, 3 x 3)
+ * For input tile d (n x n, n = m + 2) and filter g (3 x 3), output tile is
+ * A^T [(G g G^T) * (B^T d B)] A, where * is elementwise product.
+ * Entries of B^T and A^T are small integers, so that input and output
+ * transforms of ciphertexts are additions and integer multiplications which
+ * do not consume levels.
+ */
+struct WinogradTransform
+{
+    size_t tile;             // m
+    size_t size;             // n
+    vector<int> input;       // B^T (n x n)
+    vector<int> output;      // A^T (m x n)
+    vector<double> filter;   // G (n x 3)
+};
+
+/**
+ * Stride 1 3x3 convolution by Winograd minimal filtering
+ * Each n x n input tile costs n * n multiplications per input and output
+ * channel instead of 9 * m * m of Conv2D, that is 2.25 times fewer for
+ * F(2x2, 3x3) and 4 times fewer for F(4x4, 3x3). Filters are transformed in
+ * plaintext when the network is built.
+ */
+class WinogradConv2D : public Layer
+{
+public:
+    /**
+     * @param tile: output tile size m (2 or 4)
+     * @param plain_filters: transformed filters G g G^T at
+     * [n][n][in_channels][filter_size]
+     */
+    WinogradConv2D(const string& name, const size_t& in_height,
+                   const size_t& in_width, const size_t& in_channels,
+                   const size_t& filter_size, const size_t& tile,
+                   const string& padding, const string& activation,
+                   const ScalarPlaintext4D& plain_filters,
+                   const vector<Plaintext>& plain_biases, OptOption& option);
+    ~WinogradConv2D();
+
+    void printInfo() const override;
+    void forward(TensorArena& arena) const override;
+    size_t weightBytes() const override;
+    void save(SnapshotWriter& writer) const override;
+
+    static const WinogradTransform& transform(const size_t& tile);
+    static void transformFilters(const size_t& tile, const float4D& filters,
+                                 vector<double>& transformed);
+    static double maxTransformError(const size_t& tile, const float4D& filters,
+                                    const vector<double>& transformed,
+                                    const double& scale);
+
+private:
+    size_t in_height_;
+    size_t in_width_;
+    size_t in_channels_;
+    size_t filter_size_;
+    size_t tile_;
+    string padding_;
+    string activation_;
+    size_t out_height_;
+    size_t out_width_;
+    size_t pad_top_;
+    size_t pad_left_;
+    size_t tiles_height_;
+    size_t tiles_width_;
+    ScalarPlaintext4D plain_filters_;
+    vector<Plaintext> plain_biases_;
+
+    OptOption& option_;
+};
@@ -35,9 +35,15 @@ struct Server::Impl
 public:
     Impl(const char* port, stdsc::CallbackFunctionContainer& callback,
          stdsc::StateContext& state, const uint32_t max_concurrent_queries,
-         const uint32_t max_results, const uint32_t result_lifetime_sec)
-      : calc_manager_(new CalcManager(max_concurrent_queries, max_results,
-                                      result_lifetime_sec)),
+         const uint32_t max_results, const uint32_t result_lifetime_sec,
+         const uint32_t max_network_cache_mb, const std::string& snapshot_dir,
+         const float sparsity_threshold, const uint32_t tile_size,
+         const bool use_thread_local_pool, const uint32_t memory_budget_mb,
+         const std::string& spill_dir)
+      : calc_manager_(new CalcManager(
+          max_concurrent_queries, max_results, result_lifetime_sec,
+          max_network_cache_mb, snapshot_dir, sparsity_threshold, tile_size,
+          use_thread_local_pool, memory_budget_mb, spill_dir)),
         key_container_(new KeyContainer()),
         param_(new CallbackParam()),
         cparam_(new CommonCallbackParam(*calc_manager_, *key_container_))
@@ -85,9 +91,15 @@ private:
 Server::Server(const char* port, stdsc::CallbackFunctionContainer& callback,
                stdsc::StateContext& state,
                const uint32_t max_concurrent_queries,
-               const uint32_t max_results, const uint32_t result_lifetime_sec)
+               const uint32_t max_results, const uint32_t result_lifetime_sec,
+               const uint32_t max_network_cache_mb,
+               const std::string& snapshot_dir, const float sparsity_threshold,
+               const uint32_t tile_size, const bool use_thread_local_pool,
+               const uint32_t memory_budget_mb, const std::string& spill_dir)
   : pimpl_(new Impl(port, callback, state, max_concurrent_queries, max_results,
-                    result_lifetime_sec))
+                    result_lifetime_sec, max_network_cache_mb, snapshot_dir,
+                    sparsity_threshold, tile_size, use_thread_local_pool,
+                    memory_budget_mb, spill_dir))
 {
 }
 
@@ -45,6 +45,17 @@ public:
      * @param[in] max_concurrent_queries max concurrent query number
      * @param[in] max_results            max result number
      * @param[in] result_lifetime_sec    result linefile (sec)
+     * @param[in] max_network_cache_mb   max network cache size (MB)
+     * @param[in] snapshot_dir           network snapshot directory
+     * @param[in] sparsity_threshold     threshold of weights to drop
+     * @param[in] tile_size              size of output tiles of Conv2D chains
+     *                                   (0: not tiled)
+     * @param[in] use_thread_local_pool  use memory pool of each thread for
+     *                                   evaluation
+     * @param[in] memory_budget_mb       max size of feature maps held in
+     *                                   memory by a query (MB, 0: unlimited)
+     * @param[in] spill_dir              directory of feature maps spilled
+     *                                   over memory budget
      */
     Server(const char* port, stdsc::CallbackFunctionContainer& callback,
            stdsc::StateContext& state,
@@ -52,7 +63,16 @@ public:
              PPCNN_DEFAULT_MAX_CONCURRENT_QUERIES,
            const uint32_t max_results = PPCNN_DEFAULT_MAX_RESULTS,
            const uint32_t result_lifetime_sec =
-             PPCNN_DEFAULT_MAX_RESULT_LIFETIME_SEC);
+             PPCNN_DEFAULT_MAX_RESULT_LIFETIME_SEC,
+           const uint32_t max_network_cache_mb =
+             PPCNN_DEFAULT_MAX_NETWORK_CACHE_MB,
+           const std::string& snapshot_dir = PPCNN_DEFAULT_SNAPSHOT_DIR,
+           const float sparsity_threshold = PPCNN_DEFAULT_SPARSITY_THRESHOLD,
+           const uint32_t tile_size = PPCNN_DEFAULT_TILE_SIZE,
+           const bool use_thread_local_pool =
+             PPCNN_DEFAULT_USE_THREAD_LOCAL_POOL,
+           const uint32_t memory_budget_mb = PPCNN_DEFAULT_MEMORY_BUDGET_MB,
+           const std::string& spill_dir = PPCNN_DEFAULT_SPILL_DIR);
     ~Server(void) = default;
 
     /**
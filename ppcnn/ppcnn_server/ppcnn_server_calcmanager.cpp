@@ -17,17 +17,22 @@
 
 #include <unistd.h>
 #include <fstream>
+#include <unordered_map>
 #include <vector>
 
 #include <stdsc/stdsc_exception.hpp>
 #include <stdsc/stdsc_log.hpp>
 
+#include <ppcnn_share/cnn_utils/opt_option.hpp>
+#include <ppcnn_share/ppcnn_computation_params.hpp>
 #include <ppcnn_share/ppcnn_define.hpp>
 #include <ppcnn_share/ppcnn_utility.hpp>
 #include <ppcnn_server/ppcnn_server_result.hpp>
 #include <ppcnn_server/ppcnn_server_calcmanager.hpp>
 #include <ppcnn_server/ppcnn_server_calcthread.hpp>
+#include <ppcnn_server/ppcnn_server_networkcache.hpp>
 #include <ppcnn_server/ppcnn_server_query.hpp>
+#include <ppcnn_server/cnn/load_model.hpp>
 
 namespace ppcnn_server
 {
@@ -50,26 +55,49 @@ struct EncryptionKeys
 struct CalcManager::Impl
 {
     Impl(const uint32_t max_concurrent_queries, const uint32_t max_results,
-         const uint32_t result_lifetime_sec)
+         const uint32_t result_lifetime_sec,
+         const uint32_t max_network_cache_mb, const std::string& snapshot_dir,
+         const float sparsity_threshold, const uint32_t tile_size,
+         const bool use_thread_local_pool, const uint32_t memory_budget_mb,
+         const std::string& spill_dir)
       : max_concurrent_queries_(max_concurrent_queries),
         max_results_(max_results),
-        result_lifetime_sec_(result_lifetime_sec)
+        result_lifetime_sec_(result_lifetime_sec),
+        tile_size_(tile_size),
+        memory_budget_mb_(memory_budget_mb),
+        spill_dir_(spill_dir),
+        network_cache_(static_cast<size_t>(max_network_cache_mb) * 1024 * 1024,
+                       snapshot_dir, sparsity_threshold, use_thread_local_pool)
     {
     }
 
     const uint32_t max_concurrent_queries_;
     const uint32_t max_results_;
     const uint32_t result_lifetime_sec_;
+    const uint32_t tile_size_;
+    const uint32_t memory_budget_mb_;
+    const std::string spill_dir_;
     QueryQueue qque_;
     ResultQueue rque_;
+    NetworkCache network_cache_;
     std::vector<std::shared_ptr<CalcThread>> threads_;
     std::unordered_map<int32_t, EncryptionKeys> keymap_;
 };
 
 CalcManager::CalcManager(const uint32_t max_concurrent_queries,
                          const uint32_t max_results,
-                         const uint32_t result_lifetime_sec)
-  : pimpl_(new Impl(max_concurrent_queries, max_results, result_lifetime_sec))
+                         const uint32_t result_lifetime_sec,
+                         const uint32_t max_network_cache_mb,
+                         const std::string& snapshot_dir,
+                         const float sparsity_threshold,
+                         const uint32_t tile_size,
+                         const bool use_thread_local_pool,
+                         const uint32_t memory_budget_mb,
+                         const std::string& spill_dir)
+  : pimpl_(new Impl(max_concurrent_queries, max_results, result_lifetime_sec,
+                    max_network_cache_mb, snapshot_dir, sparsity_threshold,
+                    tile_size, use_thread_local_pool, memory_budget_mb,
+                    spill_dir))
 {
 }
 
@@ -80,7 +108,9 @@ void CalcManager::start_threads(const uint32_t thread_num)
     for (size_t i = 0; i < thread_num; ++i)
     {
         pimpl_->threads_.emplace_back(
-          std::make_shared<CalcThread>(pimpl_->qque_, pimpl_->rque_));
+          std::make_shared<CalcThread>(
+            pimpl_->qque_, pimpl_->rque_, pimpl_->network_cache_,
+            pimpl_->tile_size_, pimpl_->memory_budget_mb_, pimpl_->spill_dir_));
     }
 
     for (const auto& thread : pimpl_->threads_)
@@ -103,6 +133,21 @@ void CalcManager::regist_enckeys(const int32_t key_id,
     pimpl_->keymap_.emplace(key_id, enckeys);
 }
 
+size_t CalcManager::plan_levels(
+  const ppcnn_share::ComputationParams& params) const
+{
+    std::string model_structure_path, model_weights_path;
+    get_model_paths(params, CalcThreadParam().plaintext_experiment_path,
+                    model_structure_path, model_weights_path);
+
+    STDSC_LOG_INFO("Planning levels of model. (%s)",
+                   params.to_string().c_str());
+    GraphOption option(static_cast<EOptLevel>(params.opt_level),
+                       static_cast<EActivation>(params.activation));
+    return planLevels(model_structure_path, model_weights_path, option)
+      .levels;
+}
+
 int32_t CalcManager::push_query(const Query& query)
 {
     STDSC_LOG_INFO("Set queries.");
@@ -29,6 +29,11 @@ class PublicKey;
 class RelinKeys;
 } // namespace seal
 
+namespace ppcnn_share
+{
+struct ComputationParams;
+}
+
 namespace ppcnn_server
 {
 
@@ -43,9 +48,25 @@ public:
      * @param[in] max_concurrent_queries max number of concurrent queries
      * @param[in] max_results max        result number to hold
      * @param[in] result_lifetime_sec    lifetime to hold (sec)
+     * @param[in] max_network_cache_mb   max size of built networks to hold (MB)
+     * @param[in] snapshot_dir           directory of network snapshots
+     * @param[in] sparsity_threshold     weights smaller than this are dropped
+     * @param[in] tile_size              size of output tiles of Conv2D chains
+     *                                   (0: not tiled)
+     * @param[in] use_thread_local_pool  use memory pool of each thread for
+     *                                   evaluation
+     * @param[in] memory_budget_mb       max size of feature maps held in
+     *                                   memory by a query (MB, 0: unlimited)
+     * @param[in] spill_dir              directory of feature maps spilled
+     *                                   over memory budget
      */
     CalcManager(const uint32_t max_concurrent_queries,
-                const uint32_t max_results, const uint32_t result_lifetime_sec);
+                const uint32_t max_results, const uint32_t result_lifetime_sec,
+                const uint32_t max_network_cache_mb,
+                const std::string& snapshot_dir,
+                const float sparsity_threshold, const uint32_t tile_size,
+                const bool use_thread_local_pool,
+                const uint32_t memory_budget_mb, const std::string& spill_dir);
     virtual ~CalcManager() = default;
 
     /**
@@ -70,6 +91,13 @@ public:
                         const seal::PublicKey& pubkey,
                         const seal::RelinKeys& relinkey);
 
+    /**
+     * Plan levels consumed by model of computation params
+     * @param[in] params computation params (model, opt level and activation)
+     * @return minimal level of encryption parameters to compute the model
+     */
+    size_t plan_levels(const ppcnn_share::ComputationParams& params) const;
+
     /**
      * Set queries
      * @param[in] query query
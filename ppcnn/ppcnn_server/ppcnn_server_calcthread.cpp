@@ -34,10 +34,12 @@
 #include <ppcnn_server/cnn/picojson.h>
 #include <ppcnn_server/ppcnn_server_calcthread.hpp>
 #include <ppcnn_server/ppcnn_server_keycontainer.hpp>
+#include <ppcnn_server/ppcnn_server_networkcache.hpp>
 #include <ppcnn_server/ppcnn_server_query.hpp>
 #include <ppcnn_server/ppcnn_server_result.hpp>
 #include <ppcnn_server/cnn/load_model.hpp>
 #include <ppcnn_server/cnn/network.hpp>
+#include <ppcnn_server/cnn/tensor_arena.hpp>
 
 //#define ENABLE_LOCAL_DEBUG
 
@@ -48,45 +50,8 @@ static Network BuildNetwork(const std::string& model_structure_path,
                             const std::string& model_weights_path,
                             OptOption& option)
 {
-    Network network;
-    picojson::array layers = loadLayers(model_structure_path);
-
-    if (option.enable_fuse_layers)
-    {
-        for (picojson::array::const_iterator it = layers.cbegin(),
-                                             layers_end = layers.cend();
-             it != layers_end; ++it)
-        {
-            picojson::object layer = (*it).get<picojson::object>();
-            const string layer_class_name = layer["class_name"].get<string>();
-
-            if (it + 1 != layers_end)
-            {
-                picojson::object next_layer =
-                  (*(it + 1)).get<picojson::object>();
-                network.addLayer(buildLayer(layer, next_layer, layer_class_name,
-                                            model_weights_path, it, option));
-            }
-            else
-            {
-                network.addLayer(buildLayer(layer, layer_class_name,
-                                            model_weights_path, option));
-            }
-        }
-        return network;
-    }
-
-    for (picojson::array::const_iterator it = layers.cbegin(),
-                                         layers_end = layers.cend();
-         it != layers_end; ++it)
-    {
-        picojson::object layer = (*it).get<picojson::object>();
-        const string layer_class_name = layer["class_name"].get<string>();
-        network.addLayer(
-          buildLayer(layer, layer_class_name, model_weights_path, option));
-    }
-
-    return network;
+    ModelBuilder builder(model_weights_path, option);
+    return builder.build(loadLayers(model_structure_path));
 }
 
 #define LOGINFO(fmt, ...) \
@@ -94,8 +59,17 @@ static Network BuildNetwork(const std::string& model_structure_path,
 
 struct CalcThread::Impl
 {
-    Impl(QueryQueue& in_queue, ResultQueue& out_queue)
-      : in_queue_(in_queue), out_queue_(out_queue)
+    Impl(QueryQueue& in_queue, ResultQueue& out_queue,
+         NetworkCache& network_cache, const uint32_t tile_size,
+         const uint32_t memory_budget_mb, const std::string& spill_dir)
+      : in_queue_(in_queue),
+        out_queue_(out_queue),
+        network_cache_(network_cache),
+        tile_size_(tile_size),
+        memory_budget_mb_(memory_budget_mb),
+        spill_dir_(spill_dir),
+        ciphertext_pool_(static_cast<size_t>(PPCNN_MAX_CIPHERTEXT_POOL_MB) *
+                         1024 * 1024)
     {
     }
 
@@ -118,28 +92,9 @@ struct CalcThread::Impl
 
             LOGINFO("Get query. (%s)", query.params_.to_string().c_str());
 
-            const auto dataset_name = std::string(query.params_.dataset);
-            const auto model_name = std::string(query.params_.model);
-            const std::string base_model_path = args.plaintext_experiment_path +
-                                                dataset_name +
-                                                "/saved_models/" + model_name;
-            const std::string model_structure_path =
-              base_model_path + "_structure.json";
-            const std::string model_weights_path =
-              base_model_path + "_weights.h5";
-
-            if (!ppcnn_share::utility::file_exist(model_structure_path))
-            {
-                std::ostringstream oss;
-                oss << "File not fount. (" << model_structure_path << ")";
-                STDSC_THROW_FILE(oss.str());
-            }
-            if (!ppcnn_share::utility::file_exist(model_weights_path))
-            {
-                std::ostringstream oss;
-                oss << "File not fount. (" << model_weights_path << ")";
-                STDSC_THROW_FILE(oss.str());
-            }
+            std::string model_structure_path, model_weights_path;
+            get_model_paths(query.params_, args.plaintext_experiment_path,
+                            model_structure_path, model_weights_path);
 
             std::vector<Ciphertext> encrypted_results(query.params_.labels);
 
@@ -168,86 +123,109 @@ struct CalcThread::Impl
     bool compute(const int32_t th_id, const int32_t query_id,
                  const ppcnn_share::ComputationParams& params,
                  const EncryptionKeys& enc_keys,
-                 const std::vector<seal::Ciphertext>& ctxts,
+                 std::vector<seal::Ciphertext>& ctxts,
                  const std::string& model_structure_path,
                  const std::string& model_weights_path,
                  std::vector<Ciphertext>& encrypted_results)
     {
         LOGINFO("Start computation.\n");
         bool res = true;
-        auto context = seal::SEALContext::Create(*(enc_keys.params));
-
-        auto& pubkey = *(enc_keys.pubkey);
-        auto& relin_keys = *(enc_keys.relinkey);
-        std::shared_ptr<seal::Evaluator> evaluator(
-          new seal::Evaluator(context));
-        std::shared_ptr<seal::CKKSEncoder> encoder(
-          new seal::CKKSEncoder(context));
-
-        auto opt_level = static_cast<EOptLevel>(params.opt_level);
-        auto activation = static_cast<EActivation>(params.activation);
-        OptOption option(opt_level, activation, relin_keys, *evaluator,
-                         *encoder);
-
-        auto trained_model_name = std::string(params.model);
-        if (option.enable_optimize_activation)
+        // Errors of a query (e.g. a spilled feature map over the memory
+        // budget) fail the query, and the thread takes the next one.
+        try
         {
-            if (trained_model_name.find("CKKS-swish_rg4_deg4") !=
-                  std::string::npos ||
-                activation == SWISH_RG4_DEG4)
-            {
-                option.highest_deg_coeff = SWISH_RG4_DEG4_COEFFS.front();
-            }
-            else if (trained_model_name.find("CKKS-swish_rg6_deg4") !=
-                       string::npos ||
-                     activation == SWISH_RG6_DEG4)
+            auto context = seal::SEALContext::Create(*(enc_keys.params));
+            auto& relin_keys = *(enc_keys.relinkey);
+
+            NetworkCacheKey key;
+            key.dataset = std::string(params.dataset);
+            key.model = std::string(params.model);
+            key.opt_level = params.opt_level;
+            key.activation = params.activation;
+            key.parms_id = context->key_parms_id();
+            key.model_stamp =
+              stampModel(model_structure_path, model_weights_path);
+
+            auto compiled = network_cache_.get(
+              key, *(enc_keys.params), [&](CompiledNetwork& compiled) {
+                  auto& option = *compiled.option;
+                  LOGINFO("Buiding network from trained model...\n");
+                  *compiled.network = BuildNetwork(model_structure_path,
+                                                   model_weights_path, option);
+                  STDSC_LOG_INFO("Finish buiding.\n");
+              });
+            const auto& network = *compiled->network;
+            LOGINFO("Network cache. (%s)",
+                    network_cache_.stats().to_string().c_str());
+
+            network.printStructure();
+
+            LOGINFO("Predicting...\n");
+
+            const auto rows = params.img_height;
+            const auto cols = params.img_width;
+            const auto channels = params.img_channels;
+            // Buffers of outputs of layers are reused by the next layers, and
+            // by the next queries through the pool (of the same parameters).
+            // Feature maps over the memory budget of the query are spilled
+            // to disk.
+            ciphertext_pool_.retain(*context);
+            TensorArena arena(
+              &ciphertext_pool_,
+              static_cast<size_t>(memory_budget_mb_) * 1024 * 1024,
+              spill_dir_);
+            Ciphertext3D& encrypted_packed_images =
+              arena.nextTensor(rows, cols, channels);
+
+            auto* dst = encrypted_packed_images.data();
+            std::move(ctxts.begin(), ctxts.end(), dst);
+            arena.swapTensors();
+
+#if defined ENABLE_LOCAL_DEBUG
+            for (size_t i = 0; i < rows * cols * channels; ++i)
             {
-                option.highest_deg_coeff = SWISH_RG6_DEG4_COEFFS.front();
+                std::ostringstream oss;
+                oss << "_enc_inputs-" << i << ".dat";
+                ppcnn_share::seal_utility::write_to_file(oss.str(), dst[i]);
             }
-        }
-
-        LOGINFO("Buiding network from trained model...\n");
-        Network network =
-          BuildNetwork(model_structure_path, model_weights_path, option);
-        STDSC_LOG_INFO("Finish buiding.\n");
-
-        network.printStructure();
-
-        LOGINFO("Predicting...\n");
-
-        const auto rows = params.img_height;
-        const auto cols = params.img_width;
-        const auto channels = params.img_channels;
-        Ciphertext3D encrypted_packed_images(
-          boost::extents[rows][cols][channels]);
+#endif
 
-        auto* dst = encrypted_packed_images.data();
-        std::memcpy(dst, ctxts.data(), sizeof(ctxts[0]) * ctxts.size());
+            encrypted_results = network.predict(arena, relin_keys,
+                                                *compiled->option, tile_size_);
 
-#if defined ENABLE_LOCAL_DEBUG
-        for (size_t i = 0; i < rows * cols * channels; ++i)
+            STDSC_LOG_INFO("Finish predicting.\n");
+            LOGINFO("Memory pools. (%s)",
+                    compiled->option->poolUsage().to_string().c_str());
+        }
+        catch (const std::exception& e)
         {
-            std::ostringstream oss;
-            oss << "_enc_inputs-" << i << ".dat";
-            ppcnn_share::seal_utility::write_to_file(oss.str(), dst[i]);
+            STDSC_LOG_WARN("[th:%d,query:%d] Failed to compute. (%s)", th_id,
+                           query_id, e.what());
+            encrypted_results.assign(params.labels, Ciphertext());
+            res = false;
         }
-#endif
-
-        encrypted_results = network.predict(encrypted_packed_images);
-
-        STDSC_LOG_INFO("Finish predicting.\n");
 
         return res;
     }
 
     QueryQueue& in_queue_;
     ResultQueue& out_queue_;
+    NetworkCache& network_cache_;
+    const uint32_t tile_size_;
+    const uint32_t memory_budget_mb_;
+    const std::string spill_dir_;
+    CiphertextPool ciphertext_pool_;
     CalcThreadParam param_;
     std::shared_ptr<stdsc::ThreadException> te_;
 };
 
-CalcThread::CalcThread(QueryQueue& in_queue, ResultQueue& out_queue)
-  : pimpl_(new Impl(in_queue, out_queue))
+CalcThread::CalcThread(QueryQueue& in_queue, ResultQueue& out_queue,
+                       NetworkCache& network_cache,
+                       const uint32_t tile_size,
+                       const uint32_t memory_budget_mb,
+                       const std::string& spill_dir)
+  : pimpl_(new Impl(in_queue, out_queue, network_cache, tile_size,
+                    memory_budget_mb, spill_dir))
 {
 }
 
@@ -269,4 +247,31 @@ void CalcThread::exec(CalcThreadParam& args,
     pimpl_->exec(args, te);
 }
 
+void get_model_paths(const ppcnn_share::ComputationParams& params,
+                     const std::string& plaintext_experiment_path,
+                     std::string& model_structure_path,
+                     std::string& model_weights_path)
+{
+    const auto dataset_name = std::string(params.dataset);
+    const auto model_name = std::string(params.model);
+    const std::string base_model_path = plaintext_experiment_path +
+                                        dataset_name + "/saved_models/" +
+                                        model_name;
+    model_structure_path = base_model_path + "_structure.json";
+    model_weights_path = base_model_path + "_weights.h5";
+
+    if (!ppcnn_share::utility::file_exist(model_structure_path))
+    {
+        std::ostringstream oss;
+        oss << "File not fount. (" << model_structure_path << ")";
+        STDSC_THROW_FILE(oss.str());
+    }
+    if (!ppcnn_share::utility::file_exist(model_weights_path))
+    {
+        std::ostringstream oss;
+        oss << "File not fount. (" << model_weights_path << ")";
+        STDSC_THROW_FILE(oss.str());
+    }
+}
+
 } /* namespace ppcnn_server */
@@ -20,18 +20,25 @@
 
 #include <cstdbool>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include <stdsc/stdsc_thread.hpp>
 
 #include <ppcnn_share/ppcnn_define.hpp>
 
+namespace ppcnn_share
+{
+struct ComputationParams;
+}
+
 namespace ppcnn_server
 {
 
 class CalcThreadParam;
 class QueryQueue;
 class ResultQueue;
+class NetworkCache;
 
 /**
  * @brief Calculation thread
@@ -45,8 +52,16 @@ public:
      * Constructor
      * @param[in] in_queue query queue
      * @param[out] out_queue result queue
+     * @param[in] network_cache cache of built networks
+     * @param[in] tile_size size of output tiles of Conv2D chains (0: not tiled)
+     * @param[in] memory_budget_mb max size of feature maps held in memory by
+     *            a query (MB, 0: unlimited)
+     * @param[in] spill_dir directory of feature maps spilled over memory
+     *            budget
      */
-    CalcThread(QueryQueue& in_queue, ResultQueue& out_queue);
+    CalcThread(QueryQueue& in_queue, ResultQueue& out_queue,
+               NetworkCache& network_cache, const uint32_t tile_size,
+               const uint32_t memory_budget_mb, const std::string& spill_dir);
     virtual ~CalcThread(void) = default;
 
     /**
@@ -81,6 +96,18 @@ struct CalcThreadParam
       PPCNN_DEFAULT_PLAINTEXT_EXPERIMENT_PATH;
 };
 
+/**
+ * Get paths of trained model of computation params
+ * @param[in] params computation params
+ * @param[in] plaintext_experiment_path directory of trained models
+ * @param[out] model_structure_path path of model structure (JSON)
+ * @param[out] model_weights_path path of model weights (HDF5)
+ */
+void get_model_paths(const ppcnn_share::ComputationParams& params,
+                     const std::string& plaintext_experiment_path,
+                     std::string& model_structure_path,
+                     std::string& model_weights_path);
+
 } /* namespace ppcnn_server */
 
 #endif /* PPCNN_SERVER_CALCTHREAD_HPP */
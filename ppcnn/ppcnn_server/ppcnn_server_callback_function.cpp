@@ -215,4 +215,53 @@ DEFUN_UPDOWNLOAD(CallbackFunctionResultRequest)
     state.set(kEventResultRequest);
 }
 
+// CallbackFunction for Levels Request
+DEFUN_UPDOWNLOAD(CallbackFunctionLevelsRequest)
+{
+    STDSC_LOG_INFO("Received levels request. (current state : %s)",
+                   state.current_state_str().c_str());
+
+    DEF_CDATA_ON_ALL(ppcnn_server::CommonCallbackParam);
+    auto& calc_manager = cdata_a->calc_manager_;
+
+    stdsc::BufferStream rbuffstream(buffer);
+    std::iostream rstream(&rbuffstream);
+
+    ppcnn_share::PlainData<ppcnn_share::ComputationParams> rplaindata;
+    rplaindata.load(rstream);
+    const auto& comp_params = rplaindata.data();
+    STDSC_LOG_INFO("Levels request params: comp_params: {%s}",
+                   comp_params.to_string().c_str());
+
+    ppcnn_share::Srv2CliLevelsParam s2c_param;
+    try
+    {
+        s2c_param.levels = calc_manager.plan_levels(comp_params);
+        s2c_param.result = ppcnn_share::kServerCalcResultSuccess;
+    }
+    catch (const std::exception& ex)
+    {
+        STDSC_LOG_WARN("Failed to plan levels. (%s)", ex.what());
+        s2c_param.levels = 0;
+        s2c_param.result = ppcnn_share::kServerCalcResultFailed;
+    }
+    STDSC_LOG_INFO("Levels request ack: result: %d, levels: %lu",
+                   s2c_param.result, s2c_param.levels);
+
+    ppcnn_share::PlainData<ppcnn_share::Srv2CliLevelsParam> splaindata;
+    splaindata.push(s2c_param);
+
+    auto sz = splaindata.stream_size();
+    stdsc::BufferStream sbuffstream(sz);
+    std::iostream sstream(&sbuffstream);
+
+    splaindata.save(sstream);
+
+    stdsc::Buffer* bsbuff = &sbuffstream;
+    sock.send_packet(
+      stdsc::make_data_packet(ppcnn_share::kControlCodeDataLevels, sz));
+    sock.send_buffer(*bsbuff);
+    state.set(kEventLevelsRequest);
+}
+
 } /* namespace ppcnn_server */
@@ -38,6 +38,11 @@ DECLARE_UPDOWNLOAD_CLASS(CallbackFunctionQuery);
  */
 DECLARE_UPDOWNLOAD_CLASS(CallbackFunctionResultRequest);
 
+/**
+ * @brief Provides callback function in receiving levels request.
+ */
+DECLARE_UPDOWNLOAD_CLASS(CallbackFunctionLevelsRequest);
+
 } /* namespace ppcnn_server */
 
 #endif /* PPCNN_SERVER_CALLBACK_FUNCTION_HPP */
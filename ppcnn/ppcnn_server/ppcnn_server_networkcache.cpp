@@ -0,0 +1,359 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <future>
+#include <iomanip>
+#include <list>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <tuple>
+
+#include <stdsc/stdsc_log.hpp>
+
+#include <ppcnn_share/cnn_utils/opt_option.hpp>
+#include <ppcnn_share/cnn_utils/types.h>
+#include <ppcnn_share/ppcnn_utility.hpp>
+#include <ppcnn_server/cnn/network.hpp>
+#include <ppcnn_server/cnn/snapshot.hpp>
+#include <ppcnn_server/ppcnn_server_networkcache.hpp>
+
+namespace ppcnn_server
+{
+
+bool NetworkCacheKey::operator<(const NetworkCacheKey& other) const
+{
+    return std::tie(dataset, model, opt_level, activation, parms_id,
+                    model_stamp) <
+           std::tie(other.dataset, other.model, other.opt_level,
+                    other.activation, other.parms_id, other.model_stamp);
+}
+
+bool NetworkCacheKey::operator==(const NetworkCacheKey& other) const
+{
+    return std::tie(dataset, model, opt_level, activation, parms_id,
+                    model_stamp) ==
+           std::tie(other.dataset, other.model, other.opt_level,
+                    other.activation, other.parms_id, other.model_stamp);
+}
+
+std::string NetworkCacheKey::to_string() const
+{
+    std::ostringstream oss;
+    oss << "dataset: " << dataset;
+    oss << ", model: " << model;
+    oss << ", opt_level: " << opt_level;
+    oss << ", activation: " << activation;
+    oss << ", model mtime: " << model_stamp.structure_mtime << "/"
+        << model_stamp.weights_mtime;
+    oss << ", parms_id: " << std::hex;
+    for (const auto& v : parms_id)
+    {
+        oss << std::setw(16) << std::setfill('0') << v;
+    }
+    return oss.str();
+}
+
+std::string NetworkCacheKey::snapshot_filename(
+  const float sparsity_threshold) const
+{
+    std::ostringstream oss;
+    oss << dataset << "_" << model << "_opt" << opt_level << "_act"
+        << activation << "_sp" << sparsity_threshold << "_" << std::hex;
+    for (const auto& v : parms_id)
+    {
+        oss << std::setw(16) << std::setfill('0') << v;
+    }
+    oss << ".snapshot";
+    return oss.str();
+}
+
+CompiledNetwork::CompiledNetwork(const seal::EncryptionParameters& params,
+                                 const int32_t opt_level,
+                                 const int32_t activation,
+                                 const float sparsity_threshold,
+                                 const bool use_thread_local_pool)
+  : context(seal::SEALContext::Create(params)),
+    evaluator(new seal::Evaluator(context)),
+    encoder(new seal::CKKSEncoder(context)),
+    option(new OptOption(static_cast<EOptLevel>(opt_level),
+                         static_cast<EActivation>(activation), context,
+                         *evaluator, *encoder)),
+    network(new Network()),
+    weight_bytes(0)
+{
+    option->sparsity_threshold = sparsity_threshold;
+    option->use_thread_local_pool = use_thread_local_pool;
+}
+
+std::string NetworkCacheStats::to_string() const
+{
+    std::ostringstream oss;
+    oss << "hits: " << hits;
+    oss << ", misses: " << misses;
+    oss << ", evictions: " << evictions;
+    oss << ", entries: " << entries;
+    oss << ", bytes: " << bytes << "/" << max_bytes;
+    return oss.str();
+}
+
+struct NetworkCache::Impl
+{
+    using value_t = std::shared_ptr<const CompiledNetwork>;
+
+    struct Entry
+    {
+        std::shared_future<value_t> future;
+        std::list<NetworkCacheKey>::iterator lru_pos;
+        size_t bytes = 0;
+        bool ready = false;
+    };
+
+    Impl(const size_t max_bytes, const std::string& snapshot_dir,
+         const float sparsity_threshold, const bool use_thread_local_pool)
+      : max_bytes_(max_bytes),
+        snapshot_dir_(snapshot_dir),
+        sparsity_threshold_(sparsity_threshold),
+        use_thread_local_pool_(use_thread_local_pool)
+    {
+    }
+
+    value_t get(const NetworkCacheKey& key,
+                const seal::EncryptionParameters& params,
+                const builder_t& builder)
+    {
+        std::promise<value_t> promise;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto it = entries_.find(key);
+            if (it != entries_.end())
+            {
+                ++hits_;
+                lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+                auto future = it->second.future;
+                lock.unlock();
+                // waits for the other thread when the network is being built
+                return future.get();
+            }
+
+            ++misses_;
+            lru_.push_front(key);
+            Entry entry;
+            entry.future = promise.get_future().share();
+            entry.lru_pos = lru_.begin();
+            entries_.emplace(key, entry);
+        }
+
+        std::shared_ptr<CompiledNetwork> compiled;
+        try
+        {
+            compiled = load_snapshot(key, params);
+            if (!compiled)
+            {
+                STDSC_LOG_INFO("Building network for cache. (%s)",
+                               key.to_string().c_str());
+                compiled = std::make_shared<CompiledNetwork>(
+                  params, key.opt_level, key.activation, sparsity_threshold_,
+                  use_thread_local_pool_);
+                builder(*compiled);
+                save_snapshot(key, *compiled);
+            }
+            compiled->weight_bytes = compiled->network->weightBytes();
+        }
+        catch (...)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                auto it = entries_.find(key);
+                lru_.erase(it->second.lru_pos);
+                entries_.erase(it);
+            }
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+
+        promise.set_value(compiled);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto& entry = entries_.at(key);
+            entry.bytes = compiled->weight_bytes;
+            entry.ready = true;
+            bytes_ += entry.bytes;
+            evict(key);
+            if (entry.bytes > max_bytes_)
+            {
+                STDSC_LOG_WARN(
+                  "Built network exceeds cache capacity. (%lu > %lu bytes)",
+                  entry.bytes, max_bytes_);
+            }
+        }
+
+        return compiled;
+    }
+
+    NetworkCacheStats stats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        NetworkCacheStats stats;
+        stats.hits = hits_;
+        stats.misses = misses_;
+        stats.evictions = evictions_;
+        stats.entries = entries_.size();
+        stats.bytes = bytes_;
+        stats.max_bytes = max_bytes_;
+        return stats;
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = lru_.begin();
+        while (it != lru_.end())
+        {
+            auto& entry = entries_.at(*it);
+            if (!entry.ready)
+            {
+                ++it;
+                continue;
+            }
+            bytes_ -= entry.bytes;
+            entries_.erase(*it);
+            it = lru_.erase(it);
+        }
+    }
+
+private:
+    std::shared_ptr<CompiledNetwork> load_snapshot(
+      const NetworkCacheKey& key, const seal::EncryptionParameters& params)
+    {
+        if (snapshot_dir_.empty())
+        {
+            return nullptr;
+        }
+        const auto path =
+          snapshot_dir_ + "/" + key.snapshot_filename(sparsity_threshold_);
+        if (!ppcnn_share::utility::file_exist(path))
+        {
+            return nullptr;
+        }
+
+        STDSC_LOG_INFO("Loading network from snapshot. (%s)", path.c_str());
+        try
+        {
+            auto compiled = std::make_shared<CompiledNetwork>(
+              params, key.opt_level, key.activation, sparsity_threshold_,
+              use_thread_local_pool_);
+            *compiled->network =
+              loadSnapshot(path, key.parms_id,
+                           static_cast<EOptLevel>(key.opt_level),
+                           key.model_stamp, *compiled->option);
+            return compiled;
+        }
+        catch (const std::exception& e)
+        {
+            // the network is built again, and the snapshot is overwritten
+            STDSC_LOG_WARN("Failed to load snapshot. (%s)", e.what());
+            return nullptr;
+        }
+    }
+
+    void save_snapshot(const NetworkCacheKey& key,
+                       const CompiledNetwork& compiled)
+    {
+        if (snapshot_dir_.empty())
+        {
+            return;
+        }
+        const auto path =
+          snapshot_dir_ + "/" + key.snapshot_filename(sparsity_threshold_);
+        try
+        {
+            saveSnapshot(path, *compiled.network, key.parms_id,
+                         static_cast<EOptLevel>(key.opt_level),
+                         key.model_stamp, *compiled.option);
+            STDSC_LOG_INFO("Saved network to snapshot. (%s)", path.c_str());
+        }
+        catch (const std::exception& e)
+        {
+            STDSC_LOG_WARN("Failed to save snapshot. (%s)", e.what());
+        }
+    }
+
+    // Evicts least recently used networks until the total size fits in the
+    // capacity. Networks being built and the one just inserted are kept.
+    // Queries holding an evicted network can still use it.
+    void evict(const NetworkCacheKey& keep)
+    {
+        auto it = lru_.end();
+        while (bytes_ > max_bytes_ && it != lru_.begin())
+        {
+            --it;
+            auto& entry = entries_.at(*it);
+            if (!entry.ready || *it == keep)
+            {
+                continue;
+            }
+            STDSC_LOG_INFO("Evict network from cache. (%s)",
+                           it->to_string().c_str());
+            bytes_ -= entry.bytes;
+            ++evictions_;
+            entries_.erase(*it);
+            it = lru_.erase(it);
+        }
+    }
+
+    mutable std::mutex mutex_;
+    std::map<NetworkCacheKey, Entry> entries_;
+    std::list<NetworkCacheKey> lru_;
+    size_t max_bytes_;
+    std::string snapshot_dir_;
+    float sparsity_threshold_;
+    bool use_thread_local_pool_;
+    size_t bytes_ = 0;
+    size_t hits_ = 0;
+    size_t misses_ = 0;
+    size_t evictions_ = 0;
+};
+
+NetworkCache::NetworkCache(const size_t max_bytes,
+                           const std::string& snapshot_dir,
+                           const float sparsity_threshold,
+                           const bool use_thread_local_pool)
+  : pimpl_(new Impl(max_bytes, snapshot_dir, sparsity_threshold,
+                    use_thread_local_pool))
+{
+}
+
+std::shared_ptr<const CompiledNetwork> NetworkCache::get(
+  const NetworkCacheKey& key, const seal::EncryptionParameters& params,
+  const builder_t& builder)
+{
+    return pimpl_->get(key, params, builder);
+}
+
+NetworkCacheStats NetworkCache::stats() const
+{
+    return pimpl_->stats();
+}
+
+void NetworkCache::clear()
+{
+    pimpl_->clear();
+}
+
+} /* namespace ppcnn_server */
@@ -0,0 +1,160 @@
+/*
+ * Copyright 2020 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE‐2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PPCNN_SERVER_NETWORKCACHE_HPP
+#define PPCNN_SERVER_NETWORKCACHE_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <seal/seal.h>
+
+#include <ppcnn_server/cnn/model_stamp.hpp>
+
+class Network;
+struct OptOption;
+
+namespace ppcnn_server
+{
+
+/**
+ * @brief This class is used to identify a built network.
+ * Encoded weights depend only on the encryption parameters, so the keys of
+ * the client are not a part of the key. Model files are identified by their
+ * stamp, so that a model replaced while the server runs is built again.
+ */
+struct NetworkCacheKey
+{
+    std::string dataset;
+    std::string model;
+    int32_t opt_level;
+    int32_t activation;
+    seal::parms_id_type parms_id;
+    ModelStamp model_stamp;
+
+    bool operator<(const NetworkCacheKey& other) const;
+    bool operator==(const NetworkCacheKey& other) const;
+    std::string to_string() const;
+
+    /**
+     * Get file name of snapshot
+     * @param[in] sparsity_threshold threshold of weights to drop
+     * @return file name
+     */
+    std::string snapshot_filename(const float sparsity_threshold) const;
+};
+
+/**
+ * @brief This class is used to hold a built network and the SEAL objects
+ * referenced by its layers.
+ */
+struct CompiledNetwork
+{
+    /**
+     * Constructor
+     * @param[in] params encryption parameters
+     * @param[in] opt_level optimization level
+     * @param[in] activation activation function
+     * @param[in] sparsity_threshold threshold of weights to drop
+     * @param[in] use_thread_local_pool use memory pool of each thread
+     */
+    CompiledNetwork(const seal::EncryptionParameters& params,
+                    const int32_t opt_level, const int32_t activation,
+                    const float sparsity_threshold,
+                    const bool use_thread_local_pool);
+    virtual ~CompiledNetwork() = default;
+
+    std::shared_ptr<seal::SEALContext> context;
+    std::shared_ptr<seal::Evaluator> evaluator;
+    std::shared_ptr<seal::CKKSEncoder> encoder;
+    std::shared_ptr<OptOption> option;
+    std::shared_ptr<Network> network;
+    size_t weight_bytes;
+};
+
+/**
+ * @brief This class is used to hold the statistics of NetworkCache.
+ */
+struct NetworkCacheStats
+{
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t entries;
+    size_t bytes;
+    size_t max_bytes;
+
+    std::string to_string() const;
+};
+
+/**
+ * @brief Provides the thread-safe cache of built networks shared by
+ * calculation threads.
+ * When the snapshot directory is given, built networks are also saved to
+ * snapshot files, and a miss loads the snapshot instead of building when it
+ * exists, so that a restarted server does not build the networks again.
+ */
+class NetworkCache
+{
+public:
+    using builder_t = std::function<void(CompiledNetwork&)>;
+
+    /**
+     * Constructor
+     * @param[in] max_bytes max total size of encoded weights to hold
+     * @param[in] snapshot_dir directory of snapshot files (disabled if empty)
+     * @param[in] sparsity_threshold weights smaller than this are dropped
+     * @param[in] use_thread_local_pool use memory pool of each thread for
+     *                                  evaluation
+     */
+    NetworkCache(const size_t max_bytes, const std::string& snapshot_dir,
+                 const float sparsity_threshold,
+                 const bool use_thread_local_pool);
+    virtual ~NetworkCache() = default;
+
+    /**
+     * Get built network, or build it when it is not cached
+     * @param[in] key cache key
+     * @param[in] params encryption parameters
+     * @param[in] builder function to build the network on a miss
+     * @return built network
+     */
+    std::shared_ptr<const CompiledNetwork> get(const NetworkCacheKey& key,
+                                               const seal::EncryptionParameters& params,
+                                               const builder_t& builder);
+
+    /**
+     * Get statistics
+     * @return statistics
+     */
+    NetworkCacheStats stats() const;
+
+    /**
+     * Delete all cached networks
+     */
+    void clear();
+
+private:
+    struct Impl;
+    std::shared_ptr<Impl> pimpl_;
+};
+
+} /* namespace ppcnn_server */
+
+#endif /* PPCNN_SERVER_NETWORKCACHE_HPP */
@@ -44,6 +44,7 @@ enum Event_t : uint64_t
     kEventNil = 0,
     kEventQuery = 1,
     kEventResultRequest = 2,
+    kEventLevelsRequest = 3,
 };
 
 /**
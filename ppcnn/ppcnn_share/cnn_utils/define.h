@@ -33,23 +33,22 @@ const std::map<std::pair<std::size_t, std::size_t>, float> EPSILON_MAP{
 static const float EPSILON = EPSILON_MAP.at(std::make_pair(PRE_SUF_PRIME_BIT_SIZE, INTERMEDIATE_PRIMES_BIT_SIZE));
 
 /***********************
- * Swish approximation
+ * Polynomial approximation of activation functions
+ * (coefficients from the highest degree term, fitted by least squares
+ * in plaintext_experiment/functions.py)
  ***********************/
-// ax^4 + bx^2 + cx + d
-static std::vector<float> SWISH_RG4_DEG4_COEFFS = { -0.005075, 0.19566, 0.5, 0.03347 };
-static std::vector<float> SWISH_RG6_DEG4_COEFFS = { -0.002012, 0.1473, 0.5, 0.1198 };
-// x^4 + b'x^2 + c'x + d'
-static std::vector<float> SWISH_RG4_DEG4_OPT_COEFFS = { -38.5537, -98.52222, -6.59507 };
-static std::vector<float> SWISH_RG6_DEG4_OPT_COEFFS = { -73.2107, -248.5089, -59.5427 };
-
-/***********************
- * Mish approximation
- ***********************/
-// ax^4 + bx^3 + cx^2 + dx + e
+// x^2
+static std::vector<float> SQUARE_COEFFS = { 1, 0, 0 };
+// ax^4 + bx^2 + cx + d (x range: [-3, 3] to [-8, 8])
+static std::vector<float> SWISH_RG3_DEG4_COEFFS = { -0.008248, 0, 0.2212, 0.5, 0.0108 };
+static std::vector<float> SWISH_RG4_DEG4_COEFFS = { -0.005075, 0, 0.19566, 0.5, 0.03347 };
+static std::vector<float> SWISH_RG5_DEG4_COEFFS = { -0.00315, 0, 0.17003, 0.5, 0.07066 };
+static std::vector<float> SWISH_RG6_DEG4_COEFFS = { -0.002012, 0, 0.1473, 0.5, 0.1198 };
+static std::vector<float> SWISH_RG7_DEG4_COEFFS = { -0.001328, 0, 0.1282, 0.5, 0.1773 };
+static std::vector<float> SWISH_RG8_DEG4_COEFFS = { -0.000908, 0, 0.11257, 0.5, 0.2401 };
+// ax^4 + bx^3 + cx^2 + dx + e (x range: [-4, 4] to [-6, 6])
 static std::vector<float> MISH_RG4_DEG4_COEFFS = { -0.00609, -0.004142, 0.21051, 0.565775, 0.06021 };
+static std::vector<float> MISH_RG5_DEG4_COEFFS = { -0.00346443, -0.0022355, 0.17573, 0.5495, 0.1104 };
 static std::vector<float> MISH_RG6_DEG4_COEFFS = { -0.002096, -0.001277, 0.148529, 0.53663, 0.169 };
-// x^4 + b'x^3 + c'x^2 + d'x + e'
-static std::vector<float> MISH_RG4_DEG4_OPT_COEFFS = { 0.68013, -34.5665, -92.9023, -9.8867 };
-static std::vector<float> MISH_RG6_DEG4_OPT_COEFFS = { 0.60926, -70.86307, -256.02576, -80.62977 };
 
 #endif/* __DEFINE_H__*/
@@ -15,24 +15,18 @@
  * limitations under the License.
  */
 
+#include <omp.h>
+#include <algorithm>
+#include <sstream>
+
 #include <ppcnn_share/cnn_utils/define.h>
 #include <ppcnn_share/cnn_utils/opt_option.hpp>
 
-OptOption::OptOption(const EOptLevel opt_level, const EActivation act,
-                     seal::RelinKeys& _relin_keys, seal::Evaluator& _evaluator,
-                     seal::CKKSEncoder& _encoder)
+GraphOption::GraphOption(const EOptLevel opt_level, const EActivation act)
   : enable_fuse_layers(false),
     enable_optimize_activation(false),
     enable_optimize_pooling(false),
-    should_multiply_coeff(false),
-    should_multiply_pool(false),
-    activation(act),
-    highest_deg_coeff(0.0f),
-    current_pooling_mul_factor(0.0f),
-    consumed_level(0),
-    relin_keys(_relin_keys),
-    evaluator(_evaluator),
-    encoder(_encoder)
+    activation(act)
 {
     switch (opt_level)
     {
@@ -54,7 +48,69 @@ OptOption::OptOption(const EOptLevel opt_level, const EActivation act,
         default:
             break;
     }
+}
+
+OptOption::OptOption(const EOptLevel opt_level, const EActivation act,
+                     const std::shared_ptr<seal::SEALContext>& _context,
+                     seal::Evaluator& _evaluator, seal::CKKSEncoder& _encoder)
+  : GraphOption(opt_level, act),
+    sparsity_threshold(0.0f),
+    use_thread_local_pool(true),
+    consumed_level(0),
+    context(_context),
+    evaluator(_evaluator),
+    encoder(_encoder)
+{
+    for (auto context_data = context->first_context_data(); context_data;
+         context_data = context_data->next_context_data())
+    {
+        level_parms_ids.push_back(context_data->parms_id());
+    }
 
     slot_count = encoder.slot_count();
     scale_param = pow(2.0, INTERMEDIATE_PRIMES_BIT_SIZE);
 }
+
+seal::MemoryPoolHandle OptOption::pool() const
+{
+    if (use_thread_local_pool)
+    {
+        return seal::MemoryPoolHandle::ThreadLocal();
+    }
+    return seal::MemoryManager::GetPool();
+}
+
+MemoryPoolUsage OptOption::poolUsage() const
+{
+    MemoryPoolUsage usage = {0, 0, 0, 0};
+    usage.global_bytes = seal::MemoryManager::GetPool().alloc_byte_count();
+    if (!use_thread_local_pool)
+    {
+        return usage;
+    }
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+    {
+        const size_t bytes = pool().alloc_byte_count();
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+        {
+            ++usage.pools;
+            usage.bytes += bytes;
+            usage.max_pool_bytes = std::max(usage.max_pool_bytes, bytes);
+        }
+    }
+    return usage;
+}
+
+std::string MemoryPoolUsage::to_string() const
+{
+    std::ostringstream oss;
+    oss << "pools: " << pools;
+    oss << ", bytes: " << bytes;
+    oss << ", max pool bytes: " << max_pool_bytes;
+    oss << ", global bytes: " << global_bytes;
+    return oss.str();
+}
@@ -19,33 +19,67 @@
 
 #include <unistd.h>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <ppcnn_share/cnn_utils/types.h>
 
 #include <seal/seal.h>
 
-struct OptOption
+/**
+ * Options of model graph, which do not depend on encryption parameters
+ * (levels of model can be planned from them before keys are generated)
+ */
+struct GraphOption
 {
-    OptOption(const EOptLevel opt_level, const EActivation act,
-              seal::RelinKeys& relinkey, seal::Evaluator& evaluator,
-              seal::CKKSEncoder& encoder);
-    ~OptOption() = default;
+    GraphOption(const EOptLevel opt_level, const EActivation act);
+    ~GraphOption() = default;
 
     bool enable_fuse_layers;
     bool enable_optimize_activation;
     bool enable_optimize_pooling;
 
-    bool should_multiply_coeff;
-    bool should_multiply_pool;
-
     EActivation activation;
+};
+
+/**
+ * Bytes allocated by memory pools of evaluator
+ */
+struct MemoryPoolUsage
+{
+    // thread-local pools of the calling thread and its OpenMP threads
+    size_t pools;
+    size_t bytes;
+    size_t max_pool_bytes;
+    // global pool (which also holds buffers of ciphertexts)
+    size_t global_bytes;
+
+    std::string to_string() const;
+};
+
+struct OptOption : GraphOption
+{
+    OptOption(const EOptLevel opt_level, const EActivation act,
+              const std::shared_ptr<seal::SEALContext>& context,
+              seal::Evaluator& evaluator, seal::CKKSEncoder& encoder);
+    ~OptOption() = default;
+
+    // weights smaller than the threshold are dropped (disabled if 0)
+    float sparsity_threshold;
 
-    float highest_deg_coeff;
-    float current_pooling_mul_factor;
+    // Temporaries of evaluator are allocated from the memory pool of each
+    // thread (or from the global pool of SEAL if disabled), which are kept
+    // by the threads across queries. Ciphertexts which may be freed by other
+    // threads must not be allocated from the pool of thread.
+    bool use_thread_local_pool;
+    seal::MemoryPoolHandle pool() const;
+    MemoryPoolUsage poolUsage() const;
 
     size_t consumed_level;
+    // parms_id of each level, from the first (data) level
+    std::vector<seal::parms_id_type> level_parms_ids;
 
-    seal::RelinKeys& relin_keys;
+    std::shared_ptr<seal::SEALContext> context;
     seal::Evaluator& evaluator;
     seal::CKKSEncoder& encoder;
     size_t slot_count;
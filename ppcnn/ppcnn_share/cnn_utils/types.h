@@ -45,6 +45,11 @@ enum EActivation {
     SWISH_RG6_DEG4 = 3,
     MISH_RG4_DEG4  = 4,
     MISH_RG6_DEG4  = 5,
+    SWISH_RG3_DEG4 = 6,
+    SWISH_RG5_DEG4 = 7,
+    SWISH_RG7_DEG4 = 8,
+    SWISH_RG8_DEG4 = 9,
+    MISH_RG5_DEG4  = 10,
 };
 
 enum ELayerClass {
@@ -54,7 +59,10 @@ enum ELayerClass {
     BATCH_NORMALIZATION,
     DENSE,
     FLATTEN,
-    GLOBAL_AVERAGE_POOLING2D
+    GLOBAL_AVERAGE_POOLING2D,
+    DEPTHWISE_CONV2D,
+    SEPARABLE_CONV2D,
+    WINOGRAD_CONV2D
 };
 
 #endif/*__TYPES_H__*/
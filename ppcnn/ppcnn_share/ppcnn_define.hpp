@@ -20,10 +20,18 @@
 
 #define PPCNN_TIMEOUT_SEC (60)
 #define PPCNN_RETRY_INTERVAL_USEC (2000000)
+#define PPCNN_MAX_CIPHERTEXT_POOL_MB (1024)
 
 #define PPCNN_DEFAULT_MAX_CONCURRENT_QUERIES 128
 #define PPCNN_DEFAULT_MAX_RESULTS 128
 #define PPCNN_DEFAULT_MAX_RESULT_LIFETIME_SEC 50000
+#define PPCNN_DEFAULT_MAX_NETWORK_CACHE_MB 65536
+#define PPCNN_DEFAULT_SNAPSHOT_DIR ""
+#define PPCNN_DEFAULT_SPARSITY_THRESHOLD 0.0f
+#define PPCNN_DEFAULT_TILE_SIZE 0
+#define PPCNN_DEFAULT_USE_THREAD_LOCAL_POOL true
+#define PPCNN_DEFAULT_MEMORY_BUDGET_MB 0
+#define PPCNN_DEFAULT_SPILL_DIR ""
 
 #define PPCNN_DEFAULT_PLAINTEXT_EXPERIMENT_PATH "../../../plaintext_experiment/"
 #define PPCNN_DEFAULT_DATASETS_PATH "../../../datasets/"
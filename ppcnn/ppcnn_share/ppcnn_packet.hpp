@@ -35,12 +35,14 @@ enum ControlCode_t : uint64_t
     kControlCodeDataParam = 0x402,
     kControlCodeDataQueryID = 0x403,
     kControlCodeDataResult = 0x404,
+    kControlCodeDataLevels = 0x405,
 
     /* Code for Download packet: 0x801-0x8FF */
 
     /* Code for UpDownload packet: 0x1000-0x10FF */
     kControlCodeUpDownloadQuery = 0x1001,
     kControlCodeUpDownloadResult = 0x1002,
+    kControlCodeUpDownloadLevels = 0x1003,
 };
 
 } /* namespace ppcnn_share */
@@ -37,4 +37,21 @@ std::istream& operator>>(std::istream& is, Srv2CliParam& param)
     return is;
 }
 
+std::ostream& operator<<(std::ostream& os, const Srv2CliLevelsParam& param)
+{
+    auto i32_result = static_cast<int32_t>(param.result);
+    os << i32_result << std::endl;
+    os << param.levels;
+    return os;
+}
+
+std::istream& operator>>(std::istream& is, Srv2CliLevelsParam& param)
+{
+    int32_t i32_result;
+    is >> i32_result;
+    is >> param.levels;
+    param.result = static_cast<ServerCalcResult_t>(i32_result);
+    return is;
+}
+
 } /* namespace ppcnn_share */
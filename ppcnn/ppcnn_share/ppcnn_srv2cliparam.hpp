@@ -45,6 +45,19 @@ struct Srv2CliParam
 std::ostream& operator<<(std::ostream& os, const Srv2CliParam& param);
 std::istream& operator>>(std::istream& is, Srv2CliParam& param);
 
+/**
+ * @brief This class is used to hold the levels of model to transfer from cs
+ * to user.
+ */
+struct Srv2CliLevelsParam
+{
+    ServerCalcResult_t result = kServerCalcResultNil;
+    size_t levels;
+};
+
+std::ostream& operator<<(std::ostream& os, const Srv2CliLevelsParam& param);
+std::istream& operator>>(std::istream& is, Srv2CliLevelsParam& param);
+
 } /* namespace ppcnn_share */
 
 #endif /* PPCNN_SRV2CLIPARAM_HPP */